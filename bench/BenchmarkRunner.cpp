@@ -0,0 +1,148 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#include "BenchmarkRunner.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <system_error>
+#include <utility>
+
+BenchmarkRunner::BenchmarkRunner(BenchmarkSettings settings)
+    : settings(std::move(settings)) {
+    if (this->settings.directory.empty()) {
+        this->settings.directory =
+            (std::filesystem::temp_directory_path() / "zos_bench").string();
+    }
+    if (this->settings.repeat < 1) {
+        this->settings.repeat = 1;
+    }
+    std::filesystem::create_directories(this->settings.directory);
+}
+
+BenchmarkRunner::~BenchmarkRunner() {
+    for (const std::string& image : this->images) {
+        std::error_code error;
+        std::filesystem::remove(image, error);
+    }
+}
+
+void BenchmarkRunner::Add(const std::string& name, Case run) {
+    this->entries.push_back(Entry{name, std::move(run)});
+}
+
+int BenchmarkRunner::Run() {
+    int failed = 0;
+    PrintHeader();
+
+    for (const Entry& entry : this->entries) {
+        if (entry.name.find(this->settings.filter) == std::string::npos) {
+            continue;
+        }
+
+        try {
+            // Report the fastest run; the I/O counts do not vary
+            BenchmarkResult best;
+            for (int i = 0; i < this->settings.repeat; ++i) {
+                const BenchmarkResult result = entry.run(*this);
+                if (i == 0 || result.seconds < best.seconds) {
+                    best = result;
+                }
+
+                // Long runs are stable enough on their own
+                if (result.seconds > LONG_RUN_SECONDS) {
+                    break;
+                }
+            }
+            PrintResult(entry.name, best);
+        } catch (const std::exception& e) {
+            std::cout << std::left << std::setw(28) << entry.name
+                      << "Error: " << e.what() << std::endl;
+            ++failed;
+        }
+    }
+
+    return failed;
+}
+
+const BenchmarkSettings& BenchmarkRunner::Settings() const {
+    return this->settings;
+}
+
+std::string BenchmarkRunner::ScratchImage(const std::string& name) {
+    const std::string path =
+        (std::filesystem::path(this->settings.directory) / name).string();
+
+    // The filesystem opens existing images only
+    std::ofstream(path, std::ios::binary | std::ios::trunc);
+
+    if (std::find(this->images.begin(), this->images.end(), path) == this->images.end()) {
+        this->images.push_back(path);
+    }
+    return path;
+}
+
+std::unique_ptr<Filesystem> BenchmarkRunner::Mount(const std::string& path) const {
+    return Mount(path, this->settings.filesystem);
+}
+
+std::unique_ptr<Filesystem> BenchmarkRunner::Mount(const std::string& path,
+                                                   const FilesystemOptions& options) {
+    return std::make_unique<Filesystem>(path, options);
+}
+
+std::unique_ptr<Filesystem> BenchmarkRunner::FreshImage(const uint64_t bytes,
+                                                        FormatOptions options) {
+    auto fs = this->Mount(this->ScratchImage("bench.img"));
+
+    options.fast = true;
+    fs->Format(bytes, options);
+    return fs;
+}
+
+void BenchmarkRunner::PrintHeader() {
+    std::cout << std::left << std::setw(28) << "benchmark"
+              << std::right
+              << std::setw(10) << "ops"
+              << std::setw(12) << "time [ms]"
+              << std::setw(14) << "ops/s"
+              << std::setw(11) << "MB/s"
+              << std::setw(11) << "io/op"
+              << std::setw(11) << "reads/op"
+              << std::setw(11) << "writes/op"
+              << std::setw(11) << "syncs/op"
+              << std::endl;
+}
+
+void BenchmarkRunner::PrintResult(const std::string& name, const BenchmarkResult& result) {
+    const double ops = static_cast<double>(result.operations);
+    const double seconds = result.seconds > 0 ? result.seconds : 1e-9;
+
+    auto perOp = [&](const uint64_t count) {
+        return ops > 0 ? static_cast<double>(count) / ops : 0.0;
+    };
+
+    std::cout << std::left << std::setw(28) << name
+              << std::right << std::fixed
+              << std::setw(10) << result.operations
+              << std::setw(12) << std::setprecision(2) << result.seconds * 1000
+              << std::setw(14) << std::setprecision(0) << ops / seconds;
+
+    if (result.bytes > 0) {
+        std::cout << std::setw(11) << std::setprecision(1)
+                  << static_cast<double>(result.bytes) / (1024.0 * 1024.0) / seconds;
+    } else {
+        std::cout << std::setw(11) << "-";
+    }
+
+    std::cout << std::setprecision(3)
+              << std::setw(11) << perOp(result.io.reads + result.io.writes + result.io.syncs)
+              << std::setw(11) << perOp(result.io.reads)
+              << std::setw(11) << perOp(result.io.writes)
+              << std::setw(11) << perOp(result.io.syncs)
+              << std::endl;
+}
@@ -0,0 +1,205 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../include/Filesystem.h"
+#include "../include/FilesystemOptions.h"
+#include "../include/FormatOptions.h"
+#include "../helpers/FileIOHandler.h"
+
+/**
+ * @brief Outcome of one benchmark run.
+ */
+struct BenchmarkResult {
+    /** Number of measured operations (files, lookups, listings...). */
+    uint64_t operations = 0;
+
+    /** Number of payload bytes moved by the operations (0 if none). */
+    uint64_t bytes = 0;
+
+    /** Wall-clock duration of the measured part in seconds. */
+    double seconds = 0;
+
+    /** Image I/O calls issued during the measured part. */
+    FileIOHandler::Statistics io;
+};
+
+/**
+ * @brief Settings shared by all benchmarks of a run.
+ */
+struct BenchmarkSettings {
+    /** Use smaller workloads (for a quick check, not for comparisons). */
+    bool quick = false;
+
+    /** Run only benchmarks whose name contains this text. */
+    std::string filter;
+
+    /** Directory for the scratch images. */
+    std::string directory;
+
+    /**
+     * Runs per benchmark; the fastest one is reported. A run longer
+     * than BenchmarkRunner::LONG_RUN_SECONDS is not repeated.
+     */
+    int repeat = 3;
+
+    /** Runtime options of every mounted image. */
+    FilesystemOptions filesystem;
+};
+
+/**
+ * @class BenchmarkRunner
+ * @brief Runs named benchmarks on scratch images and prints a report.
+ *
+ * Every benchmark sets up its own image, so results do not depend on
+ * which other benchmarks run. Workloads use a fixed random seed and
+ * are identical between runs. Only the part passed to Measure() is
+ * timed; setup and teardown are not.
+ *
+ * The report lists, per benchmark, operations per second, payload bytes
+ * per second and the image I/O calls (FileIOHandler reads, writes and
+ * syncs) per operation.
+ */
+class BenchmarkRunner {
+public:
+    /**
+     * @brief Benchmark body, returning the measurement of one run.
+     */
+    using Case = std::function<BenchmarkResult(BenchmarkRunner&)>;
+
+    /** Measured duration after which a benchmark is not repeated. */
+    static constexpr double LONG_RUN_SECONDS = 10;
+
+    /**
+     * @brief Construct a runner.
+     *
+     * @param settings Settings of the run.
+     */
+    explicit BenchmarkRunner(BenchmarkSettings settings);
+
+    /**
+     * @brief Remove all scratch images.
+     */
+    ~BenchmarkRunner();
+
+    /**
+     * @brief Register a benchmark.
+     *
+     * @param name Unique name ("group/case").
+     * @param run Benchmark body.
+     */
+    void Add(const std::string& name, Case run);
+
+    /**
+     * @brief Run all registered benchmarks that match the filter.
+     *
+     * @return Number of benchmarks that failed.
+     */
+    int Run();
+
+    /**
+     * @brief Settings of the run.
+     */
+    [[nodiscard]] const BenchmarkSettings& Settings() const;
+
+    /**
+     * @brief Path of an empty scratch image (the file is recreated).
+     *
+     * @param name Image file name inside the scratch directory.
+     */
+    [[nodiscard]] std::string ScratchImage(const std::string& name);
+
+    /**
+     * @brief Mount an image with the runtime options of the run.
+     */
+    [[nodiscard]] std::unique_ptr<Filesystem> Mount(const std::string& path) const;
+
+    /**
+     * @brief Mount an image with the given runtime options.
+     */
+    [[nodiscard]] static std::unique_ptr<Filesystem> Mount(const std::string& path,
+                                                           const FilesystemOptions& options);
+
+    /**
+     * @brief Create, mount and fast-format a scratch image.
+     *
+     * @param bytes Image size in bytes.
+     * @param options Layout of the image (fast is always set).
+     */
+    [[nodiscard]] std::unique_ptr<Filesystem> FreshImage(uint64_t bytes,
+                                                         FormatOptions options = {});
+
+    /**
+     * @brief Time a benchmark body and count its image I/O.
+     *
+     * Pending modifications are written back before the clock starts,
+     * so the body does not pay for its setup.
+     *
+     * @param fs Filesystem whose I/O is counted (nullptr for none).
+     * @param operations Number of operations the body performs.
+     * @param bytes Payload bytes the body moves.
+     * @param body Measured code.
+     */
+    template <typename Body>
+    static BenchmarkResult Measure(Filesystem* fs,
+                                   const uint64_t operations,
+                                   const uint64_t bytes,
+                                   Body&& body) {
+        if (fs) {
+            fs->Sync();
+            fs->ResetIOStatistics();
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        body();
+        const auto stop = std::chrono::steady_clock::now();
+
+        BenchmarkResult result;
+        result.operations = operations;
+        result.bytes = bytes;
+        result.seconds = std::chrono::duration<double>(stop - start).count();
+        if (fs) {
+            result.io = fs->GetIOStatistics();
+        }
+        return result;
+    }
+
+private:
+    /**
+     * @brief Registered benchmark.
+     */
+    struct Entry {
+        /** Benchmark name. */
+        std::string name;
+
+        /** Benchmark body. */
+        Case run;
+    };
+
+    /// Settings of the run
+    BenchmarkSettings settings;
+
+    /// Benchmarks in registration order
+    std::vector<Entry> entries;
+
+    /// Scratch images created so far
+    std::vector<std::string> images;
+
+    /**
+     * @brief Print the report header.
+     */
+    static void PrintHeader();
+
+    /**
+     * @brief Print one report row.
+     */
+    static void PrintResult(const std::string& name, const BenchmarkResult& result);
+};
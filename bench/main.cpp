@@ -0,0 +1,488 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BenchmarkRunner.h"
+#include "../include/Bitmap.h"
+#include "../include/Filesystem.h"
+
+namespace {
+    constexpr uint64_t KB = 1024;
+    constexpr uint64_t MB = 1024 * KB;
+
+    /// Seed of all generated workloads
+    constexpr uint32_t SEED = 20261014;
+
+    /**
+     * @brief Generate reproducible incompressible file contents.
+     */
+    std::vector<char> RandomData(const uint64_t size, const uint32_t salt) {
+        std::mt19937 rng(SEED + salt);
+        std::vector<char> data(size);
+        for (char& c : data) {
+            c = static_cast<char>(rng());
+        }
+        return data;
+    }
+
+    /**
+     * @brief Deterministic text-like data: random words of a small vocabulary.
+     */
+    std::vector<char> TextData(const uint64_t size, const uint32_t salt) {
+        static const std::string words[] = {"block ", "inode ", "image ", "journal\n", "bitmap "};
+        std::mt19937 rng(SEED + salt);
+        std::vector<char> data;
+        data.reserve(size);
+        while (data.size() < size) {
+            const std::string& word = words[rng() % 5];
+            data.insert(data.end(), word.begin(), word.begin() + std::min<uint64_t>(word.size(), size - data.size()));
+        }
+        return data;
+    }
+
+    /**
+     * @brief Image size for a workload (payload plus a quarter of slack).
+     */
+    uint64_t ImageSize(const uint64_t payload) {
+        return std::max<uint64_t>(64 * MB, payload + payload / 4 + 16 * MB);
+    }
+
+    /**
+     * @brief Number of files imported for a file size.
+     */
+    uint64_t ImportCount(const BenchmarkRunner& runner, const uint64_t fileSize) {
+        const uint64_t total = runner.Settings().quick ? 16 * MB : 64 * MB;
+        const uint64_t limit = runner.Settings().quick ? 500 : 2000;
+        return std::clamp<uint64_t>(total / fileSize, 1, limit);
+    }
+
+    /**
+     * @brief Create entries in one directory inside a single batch.
+     */
+    void CreateEntries(Filesystem& fs, const std::string& dir, const uint64_t count) {
+        fs.CreateDirectory(dir);
+        fs.BeginBatch();
+        for (uint64_t i = 0; i < count; ++i) {
+            fs.WriteFile(dir + "/f" + std::to_string(i), {});
+        }
+        fs.Commit();
+    }
+
+    // =========================
+    // Import / export
+    // =========================
+
+    /**
+     * @brief Generator of reproducible file contents from a size and a salt.
+     */
+    using DataGenerator = std::vector<char> (*)(uint64_t size, uint32_t salt);
+
+    /**
+     * @brief Import files one command at a time (write + sync, as incp does).
+     *
+     * @param fileSize Size of every file.
+     * @param layout Layout of the image.
+     * @param generate Generator of the file contents, the same for every file.
+     */
+    BenchmarkRunner::Case Import(const uint64_t fileSize,
+                                 const FormatOptions& layout = {},
+                                 const DataGenerator generate = RandomData) {
+        return [fileSize, layout, generate](BenchmarkRunner& runner) {
+            const uint64_t count = ImportCount(runner, fileSize);
+            const std::vector<char> data = generate(fileSize, 1);
+
+            auto fs = runner.FreshImage(ImageSize(count * fileSize), layout);
+            return BenchmarkRunner::Measure(fs.get(), count, count * fileSize, [&]() {
+                for (uint64_t i = 0; i < count; ++i) {
+                    fs->WriteFile("/f" + std::to_string(i), data);
+                    fs->Sync();
+                }
+            });
+        };
+    }
+
+    /**
+     * @brief Read imported files back.
+     */
+    BenchmarkRunner::Case Export(const uint64_t fileSize) {
+        return [fileSize](BenchmarkRunner& runner) {
+            const uint64_t count = ImportCount(runner, fileSize);
+            const std::vector<char> data = RandomData(fileSize, 2);
+
+            const std::string image = runner.ScratchImage("bench.img");
+            {
+                auto writer = runner.Mount(image);
+                FormatOptions layout;
+                layout.fast = true;
+                writer->Format(ImageSize(count * fileSize), layout);
+
+                for (uint64_t i = 0; i < count; ++i) {
+                    writer->WriteFile("/f" + std::to_string(i), data);
+                }
+            }
+
+            // Read from a fresh mount, so no block comes from the cache
+            auto fs = runner.Mount(image);
+            return BenchmarkRunner::Measure(fs.get(), count, count * fileSize, [&]() {
+                for (uint64_t i = 0; i < count; ++i) {
+                    if (fs->ReadFile("/f" + std::to_string(i)).size() != fileSize) {
+                        throw std::runtime_error("Short read");
+                    }
+                }
+            });
+        };
+    }
+
+    /**
+     * @brief Stream a file through a handle in small sequential chunks.
+     */
+    BenchmarkRunner::Case StreamRead(const uint64_t chunk) {
+        return [chunk](BenchmarkRunner& runner) {
+            const uint64_t fileSize = runner.Settings().quick ? 16 * MB : 64 * MB;
+
+            const std::string image = runner.ScratchImage("bench.img");
+            {
+                auto writer = runner.Mount(image);
+                FormatOptions layout;
+                layout.fast = true;
+                writer->Format(ImageSize(fileSize), layout);
+                writer->WriteFile("/f", RandomData(fileSize, 4));
+            }
+
+            auto fs = runner.Mount(image);
+            const uint64_t reads = fileSize / chunk;
+            return BenchmarkRunner::Measure(fs.get(), reads, fileSize, [&]() {
+                const FileHandle file = fs->Open("/f");
+                std::vector<char> buffer(chunk);
+                for (uint64_t i = 0; i < reads; ++i) {
+                    if (file.Read(i * chunk, buffer.data(), chunk) != chunk) {
+                        throw std::runtime_error("Short read");
+                    }
+                }
+            });
+        };
+    }
+
+    /**
+     * @brief Read files and list a directory from several threads at once.
+     */
+    BenchmarkRunner::Case ConcurrentRead(const unsigned threads) {
+        return [threads](BenchmarkRunner& runner) {
+            constexpr uint64_t FILE_SIZE = 64 * KB;
+            constexpr uint64_t ENTRIES = 1000;
+            const uint64_t files = runner.Settings().quick ? 64 : 256;
+            const uint64_t rounds = runner.Settings().quick ? 4 : 16;
+
+            const std::string image = runner.ScratchImage("bench.img");
+            {
+                auto writer = runner.Mount(image);
+                FormatOptions layout;
+                layout.fast = true;
+                writer->Format(ImageSize(files * FILE_SIZE), layout);
+
+                writer->BeginBatch();
+                for (uint64_t i = 0; i < files; ++i) {
+                    writer->WriteFile("/f" + std::to_string(i), RandomData(FILE_SIZE, 6));
+                }
+                writer->Commit();
+                CreateEntries(*writer, "/d", ENTRIES);
+            }
+
+            FilesystemOptions options = runner.Settings().filesystem;
+            options.threadSafe = true;
+            auto fs = BenchmarkRunner::Mount(image, options);
+
+            // Every thread reads all files; one listing per file
+            const uint64_t operations = threads * rounds * files * 2;
+            return BenchmarkRunner::Measure(fs.get(), operations, threads * rounds * files * FILE_SIZE, [&]() {
+                std::vector<std::thread> workers;
+                std::vector<std::exception_ptr> errors(threads);
+
+                for (unsigned t = 0; t < threads; ++t) {
+                    workers.emplace_back([&, t]() {
+                        try {
+                            for (uint64_t round = 0; round < rounds; ++round) {
+                                for (uint64_t i = 0; i < files; ++i) {
+                                    // Threads start at different files
+                                    const uint64_t file = (i + t * files / threads) % files;
+                                    if (fs->ReadFile("/f" + std::to_string(file)).size() != FILE_SIZE) {
+                                        throw std::runtime_error("Short read");
+                                    }
+                                    if (fs->GetSubdirectories("/d").size() < ENTRIES) {
+                                        throw std::runtime_error("Entries missing");
+                                    }
+                                }
+                            }
+                        } catch (...) {
+                            errors[t] = std::current_exception();
+                        }
+                    });
+                }
+
+                for (auto& worker : workers) {
+                    worker.join();
+                }
+                for (const auto& error : errors) {
+                    if (error) {
+                        std::rethrow_exception(error);
+                    }
+                }
+            });
+        };
+    }
+
+    // =========================
+    // Directories
+    // =========================
+
+    /**
+     * @brief Create empty files in one directory.
+     */
+    BenchmarkRunner::Case CreateInDirectory(const uint64_t entries) {
+        return [entries](BenchmarkRunner& runner) {
+            FormatOptions layout;
+            layout.blocksPerInode = 1;
+
+            auto fs = runner.FreshImage(256 * MB, layout);
+            return BenchmarkRunner::Measure(fs.get(), entries, 0, [&]() {
+                CreateEntries(*fs, "/d", entries);
+            });
+        };
+    }
+
+    /**
+     * @brief Remove every file of a large directory, then the directory.
+     */
+    BenchmarkRunner::Case RemoveFromDirectory(const uint64_t entries) {
+        return [entries](BenchmarkRunner& runner) {
+            FormatOptions layout;
+            layout.blocksPerInode = 1;
+
+            auto fs = runner.FreshImage(256 * MB, layout);
+            CreateEntries(*fs, "/d", entries);
+
+            return BenchmarkRunner::Measure(fs.get(), entries, 0, [&]() {
+                fs->BeginBatch();
+                for (uint64_t i = 0; i < entries; ++i) {
+                    fs->RemoveFile("/d/f" + std::to_string(i));
+                }
+                fs->RemoveDirectory("/d");
+                fs->Commit();
+            });
+        };
+    }
+
+    /**
+     * @brief List a large directory.
+     */
+    BenchmarkRunner::Case ListDirectory(const uint64_t entries) {
+        return [entries](BenchmarkRunner& runner) {
+            FormatOptions layout;
+            layout.blocksPerInode = 1;
+
+            auto fs = runner.FreshImage(256 * MB, layout);
+            CreateEntries(*fs, "/d", entries);
+
+            const uint64_t listings = runner.Settings().quick ? 3 : 10;
+            return BenchmarkRunner::Measure(fs.get(), listings, 0, [&]() {
+                for (uint64_t i = 0; i < listings; ++i) {
+                    if (fs->GetSubdirectories("/d").size() < entries) {
+                        throw std::runtime_error("Entries missing");
+                    }
+                }
+            });
+        };
+    }
+
+    /**
+     * @brief Look up a file at the bottom of a deep directory chain.
+     */
+    BenchmarkRunner::Case ResolveDeepPath(const int depth) {
+        return [depth](BenchmarkRunner& runner) {
+            auto fs = runner.FreshImage(64 * MB);
+
+            std::string path;
+            for (int level = 0; level < depth; ++level) {
+                path += "/l" + std::to_string(level);
+                fs->CreateDirectory(path);
+            }
+            path += "/file";
+            fs->WriteFile(path, RandomData(100, 3));
+
+            const uint64_t lookups = runner.Settings().quick ? 2000 : 20000;
+            return BenchmarkRunner::Measure(fs.get(), lookups, 0, [&]() {
+                for (uint64_t i = 0; i < lookups; ++i) {
+                    (void) fs->Open(path);
+                }
+            });
+        };
+    }
+
+    // =========================
+    // Allocation
+    // =========================
+
+    /**
+     * @brief Find the first free bit of a mostly full bitmap.
+     */
+    BenchmarkRunner::Case FindFirstFree(const uint32_t bits) {
+        return [bits](BenchmarkRunner& runner) {
+            Bitmap bitmap(bits);
+            const uint32_t used = bits - bits / 64;
+            for (uint32_t i = 0; i < used; ++i) {
+                bitmap.Set(i, true);
+            }
+
+            const uint64_t searches = runner.Settings().quick ? 200 : 2000;
+            return BenchmarkRunner::Measure(nullptr, searches, 0, [&]() {
+                for (uint64_t i = 0; i < searches; ++i) {
+                    if (bitmap.FindFirstFree() != used) {
+                        throw std::runtime_error("Unexpected free bit");
+                    }
+                }
+            });
+        };
+    }
+
+    // =========================
+    // Whole image
+    // =========================
+
+    /**
+     * @brief Format an image, zero-filling it or leaving it sparse.
+     */
+    BenchmarkRunner::Case FormatImage(const uint64_t bytes, const bool fast) {
+        return [bytes, fast](BenchmarkRunner& runner) {
+            auto fs = runner.Mount(runner.ScratchImage("bench.img"));
+
+            FormatOptions layout;
+            layout.fast = fast;
+            return BenchmarkRunner::Measure(fs.get(), 1, bytes, [&]() {
+                fs->Format(bytes, layout);
+            });
+        };
+    }
+
+    /**
+     * @brief Mount a populated image and list its root.
+     */
+    BenchmarkRunner::Case MountImage(const uint64_t files) {
+        return [files](BenchmarkRunner& runner) {
+            const std::string image = runner.ScratchImage("bench.img");
+            {
+                auto fs = runner.Mount(image);
+                FormatOptions layout;
+                layout.fast = true;
+                fs->Format(256 * MB, layout);
+                CreateEntries(*fs, "/d", files);
+            }
+
+            // The I/O of the new mount starts at zero
+            std::unique_ptr<Filesystem> fs;
+            BenchmarkResult result = BenchmarkRunner::Measure(nullptr, 1, 0, [&]() {
+                fs = runner.Mount(image);
+                (void) fs->GetSubdirectories("/");
+            });
+            result.io = fs->GetIOStatistics();
+            return result;
+        };
+    }
+
+    /**
+     * @brief Print the command line usage.
+     */
+    void PrintUsage(const char* program) {
+        std::cerr << "Usage: " << program
+                  << " [--quick] [--filter <text>] [--repeat <n>] [--dir <path>] [--mmap]"
+                  << " [--async [uring|threads]]" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    BenchmarkSettings settings;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string flag = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (flag == "--quick") {
+            settings.quick = true;
+        } else if (flag == "--filter" && hasValue) {
+            settings.filter = argv[++i];
+        } else if (flag == "--repeat" && hasValue) {
+            settings.repeat = std::stoi(argv[++i]);
+        } else if (flag == "--dir" && hasValue) {
+            settings.directory = argv[++i];
+        } else if (flag == "--mmap") {
+            settings.filesystem.ioBackend = FileIOHandler::Backends::MMAP;
+        } else if (flag == "--async") {
+            settings.filesystem.asyncIO = true;
+
+            // Optional engine name
+            const std::string engine = hasValue ? argv[i + 1] : "";
+            if (engine == "uring" || engine == "threads") {
+                settings.filesystem.asyncEngine = engine == "uring"
+                    ? AsyncIO::Engines::IO_URING
+                    : AsyncIO::Engines::THREAD_POOL;
+                ++i;
+            }
+        } else {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    BenchmarkRunner runner(settings);
+
+    for (const uint64_t size : {uint64_t{64}, 1 * KB, 64 * KB, 1 * MB, 16 * MB, 60 * MB}) {
+        const std::string name = size < KB ? std::to_string(size) + "B"
+            : size < MB ? std::to_string(size / KB) + "KB"
+            : std::to_string(size / MB) + "MB";
+        runner.Add("import/" + name, Import(size));
+        runner.Add("export/" + name, Export(size));
+    }
+
+    // The same file imported over and over shares its blocks
+    FormatOptions deduplicated;
+    deduplicated.dedup = true;
+    runner.Add("import-dedup/1MB", Import(1 * MB, deduplicated));
+
+    // Text-like files shrink when stored compressed
+    FormatOptions compressed;
+    compressed.compress = true;
+    runner.Add("import-compressed/1MB", Import(1 * MB, compressed, TextData));
+
+    runner.Add("stream/read-4KB-chunks", StreamRead(4 * KB));
+
+    // Same work per thread, so the time shows how reads scale
+    runner.Add("concurrent/read-1-thread", ConcurrentRead(1));
+    runner.Add("concurrent/read-4-threads", ConcurrentRead(4));
+
+    runner.Add("dir/create-10k", CreateInDirectory(10000));
+    runner.Add("dir/remove-10k", RemoveFromDirectory(10000));
+    runner.Add("ls/10k", ListDirectory(10000));
+    if (!settings.quick) {
+        runner.Add("dir/create-100k", CreateInDirectory(100000));
+        runner.Add("ls/100k", ListDirectory(100000));
+    }
+    runner.Add("path/resolve-depth-8", ResolveDeepPath(8));
+    runner.Add("path/resolve-depth-64", ResolveDeepPath(64));
+
+    runner.Add("bitmap/find-first-free-1M", FindFirstFree(1u << 20));
+
+    runner.Add("image/format-256MB", FormatImage(256 * MB, false));
+    runner.Add("image/format-fast-1GB", FormatImage(1024 * MB, true));
+    runner.Add("image/mount-10k", MountImage(10000));
+
+    return runner.Run() == 0 ? 0 : 1;
+}
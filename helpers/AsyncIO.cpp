@@ -0,0 +1,522 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#include "AsyncIO.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "FileIOExceptions.h"
+
+namespace {
+    /// Largest transfer of a single call (io_uring lengths are 32-bit)
+    constexpr uint64_t MAX_TRANSFER = 1u << 30;
+
+    /// Most worker threads of the thread pool engine
+    constexpr unsigned MAX_WORKERS = 16;
+}
+
+IORequest IORequest::Read(const uint64_t offset, char* out, const uint64_t size) {
+    return IORequest{Kinds::READ, offset, out, size};
+}
+
+IORequest IORequest::Write(const uint64_t offset, const char* data, const uint64_t size) {
+    // Writes only read from the buffer
+    return IORequest{Kinds::WRITE, offset, const_cast<char*>(data), size};
+}
+
+/**
+ * @brief Shared state of one submitted batch.
+ */
+struct AsyncIO::Batch {
+    /// Requests of the batch
+    std::vector<IORequest> requests;
+
+    /// Callback per finished request (may be empty)
+    Callback onComplete;
+
+    /// Fulfilled by the last finished request
+    std::promise<void> done;
+
+    /// Requests not yet finished
+    std::atomic<std::size_t> remaining{0};
+
+    /// Guards the failure fields
+    std::mutex mutex;
+
+    /// Description of the first failure (empty if none)
+    std::string error;
+
+    /// Direction of the first failed request
+    IORequest::Kinds errorKind = IORequest::Kinds::READ;
+};
+
+/**
+ * @brief One request in flight.
+ */
+struct AsyncIO::Operation {
+    /// Batch the request belongs to
+    std::shared_ptr<Batch> batch;
+
+    /// Index of the request within the batch
+    std::size_t index;
+
+    /// Bytes transferred so far
+    uint64_t transferred = 0;
+
+    [[nodiscard]] const IORequest& Request() const {
+        return this->batch->requests[this->index];
+    }
+};
+
+#ifdef __linux__
+
+/**
+ * @brief Mapped io_uring submission and completion rings.
+ */
+struct AsyncIO::Ring {
+    /// Ring file descriptor
+    int fd = -1;
+
+    /// Mapping of the submission ring (and of the completion ring if shared)
+    void* sqMapping = MAP_FAILED;
+    std::size_t sqMappingSize = 0;
+
+    /// Mapping of the completion ring (same as sqMapping if shared)
+    void* cqMapping = MAP_FAILED;
+    std::size_t cqMappingSize = 0;
+
+    /// Submission queue entries
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    std::size_t sqesSize = 0;
+
+    /// Submission ring fields
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+
+    /// Completion ring fields
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    /// Entries queued in the ring but not yet handed to the kernel
+    unsigned pending = 0;
+
+    ~Ring() {
+        if (this->sqes != MAP_FAILED) {
+            ::munmap(this->sqes, this->sqesSize);
+        }
+        if (this->cqMapping != MAP_FAILED && this->cqMapping != this->sqMapping) {
+            ::munmap(this->cqMapping, this->cqMappingSize);
+        }
+        if (this->sqMapping != MAP_FAILED) {
+            ::munmap(this->sqMapping, this->sqMappingSize);
+        }
+        if (this->fd >= 0) {
+            ::close(this->fd);
+        }
+    }
+
+    /**
+     * @brief Create the rings.
+     *
+     * @return False if io_uring or its read/write operations are unavailable.
+     */
+    bool Setup(const unsigned entries) {
+        io_uring_params params{};
+        this->fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if (this->fd < 0) {
+            return false;
+        }
+
+        // IORING_OP_READ and IORING_OP_WRITE need Linux 5.6
+        std::vector<char> probeBuffer(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+        auto* probe = reinterpret_cast<io_uring_probe*>(probeBuffer.data());
+        if (::syscall(__NR_io_uring_register, this->fd, IORING_REGISTER_PROBE, probe, 256) < 0 ||
+            probe->last_op < IORING_OP_WRITE ||
+            !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) ||
+            !(probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)) {
+            return false;
+        }
+
+        this->sqMappingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        this->cqMappingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+        const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) {
+            this->sqMappingSize = this->cqMappingSize =
+                std::max(this->sqMappingSize, this->cqMappingSize);
+        }
+
+        this->sqMapping = ::mmap(nullptr, this->sqMappingSize, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQ_RING);
+        if (this->sqMapping == MAP_FAILED) {
+            return false;
+        }
+
+        this->cqMapping = single
+            ? this->sqMapping
+            : ::mmap(nullptr, this->cqMappingSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_CQ_RING);
+        if (this->cqMapping == MAP_FAILED) {
+            return false;
+        }
+
+        this->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        this->sqes = static_cast<io_uring_sqe*>(
+            ::mmap(nullptr, this->sqesSize, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQES)
+        );
+        if (this->sqes == MAP_FAILED) {
+            return false;
+        }
+
+        auto* sq = static_cast<char*>(this->sqMapping);
+        this->sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        this->sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        this->sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+        auto* cq = static_cast<char*>(this->cqMapping);
+        this->cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        this->cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        this->cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        this->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    /**
+     * @brief Queue an entry (only one thread at a time may push).
+     */
+    void Push(const uint8_t opcode, const int file, const uint64_t offset,
+              const char* buffer, const uint32_t length, const uint64_t userData) {
+        const unsigned tail = *this->sqTail;
+        const unsigned index = tail & *this->sqMask;
+
+        io_uring_sqe& sqe = this->sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = file;
+        sqe.off = offset;
+        sqe.addr = reinterpret_cast<uint64_t>(buffer);
+        sqe.len = length;
+        sqe.user_data = userData;
+
+        this->sqArray[index] = index;
+        __atomic_store_n(this->sqTail, tail + 1, __ATOMIC_RELEASE);
+        ++this->pending;
+    }
+
+    /**
+     * @brief Hand all queued entries to the kernel with one system call.
+     */
+    void Submit() {
+        while (this->pending > 0) {
+            const long submitted = ::syscall(__NR_io_uring_enter, this->fd, this->pending, 0, 0, nullptr, 0);
+            if (submitted < 0) {
+                if (errno == EINTR || errno == EAGAIN) {
+                    continue;
+                }
+                throw FileWriteException(std::string("io_uring submission failed: ") + std::strerror(errno));
+            }
+            this->pending -= static_cast<unsigned>(submitted);
+        }
+    }
+};
+
+#else
+
+struct AsyncIO::Ring {
+};
+
+#endif
+
+AsyncIO::AsyncIO(const int fd, const Engines engine, const unsigned queueDepth)
+    : fd(fd),
+      engine(engine),
+      queueDepth(std::max(queueDepth, 1u)) {
+
+#ifdef __linux__
+    if (this->engine == Engines::IO_URING) {
+        this->ring = std::make_unique<Ring>();
+        if (this->ring->Setup(this->queueDepth)) {
+            this->reaper = std::thread([this] { this->Reap(); });
+            return;
+        }
+        this->ring.reset();
+    }
+#endif
+
+    this->engine = Engines::THREAD_POOL;
+
+    const unsigned count = std::min(this->queueDepth, MAX_WORKERS);
+    this->workers.reserve(count);
+    for (unsigned i = 0; i < count; ++i) {
+        this->workers.emplace_back([this] { this->Work(); });
+    }
+}
+
+AsyncIO::~AsyncIO() {
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->changed.wait(lock, [this] { return this->inFlight == 0; });
+        this->stopping = true;
+
+#ifdef __linux__
+        // A no-op without an operation wakes the completion thread
+        if (this->ring) {
+            this->ring->Push(IORING_OP_NOP, -1, 0, nullptr, 0, 0);
+            this->ring->Submit();
+        }
+#endif
+    }
+    this->changed.notify_all();
+
+    if (this->reaper.joinable()) {
+        this->reaper.join();
+    }
+    for (std::thread& worker : this->workers) {
+        worker.join();
+    }
+}
+
+AsyncIO::Engines AsyncIO::Engine() const {
+    return this->engine;
+}
+
+unsigned AsyncIO::QueueDepth() const {
+    return this->queueDepth;
+}
+
+std::future<void> AsyncIO::Submit(std::vector<IORequest> requests, Callback onComplete) {
+    auto batch = std::make_shared<Batch>();
+    batch->requests = std::move(requests);
+    batch->onComplete = std::move(onComplete);
+    batch->remaining = batch->requests.size();
+
+    std::future<void> future = batch->done.get_future();
+    if (batch->requests.empty()) {
+        batch->done.set_value();
+        return future;
+    }
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    for (std::size_t i = 0; i < batch->requests.size(); ++i) {
+        // Hand the queued entries over before waiting for a free slot
+        if (this->inFlight == this->queueDepth) {
+#ifdef __linux__
+            if (this->ring) {
+                this->ring->Submit();
+            }
+#endif
+            this->changed.notify_all();
+            this->changed.wait(lock, [this] { return this->inFlight < this->queueDepth; });
+        }
+
+        ++this->inFlight;
+        this->Start(new Operation{batch, i});
+    }
+
+#ifdef __linux__
+    if (this->ring) {
+        this->ring->Submit();
+    }
+#endif
+    lock.unlock();
+
+    this->changed.notify_all();
+    return future;
+}
+
+bool AsyncIO::UringAvailable() {
+#ifdef __linux__
+    Ring probe;
+    return probe.Setup(1);
+#else
+    return false;
+#endif
+}
+
+void AsyncIO::Start(Operation* operation) {
+#ifdef __linux__
+    if (this->ring) {
+        const IORequest& request = operation->Request();
+        const uint64_t length = std::min(request.size - operation->transferred, MAX_TRANSFER);
+
+        this->ring->Push(request.kind == IORequest::Kinds::READ ? IORING_OP_READ : IORING_OP_WRITE,
+                         this->fd,
+                         request.offset + operation->transferred,
+                         request.buffer + operation->transferred,
+                         static_cast<uint32_t>(length),
+                         reinterpret_cast<uint64_t>(operation));
+        return;
+    }
+#endif
+
+    this->queue.push_back(operation);
+}
+
+bool AsyncIO::Advance(Operation* operation, const int64_t result) {
+    const IORequest& request = operation->Request();
+
+    if (result == -EINTR || result == -EAGAIN) {
+        return true;
+    }
+
+    if (result > 0) {
+        operation->transferred += static_cast<uint64_t>(result);
+        return operation->transferred < request.size;
+    }
+
+    // An error, or the end of the file before the request was done
+    if (result < 0 || operation->transferred < request.size) {
+        Batch& batch = *operation->batch;
+        std::lock_guard<std::mutex> lock(batch.mutex);
+        if (batch.error.empty()) {
+            batch.errorKind = request.kind;
+            batch.error = (request.kind == IORequest::Kinds::READ ? "Read of " : "Write of ") +
+                          std::to_string(request.size) + " bytes at offset " +
+                          std::to_string(request.offset) + " failed: " +
+                          (result < 0 ? std::strerror(static_cast<int>(-result)) : "end of file");
+        }
+    }
+    return false;
+}
+
+void AsyncIO::Finish(Operation* operation) {
+    const std::shared_ptr<Batch> batch = std::move(operation->batch);
+    const std::size_t index = operation->index;
+    const uint64_t transferred = operation->transferred;
+    delete operation;
+
+    if (batch->onComplete) {
+        batch->onComplete(index, transferred);
+    }
+
+    if (batch->remaining.fetch_sub(1) != 1) {
+        return;
+    }
+
+    if (batch->error.empty()) {
+        batch->done.set_value();
+    } else if (batch->errorKind == IORequest::Kinds::READ) {
+        batch->done.set_exception(std::make_exception_ptr(FileReadException(batch->error)));
+    } else {
+        batch->done.set_exception(std::make_exception_ptr(FileWriteException(batch->error)));
+    }
+}
+
+void AsyncIO::Reap() {
+#ifdef __linux__
+    Ring& uring = *this->ring;
+
+    while (true) {
+        const long waited = ::syscall(__NR_io_uring_enter, uring.fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (waited < 0 && errno != EINTR) {
+            return;
+        }
+
+        // Drained under the mutex the entries were queued with; only
+        // this thread consumes completions
+        std::vector<std::pair<Operation*, int64_t>> completed;
+        bool stop = false;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            unsigned head = *uring.cqHead;
+            const unsigned tail = __atomic_load_n(uring.cqTail, __ATOMIC_ACQUIRE);
+
+            while (head != tail) {
+                const io_uring_cqe& cqe = uring.cqes[head & *uring.cqMask];
+                auto* operation = reinterpret_cast<Operation*>(cqe.user_data);
+                if (operation) {
+                    completed.emplace_back(operation, cqe.res);
+                } else {
+                    stop = true;
+                }
+                ++head;
+            }
+            __atomic_store_n(uring.cqHead, head, __ATOMIC_RELEASE);
+        }
+
+        std::vector<Operation*> continued;
+        unsigned finished = 0;
+        for (const auto& [operation, result] : completed) {
+            if (this->Advance(operation, result)) {
+                continued.push_back(operation);
+                continue;
+            }
+            this->Finish(operation);
+            ++finished;
+        }
+
+        if (!continued.empty() || finished > 0) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                for (Operation* operation : continued) {
+                    this->Start(operation);
+                }
+                uring.Submit();
+                this->inFlight -= finished;
+            }
+            this->changed.notify_all();
+        }
+
+        if (stop) {
+            return;
+        }
+    }
+#endif
+}
+
+void AsyncIO::Work() {
+    while (true) {
+        Operation* operation = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->changed.wait(lock, [this] {
+                return this->stopping || !this->queue.empty();
+            });
+
+            if (this->queue.empty()) {
+                return;
+            }
+
+            operation = this->queue.front();
+            this->queue.pop_front();
+        }
+
+        const IORequest& request = operation->Request();
+        bool more = true;
+        while (more) {
+            const uint64_t length = std::min(request.size - operation->transferred, MAX_TRANSFER);
+            const auto offset = static_cast<off_t>(request.offset + operation->transferred);
+            char* buffer = request.buffer + operation->transferred;
+
+            const ssize_t result = request.kind == IORequest::Kinds::READ
+                ? ::pread(this->fd, buffer, length, offset)
+                : ::pwrite(this->fd, buffer, length, offset);
+            more = this->Advance(operation, result < 0 ? -errno : result);
+        }
+
+        this->Finish(operation);
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            --this->inFlight;
+        }
+        this->changed.notify_all();
+    }
+}
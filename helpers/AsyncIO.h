@@ -0,0 +1,214 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief One read or write of an asynchronous batch.
+ */
+struct IORequest {
+    /**
+     * @brief Direction of the transfer.
+     */
+    enum class Kinds {
+        /// Read from the file into the buffer
+        READ,
+
+        /// Write the buffer to the file
+        WRITE
+    };
+
+    /** Direction of the transfer. */
+    Kinds kind;
+
+    /** Byte offset in the file. */
+    uint64_t offset;
+
+    /** Destination of a read, source of a write. */
+    char* buffer;
+
+    /** Number of bytes to transfer. */
+    uint64_t size;
+
+    /**
+     * @brief Read size bytes at offset into out.
+     */
+    static IORequest Read(uint64_t offset, char* out, uint64_t size);
+
+    /**
+     * @brief Write size bytes of data at offset.
+     */
+    static IORequest Write(uint64_t offset, const char* data, uint64_t size);
+};
+
+/**
+ * @class AsyncIO
+ * @brief Asynchronous positional I/O engine with many requests in flight.
+ *
+ * Keeps up to a queue depth of reads and writes on a file descriptor in
+ * flight at once. A whole batch is submitted with one call and completes
+ * through a future, optionally with a callback per request.
+ *
+ * On Linux requests go through io_uring: a batch is queued in the
+ * submission ring and handed to the kernel with one system call, and a
+ * completion thread reaps the results. Where io_uring is not available
+ * (other systems, older kernels, blocked by a sandbox) a pool of worker
+ * threads issues blocking pread/pwrite calls instead.
+ *
+ * Short transfers are continued until the whole request is done, so a
+ * request fails only on an I/O error or at the end of the file.
+ *
+ * Buffers must stay valid until the future of their batch is ready.
+ * Submit() may be called from any thread.
+ */
+class AsyncIO {
+public:
+    /**
+     * @brief Ways of issuing the requests.
+     */
+    enum class Engines {
+        /// Linux io_uring (falls back to THREAD_POOL when unavailable)
+        IO_URING,
+
+        /// Worker threads with blocking pread/pwrite
+        THREAD_POOL
+    };
+
+    /**
+     * @brief Called once per finished request, on an engine thread.
+     *
+     * Receives the index of the request within its batch and the number
+     * of bytes transferred. Must not throw and must not submit.
+     */
+    using Callback = std::function<void(std::size_t index, uint64_t transferred)>;
+
+    /** Default maximum number of requests in flight. */
+    static constexpr unsigned DEFAULT_QUEUE_DEPTH = 64;
+
+    /**
+     * @brief Start an engine on an open file descriptor.
+     *
+     * The descriptor stays owned by the caller and must outlive the engine.
+     *
+     * @param fd File descriptor opened for reading and writing.
+     * @param engine Preferred engine.
+     * @param queueDepth Maximum number of requests in flight (at least 1).
+     */
+    AsyncIO(int fd, Engines engine, unsigned queueDepth = DEFAULT_QUEUE_DEPTH);
+
+    /**
+     * @brief Wait for all requests in flight and stop the engine.
+     */
+    ~AsyncIO();
+
+    AsyncIO(const AsyncIO&) = delete;
+    AsyncIO& operator=(const AsyncIO&) = delete;
+
+    /**
+     * @brief Engine actually in use.
+     */
+    [[nodiscard]] Engines Engine() const;
+
+    /**
+     * @brief Maximum number of requests in flight.
+     */
+    [[nodiscard]] unsigned QueueDepth() const;
+
+    /**
+     * @brief Submit a batch of requests.
+     *
+     * Returns once every request is queued; with a full queue it waits
+     * for earlier requests to complete.
+     *
+     * @param requests Requests of the batch, in no particular order.
+     * @param onComplete Optional callback per finished request.
+     * @return Future that becomes ready when all requests finished. It
+     *         holds a FileReadException or FileWriteException if any
+     *         request failed.
+     */
+    [[nodiscard]] std::future<void> Submit(std::vector<IORequest> requests,
+                                           Callback onComplete = {});
+
+    /**
+     * @brief Check whether io_uring can be used on this system.
+     */
+    [[nodiscard]] static bool UringAvailable();
+
+private:
+    struct Batch;
+    struct Operation;
+    struct Ring;
+
+    /// File descriptor of the requests
+    int fd;
+
+    /// Engine in use
+    Engines engine;
+
+    /// Maximum number of requests in flight
+    unsigned queueDepth;
+
+    /// Guards the members below and the submission ring
+    std::mutex mutex;
+
+    /// Signalled when a request completes or work is queued
+    std::condition_variable changed;
+
+    /// Requests submitted and not yet finished
+    unsigned inFlight = 0;
+
+    /// True once the engine is being destroyed
+    bool stopping = false;
+
+    /// io_uring state (IO_URING only)
+    std::unique_ptr<Ring> ring;
+
+    /// Completion thread (IO_URING only)
+    std::thread reaper;
+
+    /// Requests waiting for a worker (THREAD_POOL only)
+    std::deque<Operation*> queue;
+
+    /// Worker threads (THREAD_POOL only)
+    std::vector<std::thread> workers;
+
+    /**
+     * @brief Start the transfer of an operation (the mutex must be held).
+     */
+    void Start(Operation* operation);
+
+    /**
+     * @brief Account for a partial result of an operation.
+     *
+     * @param operation Operation in flight.
+     * @param result Bytes transferred by the last call, or -errno.
+     * @return True if the operation must be continued.
+     */
+    bool Advance(Operation* operation, int64_t result);
+
+    /**
+     * @brief Release a finished operation and complete its batch.
+     */
+    void Finish(Operation* operation);
+
+    /**
+     * @brief Completion loop of the io_uring engine.
+     */
+    void Reap();
+
+    /**
+     * @brief Worker loop of the thread pool engine.
+     */
+    void Work();
+};
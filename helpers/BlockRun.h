@@ -0,0 +1,20 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <cstdint>
+
+/**
+ * @brief Represents a run of physically adjacent data blocks.
+ *
+ * Used when allocating and transferring file data, so that a run
+ * can be read or written with a single I/O request.
+ */
+struct BlockRun {
+    /** @brief Identifier of the first block of the run. */
+    uint32_t start;
+
+    /** @brief Number of blocks in the run. */
+    uint32_t length;
+};
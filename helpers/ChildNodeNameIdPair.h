@@ -3,8 +3,10 @@
 //
 
 #pragma once
+#include <cstddef>
 #include <cstdint>
 #include <string>
+#include <string_view>
 
 /**
  * @brief Represents a mapping between a child node's name and its inode ID.
@@ -13,9 +15,28 @@
  * child is identified by a human-readable name and a unique inode ID.
  */
 struct ChildNodeNameIdPair {
+    /** @brief Maximum length of a name stored in a directory entry. */
+    static constexpr std::size_t NAME_LENGTH = 12;
+
+    /** @brief Size of a directory entry on disk (NUL-padded name + inode ID). */
+    static constexpr std::size_t ENTRY_BYTES = NAME_LENGTH + sizeof(uint32_t);
+
     /** @brief Name of the child node (file or directory). */
     std::string name;
 
     /** @brief Inode ID associated with the child node. */
     uint32_t id;
 };
+
+/**
+ * @brief Directory entry whose name points into a directory block.
+ *
+ * The name is valid only while the entry is being visited.
+ */
+struct ChildNodeNameIdView {
+    /** @brief Name of the child node, without the NUL padding. */
+    std::string_view name;
+
+    /** @brief Inode ID associated with the child node. */
+    uint32_t id;
+};
@@ -0,0 +1,59 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#include "DirtyPages.h"
+
+#include <algorithm>
+
+void DirtyPages::Mark(const uint64_t offset, const uint64_t length) {
+    if (length == 0) {
+        return;
+    }
+
+    const uint64_t first = offset / PAGE_SIZE;
+    const uint64_t last = (offset + length - 1) / PAGE_SIZE;
+
+    if (first == last && first == this->lastPage) {
+        return;
+    }
+
+    for (uint64_t page = first; page <= last; ++page) {
+        this->pages.insert(page);
+    }
+    this->lastPage = last;
+}
+
+std::vector<ImageWrite> DirtyPages::Take(const std::vector<char>& table, const uint64_t base) {
+    std::vector<ImageWrite> writes;
+
+    auto page = this->pages.begin();
+    while (page != this->pages.end()) {
+        // Extend the run over consecutive pages
+        const uint64_t first = *page;
+        uint64_t last = first;
+        while (++page != this->pages.end() && *page == last + 1) {
+            last = *page;
+        }
+
+        const uint64_t begin = first * PAGE_SIZE;
+        const uint64_t end = std::min<uint64_t>((last + 1) * PAGE_SIZE, table.size());
+        if (begin >= end) {
+            break;
+        }
+
+        writes.push_back(ImageWrite{
+            base + begin,
+            std::vector<char>(table.begin() + static_cast<std::ptrdiff_t>(begin),
+                              table.begin() + static_cast<std::ptrdiff_t>(end))
+        });
+    }
+
+    this->Clear();
+    return writes;
+}
+
+void DirtyPages::Clear() {
+    this->pages.clear();
+    this->lastPage = UINT64_MAX;
+}
@@ -0,0 +1,54 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <cstdint>
+#include <set>
+#include <vector>
+
+#include "ImageWrite.h"
+
+/**
+ * @class DirtyPages
+ * @brief Modified pages of an in-memory metadata table.
+ *
+ * Bitmaps, reference counters and the deduplication index keep their
+ * whole table in memory and write back only what changed. Changes are
+ * tracked per 4 KiB page, so two far-apart updates are written as two
+ * short runs instead of one range spanning everything between them.
+ */
+class DirtyPages {
+public:
+    /** Tracking granularity in bytes. */
+    static constexpr uint64_t PAGE_SIZE = 4096;
+
+    /**
+     * @brief Mark a byte range as modified.
+     *
+     * @param offset Offset of the first modified byte within the table.
+     * @param length Number of modified bytes.
+     */
+    void Mark(uint64_t offset, uint64_t length);
+
+    /**
+     * @brief Take the modified runs of a table and mark it clean.
+     *
+     * @param table Contents of the whole table.
+     * @param base Byte offset of the table on the image.
+     * @return One write per run of consecutive modified pages.
+     */
+    [[nodiscard]] std::vector<ImageWrite> Take(const std::vector<char>& table, uint64_t base);
+
+    /**
+     * @brief Mark the table clean without taking anything.
+     */
+    void Clear();
+
+private:
+    /// Indexes of the modified pages
+    std::set<uint64_t> pages;
+
+    /// Page marked last, which repeated updates usually hit again
+    uint64_t lastPage = UINT64_MAX;
+};
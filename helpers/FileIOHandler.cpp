@@ -4,10 +4,19 @@
 
 #include "FileIOHandler.h"
 
+#include <algorithm>
 #include <array>
+#include <cerrno>
+#include <cstring>
 #include <filesystem>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "FileIOExceptions.h"
+#include "Perf.h"
 
 /**
  * @brief Destructor.
@@ -22,7 +31,40 @@ FileIOHandler::~FileIOHandler() {
 /**
  * @brief Open a file stream with the given mode.
  */
-void FileIOHandler::OpenFile(const std::string& fileName, const FileModes mode) {
+void FileIOHandler::OpenFile(const std::string& fileName,
+                             const FileModes mode,
+                             const Backends backend) {
+    if (backend == Backends::MMAP || backend == Backends::POSITIONAL) {
+        if (mode == FileModes::READ && !std::filesystem::exists(fileName)) {
+            throw FileDoesNotExistException("File does not exist: " + fileName);
+        }
+
+        const int fd = ::open(fileName.c_str(),
+                              mode == FileModes::READ ? O_RDONLY : O_RDWR | O_CREAT,
+                              0644);
+        if (fd < 0) {
+            throw CouldNotOpenFileException("Could not open file: " + fileName);
+        }
+
+        this->fd = fd;
+        this->fileName = fileName;
+        this->mode = mode;
+        this->backend = backend;
+
+        if (backend == Backends::POSITIONAL) {
+            return;
+        }
+
+        try {
+            this->Map();
+        } catch (...) {
+            ::close(this->fd);
+            this->fd = -1;
+            throw;
+        }
+        return;
+    }
+
     // Always operate in binary mode
     std::ios::openmode flags = std::ios::binary;
 
@@ -52,12 +94,28 @@ void FileIOHandler::OpenFile(const std::string& fileName, const FileModes mode)
     this->stream = std::move(stream);
     this->fileName = fileName;
     this->mode = mode;
+    this->backend = backend;
 }
 
 /**
  * @brief Flush buffers and close the open file stream.
  */
 void FileIOHandler::CloseFile() const {
+    if (this->backend != Backends::STREAM) {
+        // Requests in flight still use the descriptor
+        this->async.reset();
+        this->Unmap();
+        if (this->fd >= 0) {
+            ::close(this->fd);
+            this->fd = -1;
+        }
+        return;
+    }
+
+    if (!this->stream) {
+        return;
+    }
+
     this->Flush();
     this->stream->close();
 }
@@ -67,22 +125,71 @@ void FileIOHandler::CloseFile() const {
  */
 std::vector<char> FileIOHandler::ReadBytes(const uint64_t offset,
                                            const uint64_t size) const {
+    std::vector<char> buffer(size);
+    buffer.resize(this->ReadInto(offset, buffer.data(), size));
+    return buffer;
+}
+
+/**
+ * @brief Read bytes from the file at a specific offset into a buffer.
+ */
+uint64_t FileIOHandler::ReadInto(const uint64_t offset,
+                                 char* out,
+                                 const uint64_t size) const {
+    ZOS_PERF_SCOPE(Perf::Probe::IO_READ, size);
+
+    if (this->backend == Backends::MMAP) {
+        if (this->fd < 0) {
+            throw FileNotOpenException("File is not open");
+        }
+
+        // Reads past the end are truncated, as with the stream
+        if (offset >= this->mappedSize) {
+            return 0;
+        }
+        const uint64_t available = std::min(size, this->mappedSize - offset);
+        this->CountRead(available);
+        std::memcpy(out, this->mapping + offset, available);
+        return available;
+    }
+
+    if (this->backend == Backends::POSITIONAL) {
+        if (this->fd < 0) {
+            throw FileNotOpenException("File is not open");
+        }
+
+        uint64_t done = 0;
+
+        // Stops at the end of the file, as with the stream
+        while (done < size) {
+            const ssize_t read = ::pread(this->fd, out + done, size - done,
+                                         static_cast<off_t>(offset + done));
+            if (read < 0 && errno == EINTR) {
+                continue;
+            }
+            if (read <= 0) {
+                break;
+            }
+            done += static_cast<uint64_t>(read);
+        }
+
+        this->CountRead(done);
+        return done;
+    }
+
     // Validate stream state
     if (!this->stream || !this->stream->is_open()) {
         throw FileNotOpenException("File is not open");
     }
 
-    // Allocate buffer of requested size
-    std::vector<char> buffer(size);
-
     // Seek to requested position and read
+    this->CountSeek();
     this->stream->seekg(static_cast<std::streamoff>(offset), std::ios::beg);
-    this->stream->read(buffer.data(),
-                       static_cast<std::streamsize>(size));
+    this->stream->read(out, static_cast<std::streamsize>(size));
 
-    // Shrink buffer to actual number of bytes read
-    buffer.resize(this->stream->gcount());
-    return buffer;
+    const auto done = static_cast<uint64_t>(this->stream->gcount());
+    this->CountRead(done);
+    return done;
 }
 
 /**
@@ -90,8 +197,54 @@ std::vector<char> FileIOHandler::ReadBytes(const uint64_t offset,
  */
 void FileIOHandler::WriteBytes(const uint64_t offset,
                                const std::vector<char>& data) const {
+    this->WriteBytes(offset, data.data(), data.size());
+}
+
+/**
+ * @brief Write a raw byte range to the file at a specific offset.
+ */
+void FileIOHandler::WriteBytes(const uint64_t offset,
+                               const char* data,
+                               const uint64_t size) const {
+    ZOS_PERF_SCOPE(Perf::Probe::IO_WRITE, size);
+
     // Ensure file is writable
     this->EnsureWritable();
+    this->CountWrite(size);
+
+    if (this->backend == Backends::MMAP) {
+        if (this->fd < 0) {
+            throw FileNotOpenException("File is not open");
+        }
+
+        // The mapping covers the image; it only grows through Resize()
+        if (offset > this->mappedSize || size > this->mappedSize - offset) {
+            throw FileWriteException("Write past the end of the mapped file");
+        }
+
+        std::memcpy(this->mapping + offset, data, size);
+        return;
+    }
+
+    if (this->backend == Backends::POSITIONAL) {
+        if (this->fd < 0) {
+            throw FileNotOpenException("File is not open");
+        }
+
+        uint64_t done = 0;
+        while (done < size) {
+            const ssize_t written = ::pwrite(this->fd, data + done, size - done,
+                                             static_cast<off_t>(offset + done));
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                throw FileWriteException("Failed to write bytes");
+            }
+            done += static_cast<uint64_t>(written);
+        }
+        return;
+    }
 
     if (!this->stream || !this->stream->is_open()) {
         throw FileNotOpenException("File is not open");
@@ -101,9 +254,10 @@ void FileIOHandler::WriteBytes(const uint64_t offset,
     this->stream->clear();
 
     // Seek and write data
+    this->CountSeek();
     this->stream->seekp(static_cast<std::streamoff>(offset), std::ios::beg);
-    this->stream->write(data.data(),
-                        static_cast<std::streamsize>(data.size()));
+    this->stream->write(data,
+                        static_cast<std::streamsize>(size));
 
     // Verify write success
     if (!(*this->stream)) {
@@ -111,19 +265,226 @@ void FileIOHandler::WriteBytes(const uint64_t offset,
     }
 }
 
+/**
+ * @brief Start an asynchronous engine for batched I/O.
+ */
+void FileIOHandler::StartAsync(const AsyncIO::Engines engine, const unsigned queueDepth) {
+    if (!this->IsOpen()) {
+        throw FileNotOpenException("File is not open");
+    }
+
+    // The stream has no descriptor, and mapped I/O is a memory copy
+    if (this->backend != Backends::POSITIONAL) {
+        return;
+    }
+
+    this->async = std::make_unique<AsyncIO>(this->fd, engine, queueDepth);
+}
+
+/**
+ * @brief Get the asynchronous engine.
+ */
+const AsyncIO* FileIOHandler::Async() const {
+    return this->async.get();
+}
+
+/**
+ * @brief Submit a batch of reads and writes.
+ */
+std::future<void> FileIOHandler::Submit(std::vector<IORequest> requests) const {
+    if (!this->IsOpen()) {
+        throw FileNotOpenException("File is not open");
+    }
+
+    for (const IORequest& request : requests) {
+        if (request.kind == IORequest::Kinds::WRITE) {
+            this->EnsureWritable();
+            break;
+        }
+    }
+
+    if (this->async) {
+        for (const IORequest& request : requests) {
+            if (request.kind == IORequest::Kinds::READ) {
+                ZOS_PERF_COUNT(Perf::Probe::IO_READ, request.size);
+                this->CountRead(request.size);
+            } else {
+                ZOS_PERF_COUNT(Perf::Probe::IO_WRITE, request.size);
+                this->CountWrite(request.size);
+            }
+        }
+        return this->async->Submit(std::move(requests));
+    }
+
+    // Failures are reported through the future, as with an engine
+    std::promise<void> done;
+    try {
+        this->TransferInline(requests);
+        done.set_value();
+    } catch (...) {
+        done.set_exception(std::current_exception());
+    }
+    return done.get_future();
+}
+
+/**
+ * @brief Carry out a batch of reads and writes and wait for it.
+ */
+void FileIOHandler::Transfer(std::vector<IORequest> requests) const {
+    // A lone request that is waited for at once gains nothing from
+    // being in flight, but would pay for the hand-off to the engine
+    if (requests.size() == 1) {
+        this->TransferInline(requests);
+        return;
+    }
+
+    this->Submit(std::move(requests)).get();
+}
+
+/**
+ * @brief Carry out requests one after another on the calling thread.
+ */
+void FileIOHandler::TransferInline(const std::vector<IORequest>& requests) const {
+    for (const IORequest& request : requests) {
+        if (request.kind == IORequest::Kinds::WRITE) {
+            this->WriteBytes(request.offset, request.buffer, request.size);
+        } else if (this->ReadInto(request.offset, request.buffer, request.size) != request.size) {
+            throw FileReadException("Read of " + std::to_string(request.size) +
+                                    " bytes at offset " + std::to_string(request.offset) +
+                                    " failed: end of file");
+        }
+    }
+}
+
+/**
+ * @brief Write a set of disjoint byte ranges as one batch.
+ */
+void FileIOHandler::WriteAll(const std::vector<ImageWrite>& writes) const {
+    std::vector<IORequest> requests;
+    requests.reserve(writes.size());
+    for (const ImageWrite& write : writes) {
+        requests.push_back(IORequest::Write(write.offset, write.data.data(), write.data.size()));
+    }
+    this->Transfer(std::move(requests));
+}
+
 /**
  * @brief Flush buffered output to disk.
  */
 void FileIOHandler::Flush() const {
+    if (this->backend == Backends::MMAP) {
+        if (this->mapping) {
+            ::msync(this->mapping, this->mappedSize, MS_ASYNC);
+        }
+        return;
+    }
+
+    // Positional writes are not buffered
+    if (this->stream) {
+        this->stream->flush();
+    }
+}
+
+/**
+ * @brief Flush output and wait for stable storage.
+ */
+void FileIOHandler::FlushToDisk() const {
+    ZOS_PERF_SCOPE(Perf::Probe::IO_SYNC);
+    this->CountSync();
+
+    if (this->backend == Backends::MMAP) {
+        if (this->mapping && ::msync(this->mapping, this->mappedSize, MS_SYNC) != 0) {
+            throw FileWriteException("Failed to sync file: " + std::string(std::strerror(errno)));
+        }
+        return;
+    }
+
+    if (this->backend == Backends::POSITIONAL) {
+        if (this->fd >= 0 && ::fdatasync(this->fd) != 0) {
+            throw FileWriteException("Failed to sync file: " + std::string(std::strerror(errno)));
+        }
+        return;
+    }
+
+    if (!this->stream) {
+        return;
+    }
+
     this->stream->flush();
+    if (!(*this->stream)) {
+        throw FileWriteException("Failed to flush file");
+    }
+
+    // The stream does not expose its descriptor
+    const int descriptor = ::open(this->fileName.c_str(), O_WRONLY);
+    if (descriptor < 0) {
+        throw FileWriteException("Failed to sync file: " + std::string(std::strerror(errno)));
+    }
+
+    const int result = ::fdatasync(descriptor);
+    ::close(descriptor);
+
+    if (result != 0) {
+        throw FileWriteException("Failed to sync file: " + std::string(std::strerror(errno)));
+    }
+}
+
+/**
+ * @brief Get direct access to a byte range of a mapped file.
+ */
+const char* FileIOHandler::Data(const uint64_t offset, const uint64_t size) const {
+    if (!this->mapping || offset > this->mappedSize || size > this->mappedSize - offset) {
+        return nullptr;
+    }
+    ZOS_PERF_COUNT(Perf::Probe::IO_READ, size);
+    this->CountRead(size);
+    return this->mapping + offset;
+}
+
+/**
+ * @brief Check whether the file is memory-mapped.
+ */
+bool FileIOHandler::IsMapped() const {
+    return this->backend == Backends::MMAP;
 }
 
 /**
  * @brief Resize the currently open file and zero-fill it.
  */
-uint64_t FileIOHandler::Resize(const uint64_t newSize) const {
+uint64_t FileIOHandler::Resize(const uint64_t newSize, const bool zeroFill) const {
     this->EnsureWritable();
 
+    if (this->backend != Backends::STREAM) {
+        if (this->fd < 0) {
+            throw FileNotOpenException("File is not open");
+        }
+
+        this->Unmap();
+
+        // Truncating to zero first discards the old contents
+        if (::ftruncate(this->fd, 0) != 0 ||
+            ::ftruncate(this->fd, static_cast<off_t>(newSize)) != 0) {
+            throw FileWriteException("Failed to resize file: " + std::string(std::strerror(errno)));
+        }
+
+        if (this->backend == Backends::POSITIONAL) {
+            // Reserve the space without writing the zeros ourselves
+            if (zeroFill && newSize > 0 &&
+                ::posix_fallocate(this->fd, 0, static_cast<off_t>(newSize)) != 0) {
+                throw FileWriteException("Failed to zero-fill file");
+            }
+            return newSize;
+        }
+
+        this->Map();
+
+        // Touch every page so the space is actually reserved
+        if (zeroFill && this->mapping) {
+            std::memset(this->mapping, 0, this->mappedSize);
+        }
+        return newSize;
+    }
+
     if (!this->stream || !this->stream->is_open()) {
         throw FileNotOpenException("File is not open");
     }
@@ -132,9 +493,15 @@ uint64_t FileIOHandler::Resize(const uint64_t newSize) const {
     this->stream->flush();
     this->stream->close();
 
-    // Perform filesystem resize
+    // Perform filesystem resize; truncating to zero first drops the old
+    // contents, so the grown file is sparse and reads as zeros
     std::error_code ec;
-    std::filesystem::resize_file(this->fileName, newSize, ec);
+    if (!zeroFill) {
+        std::filesystem::resize_file(this->fileName, 0, ec);
+    }
+    if (!ec) {
+        std::filesystem::resize_file(this->fileName, newSize, ec);
+    }
     if (ec) {
         throw FileWriteException("Failed to resize file: " + ec.message());
     }
@@ -146,6 +513,11 @@ uint64_t FileIOHandler::Resize(const uint64_t newSize) const {
         throw FileNotOpenException("Failed to reopen file after resize");
     }
 
+    if (!zeroFill) {
+        this->stream->clear();
+        return newSize;
+    }
+
     // Zero-fill the entire file
     constexpr std::size_t ZERO_BUF_SIZE = 4096;
     std::array<char, ZERO_BUF_SIZE> zeroBuf{};
@@ -176,10 +548,45 @@ uint64_t FileIOHandler::Resize(const uint64_t newSize) const {
     return newSize;
 }
 
+/**
+ * @brief Release the storage behind a byte range of the file.
+ */
+void FileIOHandler::PunchHole(const uint64_t offset, const uint64_t size) const {
+    this->EnsureWritable();
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+    if (this->backend != Backends::STREAM) {
+        ::fallocate(this->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                    static_cast<off_t>(offset), static_cast<off_t>(size));
+        return;
+    }
+
+    if (!this->stream) {
+        return;
+    }
+
+    // Buffered writes must not land after the hole is punched
+    this->stream->flush();
+
+    const int descriptor = ::open(this->fileName.c_str(), O_WRONLY);
+    if (descriptor >= 0) {
+        ::fallocate(descriptor, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                    static_cast<off_t>(offset), static_cast<off_t>(size));
+        ::close(descriptor);
+    }
+#else
+    (void) offset;
+    (void) size;
+#endif
+}
+
 /**
  * @brief Check whether a file stream is open.
  */
 bool FileIOHandler::IsOpen() const {
+    if (this->backend != Backends::STREAM) {
+        return this->fd >= 0;
+    }
     return this->stream && this->stream->is_open();
 }
 
@@ -191,3 +598,114 @@ void FileIOHandler::EnsureWritable() const {
         throw FileReadOnlyException("File opened read-only");
     }
 }
+
+/**
+ * @brief Map the whole file into memory.
+ */
+void FileIOHandler::Map() const {
+    struct stat info {};
+    if (::fstat(this->fd, &info) != 0) {
+        throw CouldNotOpenFileException("Could not stat file: " + this->fileName);
+    }
+
+    this->mappedSize = static_cast<uint64_t>(info.st_size);
+    if (this->mappedSize == 0) {
+        // Nothing to map until the file is resized
+        this->mapping = nullptr;
+        return;
+    }
+
+    const int protection = this->mode == FileModes::READ
+        ? PROT_READ
+        : PROT_READ | PROT_WRITE;
+
+    void* address = ::mmap(nullptr, this->mappedSize, protection, MAP_SHARED, this->fd, 0);
+    if (address == MAP_FAILED) {
+        this->mappedSize = 0;
+        throw CouldNotOpenFileException("Could not map file: " + this->fileName);
+    }
+
+    this->mapping = static_cast<char*>(address);
+}
+
+/**
+ * @brief Write back and remove the mapping.
+ */
+void FileIOHandler::Unmap() const {
+    if (this->mapping) {
+        ::msync(this->mapping, this->mappedSize, MS_SYNC);
+        ::munmap(this->mapping, this->mappedSize);
+    }
+
+    this->mapping = nullptr;
+    this->mappedSize = 0;
+}
+
+/**
+ * @brief Get the call counters.
+ */
+FileIOHandler::Statistics FileIOHandler::GetStatistics() const {
+    Statistics stats;
+    stats.reads = this->reads.load(std::memory_order_relaxed);
+    stats.writes = this->writes.load(std::memory_order_relaxed);
+    stats.syncs = this->syncs.load(std::memory_order_relaxed);
+    stats.seeks = this->seeks.load(std::memory_order_relaxed);
+    stats.bytesRead = this->bytesRead.load(std::memory_order_relaxed);
+    stats.bytesWritten = this->bytesWritten.load(std::memory_order_relaxed);
+    return stats;
+}
+
+/**
+ * @brief Clear the call counters.
+ */
+void FileIOHandler::ResetStatistics() const {
+    this->reads.store(0, std::memory_order_relaxed);
+    this->writes.store(0, std::memory_order_relaxed);
+    this->syncs.store(0, std::memory_order_relaxed);
+    this->seeks.store(0, std::memory_order_relaxed);
+    this->bytesRead.store(0, std::memory_order_relaxed);
+    this->bytesWritten.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Count a read call.
+ */
+void FileIOHandler::CountRead(const uint64_t size) const {
+#ifdef ZOS_PERF
+    this->reads.fetch_add(1, std::memory_order_relaxed);
+    this->bytesRead.fetch_add(size, std::memory_order_relaxed);
+#else
+    static_cast<void>(size);
+#endif
+}
+
+/**
+ * @brief Count a write call.
+ */
+void FileIOHandler::CountWrite(const uint64_t size) const {
+#ifdef ZOS_PERF
+    this->writes.fetch_add(1, std::memory_order_relaxed);
+    this->bytesWritten.fetch_add(size, std::memory_order_relaxed);
+#else
+    static_cast<void>(size);
+#endif
+}
+
+/**
+ * @brief Count a write barrier.
+ */
+void FileIOHandler::CountSync() const {
+#ifdef ZOS_PERF
+    this->syncs.fetch_add(1, std::memory_order_relaxed);
+#endif
+}
+
+/**
+ * @brief Count a stream repositioning.
+ */
+void FileIOHandler::CountSeek() const {
+#ifdef ZOS_PERF
+    this->seeks.fetch_add(1, std::memory_order_relaxed);
+    ZOS_PERF_COUNT(Perf::Probe::IO_SEEK);
+#endif
+}
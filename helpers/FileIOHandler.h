@@ -3,21 +3,67 @@
 //
 
 #pragma once
+#include <atomic>
 #include <cstdint>
 #include <fstream>
+#include <future>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "AsyncIO.h"
+#include "ImageWrite.h"
+
 /**
  * @brief Stream-based file I/O handler.
  *
  * Provides low-level binary read/write access to a file using a single
  * managed stream. Supports file creation, resizing, and random-access
  * reads and writes.
+ *
+ * Alternatively the file can be memory-mapped. Reads and writes are
+ * then plain memory copies, Data() exposes the mapping for zero-copy
+ * parsing, and Flush() schedules the write-back with msync.
+ *
+ * The stream shares one file position between all reads and writes and
+ * must only be used from one thread. The positional and mapped backends
+ * have no shared position: reads and writes of distinct ranges may be
+ * issued concurrently. Resize() and CloseFile() never may.
+ *
+ * A positional file can additionally be given an AsyncIO engine with
+ * StartAsync(); Submit() and Transfer() then keep a whole batch of reads
+ * and writes in flight at once. Without an engine (and for the other
+ * backends) batches are carried out one request after another.
+ *
+ * When built with ZOS_PERF, every handler counts the read, write, seek
+ * and sync calls issued through it and the bytes they moved, and times
+ * them through the Perf probes.
  */
 class FileIOHandler {
 public:
+    /**
+     * @brief Number of calls issued through the handler.
+     */
+    struct Statistics {
+        /** ReadBytes() and successful Data() calls, and submitted reads. */
+        uint64_t reads = 0;
+
+        /** WriteBytes() calls and submitted writes. */
+        uint64_t writes = 0;
+
+        /** FlushToDisk() calls. */
+        uint64_t syncs = 0;
+
+        /** Stream repositionings (stream backend only). */
+        uint64_t seeks = 0;
+
+        /** Bytes returned by reads. */
+        uint64_t bytesRead = 0;
+
+        /** Bytes passed to writes. */
+        uint64_t bytesWritten = 0;
+    };
+
     /**
      * @brief File opening modes.
      */
@@ -29,6 +75,20 @@ public:
         READ_WRITE
     };
 
+    /**
+     * @brief Ways of accessing the file contents.
+     */
+    enum class Backends {
+        /// Buffered std::fstream with seek + read/write
+        STREAM,
+
+        /// Shared memory mapping of the whole file
+        MMAP,
+
+        /// Unbuffered pread/pwrite on a file descriptor
+        POSITIONAL
+    };
+
     /**
      * @brief Construct a FileIOHandler.
      *
@@ -51,11 +111,13 @@ public:
      *
      * @param fileName Path to the file.
      * @param mode Mode to open the file in.
+     * @param backend Way of accessing the file contents.
      *
      * @throws FileDoesNotExistException If the file does not exist in READ mode.
-     * @throws CouldNotOpenFileException If the file could not be opened.
+     * @throws CouldNotOpenFileException If the file could not be opened or mapped.
      */
-    void OpenFile(const std::string& fileName, FileModes mode);
+    void OpenFile(const std::string& fileName, FileModes mode,
+                  Backends backend = Backends::STREAM);
 
     /**
      * @brief Flush and close the file stream.
@@ -83,6 +145,19 @@ public:
      */
     [[nodiscard]] std::vector<char> ReadBytes(uint64_t offset, uint64_t size) const;
 
+    /**
+     * @brief Read a sequence of bytes from the file into a buffer.
+     *
+     * @param offset Byte offset from the beginning of the file.
+     * @param out Destination buffer of at least size bytes.
+     * @param size Number of bytes to read.
+     *
+     * @return Number of bytes read (less than size at the end of the file).
+     *
+     * @throws FileNotOpenException If no file is open.
+     */
+    uint64_t ReadInto(uint64_t offset, char* out, uint64_t size) const;
+
     /**
      * @brief Write bytes to the file.
      *
@@ -95,17 +170,125 @@ public:
      */
     void WriteBytes(uint64_t offset, const std::vector<char>& data) const;
 
+    /**
+     * @brief Write a raw byte range to the file.
+     *
+     * @param offset Byte offset from the beginning of the file.
+     * @param data Pointer to the data to write.
+     * @param size Number of bytes to write.
+     *
+     * @throws FileNotOpenException If no file is open.
+     * @throws FileReadOnlyException If file is read-only.
+     * @throws FileWriteException If the write fails.
+     */
+    void WriteBytes(uint64_t offset, const char* data, uint64_t size) const;
+
+    /**
+     * @brief Start an asynchronous engine for batched I/O.
+     *
+     * Only positional files are driven asynchronously; for the other
+     * backends this is a no-op. The engine is stopped by CloseFile().
+     *
+     * @param engine Preferred engine (io_uring falls back to threads).
+     * @param queueDepth Maximum number of requests in flight.
+     *
+     * @throws FileNotOpenException If no file is open.
+     */
+    void StartAsync(AsyncIO::Engines engine,
+                    unsigned queueDepth = AsyncIO::DEFAULT_QUEUE_DEPTH);
+
+    /**
+     * @brief Get the asynchronous engine (nullptr if none is running).
+     */
+    [[nodiscard]] const AsyncIO* Async() const;
+
+    /**
+     * @brief Submit a batch of reads and writes.
+     *
+     * With an engine all requests are issued at once and the call only
+     * waits for free queue slots; otherwise they are carried out before
+     * it returns. Every request counts as one read or write call.
+     * Reads past the end of the file fail.
+     *
+     * @param requests Requests of the batch; buffers must stay valid
+     *                 until the returned future is ready.
+     *
+     * @return Future that becomes ready when the whole batch finished.
+     *
+     * @throws FileNotOpenException If no file is open.
+     * @throws FileReadOnlyException If the batch writes to a read-only file.
+     */
+    [[nodiscard]] std::future<void> Submit(std::vector<IORequest> requests) const;
+
+    /**
+     * @brief Carry out a batch of reads and writes and wait for it.
+     *
+     * A batch of a single request is issued directly on the calling
+     * thread, which is cheaper than handing it to the engine.
+     *
+     * @param requests Requests of the batch.
+     *
+     * @throws FileReadException If a read failed.
+     * @throws FileWriteException If a write failed.
+     * @see Submit()
+     */
+    void Transfer(std::vector<IORequest> requests) const;
+
+    /**
+     * @brief Write a set of disjoint byte ranges as one batch.
+     *
+     * @param writes Ranges to write; they must not overlap.
+     *
+     * @throws FileReadOnlyException If file is read-only.
+     * @throws FileWriteException If a write failed.
+     */
+    void WriteAll(const std::vector<ImageWrite>& writes) const;
+
+    /**
+     * @brief Get direct access to a byte range of a mapped file.
+     *
+     * The pointer stays valid until the file is resized or closed.
+     *
+     * @param offset Byte offset from the beginning of the file.
+     * @param size Number of bytes that will be accessed.
+     *
+     * @return Pointer into the mapping, or nullptr if the file is not
+     *         mapped or the range lies outside of it.
+     */
+    [[nodiscard]] const char* Data(uint64_t offset, uint64_t size) const;
+
+    /**
+     * @brief Check whether the file is accessed through a memory mapping.
+     */
+    [[nodiscard]] bool IsMapped() const;
+
     /**
      * @brief Flush buffered output to disk.
+     *
+     * For a mapped file, schedules write-back of modified pages.
      */
     void Flush() const;
 
+    /**
+     * @brief Flush output and wait until it reached stable storage.
+     *
+     * Used as a write barrier: nothing written afterwards can reach the
+     * disk before everything written earlier.
+     *
+     * @throws FileWriteException If the data could not be synchronized.
+     */
+    void FlushToDisk() const;
+
     /**
      * @brief Resize the currently open file.
      *
-     * The file is resized and fully zero-filled to the new size.
+     * The old contents are discarded and the file reads as zeros up to
+     * the new size. With zeroFill the zeros are physically written, so
+     * all space is reserved up front; without it the file stays sparse
+     * and resizing takes constant time.
      *
      * @param newSize Target file size in bytes.
+     * @param zeroFill Write the zeros instead of leaving a sparse file.
      *
      * @return The new file size.
      *
@@ -113,7 +296,20 @@ public:
      * @throws FileReadOnlyException If file is read-only.
      * @throws FileWriteException If resizing or zero-filling fails.
      */
-    [[nodiscard]] uint64_t Resize(uint64_t newSize) const;
+    [[nodiscard]] uint64_t Resize(uint64_t newSize, bool zeroFill = true) const;
+
+    /**
+     * @brief Release the storage behind a byte range of the file.
+     *
+     * The range keeps its place in the file and reads back as zeros;
+     * on hosts without hole punching this is a no-op.
+     *
+     * @param offset Byte offset from the beginning of the file.
+     * @param size Number of bytes to release.
+     *
+     * @throws FileReadOnlyException If file is read-only.
+     */
+    void PunchHole(uint64_t offset, uint64_t size) const;
 
     /**
      * @brief Check whether a file stream is currently open.
@@ -122,6 +318,18 @@ public:
      */
     [[nodiscard]] bool IsOpen() const;
 
+    /**
+     * @brief Get the call counters since opening or the last reset.
+     *
+     * All zero unless built with ZOS_PERF.
+     */
+    [[nodiscard]] Statistics GetStatistics() const;
+
+    /**
+     * @brief Clear the call counters.
+     */
+    void ResetStatistics() const;
+
 private:
     /// Path of the currently opened file
     std::string fileName;
@@ -131,4 +339,66 @@ private:
 
     /// Mode the file was opened with
     FileModes mode;
+
+    /// Backend the file was opened with
+    Backends backend = Backends::STREAM;
+
+    /// File descriptor of a mapped or positional file
+    mutable int fd = -1;
+
+    /// Start of the mapping (nullptr if empty or not mapped)
+    mutable char* mapping = nullptr;
+
+    /// Length of the mapping in bytes
+    mutable uint64_t mappedSize = 0;
+
+    /// Asynchronous engine of a positional file (nullptr if none)
+    mutable std::unique_ptr<AsyncIO> async;
+
+    /// Call counters (relaxed; they order nothing)
+    mutable std::atomic<uint64_t> reads{0};
+    mutable std::atomic<uint64_t> writes{0};
+    mutable std::atomic<uint64_t> syncs{0};
+    mutable std::atomic<uint64_t> seeks{0};
+    mutable std::atomic<uint64_t> bytesRead{0};
+    mutable std::atomic<uint64_t> bytesWritten{0};
+
+    /**
+     * @brief Count a read call.
+     */
+    void CountRead(uint64_t size) const;
+
+    /**
+     * @brief Count a write call.
+     */
+    void CountWrite(uint64_t size) const;
+
+    /**
+     * @brief Count a write barrier.
+     */
+    void CountSync() const;
+
+    /**
+     * @brief Count a stream repositioning.
+     */
+    void CountSeek() const;
+
+    /**
+     * @brief Carry out requests one after another on the calling thread.
+     *
+     * @throws FileReadException If a read ends early.
+     */
+    void TransferInline(const std::vector<IORequest>& requests) const;
+
+    /**
+     * @brief Map the whole file (no-op for an empty file).
+     *
+     * @throws CouldNotOpenFileException If the file cannot be mapped.
+     */
+    void Map() const;
+
+    /**
+     * @brief Write back and remove the mapping.
+     */
+    void Unmap() const;
 };
@@ -46,6 +46,18 @@ public:
         : std::runtime_error{msg} {}
 };
 
+/**
+ * @brief Thrown when modifying an image that is mounted read-only.
+ */
+class ReadOnlyFilesystemException : public std::runtime_error {
+public:
+    /**
+     * @param msg Human-readable error message.
+     */
+    explicit ReadOnlyFilesystemException(const std::string& msg)
+        : std::runtime_error{msg} {}
+};
+
 /**
  * @brief Thrown when the filesystem superblock is invalid or corrupted.
  */
@@ -178,6 +190,18 @@ public:
         : std::runtime_error{msg} {}
 };
 
+/**
+ * @brief Thrown when a name cannot be stored in a directory entry.
+ */
+class InvalidFileNameException : public std::runtime_error {
+public:
+    /**
+     * @param msg Human-readable error message.
+     */
+    explicit InvalidFileNameException(const std::string& msg)
+        : std::runtime_error{msg} {}
+};
+
 /**
  * @brief Thrown when a child entry cannot be found in a directory.
  */
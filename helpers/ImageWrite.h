@@ -0,0 +1,21 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Represents a pending write of a byte range of the image.
+ *
+ * Produced by the caches when collecting their dirty state, so that it
+ * can either be written in place or committed through the journal.
+ */
+struct ImageWrite {
+    /** @brief Byte offset from the beginning of the image. */
+    uint64_t offset;
+
+    /** @brief Bytes to write. */
+    std::vector<char> data;
+};
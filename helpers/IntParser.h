@@ -14,6 +14,9 @@
  * to and from byte buffers using a defined byte order.
  *
  * All values are encoded and decoded using little-endian format.
+ *
+ * The pointer-based overloads decode and encode in place, without
+ * allocating, and can be evaluated at compile time.
  */
 class IntParser {
 public:
@@ -60,4 +63,52 @@ public:
      * @return Byte buffer containing the encoded value.
      */
     static std::vector<char> WriteUInt64(const uint64_t& number);
+
+    /**
+     * @brief Parse a 32-bit unsigned integer in place.
+     *
+     * @param data Pointer to at least 4 bytes of little-endian data.
+     * @return Parsed 32-bit unsigned integer.
+     */
+    static constexpr uint32_t ReadUInt32(const char* data) {
+        return  static_cast<uint32_t>(static_cast<uint8_t>(data[0])) |
+                static_cast<uint32_t>(static_cast<uint8_t>(data[1])) << 8 |
+                static_cast<uint32_t>(static_cast<uint8_t>(data[2])) << 16 |
+                static_cast<uint32_t>(static_cast<uint8_t>(data[3])) << 24;
+    }
+
+    /**
+     * @brief Parse a 64-bit unsigned integer in place.
+     *
+     * @param data Pointer to at least 8 bytes of little-endian data.
+     * @return Parsed 64-bit unsigned integer.
+     */
+    static constexpr uint64_t ReadUInt64(const char* data) {
+        return  static_cast<uint64_t>(ReadUInt32(data)) |
+                static_cast<uint64_t>(ReadUInt32(data + 4)) << 32;
+    }
+
+    /**
+     * @brief Serialize a 32-bit unsigned integer in place.
+     *
+     * @param out Pointer to at least 4 writable bytes.
+     * @param number Value to serialize.
+     */
+    static constexpr void WriteUInt32(char* out, const uint32_t number) {
+        out[0] = static_cast<char>(number & 0xFF);
+        out[1] = static_cast<char>((number >> 8) & 0xFF);
+        out[2] = static_cast<char>((number >> 16) & 0xFF);
+        out[3] = static_cast<char>((number >> 24) & 0xFF);
+    }
+
+    /**
+     * @brief Serialize a 64-bit unsigned integer in place.
+     *
+     * @param out Pointer to at least 8 writable bytes.
+     * @param number Value to serialize.
+     */
+    static constexpr void WriteUInt64(char* out, const uint64_t number) {
+        WriteUInt32(out, static_cast<uint32_t>(number));
+        WriteUInt32(out + 4, static_cast<uint32_t>(number >> 32));
+    }
 };
@@ -0,0 +1,251 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#include "Lz4.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#include "FileIOExceptions.h"
+
+namespace {
+    /// Shortest back reference
+    constexpr std::size_t MIN_MATCH = 4;
+
+    /// The last bytes of a block are always literals
+    constexpr std::size_t LAST_LITERALS = 5;
+
+    /// No back reference starts in the last bytes of a block
+    constexpr std::size_t MATCH_LIMIT = 12;
+
+    /// Farthest back reference (16-bit distance)
+    constexpr std::size_t MAX_DISTANCE = 65535;
+
+    /// Length code that continues in extension bytes
+    constexpr std::size_t LONG_LENGTH = 15;
+
+    /// Size of the match table (4096 positions)
+    constexpr int HASH_BITS = 12;
+
+    constexpr uint32_t NO_POSITION = UINT32_MAX;
+
+    uint32_t Read32(const char* data) {
+        uint32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    uint64_t Read64(const char* data) {
+        uint64_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    uint32_t HashOf(const uint32_t sequence) {
+        return (sequence * 2654435761U) >> (32 - HASH_BITS);
+    }
+
+    /**
+     * @brief Output buffer of limited size.
+     */
+    struct Output {
+        char* data;
+        std::size_t capacity;
+        std::size_t size = 0;
+
+        [[nodiscard]] bool Fits(const std::size_t bytes) const {
+            return this->capacity - this->size >= bytes;
+        }
+
+        /// Extension bytes of a length code of LONG_LENGTH
+        bool Length(std::size_t value) {
+            for (; value >= 255; value -= 255) {
+                if (!this->Fits(1)) {
+                    return false;
+                }
+                this->data[this->size++] = static_cast<char>(255);
+            }
+            if (!this->Fits(1)) {
+                return false;
+            }
+            this->data[this->size++] = static_cast<char>(value);
+            return true;
+        }
+    };
+
+    /**
+     * @brief Encode literals followed by a back reference (none if match is 0).
+     *
+     * @return False if the output is full.
+     */
+    bool EmitSequence(Output& output,
+                      const char* literals, const std::size_t count,
+                      const std::size_t distance, const std::size_t match) {
+        const std::size_t literalCode = std::min(count, LONG_LENGTH);
+        const std::size_t matchCode = match == 0 ? 0 : std::min(match - MIN_MATCH, LONG_LENGTH);
+
+        if (!output.Fits(1)) {
+            return false;
+        }
+        output.data[output.size++] = static_cast<char>(literalCode << 4 | matchCode);
+
+        if (count >= LONG_LENGTH && !output.Length(count - LONG_LENGTH)) {
+            return false;
+        }
+        if (!output.Fits(count)) {
+            return false;
+        }
+        std::memcpy(output.data + output.size, literals, count);
+        output.size += count;
+
+        // The last sequence ends with its literals
+        if (match == 0) {
+            return true;
+        }
+
+        if (!output.Fits(2)) {
+            return false;
+        }
+        output.data[output.size++] = static_cast<char>(distance & 0xFF);
+        output.data[output.size++] = static_cast<char>(distance >> 8);
+
+        return match - MIN_MATCH < LONG_LENGTH || output.Length(match - MIN_MATCH - LONG_LENGTH);
+    }
+}
+
+std::size_t Lz4::Compress(const char* data, const std::size_t size,
+                          char* out, const std::size_t capacity) {
+    Output output{out, capacity};
+    std::size_t anchor = 0;
+
+    if (size > MATCH_LIMIT) {
+        std::array<uint32_t, 1 << HASH_BITS> table;
+        table.fill(NO_POSITION);
+
+        const std::size_t matchEnd = size - LAST_LITERALS;
+        const std::size_t lastStart = size - MATCH_LIMIT;
+        std::size_t position = 0;
+        std::size_t misses = 0;
+
+        while (position <= lastStart) {
+            const uint32_t sequence = Read32(data + position);
+            uint32_t& slot = table[HashOf(sequence)];
+            const uint32_t candidate = slot;
+            slot = static_cast<uint32_t>(position);
+
+            if (candidate == NO_POSITION ||
+                position - candidate > MAX_DISTANCE ||
+                Read32(data + candidate) != sequence) {
+                // Step faster through data that does not compress
+                position += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            // Extend the match backwards over pending literals, then forwards
+            std::size_t start = position;
+            std::size_t from = candidate;
+            while (start > anchor && from > 0 && data[start - 1] == data[from - 1]) {
+                --start;
+                --from;
+            }
+
+            std::size_t end = position + MIN_MATCH;
+            std::size_t reference = candidate + MIN_MATCH;
+            while (end + sizeof(uint64_t) <= matchEnd && Read64(data + end) == Read64(data + reference)) {
+                end += sizeof(uint64_t);
+                reference += sizeof(uint64_t);
+            }
+            while (end < matchEnd && data[end] == data[reference]) {
+                ++end;
+                ++reference;
+            }
+
+            if (!EmitSequence(output, data + anchor, start - anchor, start - from, end - start)) {
+                return 0;
+            }
+
+            // Let the next match start right behind this one
+            table[HashOf(Read32(data + end - 2))] = static_cast<uint32_t>(end - 2);
+            anchor = position = end;
+        }
+    }
+
+    if (!EmitSequence(output, data + anchor, size - anchor, 0, 0)) {
+        return 0;
+    }
+    return output.size;
+}
+
+void Lz4::Decompress(const char* data, const std::size_t size,
+                     char* out, const std::size_t expected) {
+    const auto* in = reinterpret_cast<const unsigned char*>(data);
+    std::size_t read = 0;
+    std::size_t written = 0;
+
+    auto length = [&](std::size_t value) {
+        if (value != LONG_LENGTH) {
+            return value;
+        }
+
+        unsigned char byte = 0;
+        do {
+            if (read >= size) {
+                throw FileReadException("Damaged compressed data");
+            }
+            byte = in[read++];
+            value += byte;
+        } while (byte == 255);
+        return value;
+    };
+
+    while (true) {
+        if (read >= size) {
+            throw FileReadException("Damaged compressed data");
+        }
+        const unsigned token = in[read++];
+
+        const std::size_t literals = length(token >> 4);
+        if (literals > size - read || literals > expected - written) {
+            throw FileReadException("Damaged compressed data");
+        }
+        std::memcpy(out + written, data + read, literals);
+        read += literals;
+        written += literals;
+
+        // The last sequence has no back reference
+        if (read == size) {
+            break;
+        }
+
+        if (size - read < 2) {
+            throw FileReadException("Damaged compressed data");
+        }
+        const std::size_t distance = in[read] | static_cast<std::size_t>(in[read + 1]) << 8;
+        read += 2;
+
+        const std::size_t match = length(token & LONG_LENGTH) + MIN_MATCH;
+        if (distance == 0 || distance > written || match > expected - written) {
+            throw FileReadException("Damaged compressed data");
+        }
+
+        // A reference closer than its length repeats the bytes just written
+        char* to = out + written;
+        const char* from = to - distance;
+        if (distance >= match) {
+            std::memcpy(to, from, match);
+        } else {
+            for (std::size_t i = 0; i < match; ++i) {
+                to[i] = from[i];
+            }
+        }
+        written += match;
+    }
+
+    if (written != expected) {
+        throw FileReadException("Damaged compressed data");
+    }
+}
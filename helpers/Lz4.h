@@ -0,0 +1,47 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <cstddef>
+
+/**
+ * @brief Compressor of the LZ4 block format.
+ *
+ * Data is encoded as a sequence of literal runs and back references of
+ * at least 4 bytes at most 65535 bytes back, exactly as in an LZ4 block
+ * (without the frame around it). Matches are found through a hash table
+ * of 4-byte sequences, so compression runs in a single pass and
+ * decompression is little more than copying.
+ */
+class Lz4 {
+public:
+    /**
+     * @brief Compress data into a buffer of limited size.
+     *
+     * Compression stops as soon as the output would not fit, so
+     * incompressible data costs little more than a scan.
+     *
+     * @param data Data to compress.
+     * @param size Number of bytes of data.
+     * @param out Destination buffer.
+     * @param capacity Size of the destination buffer.
+     * @return Number of compressed bytes, or 0 if they do not fit.
+     */
+    static std::size_t Compress(const char* data, std::size_t size,
+                                char* out, std::size_t capacity);
+
+    /**
+     * @brief Decompress data of a known size.
+     *
+     * @param data Compressed data.
+     * @param size Number of bytes of compressed data.
+     * @param out Destination buffer of exactly expected bytes.
+     * @param expected Number of bytes the data decompresses to.
+     *
+     * @throws FileReadException If the data is damaged or does not
+     *         decompress to exactly expected bytes.
+     */
+    static void Decompress(const char* data, std::size_t size,
+                           char* out, std::size_t expected);
+};
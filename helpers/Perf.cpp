@@ -0,0 +1,197 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#include "Perf.h"
+
+#include <atomic>
+
+namespace {
+    /**
+     * @brief Shared counters of one probe.
+     */
+    struct AtomicProbe {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> timed{0};
+        std::atomic<uint64_t> nanoseconds{0};
+        std::array<std::atomic<uint64_t>, Perf::LATENCY_BUCKETS> latency{};
+    };
+
+    /// Counters of all probes (zero-initialized static storage)
+    std::array<AtomicProbe, Perf::PROBE_COUNT> counters;
+
+    /**
+     * @brief Histogram bucket of a latency.
+     */
+    std::size_t BucketOf(uint64_t nanoseconds) {
+        std::size_t bucket = 0;
+        while (nanoseconds > 1 && bucket + 1 < Perf::LATENCY_BUCKETS) {
+            nanoseconds >>= 1;
+            ++bucket;
+        }
+        return bucket;
+    }
+
+    AtomicProbe& CountersOf(const Perf::Probe probe) {
+        return counters[static_cast<std::size_t>(probe)];
+    }
+
+    /**
+     * @brief Whether every call of a probe is timed (I/O is slow enough).
+     */
+    bool AlwaysTimed(const Perf::Probe probe) {
+        return probe == Perf::Probe::IO_READ ||
+               probe == Perf::Probe::IO_WRITE ||
+               probe == Perf::Probe::IO_SYNC;
+    }
+}
+
+namespace Perf {
+    const char* ProbeName(const Probe probe) {
+        switch (probe) {
+            case Probe::IO_READ:        return "io.read";
+            case Probe::IO_WRITE:       return "io.write";
+            case Probe::IO_SEEK:        return "io.seek";
+            case Probe::IO_SYNC:        return "io.sync";
+            case Probe::READ_INODE:     return "inode.read";
+            case Probe::WRITE_INODE:    return "inode.write";
+            case Probe::ALLOCATE_BLOCK: return "alloc.block";
+            case Probe::ALLOCATE_RUNS:  return "alloc.runs";
+            case Probe::GET_CHILDREN:   return "dir.children";
+            case Probe::RESOLVE_PATH:   return "path.resolve";
+            case Probe::COUNT:          break;
+        }
+        return "?";
+    }
+
+    uint64_t ProbeStats::Percentile(const double share) const {
+        uint64_t timed = 0;
+        for (const uint64_t count : this->latency) {
+            timed += count;
+        }
+        if (timed == 0) {
+            return 0;
+        }
+
+        const auto wanted = static_cast<uint64_t>(share * static_cast<double>(timed));
+        uint64_t seen = 0;
+        for (std::size_t bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+            seen += this->latency[bucket];
+            if (seen > wanted || seen == timed) {
+                return uint64_t{2} << bucket;
+            }
+        }
+        return uint64_t{2} << (LATENCY_BUCKETS - 1);
+    }
+
+    double ProbeStats::AverageNanoseconds() const {
+        if (this->timed == 0) {
+            return 0;
+        }
+        return static_cast<double>(this->nanoseconds) / static_cast<double>(this->timed);
+    }
+
+    double ProbeStats::TotalNanoseconds() const {
+        return this->AverageNanoseconds() * static_cast<double>(this->calls);
+    }
+
+    ProbeStats& ProbeStats::operator+=(const ProbeStats& other) {
+        this->calls += other.calls;
+        this->bytes += other.bytes;
+        this->timed += other.timed;
+        this->nanoseconds += other.nanoseconds;
+        for (std::size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+            this->latency[i] += other.latency[i];
+        }
+        return *this;
+    }
+
+    ProbeStats& ProbeStats::operator-=(const ProbeStats& other) {
+        this->calls -= other.calls;
+        this->bytes -= other.bytes;
+        this->timed -= other.timed;
+        this->nanoseconds -= other.nanoseconds;
+        for (std::size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+            this->latency[i] -= other.latency[i];
+        }
+        return *this;
+    }
+
+    const ProbeStats& Snapshot::operator[](const Probe probe) const {
+        return this->probes[static_cast<std::size_t>(probe)];
+    }
+
+    Snapshot& Snapshot::operator+=(const Snapshot& other) {
+        for (std::size_t i = 0; i < PROBE_COUNT; ++i) {
+            this->probes[i] += other.probes[i];
+        }
+        return *this;
+    }
+
+    Snapshot& Snapshot::operator-=(const Snapshot& other) {
+        for (std::size_t i = 0; i < PROBE_COUNT; ++i) {
+            this->probes[i] -= other.probes[i];
+        }
+        return *this;
+    }
+
+    void Record(const Probe probe, const uint64_t nanoseconds, const uint64_t bytes) {
+        AtomicProbe& probeCounters = CountersOf(probe);
+        probeCounters.calls.fetch_add(1, std::memory_order_relaxed);
+        if (bytes != 0) {
+            probeCounters.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        }
+        probeCounters.timed.fetch_add(1, std::memory_order_relaxed);
+        probeCounters.nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+        probeCounters.latency[BucketOf(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Count(const Probe probe, const uint64_t bytes) {
+        AtomicProbe& probeCounters = CountersOf(probe);
+        probeCounters.calls.fetch_add(1, std::memory_order_relaxed);
+        if (bytes != 0) {
+            probeCounters.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        }
+    }
+
+    bool Sample(const Probe probe) {
+        if (AlwaysTimed(probe)) {
+            return true;
+        }
+
+        thread_local std::array<uint32_t, PROBE_COUNT> calls{};
+        return calls[static_cast<std::size_t>(probe)]++ % SAMPLE_INTERVAL == 0;
+    }
+
+    Snapshot Capture() {
+        Snapshot snapshot;
+        if (!ENABLED) {
+            return snapshot;
+        }
+
+        for (std::size_t i = 0; i < PROBE_COUNT; ++i) {
+            ProbeStats& stats = snapshot.probes[i];
+            stats.calls = counters[i].calls.load(std::memory_order_relaxed);
+            stats.bytes = counters[i].bytes.load(std::memory_order_relaxed);
+            stats.timed = counters[i].timed.load(std::memory_order_relaxed);
+            stats.nanoseconds = counters[i].nanoseconds.load(std::memory_order_relaxed);
+            for (std::size_t bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+                stats.latency[bucket] = counters[i].latency[bucket].load(std::memory_order_relaxed);
+            }
+        }
+        return snapshot;
+    }
+
+    void Reset() {
+        for (AtomicProbe& probe : counters) {
+            probe.calls.store(0, std::memory_order_relaxed);
+            probe.bytes.store(0, std::memory_order_relaxed);
+            probe.timed.store(0, std::memory_order_relaxed);
+            probe.nanoseconds.store(0, std::memory_order_relaxed);
+            for (auto& bucket : probe.latency) {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+}
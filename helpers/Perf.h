@@ -0,0 +1,248 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Hot-path performance counters.
+ *
+ * Every probe counts its calls and bytes and sorts call latencies into
+ * a power-of-two histogram. Counters are process-wide relaxed atomics,
+ * so probes may fire from any thread.
+ *
+ * Reading the clock costs more than the cheapest probed operations, so
+ * only I/O calls are all timed; in-memory probes time one call in
+ * SAMPLE_INTERVAL per thread and estimate the total duration from it.
+ * Requests handed to an asynchronous engine overlap each other; they are
+ * counted but not timed.
+ *
+ * The probes are compiled in only when ZOS_PERF is defined; otherwise
+ * ZOS_PERF_SCOPE and ZOS_PERF_COUNT expand to nothing and Capture()
+ * returns zeros.
+ */
+namespace Perf {
+#ifdef ZOS_PERF
+    /** Whether the probes are compiled in. */
+    constexpr bool ENABLED = true;
+#else
+    /** Whether the probes are compiled in. */
+    constexpr bool ENABLED = false;
+#endif
+
+    /**
+     * @brief Instrumented operations.
+     */
+    enum class Probe : std::size_t {
+        /// FileIOHandler read (ReadBytes, mapped Data, submitted reads)
+        IO_READ,
+
+        /// FileIOHandler write (WriteBytes, submitted writes)
+        IO_WRITE,
+
+        /// FileIOHandler stream repositioning (no latency)
+        IO_SEEK,
+
+        /// FileIOHandler write barrier
+        IO_SYNC,
+
+        /// Filesystem::readINode
+        READ_INODE,
+
+        /// Filesystem::writeINode
+        WRITE_INODE,
+
+        /// Filesystem::AllocateBlock (single metadata block)
+        ALLOCATE_BLOCK,
+
+        /// Filesystem::AllocateBlockRuns (file data)
+        ALLOCATE_RUNS,
+
+        /// Filesystem::GetChildren
+        GET_CHILDREN,
+
+        /// Filesystem::ResolvePath
+        RESOLVE_PATH,
+
+        /// Number of probes
+        COUNT
+    };
+
+    /** Number of probes. */
+    constexpr std::size_t PROBE_COUNT = static_cast<std::size_t>(Probe::COUNT);
+
+    /** Number of latency buckets; bucket i holds calls of 2^i to 2^(i+1) ns. */
+    constexpr std::size_t LATENCY_BUCKETS = 40;
+
+    /** One in this many calls of an in-memory probe is timed. */
+    constexpr uint32_t SAMPLE_INTERVAL = 16;
+
+    /**
+     * @brief Printable name of a probe.
+     */
+    const char* ProbeName(Probe probe);
+
+    /**
+     * @brief Counters of one probe.
+     */
+    struct ProbeStats {
+        /** Number of calls. */
+        uint64_t calls = 0;
+
+        /** Bytes moved or allocated by the calls. */
+        uint64_t bytes = 0;
+
+        /** Number of timed calls. */
+        uint64_t timed = 0;
+
+        /** Total duration of the timed calls in nanoseconds. */
+        uint64_t nanoseconds = 0;
+
+        /** Latency histogram of the timed calls (see LATENCY_BUCKETS). */
+        std::array<uint64_t, LATENCY_BUCKETS> latency{};
+
+        /**
+         * @brief Mean latency of the timed calls in nanoseconds.
+         */
+        [[nodiscard]] double AverageNanoseconds() const;
+
+        /**
+         * @brief Estimated duration of all calls in nanoseconds.
+         */
+        [[nodiscard]] double TotalNanoseconds() const;
+
+        /**
+         * @brief Upper bound of the latency below which a share of the calls finished.
+         *
+         * @param share Share of the calls (0.5 for the median).
+         * @return Latency in nanoseconds (0 without timed calls).
+         */
+        [[nodiscard]] uint64_t Percentile(double share) const;
+
+        ProbeStats& operator+=(const ProbeStats& other);
+        ProbeStats& operator-=(const ProbeStats& other);
+    };
+
+    /**
+     * @brief Counters of all probes at one point in time.
+     */
+    struct Snapshot {
+        /** Counters indexed by Probe. */
+        std::array<ProbeStats, PROBE_COUNT> probes{};
+
+        /**
+         * @brief Counters of one probe.
+         */
+        [[nodiscard]] const ProbeStats& operator[](Probe probe) const;
+
+        Snapshot& operator+=(const Snapshot& other);
+        Snapshot& operator-=(const Snapshot& other);
+    };
+
+    /**
+     * @brief Counters of one shell command, summed over its runs.
+     */
+    struct CommandStats {
+        /** Number of runs. */
+        uint64_t runs = 0;
+
+        /** Total duration of all runs in nanoseconds. */
+        uint64_t nanoseconds = 0;
+
+        /** Probes fired during the runs. */
+        Snapshot probes;
+    };
+
+    /**
+     * @brief Record a timed call.
+     *
+     * @param probe Instrumented operation.
+     * @param nanoseconds Duration of the call.
+     * @param bytes Bytes moved by the call.
+     */
+    void Record(Probe probe, uint64_t nanoseconds, uint64_t bytes = 0);
+
+    /**
+     * @brief Record a call without a latency.
+     */
+    void Count(Probe probe, uint64_t bytes = 0);
+
+    /**
+     * @brief Decide whether the calling thread times this call of a probe.
+     */
+    [[nodiscard]] bool Sample(Probe probe);
+
+    /**
+     * @brief Read all counters.
+     */
+    [[nodiscard]] Snapshot Capture();
+
+    /**
+     * @brief Clear all counters.
+     */
+    void Reset();
+
+    /**
+     * @brief Times the enclosing block and records it on destruction.
+     */
+    class Scope {
+    public:
+        /**
+         * @param probe Instrumented operation.
+         * @param bytes Bytes moved by the operation.
+         */
+        explicit Scope(const Probe probe, const uint64_t bytes = 0)
+            : probe(probe),
+              bytes(bytes),
+              timed(Sample(probe)) {
+            if (this->timed) {
+                this->start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~Scope() {
+            if (!this->timed) {
+                Count(this->probe, this->bytes);
+                return;
+            }
+
+            const auto elapsed = std::chrono::steady_clock::now() - this->start;
+            Record(this->probe,
+                   static_cast<uint64_t>(
+                       std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()
+                   ),
+                   this->bytes);
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        /// Instrumented operation
+        Probe probe;
+
+        /// Bytes moved by the operation
+        uint64_t bytes;
+
+        /// Whether this call is timed
+        bool timed;
+
+        /// Time the operation started (if timed)
+        std::chrono::steady_clock::time_point start;
+    };
+}
+
+#ifdef ZOS_PERF
+/** Time the rest of the enclosing block: ZOS_PERF_SCOPE(Perf::Probe::X[, bytes]). */
+#define ZOS_PERF_SCOPE(...) const Perf::Scope perfScope(__VA_ARGS__)
+
+/** Count an untimed call: ZOS_PERF_COUNT(Perf::Probe::X[, bytes]). */
+#define ZOS_PERF_COUNT(...) Perf::Count(__VA_ARGS__)
+#else
+#define ZOS_PERF_SCOPE(...) static_cast<void>(0)
+#define ZOS_PERF_COUNT(...) static_cast<void>(0)
+#endif
@@ -8,6 +8,8 @@
 #include <istream>
 #include <ostream>
 
+#include "../helpers/DirtyPages.h"
+
 /**
  * @class Bitmap
  * @brief Bitmap structure for resource allocation.
@@ -23,6 +25,11 @@
  *
  * The bitmap is stored in a packed byte representation
  * and can be serialized to / deserialized from disk.
+ *
+ * Searches scan 64 bits at a time. The bitmap keeps a running count
+ * of free bits and a hint below which all bits are known to be
+ * allocated, so repeated allocations do not rescan the allocated
+ * prefix.
  */
 class Bitmap {
 public:
@@ -70,9 +77,20 @@ public:
      */
     [[nodiscard]] std::optional<uint32_t> FindFirstFree() const;
 
+    /**
+     * @brief Find the first run of consecutive free bits.
+     *
+     * @param count Length of the run.
+     * @return Index of the first bit of the run, or std::nullopt
+     *         if no such run exists.
+     */
+    [[nodiscard]] std::optional<uint32_t> FindFreeRun(uint32_t count) const;
+
     /**
      * @brief Count the number of free bits.
      *
+     * Served from a counter maintained by Set().
+     *
      * @return Number of free (unset) bits.
      */
     [[nodiscard]] uint32_t FreeCount() const;
@@ -97,6 +115,17 @@ public:
      */
     [[nodiscard]] std::vector<char> SaveToBytes() const;
 
+    /**
+     * @brief Take the pages modified since the last call.
+     *
+     * Returns every page holding a bit changed by Set(), consecutive
+     * pages as one write, and marks the bitmap clean.
+     *
+     * @param offset Byte offset of the bitmap on the image.
+     * @return One write per run of modified pages (empty if nothing changed).
+     */
+    [[nodiscard]] std::vector<ImageWrite> TakeDirty(uint64_t offset);
+
     // =====================================================
     // Internal state
     // =====================================================
@@ -109,7 +138,25 @@ public:
     /**
      * @brief Packed bit data.
      *
-     * Bits are packed LSB-first into bytes.
+     * Bits are packed LSB-first into bytes. Must only be modified
+     * through Set() to keep the free counter and hint valid.
      */
     std::vector<char> data;
+
+private:
+    /// Number of free bits
+    uint32_t freeBits;
+
+    /// All bits below this index are allocated
+    mutable uint32_t hint = 0;
+
+    /// Pages modified since the last TakeDirty()
+    DirtyPages dirty;
+
+    /**
+     * @brief Load 64 bits starting at bit wordIndex * 64.
+     *
+     * Bits past the end of the bitmap read as allocated.
+     */
+    [[nodiscard]] uint64_t Word(uint32_t wordIndex) const;
 };
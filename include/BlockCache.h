@@ -0,0 +1,317 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "../helpers/BlockRun.h"
+#include "../helpers/FileIOHandler.h"
+#include "../helpers/ImageWrite.h"
+
+/**
+ * @class BlockCache
+ * @brief Block-granular LRU write-back cache for the data region.
+ *
+ * Sits between Filesystem and FileIOHandler and keeps recently used
+ * data blocks (directory blocks, indirect tables, file data) in memory.
+ *
+ *  - reads are served from memory once a block is cached
+ *  - writes modify the cached copy and mark the block dirty
+ *  - dirty blocks are written back on eviction or on Flush()
+ *
+ * Flush() writes dirty blocks in ascending order and merges runs of
+ * adjacent blocks into a single write, so repeated small updates of one
+ * block are coalesced into one disk write. ReadThrough() likewise reads
+ * the uncached parts of a run of adjacent blocks with one request each.
+ * The requests of a flush, of a read or write over several runs and of
+ * a prefetch are submitted together as one batch, so an asynchronous
+ * handler keeps all of them in flight at once.
+ *
+ * When the image is memory-mapped the mapping already is the cache:
+ * reads return pointers into the mapping and writes go straight into it,
+ * so no block is ever copied or held dirty.
+ *
+ * With dirty blocks pinned (journaled images) modified blocks are never
+ * written on their own, not even on a mapped image: they leave the LRU
+ * list and stay in memory until they are collected by TakeDirty().
+ *
+ * All methods may be called concurrently, but a pointer returned by
+ * ReadBlock() is only valid until the next call, so concurrent readers
+ * use CopyBlock() instead.
+ */
+class BlockCache {
+public:
+    /** Default number of cached blocks. */
+    static constexpr std::size_t DEFAULT_CAPACITY = 1024;
+
+    /**
+     * @brief Construct a block cache over an open image.
+     *
+     * The cache is unusable until Configure() is called with the layout
+     * of the data region.
+     *
+     * @param io I/O handler of the filesystem image.
+     * @param capacity Maximum number of cached blocks (at least 1).
+     */
+    BlockCache(FileIOHandler& io, std::size_t capacity);
+
+    /**
+     * @brief Set the geometry of the data region.
+     *
+     * Drops all cached blocks without writing them back.
+     *
+     * @param dataOffset Byte offset of the first data block.
+     * @param blockSize Size of a single block in bytes.
+     */
+    void Configure(uint64_t dataOffset, uint32_t blockSize);
+
+    /**
+     * @brief Get the contents of a block.
+     *
+     * The returned pointer stays valid only until the next call
+     * that may load, evict or write a block.
+     *
+     * @param block Block identifier.
+     * @return Block contents (exactly blockSize bytes).
+     *
+     * @throws InvalidBlockSizeException If the block cannot be read.
+     */
+    [[nodiscard]] const char* ReadBlock(uint32_t block);
+
+    /**
+     * @brief Overwrite a whole block.
+     *
+     * The previous contents are not read from disk. Data shorter than
+     * the block size is padded with zeroes.
+     *
+     * @param block Block identifier.
+     * @param data New block contents.
+     */
+    void WriteBlock(uint32_t block, std::vector<char> data);
+
+    /**
+     * @brief Write bytes into a block.
+     *
+     * @param block Block identifier.
+     * @param offset Byte offset inside the block.
+     * @param data Data to write (must fit into the block).
+     */
+    void WriteBytes(uint32_t block, uint32_t offset, const std::vector<char>& data);
+
+    /**
+     * @brief Write a run of adjacent blocks directly to the image.
+     *
+     * Bypasses the cache with a single sequential write; cached copies
+     * of the affected blocks are dropped.
+     *
+     * @param firstBlock Identifier of the first block of the run.
+     * @param data Pointer to the data to write.
+     * @param size Number of bytes to write.
+     */
+    void WriteThrough(uint32_t firstBlock, const char* data, uint64_t size);
+
+    /**
+     * @brief Start writing runs of blocks directly to the image.
+     *
+     * Like WriteThrough(), with one request per run, all submitted as
+     * one batch. The data fills the runs in order.
+     *
+     * @param runs Runs of the written blocks.
+     * @param data Data to write; must stay valid until the future is ready.
+     * @param size Number of bytes to write (at most the size of the runs).
+     *
+     * @return Future that becomes ready when all runs are written.
+     */
+    [[nodiscard]] std::future<void> SubmitThrough(const std::vector<BlockRun>& runs,
+                                                  const char* data,
+                                                  uint64_t size);
+
+    /**
+     * @brief Read a byte range of a run of adjacent blocks into a buffer.
+     *
+     * Cached blocks are copied from memory; every stretch of uncached
+     * blocks is read with a single request straight into the buffer,
+     * without being cached. Safe to use while other threads access the
+     * cache.
+     *
+     * @param firstBlock Identifier of the first block of the run.
+     * @param offset Byte offset inside the first block.
+     * @param out Destination buffer.
+     * @param size Number of bytes to read.
+     *
+     * @throws InvalidBlockSizeException If the blocks cannot be read.
+     */
+    void ReadThrough(uint32_t firstBlock, uint32_t offset, char* out, uint64_t size);
+
+    /**
+     * @brief Read a byte range of several runs of blocks into a buffer.
+     *
+     * Like ReadThrough(), with the uncached stretches of all runs read
+     * as one batch. The range starts at offset inside the first run and
+     * continues through the runs in order.
+     *
+     * @param runs Runs holding the range.
+     * @param offset Byte offset inside the first block of the first run.
+     * @param out Destination buffer.
+     * @param size Number of bytes to read.
+     *
+     * @throws InvalidBlockSizeException If the blocks cannot be read.
+     */
+    void ReadThrough(const std::vector<BlockRun>& runs, uint32_t offset, char* out, uint64_t size);
+
+    /**
+     * @brief Load a run of adjacent blocks into the cache ahead of use.
+     *
+     * Uncached blocks of the run are read with a single request per
+     * stretch and cached clean. Does nothing on a mapped image.
+     *
+     * @param run Blocks to load.
+     *
+     * @throws InvalidBlockSizeException If the blocks cannot be read.
+     */
+    void Prefetch(const BlockRun& run);
+
+    /**
+     * @brief Load several runs of blocks into the cache with one batch.
+     *
+     * @param runs Blocks to load.
+     *
+     * @throws InvalidBlockSizeException If the blocks cannot be read.
+     */
+    void Prefetch(const std::vector<BlockRun>& runs);
+
+    /**
+     * @brief Drop a block from the cache without writing it back.
+     *
+     * @param block Block identifier.
+     */
+    void Discard(uint32_t block);
+
+    /**
+     * @brief Copy a block into a buffer.
+     *
+     * Safe to use while other threads access the cache. On a miss the
+     * block is read without holding the cache lock.
+     *
+     * @param block Block identifier.
+     * @param out Buffer of at least one block.
+     *
+     * @throws InvalidBlockSizeException If the block cannot be read.
+     */
+    void CopyBlock(uint32_t block, char* out);
+
+    /**
+     * @brief Keep dirty blocks in memory until TakeDirty().
+     *
+     * @param pinned True to never write dirty blocks on its own.
+     */
+    void SetPinned(bool pinned);
+
+    /**
+     * @brief Collect all dirty blocks and mark them clean.
+     *
+     * @return Writes of the data region, adjacent blocks merged.
+     */
+    [[nodiscard]] std::vector<ImageWrite> TakeDirty();
+
+    /**
+     * @brief Write all dirty blocks back to the image.
+     *
+     * Blocks stay cached and become clean.
+     */
+    void Flush();
+
+    /**
+     * @brief Drop all cached blocks without writing them back.
+     */
+    void Clear();
+
+    /**
+     * @brief Get the maximum number of cached blocks.
+     */
+    [[nodiscard]] std::size_t Capacity() const;
+
+private:
+    /**
+     * @brief Cached block state.
+     */
+    struct Entry {
+        /// Block contents
+        std::vector<char> data;
+
+        /// True if the cached copy differs from disk
+        bool dirty = false;
+
+        /// Position in the LRU list (pinned dirty blocks are not listed)
+        std::list<uint32_t>::iterator lru;
+
+        /// True if the block is in the LRU list
+        bool listed = true;
+    };
+
+    /// I/O handler of the filesystem image
+    FileIOHandler& io;
+
+    /// Maximum number of cached blocks
+    std::size_t capacity;
+
+    /// Byte offset of the first data block
+    uint64_t dataOffset = 0;
+
+    /// Size of a single block in bytes
+    uint32_t blockSize = 0;
+
+    /// Block identifiers ordered from most to least recently used
+    std::list<uint32_t> lru;
+
+    /// Cached blocks by identifier
+    std::unordered_map<uint32_t, Entry> entries;
+
+    /// True if dirty blocks are only written through TakeDirty()
+    bool pinned = false;
+
+    /// Guards all members above
+    mutable std::mutex mutex;
+
+    /**
+     * @brief Get a cache entry, creating it if necessary.
+     *
+     * @param block Block identifier.
+     * @param fetch Read the block from disk when it is not cached.
+     */
+    Entry& Lookup(uint32_t block, bool fetch);
+
+    /**
+     * @brief Find the stretches of a run that are not cached (the mutex must be held).
+     */
+    [[nodiscard]] std::vector<BlockRun> Uncached(const BlockRun& run) const;
+
+    /**
+     * @brief Collect dirty blocks (the mutex must be held).
+     */
+    [[nodiscard]] std::vector<ImageWrite> CollectDirty();
+
+    /**
+     * @brief Mark an entry dirty, unlisting it when pinned.
+     */
+    void MarkDirty(Entry& entry);
+
+    /**
+     * @brief Evict least recently used blocks above capacity.
+     *
+     * The most recently used block is never evicted.
+     */
+    void Evict();
+
+    /**
+     * @brief Byte offset of a block in the image.
+     */
+    [[nodiscard]] uint64_t OffsetOf(uint32_t block) const;
+};
@@ -0,0 +1,151 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @class ChunkMap
+ * @brief Chunk table of a compressed file.
+ *
+ * A compressed file is cut into chunks of CHUNK_BLOCKS blocks of
+ * contents (the last one may be shorter). Every chunk is stored in
+ * whole blocks: LZ4-compressed behind a 4-byte length if that saves at
+ * least one block, as is otherwise. The block map of the file lists
+ * the stored blocks of all chunks in order, followed by the table
+ * blocks holding this map.
+ *
+ * The table stores, for every chunk, the number of blocks it is stored
+ * in as one byte; a chunk stored in as many blocks as it has contents
+ * is not compressed. The table blocks of a file with n chunks are the
+ * last TableBlocks(n) blocks of its block map.
+ */
+class ChunkMap {
+public:
+    /** Number of blocks of contents in a chunk. */
+    static constexpr uint32_t CHUNK_BLOCKS = 16;
+
+    /** Size of the compressed length stored in front of a compressed chunk. */
+    static constexpr uint32_t HEADER_BYTES = 4;
+
+    /**
+     * @brief Construct a map of no chunks.
+     *
+     * @param blockSize Block size of the image.
+     */
+    explicit ChunkMap(uint32_t blockSize);
+
+    /**
+     * @brief Number of bytes of contents of a whole chunk.
+     */
+    [[nodiscard]] uint64_t ChunkBytes() const;
+
+    /**
+     * @brief Number of chunks of a file of a size.
+     */
+    [[nodiscard]] uint32_t ChunksFor(uint64_t fileSize) const;
+
+    /**
+     * @brief Number of table blocks of a map of a number of chunks.
+     */
+    [[nodiscard]] uint32_t TableBlocks(uint32_t chunks) const;
+
+    /**
+     * @brief Number of chunks.
+     */
+    [[nodiscard]] uint32_t Count() const;
+
+    /**
+     * @brief Number of blocks a chunk is stored in.
+     */
+    [[nodiscard]] uint32_t StoredBlocks(uint32_t chunk) const;
+
+    /**
+     * @brief Position of the first stored block of a chunk in the block map.
+     *
+     * @param chunk Chunk index; Count() gives the number of data blocks.
+     */
+    [[nodiscard]] uint32_t FirstBlock(uint32_t chunk) const;
+
+    /**
+     * @brief Check whether any chunk is compressed.
+     *
+     * @param fileSize Size of the file the map describes.
+     */
+    [[nodiscard]] bool Compressed(uint64_t fileSize) const;
+
+    /**
+     * @brief Append a chunk.
+     *
+     * @param storedBlocks Number of blocks the chunk is stored in.
+     */
+    void Push(uint32_t storedBlocks);
+
+    /**
+     * @brief Append the chunks of another map.
+     */
+    void Append(const ChunkMap& other);
+
+    /**
+     * @brief Drop the chunks from an index on.
+     */
+    void Truncate(uint32_t chunks);
+
+    // =====================================================
+    // Chunk contents
+    // =====================================================
+
+    /**
+     * @brief Store a chunk in whole blocks.
+     *
+     * @param data Contents of the chunk.
+     * @param size Number of bytes (at most ChunkBytes()).
+     * @return Stored blocks, compressed if that saves a block.
+     */
+    [[nodiscard]] std::vector<char> Pack(const char* data, std::size_t size) const;
+
+    /**
+     * @brief Restore the contents of a stored chunk.
+     *
+     * @param stored Stored blocks of the chunk.
+     * @param storedBlocks Number of stored blocks.
+     * @param out Destination buffer.
+     * @param size Number of bytes of contents of the chunk.
+     *
+     * @throws FileReadException If the stored chunk is damaged.
+     */
+    void Unpack(const char* stored, uint32_t storedBlocks, char* out, std::size_t size) const;
+
+    // =====================================================
+    // Persistence
+    // =====================================================
+
+    /**
+     * @brief Load a map from its table blocks.
+     *
+     * @param data Contents of the table blocks.
+     * @param fileSize Size of the file the map describes.
+     * @param blockSize Block size of the image.
+     *
+     * @throws FileReadException If an entry is out of range.
+     */
+    static ChunkMap LoadFromBytes(const std::vector<char>& data, uint64_t fileSize, uint32_t blockSize);
+
+    /**
+     * @brief Serialize the map to whole table blocks (zero-padded).
+     */
+    [[nodiscard]] std::vector<char> SaveToBytes() const;
+
+private:
+    /// Block size of the image
+    uint32_t blockSize;
+
+    /// Number of stored blocks of every chunk
+    std::vector<uint8_t> stored;
+
+    /// Position of the first stored block of every chunk, and of the end
+    std::vector<uint32_t> first;
+};
@@ -0,0 +1,82 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <cstddef>
+#include <istream>
+#include <ostream>
+#include <string>
+
+/**
+ * @class Client
+ * @brief Command-line client of a filesystem Server.
+ *
+ * Reads commands like the Shell does, but sends them to a running server
+ * instead of mounting the image itself. Commands are pipelined: up to
+ * PIPELINE_DEPTH lines are sent with one write before the responses are
+ * read, so a script costs one round-trip per batch instead of one per
+ * command. Interactive input is sent line by line with a prompt.
+ */
+class Client {
+public:
+    /** Maximum number of commands sent before their responses are read. */
+    static constexpr std::size_t PIPELINE_DEPTH = 64;
+
+    /**
+     * @brief Connect to a server.
+     *
+     * @param socketPath Path of the server's Unix socket.
+     *
+     * @throws CouldNotOpenFileException If no server listens on the socket.
+     */
+    explicit Client(const std::string& socketPath);
+
+    /**
+     * @brief Closes the connection.
+     */
+    ~Client();
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    /**
+     * @brief Send commands until "exit" or end of input and print their results.
+     *
+     * @param in Commands, one per line.
+     * @param out Destination of the results.
+     * @param interactive Print a prompt and send every line on its own.
+     *
+     * @throws FileReadException If the server closes the connection early.
+     * @throws FileWriteException If the commands cannot be sent.
+     */
+    void Run(std::istream& in, std::ostream& out, bool interactive);
+
+private:
+    /// Socket connected to the server
+    int fd = -1;
+
+    /// Received bytes not yet consumed
+    std::string input;
+
+    /// Read position in input
+    std::size_t consumed = 0;
+
+    /**
+     * @brief Send a batch of commands with as few writes as possible.
+     */
+    void SendAll(const std::string& data);
+
+    /**
+     * @brief Receive the next response.
+     *
+     * @param cwd Set to the working directory after the command.
+     * @return Result of the command.
+     */
+    std::string ReadResponse(std::string& cwd);
+
+    /**
+     * @brief Make sure at least count unconsumed bytes have been received.
+     */
+    void Fill(std::size_t count);
+};
@@ -0,0 +1,137 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "../helpers/DirtyPages.h"
+
+/**
+ * @class DedupIndex
+ * @brief Content hash → block index of deduplicated data blocks.
+ *
+ * Images formatted with deduplication store, for every data block, a
+ * 64-bit hash of its contents (0 if the block is not indexed). On mount
+ * the table is loaded and inverted into a hash → block map, so a newly
+ * written block can be matched against the stored ones; the match is
+ * then shared through the RefCountTable.
+ *
+ * A hash only names a candidate: callers compare the contents before
+ * sharing it. An entry is forgotten whenever its block is freed or
+ * written in place, so an indexed block always is a file data block.
+ *
+ * Every entry is a little-endian 64-bit hash. An empty table (images
+ * formatted without deduplication) indexes nothing.
+ */
+class DedupIndex {
+public:
+    /** Size of one serialized hash in bytes. */
+    static constexpr uint32_t ENTRY_BYTES = 8;
+
+    /** Hash of a block that is not indexed. */
+    static constexpr uint64_t NO_HASH = 0;
+
+    /**
+     * @brief Construct a table with no block indexed.
+     *
+     * @param blockCount Number of tracked blocks (0 for no table).
+     */
+    explicit DedupIndex(uint32_t blockCount);
+
+    /**
+     * @brief Check whether the image has a deduplication index.
+     */
+    [[nodiscard]] bool Enabled() const;
+
+    /**
+     * @brief Hash the contents of a block.
+     *
+     * @return Hash of the data, never NO_HASH.
+     */
+    [[nodiscard]] static uint64_t Hash(const char* data, std::size_t size);
+
+    /**
+     * @brief Find a block indexed with a hash.
+     */
+    [[nodiscard]] std::optional<uint32_t> Find(uint64_t hash) const;
+
+    /**
+     * @brief Get the hash of a block (NO_HASH if it is not indexed).
+     */
+    [[nodiscard]] uint64_t Get(uint32_t block) const;
+
+    /**
+     * @brief Index a block under the hash of its contents.
+     *
+     * The block replaces any other block indexed with the same hash.
+     */
+    void Insert(uint32_t block, uint64_t hash);
+
+    /**
+     * @brief Drop the entry of a block (nothing happens if it has none).
+     */
+    void Forget(uint32_t block);
+
+    /**
+     * @brief Number of indexed blocks.
+     */
+    [[nodiscard]] uint32_t IndexedCount() const;
+
+    // =====================================================
+    // Persistence
+    // =====================================================
+
+    /**
+     * @brief Serialized size of a table in bytes.
+     *
+     * @param blockCount Number of tracked blocks.
+     */
+    [[nodiscard]] static uint64_t ByteSize(uint32_t blockCount);
+
+    /**
+     * @brief Load a table from raw byte data.
+     *
+     * @param data Raw table bytes read from disk.
+     * @param blockCount Number of tracked blocks.
+     */
+    static DedupIndex LoadFromBytes(std::vector<char> data, uint32_t blockCount);
+
+    /**
+     * @brief Serialize the table to raw byte data.
+     */
+    [[nodiscard]] std::vector<char> SaveToBytes() const;
+
+    /**
+     * @brief Take the pages modified since the last call.
+     *
+     * @param offset Byte offset of the table on the image.
+     * @return One write per run of modified pages (empty if nothing changed).
+     */
+    [[nodiscard]] std::vector<ImageWrite> TakeDirty(uint64_t offset);
+
+private:
+    /// Number of tracked blocks
+    uint32_t size;
+
+    /// Serialized hashes
+    std::vector<char> data;
+
+    /// Hash → block of the indexed blocks
+    std::unordered_map<uint64_t, uint32_t> blocks;
+
+    /// Number of indexed blocks
+    uint32_t indexed = 0;
+
+    /// Pages modified since the last TakeDirty()
+    DirtyPages dirty;
+
+    /**
+     * @brief Store a hash and mark its page modified.
+     */
+    void Put(uint32_t block, uint64_t hash);
+};
@@ -0,0 +1,170 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../helpers/ChildNodeNameIdPair.h"
+
+/**
+ * @class DirectoryIndex
+ * @brief In-memory dentry cache of directory contents.
+ *
+ * Maps (directory, name) → inode and, in reverse, inode → (directory,
+ * name) for every entry except "." and "..".
+ *
+ * The index of a directory is built lazily from its on-disk entries
+ * the first time a name is looked up in it, and is then kept up to date
+ * by the filesystem on every entry insertion and removal. Lookups in an
+ * indexed directory take constant time and do not touch the disk.
+ *
+ * The reverse mapping is exact for directories, which have a single
+ * parent entry; for hard-linked files it records one of the names.
+ *
+ * The total number of indexed entries is bounded; when building a new
+ * directory index would exceed the capacity, all other indexes are
+ * dropped and rebuilt on demand.
+ *
+ * All methods may be called concurrently.
+ */
+class DirectoryIndex {
+public:
+    /**
+     * @brief Entry naming an inode inside its parent directory.
+     */
+    struct ParentEntry {
+        /** Parent directory inode identifier. */
+        uint32_t parent;
+
+        /** Name of the inode inside the parent. */
+        std::string name;
+    };
+
+    /** Default maximum number of indexed entries. */
+    static constexpr std::size_t DEFAULT_CAPACITY = 65536;
+
+    /**
+     * @brief Construct an empty index.
+     *
+     * @param capacity Maximum number of indexed entries.
+     */
+    explicit DirectoryIndex(std::size_t capacity);
+
+    /**
+     * @brief Maximum number of indexed entries.
+     */
+    [[nodiscard]] std::size_t Capacity() const;
+
+    /**
+     * @brief Check whether a directory is indexed.
+     *
+     * @param dir Directory inode identifier.
+     */
+    [[nodiscard]] bool Contains(uint32_t dir) const;
+
+    /**
+     * @brief Build the index of a directory.
+     *
+     * If a name occurs more than once, the first entry wins.
+     *
+     * @param dir Directory inode identifier.
+     * @param children All entries of the directory.
+     */
+    void Build(uint32_t dir, const std::vector<ChildNodeNameIdPair>& children);
+
+    /**
+     * @brief Look up a name in an indexed directory.
+     *
+     * @param dir Directory inode identifier.
+     * @param name Entry name.
+     * @return Inode identifier of the entry, or std::nullopt if absent.
+     */
+    [[nodiscard]]
+    std::optional<uint32_t> Find(uint32_t dir, const std::string& name) const;
+
+    /**
+     * @brief Look up a name, telling apart absent names and unindexed directories.
+     *
+     * @param dir Directory inode identifier.
+     * @param name Entry name.
+     * @param child Set to the inode identifier of the entry, or std::nullopt.
+     * @return False if the directory is not indexed (child is then untouched).
+     */
+    bool TryFind(uint32_t dir, const std::string& name, std::optional<uint32_t>& child) const;
+
+    /**
+     * @brief Find the entry naming an inode in an indexed directory.
+     *
+     * @param child Inode identifier.
+     * @return Parent and name, or std::nullopt if no indexed directory
+     *         contains the inode.
+     */
+    [[nodiscard]] std::optional<ParentEntry> FindParent(uint32_t child) const;
+
+    /**
+     * @brief Record a new entry (ignored if the directory is not indexed).
+     *
+     * @param dir Directory inode identifier.
+     * @param name Entry name.
+     * @param child Inode identifier of the entry.
+     */
+    void Insert(uint32_t dir, const std::string& name, uint32_t child);
+
+    /**
+     * @brief Forget an entry (ignored if the directory is not indexed).
+     *
+     * @param dir Directory inode identifier.
+     * @param name Entry name.
+     */
+    void Remove(uint32_t dir, const std::string& name);
+
+    /**
+     * @brief Drop the index of a directory.
+     *
+     * @param dir Directory inode identifier.
+     */
+    void Drop(uint32_t dir);
+
+    /**
+     * @brief Drop all indexes.
+     */
+    void Clear();
+
+private:
+    /// Maximum number of indexed entries
+    std::size_t capacity;
+
+    /// Number of currently indexed entries
+    std::size_t entryCount = 0;
+
+    /// Name → inode maps by directory inode identifier
+    std::unordered_map<uint32_t, std::unordered_map<std::string, uint32_t>> directories;
+
+    /// Inode → (parent, name) for entries of indexed directories
+    std::unordered_map<uint32_t, ParentEntry> parents;
+
+    /// Guards all members above
+    mutable std::mutex mutex;
+
+    /**
+     * @brief Check whether a name refers to the directory itself or its parent.
+     */
+    [[nodiscard]] static bool IsDotEntry(const std::string& name);
+
+    /**
+     * @brief Drop the index of a directory (the mutex must be held).
+     */
+    void Forget(uint32_t dir);
+
+    /**
+     * @brief Forget the reverse mapping of an entry if it is current.
+     */
+    void ForgetParent(uint32_t child, uint32_t dir, const std::string& name);
+};
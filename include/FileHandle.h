@@ -0,0 +1,118 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+class Filesystem;
+
+/**
+ * @class FileHandle
+ * @brief Handle for chunked, random-access I/O on a regular file.
+ *
+ * Obtained from Filesystem::Open() or Filesystem::Create(). Every call
+ * transfers only the requested byte range, so files of any size can be
+ * processed with bounded memory.
+ *
+ * A handle refers to the file inode and stays valid until the file is
+ * removed or the filesystem is reformatted or destroyed.
+ *
+ * On a thread-safe filesystem handles may be used from any thread;
+ * reads of a file run concurrently, writes to it exclusively.
+ *
+ * A handle notices sequential reads and then loads the next
+ * FilesystemOptions::readAheadBytes of the file into the block cache
+ * with one request, whenever a read passes the data loaded so far.
+ */
+class FileHandle {
+public:
+    /**
+     * @brief Get the current file size.
+     *
+     * @return File size in bytes.
+     */
+    [[nodiscard]] uint64_t Size() const;
+
+    /**
+     * @brief Read a byte range of the file.
+     *
+     * A read that starts where the previous one ended reads ahead.
+     *
+     * @param offset Byte offset within the file.
+     * @param buffer Destination buffer.
+     * @param size Maximum number of bytes to read.
+     * @return Number of bytes read (0 at or past the end of file).
+     */
+    std::size_t Read(uint64_t offset, char* buffer, std::size_t size) const;
+
+    /**
+     * @brief Write a byte range of the file.
+     *
+     * Overwrites existing data and grows the file as needed; a gap
+     * between the end of file and the offset reads back as zeros.
+     *
+     * @param offset Byte offset within the file.
+     * @param data Data to write.
+     * @param size Number of bytes to write.
+     *
+     * @throws CouldNotAllocateBlockException If not enough blocks are free.
+     * @throws FileTooLargeException If the file would exceed the block map.
+     */
+    void Write(uint64_t offset, const char* data, std::size_t size);
+
+    /**
+     * @brief Append data to the end of the file.
+     *
+     * @param data Data to write.
+     * @param size Number of bytes to write.
+     */
+    void Append(const char* data, std::size_t size);
+
+    /**
+     * @brief Change the size of the file.
+     *
+     * Shrinking releases only the blocks past the new end; growing
+     * appends zeros.
+     *
+     * @param size New file size in bytes.
+     */
+    void Truncate(uint64_t size);
+
+private:
+    friend class Filesystem;
+
+    /**
+     * @brief Construct a handle for an inode.
+     */
+    FileHandle(Filesystem& filesystem, uint32_t inodeId);
+
+    /// Filesystem owning the file
+    Filesystem* filesystem;
+
+    /// Inode identifier of the file
+    uint32_t inodeId;
+
+    /**
+     * @brief Sequential read state.
+     *
+     * Relaxed atomics: readers sharing a handle only disturb each
+     * other's read-ahead.
+     */
+    struct ReadAhead {
+        /// Offset just past the previous read
+        std::atomic<uint64_t> next{0};
+
+        /// Offset just past the data read ahead so far
+        std::atomic<uint64_t> end{0};
+
+        ReadAhead() = default;
+        ReadAhead(const ReadAhead& other);
+        ReadAhead& operator=(const ReadAhead& other);
+    };
+
+    /// Read-ahead state of the handle
+    mutable ReadAhead readAhead;
+};
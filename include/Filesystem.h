@@ -4,12 +4,33 @@
 
 #pragma once
 #include <cstdint>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "Bitmap.h"
+#include "BlockCache.h"
+#include "ChunkMap.h"
+#include "DedupIndex.h"
+#include "DirectoryIndex.h"
+#include "FileHandle.h"
+#include "FilesystemChecker.h"
+#include "FilesystemOptions.h"
+#include "FormatOptions.h"
 #include "INode.h"
+#include "INodeCache.h"
+#include "Journal.h"
+#include "LockTable.h"
+#include "RefCountTable.h"
 #include "Superblock.h"
+#include "../helpers/BlockRun.h"
 #include "../helpers/ChildNodeNameIdPair.h"
 #include "../helpers/FileIOHandler.h"
 
@@ -21,13 +42,47 @@
  *  - directories
  *  - regular files
  *  - hard links
+ *  - block-sharing file copies
  *
  * The filesystem uses:
  *  - a superblock for metadata
  *  - an inode table
  *  - bitmaps for inode and block allocation
+ *  - a write-ahead journal for metadata updates
  *
- * All metadata is flushed back to disk on destruction.
+ * Data blocks and inodes are accessed through write-back caches.
+ * Cached blocks, inodes and bitmap changes are committed on Sync();
+ * after a crash the last complete commit is replayed on mount. Full
+ * data blocks of files are written directly, before the metadata that
+ * references them is committed.
+ *
+ * CopyFile() shares the data blocks of the source with the copy and
+ * records the extra owners in a per-block reference count table; a
+ * shared block is copied when one of its owners writes to it, and
+ * freed when its last owner releases it.
+ *
+ * Images formatted with deduplication also index the contents of the
+ * whole blocks written to files by hash. A newly written block whose
+ * contents match an indexed one shares it like a file copy would, so
+ * only its reference count is written.
+ *
+ * Images formatted with compression store files in LZ4-compressed
+ * chunks (see ChunkMap) when that saves blocks. Appending to such a
+ * file packs its last chunk again; any other write unpacks the whole
+ * file to plain blocks first.
+ *
+ * Freed blocks are released in the block bitmap only. Every structure
+ * whose format relies on its initial contents (directory blocks and
+ * pointer tables, which are terminated by 0xFF entries) is initialized
+ * when it is allocated.
+ *
+ * In thread-safe mode any number of threads may use the filesystem at
+ * once. Reads (ReadFile, GetSubdirectories, file handle reads, ...)
+ * run concurrently; writes through file handles run concurrently with
+ * reads and with writes to other files, serialized per inode by
+ * reader/writer locks; operations that change the directory tree,
+ * Format() and Sync() run alone. Each thread has its own working
+ * directory, starting at the root.
  */
 class Filesystem {
 public:
@@ -38,8 +93,10 @@ public:
      * is mounted. Otherwise it remains unformatted.
      *
      * @param imagePath Path to the filesystem image file.
+     * @param options Runtime options (cache sizes, I/O backend).
      */
-    explicit Filesystem(const std::string& imagePath);
+    explicit Filesystem(const std::string& imagePath,
+                        const FilesystemOptions& options = {});
 
     /**
      * @brief Flush metadata and close the filesystem image.
@@ -52,9 +109,29 @@ public:
      * Initializes a new filesystem layout and overwrites
      * any existing data in the image.
      *
+     * A fast format leaves the image sparse and writes only the
+     * metadata (superblock, bitmaps, root inode and root directory
+     * block), so it takes time proportional to the metadata size.
+     * A full format writes zeros over the whole image first, which
+     * reserves all disk space up front.
+     *
+     * The image is laid out with the block size and inode ratio of the
+     * options; the number of blocks is limited to 2^32 - 1, so images
+     * beyond 4 TiB need blocks larger than 1 KiB.
+     *
+     * With deduplication, 8 bytes per block are reserved for the index
+     * of block contents.
+     *
      * @param bytes Desired filesystem image size in bytes.
+     * @param options Block size, inode ratio, fast format,
+     *        deduplication and compression flags.
+     *
+     * @throws InvalidBlockSizeException If the block size is not a power
+     *         of two between 1 KiB and 64 KiB.
+     * @throws InvalidFilesystemSizeException If the image is too small,
+     *         has too many blocks, or the inode ratio is zero.
      */
-    void Format(uint32_t bytes);
+    void Format(uint64_t bytes, const FormatOptions& options = {});
 
     /**
      * @brief Check whether the filesystem is formatted.
@@ -63,6 +140,45 @@ public:
      */
     [[nodiscard]] bool Formated() const;
 
+    /**
+     * @brief Write all cached modifications back to the image.
+     *
+     * Dirty inodes, blocks and bitmap ranges are collected with adjacent
+     * records merged, and committed through the journal as one atomic
+     * record. Images without a journal (layout version 1) are updated
+     * in place.
+     *
+     * Does nothing while a batch is open.
+     */
+    void Sync();
+
+    /**
+     * @brief Open a batch of operations.
+     *
+     * Until the matching Commit(), Sync() is suppressed: resolved
+     * directories, dirty inodes, bitmap changes and directory blocks
+     * stay in memory and are written out once. Batches nest; only the
+     * outermost Commit() writes. Blocks freed inside the batch are
+     * reused only after it is committed.
+     */
+    void BeginBatch();
+
+    /**
+     * @brief Close a batch opened by BeginBatch() and write it out.
+     *
+     * The batch is committed through the journal as one transaction, so
+     * after a crash the image holds either all of it or none of it. Only
+     * when the image has too little free space for the part that does
+     * not fit the journal is it split into several transactions, each
+     * atomic on its own.
+     */
+    void Commit();
+
+    /**
+     * @brief Check whether a batch is open.
+     */
+    [[nodiscard]] bool InBatch() const;
+
     // =========================
     // Directory operations
     // =========================
@@ -89,7 +205,10 @@ public:
      * @brief Write data to a file.
      *
      * Creates the file if it does not exist or overwrites
-     * existing contents if it does.
+     * existing contents if it does. On images with deduplication, whole
+     * blocks matching stored ones share them instead of being written.
+     * On images with compression, the file is stored in compressed
+     * chunks if that takes fewer blocks.
      *
      * @param srcPath Path of the file.
      * @param data File contents.
@@ -104,18 +223,63 @@ public:
      */
     [[nodiscard]] std::vector<char> ReadFile(const std::string& srcPath);
 
+    /**
+     * @brief Append data to a file, creating it if it does not exist.
+     *
+     * Only the last partial block and the newly needed blocks are
+     * written; the existing contents stay in place.
+     *
+     * @param path Path of the file.
+     * @param data Data to append.
+     */
+    void AppendFile(const std::string& path, const std::vector<char>& data);
+
+    /**
+     * @brief Overwrite a byte range of an existing file.
+     *
+     * Only the blocks covering the range are written; the file grows as
+     * needed and a gap past the end of file reads back as zeros.
+     *
+     * @param path Path of the file.
+     * @param offset Byte offset within the file.
+     * @param data Data to write.
+     */
+    void WriteAt(const std::string& path, uint64_t offset, const std::vector<char>& data);
+
+    /**
+     * @brief Change the size of an existing file.
+     *
+     * Shrinking releases only the blocks past the new end; growing
+     * appends zeros.
+     *
+     * @param path Path of the file.
+     * @param size New file size in bytes.
+     */
+    void TruncateFile(const std::string& path, uint64_t size);
+
     /**
      * @brief Copy a file.
      *
+     * The copy shares the data blocks of the source, so only the inode
+     * and the pointer tables are written. Images without a reference
+     * count table (layout versions 1 and 2) copy the data.
+     *
      * @param srcPath Source file path.
      * @param dstPath Destination file path.
      */
     void CopyFile(const std::string& srcPath, const std::string& dstPath);
 
     /**
-     * @brief Move a file.
+     * @brief Move or rename a file or a directory.
      *
-     * Equivalent to copy followed by remove.
+     * Only directory entries change: the entry is added to the
+     * destination parent and removed from the source parent, and ".."
+     * of a moved directory is pointed at its new parent. Data blocks are
+     * never touched.
+     *
+     * If the destination is a directory, the source is moved into it
+     * under its own name. An existing file at the destination is
+     * replaced; an existing directory is not.
      *
      * @param srcPath Source file path.
      * @param dstPath Destination file path.
@@ -138,6 +302,40 @@ public:
     void LinkFile(const std::string& originalPath,
                   const std::string& linkPath);
 
+    // =========================
+    // Streaming file access
+    // =========================
+
+    /**
+     * @brief Open an existing file for chunked I/O.
+     *
+     * @param path Path of the file.
+     * @return Handle of the file.
+     */
+    [[nodiscard]] FileHandle Open(const std::string& path);
+
+    /**
+     * @brief Create a file, or truncate it if it exists, for chunked I/O.
+     *
+     * @param path Path of the file.
+     * @return Handle of the empty file.
+     */
+    [[nodiscard]] FileHandle Create(const std::string& path);
+
+    /**
+     * @brief Check that a file of the given size fits at a path.
+     *
+     * Counts the free blocks and the blocks the file at path (if any)
+     * would release, so a file written chunk by chunk can fail before it
+     * is created. Images with compression are not checked, as the stored
+     * size is known only once the data is packed.
+     *
+     * @param path Path of the file.
+     * @param size File size in bytes.
+     * @throws CouldNotAllocateBlockException If the file does not fit.
+     */
+    void EnsureRoom(const std::string& path, uint64_t size) const;
+
     // =========================
     // Navigation & queries
     // =========================
@@ -162,6 +360,8 @@ public:
     /**
      * @brief Get the current working directory path.
      *
+     * The path is cached and maintained by ChangeActiveDirectory().
+     *
      * @return Vector of path components from root.
      */
     [[nodiscard]] std::vector<std::string> GetCurrentPath() const;
@@ -181,10 +381,83 @@ public:
      */
     [[nodiscard]] std::string GetFilesystemStats() const;
 
+    /**
+     * @brief Check the consistency of the image.
+     *
+     * Walks the directory tree in parallel (see FilesystemChecker) and
+     * compares the result with the inode and block bitmaps, the
+     * reference counts, the link counts and the "." and ".." entries;
+     * free blocks are dropped from the deduplication index. With repair,
+     * everything is written back first, broken entries are fixed and
+     * the allocation metadata is then rebuilt from the tree: unreachable
+     * inodes and blocks are released. A plain check writes nothing and
+     * walks the committed image, so changes made since the last Sync()
+     * show up as differences.
+     *
+     * Runs on mount by itself when an image of layout version 4 or later
+     * was not unmounted properly; see MountReport().
+     *
+     * @param repair Fix every difference found.
+     * @return Human-readable report.
+     *
+     * @throws ReadOnlyFilesystemException If repairing a read-only image.
+     */
+    std::string Check(bool repair);
+
+    /**
+     * @brief Check whether the image is mounted read-only.
+     *
+     * An image that was not unmounted properly is mounted read-only when
+     * the check on mount fails or finds errors it cannot repair. Every
+     * modification then throws ReadOnlyFilesystemException; Format()
+     * makes the image writable again.
+     */
+    [[nodiscard]] bool ReadOnly() const;
+
+    /**
+     * @brief Report of the check run on mount (empty if none ran).
+     *
+     * Holds the error message if the check itself failed.
+     */
+    [[nodiscard]] const std::string& MountReport() const;
+
+    /**
+     * @brief Get the number of image I/O calls issued so far.
+     *
+     * All zero unless built with ZOS_PERF.
+     */
+    [[nodiscard]] FileIOHandler::Statistics GetIOStatistics() const;
+
+    /**
+     * @brief Clear the image I/O call counters.
+     */
+    void ResetIOStatistics() const;
+
 private:
+    friend class FileHandle;
+
     /// File I/O handler for the filesystem image
     std::unique_ptr<FileIOHandler> FileIO;
 
+    /// Write-back cache of data blocks
+    std::unique_ptr<BlockCache> Cache;
+
+    /// Write-back cache of decoded inodes
+    std::unique_ptr<INodeCache> INodes;
+
+    /// Name → inode index of directory contents
+    std::unique_ptr<DirectoryIndex> Index;
+
+    /// Write-ahead log of metadata updates
+    std::unique_ptr<Journal> Log;
+
+    /// Runtime options the filesystem was opened with
+    FilesystemOptions options;
+
+    /// Blocks freed since the last write-back; allocated until it commits
+    /// or the allocator reclaims them
+    std::vector<uint32_t> releasedBlocks;
+
     /// Filesystem superblock
     Superblock superblock{};
 
@@ -194,8 +467,52 @@ private:
     /// Bitmap tracking data block allocation
     Bitmap BlockBitmap;
 
-    /// Current working directory inode
-    INode currentNode;
+    /// Extra owners of shared data blocks
+    RefCountTable References;
+
+    /// Content hashes of deduplicated data blocks
+    DedupIndex Dedup;
+
+    /**
+     * @brief Working directory of a session (a thread in thread-safe mode).
+     */
+    struct WorkingDirectory {
+        /// Inode identifier of the directory
+        uint32_t node = 0;
+
+        /// Cached path of the directory (empty if unknown)
+        std::optional<std::vector<std::string>> path;
+    };
+
+    /// Working directory when not in thread-safe mode
+    mutable WorkingDirectory workingDirectory;
+
+    /**
+     * @brief Working directories by thread in thread-safe mode.
+     *
+     * Shared with the threads that own a session, which erase it when
+     * they end, so a later thread with a reused id starts in the root.
+     */
+    struct SessionTable {
+        /// Guards the map
+        std::mutex lock;
+
+        /// Working directory of every thread that used the filesystem
+        std::unordered_map<std::thread::id, WorkingDirectory> byThread;
+    };
+
+    /// Sessions of the threads in thread-safe mode
+    std::shared_ptr<SessionTable> sessions = std::make_shared<SessionTable>();
+
+    /// Held shared by every operation, exclusively by tree changes and Sync()
+    mutable std::shared_mutex operationLock;
+
+    /// Per-inode reader/writer locks of file contents
+    LockTable INodeLocks;
+
+    /// Guards the bitmaps, the reference counts, the deduplication index
+    /// and the released block list
+    mutable std::mutex allocatorLock;
 
     /// Path to filesystem image
     std::string imagePath;
@@ -206,17 +523,151 @@ private:
     /// Indicates whether the filesystem is formatted
     bool formated = false;
 
+    /// Set when the check on mount left the image damaged
+    bool readOnly = false;
+
+    /// Report of the check run on mount
+    std::string mountReport;
+
+    /// Number of open batches (Sync() is suppressed while non-zero)
+    uint32_t batchDepth = 0;
+
     // =========================
     // Internal helpers
     // =========================
 
     /**
-     * @brief Read an inode from disk.
+     * @brief Hold of the operation lock for the duration of a call.
+     *
+     * Nested calls (CopyFile → ReadFile, ...) run under the hold of the
+     * outermost call, which must be exclusive if any nested one is.
+     */
+    class OperationGuard {
+    public:
+        /**
+         * @param mutex Operation lock, or nullptr for no locking.
+         * @param exclusive True to lock exclusively.
+         */
+        OperationGuard(std::shared_mutex* mutex, bool exclusive);
+        ~OperationGuard();
+
+        OperationGuard(const OperationGuard&) = delete;
+        OperationGuard& operator=(const OperationGuard&) = delete;
+
+    private:
+        /// Lock taken by this hold (nullptr if none)
+        std::shared_mutex* mutex;
+
+        /// True if the lock is held exclusively
+        bool exclusive;
+    };
+
+    /**
+     * @brief Take the operation lock shared (no-op unless thread-safe).
+     */
+    [[nodiscard]] OperationGuard ShareOperations() const;
+
+    /**
+     * @brief Take the operation lock exclusively (no-op unless thread-safe).
+     */
+    [[nodiscard]] OperationGuard LockOperations() const;
+
+    /**
+     * @brief Lock an inode for reading (no-op unless thread-safe).
+     */
+    [[nodiscard]] std::shared_lock<std::shared_mutex> ShareINode(uint32_t id) const;
+
+    /**
+     * @brief Lock an inode for writing (no-op unless thread-safe).
+     */
+    [[nodiscard]] std::unique_lock<std::shared_mutex> LockINode(uint32_t id) const;
+
+    /**
+     * @brief Lock the allocator (no-op unless thread-safe).
+     */
+    [[nodiscard]] std::unique_lock<std::mutex> LockAllocator() const;
+
+    /**
+     * @brief Get the working directory of the calling session.
+     */
+    [[nodiscard]] WorkingDirectory& Session() const;
+
+    /**
+     * @brief Erase the session of the calling thread from a table when the thread ends.
+     */
+    static void DropSessionAtExit(const std::shared_ptr<SessionTable>& table);
+
+    /**
+     * @brief Forget the cached paths of all working directories.
+     */
+    void ForgetWorkingPaths() const;
+
+    /**
+     * @brief Check whether a directory is the working directory of any session.
+     */
+    [[nodiscard]] bool IsWorkingDirectory(uint32_t id) const;
+
+    /**
+     * @brief Throw ReadOnlyFilesystemException if the image is mounted read-only.
+     */
+    void EnsureWritable() const;
+
+    /**
+     * @brief Check the image against its tree (operations must be locked).
+     *
+     * @param repair Fix every difference found.
+     * @param unrepairable Set if errors were found that cannot be repaired.
+     * @return Human-readable report.
+     */
+    std::string CheckImage(bool repair, bool& unrepairable);
+
+    /**
+     * @brief Commit all cached modifications (operations must be locked).
+     */
+    void WriteBack();
+
+    /**
+     * @brief Write the superblock in place.
+     */
+    void WriteSuperblock() const;
+
+    /**
+     * @brief Size of the inode records of the image.
+     */
+    [[nodiscard]] int INodeRecordBytes() const;
+
+    /**
+     * @brief Run the checker over the image.
+     *
+     * @param writeBack Write everything back first; otherwise the
+     *        checker sees only the committed image.
+     */
+    [[nodiscard]] FilesystemChecker::Report RunChecker(bool writeBack);
+
+    /**
+     * @brief Remove or add the directory entries reported by the checker.
+     */
+    void RepairEntries(const std::vector<FilesystemChecker::EntryFix>& fixes);
+
+    /**
+     * @brief Get the contents of a block.
+     *
+     * In thread-safe mode the block is copied into scratch, since other
+     * threads may evict it from the cache at any time.
+     *
+     * @param block Block identifier.
+     * @param scratch Buffer that may back the returned pointer.
+     * @return Pointer to one block of data, valid while scratch is.
+     */
+    [[nodiscard]] const char* BlockData(uint32_t block, std::vector<char>& scratch) const;
+
+    /**
+     * @brief Read an inode (served from the inode cache).
      */
     [[nodiscard]] INode readINode(uint32_t id) const;
 
     /**
-     * @brief Write an inode to disk.
+     * @brief Write an inode (marked dirty in the inode cache).
      */
     void writeINode(const INode& node) const;
 
@@ -235,13 +686,112 @@ private:
      */
     std::optional<uint32_t> AllocateBlock();
 
+    /**
+     * @brief Allocate data blocks as few contiguous runs as possible.
+     *
+     * @throws CouldNotAllocateBlockException If not enough blocks are free.
+     */
+    std::vector<BlockRun> AllocateBlockRuns(uint32_t count);
+
     /**
      * @brief Free a data block.
+     *
+     * A shared block only loses one owner. Otherwise the block leaves the
+     * deduplication index and is released; it stays allocated until the
+     * next write-back commits the release, so no write can reach data the
+     * committed tree still references, unless the image runs out of free
+     * blocks first (see ReclaimReleasedBlocks()).
      */
     void FreeBlock(uint32_t block);
 
+    /**
+     * @brief Make released blocks free until count blocks are free.
+     *
+     * Called by the allocator (with the allocator lock held) when the
+     * free blocks do not suffice. A reclaimed block is reused before the
+     * commit, so its old contents no longer survive a crash.
+     */
+    void ReclaimReleasedBlocks(uint32_t count);
+
+    /**
+     * @brief Count blocks the allocator can hand out (free and released).
+     */
+    [[nodiscard]] uint32_t AvailableBlocks() const;
+
+    /**
+     * @brief Count blocks released by truncating the file at path.
+     *
+     * Blocks the file shares with other owners are not counted.
+     *
+     * @return 0 if path does not name an existing file.
+     */
+    [[nodiscard]] uint32_t ReleasableBlocks(const std::string& path) const;
+
+    /**
+     * @brief Data blocks chosen for new file contents (see PlaceBlocks()).
+     */
+    struct Placement {
+        /// Block of every position
+        std::vector<uint32_t> blocks;
+
+        /// False for positions sharing a block that already holds their contents
+        std::vector<bool> fresh;
+
+        /// Hash of every fresh whole block to index once written (empty without an index)
+        std::vector<uint64_t> hashes;
+    };
+
+    /**
+     * @brief Choose the data blocks of new file contents.
+     *
+     * On images with a deduplication index, every whole block matching
+     * an indexed block or an earlier position shares that block (the
+     * contents are compared, not only the hashes). The other positions
+     * get newly allocated blocks, laid out in as few runs as possible.
+     *
+     * @param data Contents, starting at a block boundary.
+     * @param size Number of bytes of contents.
+     * @param count Number of positions (blocks covering size bytes).
+     *
+     * @throws CouldNotAllocateBlockException If not enough blocks are free.
+     */
+    Placement PlaceBlocks(const char* data, uint64_t size, uint32_t count);
+
+    /**
+     * @brief Start writing the fresh positions of a placement.
+     *
+     * Every stretch of fresh positions is submitted as one batch of runs.
+     *
+     * @return Futures of the submitted batches.
+     */
+    std::vector<std::future<void>> SubmitPlaced(const Placement& placement,
+                                                const char* data, uint64_t size);
+
+    /**
+     * @brief Index the fresh whole blocks of a placement once they are written.
+     */
+    void IndexBlocks(const Placement& placement);
+
+    /**
+     * @brief Find free space for the overflow of a large journal transaction.
+     *
+     * @param bytes Number of bytes still missing.
+     * @param next Next block to look at, advanced past the blocks taken.
+     * @param taken Collects the blocks taken.
+     * @return Extents of blocks free before and after the transaction.
+     */
+    [[nodiscard]] std::vector<Journal::Extent> SpillExtents(uint64_t bytes, uint32_t& next,
+                                                           std::vector<uint32_t>& taken) const;
+
+    /**
+     * @brief Zero (secure erase) or punch holes for (trim) committed released blocks.
+     */
+    void ScrubReleasedBlocks();
+
     /**
      * @brief Add a directory entry.
+     *
+     * Entries are kept packed, so the entry count locates the free slot.
      */
     void AddChild(INode& node,
                   std::string name,
@@ -254,10 +804,37 @@ private:
     std::vector<ChildNodeNameIdPair>
     GetChildren(const INode& node) const;
 
+    /**
+     * @brief Visit the entries of a directory in order, a block at a time.
+     *
+     * Names point into the directory block, so no entry is copied; the
+     * visitor must not use the filesystem.
+     *
+     * @param visit Called for every entry; returns false to stop.
+     * @return True if the visitor stopped the scan.
+     */
+    bool ForEachChild(const INode& dir,
+                      const std::function<bool(const ChildNodeNameIdView&)>& visit) const;
+
+    /**
+     * @brief Number of entries of a directory ("." and ".." included).
+     *
+     * Taken from the inode if recorded, counted otherwise.
+     */
+    [[nodiscard]] uint32_t CountChildren(const INode& dir) const;
+
+    /**
+     * @brief Check whether directories record their entry count (layout version 7 on).
+     */
+    [[nodiscard]] bool CountsEntries() const;
+
     /**
      * @brief Remove a directory entry.
+     *
+     * The last entry is moved into its slot; the entry count of the
+     * directory is updated and its inode written.
      */
-    void RemoveChild(const INode& node,
+    void RemoveChild(INode& node,
                      uint32_t childNode, std::string filename) const;
 
     /**
@@ -266,16 +843,225 @@ private:
     void AttachBlock(INode& node, uint32_t block);
 
     /**
-     * @brief Detach a data block from an inode.
+     * @brief Number of indirect table blocks needed to map a file.
+     *
+     * @throws FileTooLargeException If the blocks do not fit the block map.
      */
-    void DeattachBlock(INode& node, uint32_t block);
+    [[nodiscard]] uint32_t BlockMapOverhead(uint32_t dataBlocks) const;
 
     /**
-     * @brief Interpret a block as directory entries.
+     * @brief Build the complete block map of an inode in a single pass.
+     *
+     * Fills the direct links and writes every indirect table once,
+     * allocating the tables as a contiguous run. The inode must not
+     * have any blocks attached.
      */
-    [[nodiscard]]
-    std::vector<ChildNodeNameIdPair>
-    ReadBlockAsSubdirectories(uint32_t block) const;
+    void BuildBlockMap(INode& node, const std::vector<uint32_t>& blocks);
+
+    /**
+     * @brief Allocate an empty (0xFF-filled) pointer table block.
+     *
+     * @throws CouldNotAllocateBlockException If no block is free.
+     */
+    uint32_t AllocateTable();
+
+    /**
+     * @brief Read one entry of a pointer table.
+     */
+    [[nodiscard]] uint32_t ReadTableEntry(uint32_t table, uint32_t index) const;
+
+    /**
+     * @brief Map a logical block index of an inode to a data block.
+     *
+     * @return Block identifier, or INode::UNUSED_LINK if not mapped.
+     */
+    [[nodiscard]] uint32_t BlockAt(const INode& node, uint32_t index) const;
+
+    /**
+     * @brief Allocate the pointer tables needed to map a logical block.
+     *
+     * @throws FileTooLargeException If the index exceeds the block map.
+     */
+    void EnsureTables(INode& node, uint32_t index);
+
+    /**
+     * @brief Record the data block of a logical block index.
+     *
+     * The pointer tables must already exist (see EnsureTables()).
+     */
+    void MapBlock(INode& node, uint32_t index, uint32_t block);
+
+    /**
+     * @brief Give a file a private copy of a shared data block.
+     *
+     * @param node Inode of the file (its block map is updated).
+     * @param index Logical block index.
+     * @param preserve False if the caller overwrites the whole block,
+     *                 so the old contents need not be copied.
+     * @return Block identifier now mapped at the index.
+     */
+    uint32_t UnshareBlock(INode& node, uint32_t index, bool preserve);
+
+    /**
+     * @brief Find a file, creating it or releasing its blocks.
+     *
+     * @return Inode of the empty file.
+     */
+    INode CreateOrTruncate(const std::string& path);
+
+    /**
+     * @brief Read a byte range of a file.
+     *
+     * The blocks of the range are read in runs of adjacent blocks.
+     *
+     * @param readAhead Bytes past the range to load into the block cache.
+     * @return Number of bytes read.
+     */
+    std::size_t ReadAt(const INode& node, uint64_t offset,
+                       char* buffer, std::size_t size,
+                       uint64_t readAhead = 0) const;
+
+    /**
+     * @brief Read whole file blocks into a buffer, one request per run.
+     *
+     * @param blocks Blocks of a byte range, in file order.
+     * @param offset Byte offset of the range inside its first block.
+     * @param buffer Destination buffer of size bytes.
+     * @param size Number of bytes to read.
+     */
+    void ReadBlocks(const std::vector<uint32_t>& blocks, uint32_t offset,
+                    char* buffer, uint64_t size) const;
+
+    /**
+     * @brief Merge a list of blocks into runs of physically adjacent blocks.
+     *
+     * @param blocks Blocks in file order.
+     * @return Runs in file order.
+     */
+    [[nodiscard]] static std::vector<BlockRun> CoalesceRuns(const std::vector<uint32_t>& blocks);
+
+    /**
+     * @brief Write a byte range of a file, growing it as needed.
+     *
+     * Keeps the file inline while it fits and moves it to a data block
+     * once it outgrows the inode. A compressed file is appended to by
+     * packing its last chunk again and unpacked by any other write.
+     */
+    void WriteAt(INode& node, uint64_t offset,
+                 const char* data, std::size_t size);
+
+    /**
+     * @brief Write a byte range of a file stored in data blocks.
+     */
+    void WriteBlocks(INode& node, uint64_t offset,
+                     const char* data, std::size_t size);
+
+    /**
+     * @brief Set the size of a file, releasing or zero-filling its tail.
+     *
+     * Blocks past the new end are detached last-first. A compressed
+     * file keeps its chunks before the new end and packs the one holding
+     * it again; growing it unpacks it first.
+     */
+    void TruncateAt(INode& node, uint64_t size);
+
+    /**
+     * @brief Check whether the image stores files compressed.
+     */
+    [[nodiscard]] bool CompressesFiles() const;
+
+    /**
+     * @brief Pack data into chunks, in parallel for large data.
+     *
+     * @param map Chunk table the packed chunks are added to.
+     * @return Stored blocks of the chunks, in order.
+     */
+    std::vector<char> PackChunks(const char* data, uint64_t size, ChunkMap& map) const;
+
+    /**
+     * @brief Load the chunk table of a compressed file.
+     *
+     * @throws FileReadException If the table does not match the block map.
+     */
+    [[nodiscard]] ChunkMap ReadChunkMap(const INode& node) const;
+
+    /**
+     * @brief Data blocks of a range of logical block indexes.
+     *
+     * @throws FileReadException If a block of the range is not mapped.
+     */
+    [[nodiscard]] std::vector<uint32_t> BlocksAt(const INode& node, uint32_t from, uint32_t to) const;
+
+    /**
+     * @brief Read and unpack a range of chunks of a compressed file.
+     *
+     * @param first First chunk.
+     * @param end Chunk past the range.
+     * @param blocks Stored blocks of the range.
+     * @param fileSize Size of the file.
+     * @return Contents of the chunks.
+     */
+    [[nodiscard]] std::vector<char> ReadChunks(const ChunkMap& map, uint32_t first, uint32_t end,
+                                               const std::vector<uint32_t>& blocks,
+                                               uint64_t fileSize) const;
+
+    /**
+     * @brief Read a byte range of a compressed file (see ReadAt()).
+     */
+    std::size_t ReadCompressed(const INode& node, uint64_t offset,
+                               char* buffer, std::size_t size,
+                               uint64_t readAhead) const;
+
+    /**
+     * @brief Replace the contents of a file from an offset on with data,
+     *        stored compressed.
+     *
+     * Chunks before the chunk holding the offset are kept; the stored
+     * blocks after them and the chunk table are replaced.
+     *
+     * @param keep Bytes of the current contents kept.
+     * @return False, without any change, if the file is not compressed
+     *         yet and the data does not compress.
+     *
+     * @throws CouldNotAllocateBlockException If the new blocks do not fit.
+     */
+    bool RewriteCompressed(INode& node, uint64_t keep, const char* data, std::size_t size);
+
+    /**
+     * @brief Store a compressed file in plain data blocks.
+     *
+     * @throws CouldNotAllocateBlockException If the plain blocks do not fit.
+     */
+    void Inflate(INode& node);
+
+    /**
+     * @brief Write whole blocks to the end of a block map.
+     *
+     * @param index Logical block index of the first block.
+     * @param count Number of blocks of data.
+     */
+    void AppendBlocks(INode& node, uint32_t index, const char* data, uint32_t count);
+
+    /**
+     * @brief Largest file size the inode records of the image can hold.
+     *
+     * Images of layout versions 1 to 3 store a 32-bit file size.
+     */
+    [[nodiscard]] uint64_t MaxFileSize() const;
+
+    /**
+     * @brief Largest file stored inside its inode (0 before layout version 5).
+     */
+    [[nodiscard]] uint32_t InlineCapacity() const;
+
+    /**
+     * @brief Detach a data block from an inode.
+     *
+     * The block map is searched from its end, so detaching the tail of
+     * a file does not scan its whole block map, and a block referenced
+     * more than once loses its last reference.
+     */
+    void DeattachBlock(INode& node, uint32_t block);
 
     /**
      * @brief Interpret a block as a block-ID table.
@@ -292,6 +1078,8 @@ private:
 
     /**
      * @brief Find a child inode by name.
+     *
+     * Served from the directory index, which is built on first use.
      */
     [[nodiscard]]
     std::optional<uint32_t>
@@ -305,6 +1093,15 @@ private:
     bool ExistsChild(const INode& dir,
                      const std::string& name) const;
 
+    /**
+     * @brief Get the data blocks of a file in logical order.
+     *
+     * Unlike GetAllBlockIds(), pointer tables are not included.
+     */
+    [[nodiscard]]
+    std::vector<uint32_t>
+    GetDataBlockIds(const INode& node) const;
+
     /**
      * @brief Get all data blocks used by an inode.
      */
@@ -318,6 +1115,15 @@ private:
     [[nodiscard]]
     INode ResolvePath(const std::string& path) const;
 
+    /**
+     * @brief Compute the path of a directory from root.
+     *
+     * Walks ".." entries up to root and looks names up in the
+     * directory index.
+     */
+    [[nodiscard]]
+    std::vector<std::string> PathOf(const INode& dir) const;
+
     /**
      * @brief Resolve parent directory of a path.
      */
@@ -0,0 +1,265 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "INode.h"
+#include "Superblock.h"
+#include "ThreadPool.h"
+#include "../helpers/FileIOHandler.h"
+
+/**
+ * @class FilesystemChecker
+ * @brief Consistency checker of a filesystem image.
+ *
+ * Walks the directory tree from the root and derives from it what the
+ * allocation metadata should be:
+ *
+ *  - the inodes in use (every inode reachable from the root)
+ *  - the blocks in use and the number of owners of each
+ *  - the link count of every reachable inode
+ *  - the "." and ".." entries of every directory
+ *  - the number of entries of every directory
+ *
+ * Directories are visited in parallel by a thread pool. The checker
+ * reads the image through its own positional handle, bypassing every
+ * cache, so the image must be fully written back before Run().
+ *
+ * A directory named by several entries keeps the entry it was first
+ * reached through; the others are reported as extra links, so the
+ * repaired tree is always connected.
+ *
+ * The checker only reports; Filesystem::Check() applies the repairs.
+ */
+class FilesystemChecker {
+public:
+    /**
+     * @brief Directory entry that has to be removed or added.
+     */
+    struct EntryFix {
+        /**
+         * @brief Kinds of broken entries.
+         */
+        enum class Kinds {
+            /// Entry naming an inode that does not exist (remove it)
+            DANGLING,
+
+            /// Second entry naming a directory (remove it)
+            EXTRA_LINK,
+
+            /// "." or ".." pointing elsewhere than expected (point it at expected)
+            WRONG_TARGET,
+
+            /// "." or ".." missing (add it, pointing at expected)
+            MISSING
+        };
+
+        /// Kind of the problem
+        Kinds kind;
+
+        /// Directory holding the entry
+        uint32_t directory;
+
+        /// Name of the entry
+        std::string name;
+
+        /// Inode the entry currently names (unused for MISSING)
+        uint32_t target;
+
+        /// Inode the entry should name ("." and ".." only)
+        uint32_t expected;
+    };
+
+    /**
+     * @brief Metadata derived from the directory tree.
+     */
+    struct Report {
+        /// Number of reachable directories (the root included)
+        uint32_t directories = 0;
+
+        /// Number of reachable files
+        uint32_t files = 0;
+
+        /// True for every reachable inode
+        std::vector<bool> inodes;
+
+        /// Number of owners of every block
+        std::vector<uint32_t> owners;
+
+        /// Expected link count of every reachable inode (0 for the others)
+        std::vector<uint32_t> links;
+
+        /// Link count stored in every reachable inode (0 for the others)
+        std::vector<uint32_t> recordedLinks;
+
+        /// Number of entries of every reachable directory (0 for the others)
+        std::vector<uint32_t> entryCounts;
+
+        /// Entry count stored in every reachable directory (0 if not recorded)
+        std::vector<uint32_t> recordedEntryCounts;
+
+        /// Broken directory entries
+        std::vector<EntryFix> entries;
+
+        /// Block references outside the data region (not followed)
+        uint32_t badBlockReferences = 0;
+    };
+
+    /** Number of entries of a large directory checked by one task. */
+    static constexpr std::size_t ENTRIES_PER_TASK = 256;
+
+    /**
+     * @brief Open an image for checking.
+     *
+     * @param imagePath Path to the filesystem image file.
+     * @param superblock Superblock of the image.
+     * @param inodeBytes Size of one inode record.
+     * @param threads Number of worker threads.
+     *
+     * @throws CouldNotOpenFileException If the image cannot be opened.
+     */
+    FilesystemChecker(const std::string& imagePath,
+                      const Superblock& superblock,
+                      int inodeBytes,
+                      std::size_t threads = ThreadPool::DefaultThreads());
+
+    /**
+     * @brief Walk the directory tree.
+     *
+     * @return Metadata derived from the tree.
+     *
+     * @throws FileReadException If the image cannot be read.
+     */
+    [[nodiscard]] Report Run();
+
+private:
+    /**
+     * @brief An entry of a directory, as stored on disk.
+     */
+    struct Entry {
+        /// Name of the entry
+        std::string name;
+
+        /// Inode the entry names
+        uint32_t id;
+    };
+
+    /// Read-only handle of the image
+    FileIOHandler io;
+
+    /// Superblock of the image
+    Superblock superblock;
+
+    /// Size of one inode record
+    int inodeBytes;
+
+    /// Number of worker threads
+    std::size_t threads;
+
+    /// 1 once an inode has been reached
+    std::vector<std::atomic<uint8_t>> reached;
+
+    /// Number of entries naming every inode ("." and ".." excluded)
+    std::vector<std::atomic<uint32_t>> named;
+
+    /// Number of owners of every block
+    std::vector<std::atomic<uint32_t>> owners;
+
+    /// Link count stored in every inode (written only by the task that reached it)
+    std::vector<uint32_t> recordedLinks;
+
+    /// Number of entries of every directory, and the count stored in it
+    std::vector<uint32_t> entryCounts, recordedEntryCounts;
+
+    /// Number of reached directories and files
+    std::atomic<uint32_t> directories{0}, files{0};
+
+    /// Block references outside the data region
+    std::atomic<uint32_t> badBlockReferences{0};
+
+    /// Broken directory entries found so far
+    std::vector<EntryFix> entries;
+
+    /// Pool running the walk (only during Run())
+    ThreadPool* pool = nullptr;
+
+    /// Number of queued or running tasks
+    std::size_t pending = 0;
+
+    /// First error raised by a task
+    std::exception_ptr error;
+
+    /// Guards entries, pending and error
+    std::mutex mutex;
+
+    /// Signalled when the last task finishes
+    std::condition_variable idle;
+
+    /**
+     * @brief Queue a task of the walk.
+     */
+    void Spawn(std::function<void()> task);
+
+    /**
+     * @brief Check a directory: its blocks, "." and ".." and its entries.
+     *
+     * @param id Inode of the directory.
+     * @param parent Directory it was reached from.
+     */
+    void VisitDirectory(uint32_t id, uint32_t parent);
+
+    /**
+     * @brief Check a slice of the entries of a directory.
+     */
+    void VisitEntries(uint32_t directory, std::vector<Entry> slice);
+
+    /**
+     * @brief Count the blocks of an inode as owned by it, tables included.
+     *
+     * @return Data blocks of the inode (tables excluded), in file order.
+     */
+    std::vector<uint32_t> ClaimBlocks(const INode& node);
+
+    /**
+     * @brief Read the entries of a directory (stops at the first unused slot per block).
+     */
+    std::vector<Entry> ReadEntries(const std::vector<uint32_t>& blocks);
+
+    /**
+     * @brief Read the block identifiers of a pointer table, dropping invalid ones.
+     */
+    std::vector<uint32_t> ReadTable(uint32_t table);
+
+    /**
+     * @brief Read a data block.
+     */
+    void ReadBlock(uint32_t block, std::vector<char>& out);
+
+    /**
+     * @brief Read an inode record.
+     *
+     * @return Decoded inode, or nothing if the record does not hold it.
+     */
+    std::optional<INode> ReadINode(uint32_t id);
+
+    /**
+     * @brief Check a block identifier, counting it as bad if out of range.
+     */
+    bool ValidBlock(uint32_t block);
+
+    /**
+     * @brief Record a broken entry.
+     */
+    void Record(EntryFix fix);
+};
@@ -4,12 +4,17 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstddef>
 #include <functional>
+#include <istream>
+#include <ostream>
 #include <map>
 #include <memory>
 #include <string>
 
 #include "Filesystem.h"
+#include "../helpers/Perf.h"
 
 /**
  * @class FilesystemInterface
@@ -41,8 +46,10 @@ public:
      * shell commands.
      *
      * @param path Path to the filesystem image file.
+     * @param options Runtime options of the filesystem.
      */
-    explicit FilesystemInterface(std::string path);
+    explicit FilesystemInterface(std::string path,
+                                 const FilesystemOptions& options = {});
 
     /**
      * @brief Destructor.
@@ -67,6 +74,46 @@ public:
     std::pair<std::string, std::string>
     Execute(const std::string& command);
 
+    /**
+     * @brief Execute a user command in the given working directory.
+     *
+     * Used by callers that keep one working directory per client. The
+     * directory is entered directly, so no command is run or recorded
+     * for it. If it no longer exists, the command is not executed and
+     * an error is returned along with the root as the new directory.
+     *
+     * @param command Raw command string entered by the user.
+     * @param cwd Absolute path of the working directory.
+     *
+     * @return Same as Execute(const std::string&).
+     */
+    std::pair<std::string, std::string>
+    Execute(const std::string& command, const std::string& cwd);
+
+    /**
+     * @brief Get the probe counters of every command run so far.
+     *
+     * The counters of "load" include the commands of its script.
+     * Empty unless built with ZOS_PERF.
+     *
+     * @return Counters by command name.
+     */
+    [[nodiscard]] const std::map<std::string, Perf::CommandStats>& GetCommandStats() const;
+
+    /**
+     * @brief Clear all probe counters, the per-command breakdown and the
+     *        image I/O counters.
+     */
+    void ResetPerf();
+
+    /**
+     * @brief Message about the check run on mount (empty if none ran).
+     *
+     * Says whether the image was repaired or is mounted read-only and
+     * includes the report of the check.
+     */
+    [[nodiscard]] std::string MountMessage() const;
+
 private:
     /** Underlying filesystem instance. */
     std::unique_ptr<Filesystem> filesystem;
@@ -74,6 +121,12 @@ private:
     /** Path to the filesystem image file. */
     std::string imagePath;
 
+    /** Size of the chunks moved by incp, outcp and cat. */
+    static constexpr std::size_t TRANSFER_CHUNK = 1024 * 1024;
+
+    /** Probe counters by command name. */
+    std::map<std::string, Perf::CommandStats> commandStats;
+
     /**
      * @brief Mapping of command names to handler functions.
      *
@@ -116,11 +169,75 @@ private:
      */
     std::vector<std::string> ParseParams(const std::string& command);
 
+    /**
+     * @brief Execute a script line by line.
+     *
+     * Stops at the first failing command or at "exit".
+     *
+     * @param in Stream with one command per line.
+     * @return "OK", or the message of the failing command.
+     */
+    std::string RunScript(std::istream& in);
+
+    // =====================================================
+    // Transfer helpers
+    // =====================================================
+
+    /**
+     * @brief Create a filesystem file from a host stream, chunk by chunk.
+     *
+     * Fails before the target is created if size bytes do not fit, and
+     * removes the target if the import fails midway.
+     *
+     * @param size Size of the host file in bytes.
+     */
+    void ImportStream(std::istream& in, uint64_t size, const std::string& target);
+
+    /**
+     * @brief Write the whole content of a file to a host stream, chunk by chunk.
+     */
+    void ExportHandle(const FileHandle& file, std::ostream& out);
+
+    /**
+     * @brief Import a host directory tree (incp -r).
+     *
+     * Host files are read ahead by a thread pool; directories and file
+     * contents are written by the calling thread in tree order.
+     *
+     * @return Number of imported files.
+     */
+    std::string ImportTree(const std::string& hostDir, const std::string& fsDir);
+
+    /**
+     * @brief Export a directory tree to the host (outcp -r).
+     *
+     * Files are read by the calling thread and written to the host by a
+     * thread pool.
+     *
+     * @return Number of exported files.
+     */
+    std::string ExportTree(const std::string& fsDir, const std::string& hostDir);
+
+    /**
+     * @brief Copy a directory tree inside the filesystem (cp -r).
+     *
+     * The source tree is listed before anything is created, so the
+     * destination may lie inside the source.
+     *
+     * @return Number of copied files.
+     */
+    std::string CopyTree(const std::string& src, const std::string& dst);
+
+    /**
+     * @brief Append a name to a path.
+     */
+    static std::string JoinPath(const std::string& base, const std::string& name);
+
     // =====================================================
     // Command handlers
     // =====================================================
 
-    /** @brief Copy a file (cp s1 s2). */
+    /** @brief Copy a file or, with -r, a directory tree (cp [-r] s1 s2). */
     std::string cmd_cp(const std::vector<std::string>& args);
 
     /** @brief Move or rename a file or directory (mv s1 s2). */
@@ -153,16 +270,19 @@ private:
     /** @brief Display filesystem statistics (statfs). */
     std::string cmd_statfs(const std::vector<std::string>& args);
 
-    /** @brief Copy file from host system into filesystem (incp src dst). */
+    /** @brief Check and optionally repair the filesystem metadata (fsck [--repair]). */
+    std::string cmd_fsck(const std::vector<std::string>& args);
+
+    /** @brief Copy a file or, with -r, a directory tree from host system into filesystem (incp [-r] src dst). */
     std::string cmd_incp(const std::vector<std::string>& args);
 
-    /** @brief Copy file from filesystem to host system (outcp src dst). */
+    /** @brief Copy a file or, with -r, a directory tree from filesystem to host system (outcp [-r] src dst). */
     std::string cmd_outcp(const std::vector<std::string>& args);
 
-    /** @brief Execute commands from a script file (load file). */
+    /** @brief Execute commands from a script file (load [--batch] file). */
     std::string cmd_load(const std::vector<std::string>& args);
 
-    /** @brief Format the filesystem image (format 600MB). */
+    /** @brief Format the filesystem image (format [--fast] [--dedup] [--compress] [--block-size 4KB] [--inode-ratio 4] 600MB). */
     std::string cmd_format(const std::vector<std::string>& args);
 
     /** @brief Terminate the shell session (exit). */
@@ -171,6 +291,40 @@ private:
     /** @brief Create a hard link (ln existing newpath). */
     std::string cmd_ln(const std::vector<std::string>& args);
 
+    /** @brief Append a line of text to a file (append file words...). */
+    std::string cmd_append(const std::vector<std::string>& args);
+
+    /** @brief Change the size of a file (truncate file 10KB). */
+    std::string cmd_truncate(const std::vector<std::string>& args);
+
+    /** @brief Show or clear the performance counters (perf [commands|reset]). */
+    std::string cmd_perf(const std::vector<std::string>& args);
+
+    // =====================================================
+    // Performance counters
+    // =====================================================
+
+    /**
+     * @brief Add the probes fired since a snapshot to a command's counters.
+     *
+     * @param cmd Command name.
+     * @param before Probe counters when the command started.
+     * @param start Time the command started.
+     */
+    void RecordCommand(const std::string& cmd,
+                       const Perf::Snapshot& before,
+                       std::chrono::steady_clock::time_point start);
+
+    /**
+     * @brief Format a table of all probes with at least one call.
+     */
+    static std::string FormatProbes(const Perf::Snapshot& snapshot);
+
+    /**
+     * @brief Format one line per command with its non-zero probe calls.
+     */
+    std::string FormatCommands() const;
+
     // =====================================================
     // Command registration
     // =====================================================
@@ -196,6 +350,7 @@ private:
 
         commandMap["info"]   = [this](auto& args) { return cmd_info(args); };
         commandMap["statfs"] = [this](auto& args) { return cmd_statfs(args); };
+        commandMap["fsck"]   = [this](auto& args) { return cmd_fsck(args); };
 
         commandMap["incp"]   = [this](auto& args) { return cmd_incp(args); };
         commandMap["outcp"]  = [this](auto& args) { return cmd_outcp(args); };
@@ -205,5 +360,10 @@ private:
         commandMap["exit"]   = [this](auto& args) { return cmd_exit(args); };
 
         commandMap["ln"]     = [this](auto& args) { return cmd_ln(args); };
+
+        commandMap["append"]   = [this](auto& args) { return cmd_append(args); };
+        commandMap["truncate"] = [this](auto& args) { return cmd_truncate(args); };
+
+        commandMap["perf"]   = [this](auto& args) { return cmd_perf(args); };
     }
 };
\ No newline at end of file
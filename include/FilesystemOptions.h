@@ -0,0 +1,63 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <cstddef>
+
+#include "BlockCache.h"
+#include "DirectoryIndex.h"
+#include "INodeCache.h"
+#include "../helpers/AsyncIO.h"
+#include "../helpers/FileIOHandler.h"
+
+/**
+ * @brief Runtime options of a mounted filesystem.
+ *
+ * Options affect only how the image is accessed, not its on-disk layout.
+ */
+struct FilesystemOptions {
+    /** Maximum number of data blocks kept in the block cache. */
+    std::size_t blockCacheCapacity = BlockCache::DEFAULT_CAPACITY;
+
+    /** Maximum number of decoded inodes kept in the inode cache. */
+    std::size_t inodeCacheCapacity = INodeCache::DEFAULT_CAPACITY;
+
+    /** Maximum number of directory entries kept in the name index. */
+    std::size_t directoryIndexCapacity = DirectoryIndex::DEFAULT_CAPACITY;
+
+    /** How the image file is accessed (buffered stream or memory mapping). */
+    FileIOHandler::Backends ioBackend = FileIOHandler::Backends::STREAM;
+
+    /** Overwrite freed blocks with zeros instead of only releasing them. */
+    bool secureErase = false;
+
+    /** Punch holes into the image for freed blocks on Sync(). */
+    bool trimFreedBlocks = false;
+
+    /**
+     * Bytes a sequential FileHandle reader loads into the block cache
+     * ahead of its position, with one request per window (0 disables).
+     */
+    std::size_t readAheadBytes = 128 * 1024;
+
+    /**
+     * Allow concurrent use from several threads. The stream backend is
+     * then replaced by positional I/O, which has no shared file position.
+     */
+    bool threadSafe = false;
+
+    /**
+     * Issue bulk reads and writes (file data, cache and journal flushes)
+     * as batches with many requests in flight. The stream backend is then
+     * replaced by positional I/O; the mapped backend copies memory and
+     * ignores the option.
+     */
+    bool asyncIO = false;
+
+    /** Engine of the asynchronous I/O (io_uring falls back to threads). */
+    AsyncIO::Engines asyncEngine = AsyncIO::Engines::IO_URING;
+
+    /** Maximum number of asynchronous requests in flight. */
+    unsigned asyncQueueDepth = AsyncIO::DEFAULT_QUEUE_DEPTH;
+};
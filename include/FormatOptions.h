@@ -0,0 +1,41 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <cstdint>
+
+/**
+ * @brief Layout options of a newly formatted filesystem.
+ *
+ * Unlike FilesystemOptions, these are fixed for the lifetime of the
+ * image and recorded in its superblock.
+ */
+struct FormatOptions {
+    /** Smallest supported data block size in bytes. */
+    static constexpr uint32_t MIN_BLOCK_SIZE = 1024;
+
+    /** Largest supported data block size in bytes. */
+    static constexpr uint32_t MAX_BLOCK_SIZE = 65536;
+
+    /** Size of a data block in bytes (a power of two, 1 KiB to 64 KiB). */
+    uint32_t blockSize = MIN_BLOCK_SIZE;
+
+    /** Number of data blocks per inode (the inode ratio). */
+    uint32_t blocksPerInode = 4;
+
+    /** Skip zero-filling the image and leave it sparse. */
+    bool fast = false;
+
+    /**
+     * Reserve a deduplication index, so that written blocks matching a
+     * stored one share it instead of taking a block of their own.
+     */
+    bool dedup = false;
+
+    /**
+     * Store newly written files in compressed chunks; chunks that do not
+     * compress are stored as they are.
+     */
+    bool compress = false;
+};
@@ -4,6 +4,7 @@
 
 #pragma once
 #include <array>
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
@@ -17,6 +18,17 @@
  *  - hard link count
  *  - direct and indirect data block references
  *
+ * From layout version 5 on, a file of at most INLINE_BYTES bytes keeps
+ * its contents in the inode record itself, in place of the block
+ * references and in the record tail, and owns no data block.
+ *
+ * From layout version 6 on, a file may be stored compressed: its block
+ * map then lists the stored chunks and the chunk table (see ChunkMap),
+ * and the record tail holds the number of blocks in the block map.
+ *
+ * From layout version 7 on, the record tail of a directory holds its
+ * number of entries.
+ *
  * The inode is serialized to a fixed-size on-disk layout
  * and reconstructed when loading the filesystem.
  */
@@ -26,11 +38,23 @@ public:
     static constexpr int DIRECT_LINKS = 5;
 
     /** Size of the serialized inode in bytes. */
-    static constexpr int BYTES = 41;
+    static constexpr int BYTES = 128;
+
+    /** Size of a serialized inode of layout version 4 (no inline data). */
+    static constexpr int WIDE_BYTES = 45;
+
+    /** Size of a serialized inode of layout versions 1 to 3 (32-bit file size). */
+    static constexpr int LEGACY_BYTES = 41;
 
     /** Marker value for an unused block reference. */
     static constexpr uint32_t UNUSED_LINK = UINT32_MAX;
 
+    /** Bytes taken by the block references (reused by inline data). */
+    static constexpr int LINK_BYTES = (DIRECT_LINKS + 2) * 4;
+
+    /** Largest file stored inline: the block references plus the record tail. */
+    static constexpr int INLINE_BYTES = LINK_BYTES + (BYTES - WIDE_BYTES);
+
     // =====================================================
     // Serialization
     // =====================================================
@@ -43,6 +67,16 @@ public:
      */
     static INode FromBytes(std::vector<char> bytes);
 
+    /**
+     * @brief Deserialize an inode in place from raw memory.
+     *
+     * @param bytes Pointer to exactly recordBytes bytes of inode data.
+     * @param recordBytes BYTES, WIDE_BYTES without inline data, or
+     *                    LEGACY_BYTES for a 32-bit file size.
+     * @return Reconstructed inode instance.
+     */
+    static INode FromBytes(const char* bytes, int recordBytes = BYTES);
+
     /**
      * @brief Serialize inode to raw byte data.
      *
@@ -50,6 +84,18 @@ public:
      */
     [[nodiscard]] std::vector<char> ToBytes() const;
 
+    /**
+     * @brief Serialize inode in place into raw memory.
+     *
+     * A legacy record keeps the low 32 bits of the file size only. Only
+     * a BYTES record has room for inline data or a compressed file.
+     *
+     * @param out Pointer to exactly recordBytes writable bytes.
+     * @param recordBytes BYTES, WIDE_BYTES without inline data, or
+     *                    LEGACY_BYTES for a 32-bit file size.
+     */
+    void ToBytes(char* out, int recordBytes = BYTES) const;
+
     // =====================================================
     // Construction / destruction
     // =====================================================
@@ -105,24 +151,31 @@ public:
      */
     bool removeLink();
 
+    /**
+     * @brief Overwrite the hard link count (used by the consistency check).
+     *
+     * @param links New link count.
+     */
+    void setLinks(uint32_t links);
+
     /**
      * @brief Get file size in bytes.
      */
-    [[nodiscard]] uint32_t getSize() const;
+    [[nodiscard]] uint64_t getSize() const;
 
     /**
      * @brief Increase file size.
      *
      * @param bytes Number of bytes to add.
      */
-    void addSize(uint32_t bytes);
+    void addSize(uint64_t bytes);
 
     /**
      * @brief Decrease file size.
      *
      * @param bytes Number of bytes to remove.
      */
-    void removeSize(uint32_t bytes);
+    void removeSize(uint64_t bytes);
 
     // =====================================================
     // Direct block references
@@ -144,10 +197,21 @@ public:
     /**
      * @brief Remove a direct data block reference.
      *
+     * A block referenced more than once (deduplicated contents) loses
+     * its last reference, as a file shrinks from its end.
+     *
      * @param link Block identifier.
      */
     void removeDirectLink(uint32_t link);
 
+    /**
+     * @brief Replace the direct data block reference at a position.
+     *
+     * @param index Position of the reference (below DIRECT_LINKS).
+     * @param replacement New block identifier.
+     */
+    void replaceDirectLink(int index, uint32_t replacement);
+
     /**
      * @brief Clear all direct block references.
      */
@@ -191,6 +255,82 @@ public:
      */
     void removeSecondLevelIndirectLink();
 
+    // =====================================================
+    // Inline data
+    // =====================================================
+
+    /**
+     * @brief Check whether the file contents are stored in the inode.
+     */
+    [[nodiscard]] bool isInline() const;
+
+    /**
+     * @brief Get the inline contents (getSize() bytes, zeros after them).
+     */
+    [[nodiscard]] const char* getInlineData() const;
+
+    /**
+     * @brief Write bytes into the inline contents and mark the file inline.
+     *
+     * The file size is not changed. The inode must not reference any
+     * block.
+     *
+     * @param offset Byte offset inside the file.
+     * @param data Bytes to write.
+     * @param size Number of bytes (offset + size <= INLINE_BYTES).
+     */
+    void writeInline(uint64_t offset, const char* data, std::size_t size);
+
+    /**
+     * @brief Zero the inline contents from an offset on.
+     *
+     * @param offset First byte to clear; clearing from 0 also drops the
+     *               inline mark.
+     */
+    void clearInline(uint64_t offset = 0);
+
+    // =====================================================
+    // Compressed contents
+    // =====================================================
+
+    /**
+     * @brief Check whether the file is stored in compressed chunks.
+     */
+    [[nodiscard]] bool isCompressed() const;
+
+    /**
+     * @brief Get the number of blocks in the block map of a compressed file.
+     */
+    [[nodiscard]] uint32_t getStoredBlocks() const;
+
+    /**
+     * @brief Mark the file compressed and record the size of its block map.
+     *
+     * @param storedBlocks Number of blocks in the block map.
+     */
+    void setCompressed(uint32_t storedBlocks);
+
+    /**
+     * @brief Drop the compressed mark.
+     */
+    void clearCompressed();
+
+    // =====================================================
+    // Directory entries
+    // =====================================================
+
+    /**
+     * @brief Get the number of entries of a directory (0 if not recorded).
+     */
+    [[nodiscard]] uint32_t getEntryCount() const;
+
+    /**
+     * @brief Record the number of entries of a directory.
+     *
+     * @throws std::runtime_error If the inode is not a directory.
+     */
+    void setEntryCount(uint32_t entries);
+
     // =====================================================
     // On-disk layout
     // =====================================================
@@ -210,9 +350,15 @@ public:
      *     28 | direct[4]
      *     32 | indirect level 1
      *     36 | indirect level 2
-     *     40 | is directory flag
+     *     40 | flags (bit 0 directory, bit 1 inline data, bit 2 compressed)
+     *     41 | file size, high 32 bits
+     *     45 | inline data tail, the number of blocks in the
+     *        | block map of a compressed file, or the number of
+     *        | entries of a directory
      * -------|----------------
-     * TOTAL: 41 bytes
+     * TOTAL: 128 bytes (41 bytes up to layout version 3, 45 in version 4)
+     *
+     * Inline data fills offsets 12 to 39 first and continues at 45.
      */
 private:
     /** Inode identifier. */
@@ -224,8 +370,20 @@ private:
     /** True if inode represents a directory. */
     bool _isDir;
 
+    /** True if the file contents are stored in _inline. */
+    bool _isInline;
+
+    /** True if the file contents are stored in compressed chunks. */
+    bool _isCompressed;
+
+    /** Number of blocks in the block map of a compressed file. */
+    uint32_t _storedBlocks;
+
+    /** Number of entries of a directory (0 if not recorded). */
+    uint32_t _entries;
+
     /** File size in bytes. */
-    uint32_t _size;
+    uint64_t _size;
 
     /** Direct data block references. */
     std::array<uint32_t, DIRECT_LINKS> _direct;
@@ -235,4 +393,7 @@ private:
 
     /** Second-level indirect block reference. */
     uint32_t _indirect2;
+
+    /** Inline file contents (zeros past the file size). */
+    std::array<char, INLINE_BYTES> _inline;
 };
@@ -0,0 +1,155 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "INode.h"
+#include "../helpers/FileIOHandler.h"
+#include "../helpers/ImageWrite.h"
+
+/**
+ * @class INodeCache
+ * @brief In-memory cache of decoded inodes with dirty tracking.
+ *
+ * Inodes are decoded once and kept in memory. Modified inodes are only
+ * marked dirty and written back in a batch on Flush(), where records
+ * with adjacent identifiers are merged into a single write.
+ *
+ * When the number of cached inodes exceeds the capacity, all dirty
+ * inodes are written back and the cache is emptied. With dirty inodes
+ * pinned (journaled images) only clean inodes are dropped, and dirty
+ * ones stay until they are collected by TakeDirty().
+ *
+ * All methods may be called concurrently.
+ */
+class INodeCache {
+public:
+    /** Default number of cached inodes. */
+    static constexpr std::size_t DEFAULT_CAPACITY = 4096;
+
+    /**
+     * @brief Construct an inode cache over an open image.
+     *
+     * @param io I/O handler of the filesystem image.
+     * @param capacity Maximum number of cached inodes (at least 1).
+     */
+    INodeCache(FileIOHandler& io, std::size_t capacity);
+
+    /**
+     * @brief Set the location and record size of the inode table.
+     *
+     * Drops all cached inodes without writing them back.
+     *
+     * @param tableOffset Byte offset of the inode table.
+     * @param recordBytes INode::BYTES, INode::WIDE_BYTES on images of
+     *                    layout version 4, or INode::LEGACY_BYTES on
+     *                    images of layout versions 1 to 3.
+     */
+    void Configure(uint64_t tableOffset, int recordBytes = INode::BYTES);
+
+    /**
+     * @brief Get an inode.
+     *
+     * @param id Inode identifier.
+     * @return Copy of the cached inode.
+     *
+     * @throws InvalidINodeSizeException If the inode cannot be read.
+     */
+    [[nodiscard]] INode Read(uint32_t id);
+
+    /**
+     * @brief Store a modified inode.
+     *
+     * @param node Inode to store; written back on Flush().
+     */
+    void Write(const INode& node);
+
+    /**
+     * @brief Clear an inode record.
+     *
+     * The on-disk record is zeroed on Flush().
+     *
+     * @param id Inode identifier.
+     */
+    void Erase(uint32_t id);
+
+    /**
+     * @brief Keep dirty inodes in memory until TakeDirty().
+     *
+     * @param pinned True to never write dirty inodes on its own.
+     */
+    void SetPinned(bool pinned);
+
+    /**
+     * @brief Collect all dirty inode records and mark them clean.
+     *
+     * @return Writes of the inode table, adjacent records merged.
+     */
+    [[nodiscard]] std::vector<ImageWrite> TakeDirty();
+
+    /**
+     * @brief Write all dirty inodes back to the inode table.
+     */
+    void Flush();
+
+    /**
+     * @brief Drop all cached inodes without writing them back.
+     */
+    void Clear();
+
+private:
+    /**
+     * @brief Cached inode state.
+     */
+    struct Entry {
+        /// Decoded inode
+        INode node;
+
+        /// True if the record must be written back
+        bool dirty = false;
+
+        /// True if the record must be zeroed instead
+        bool erased = false;
+    };
+
+    /// I/O handler of the filesystem image
+    FileIOHandler& io;
+
+    /// Maximum number of cached inodes
+    std::size_t capacity;
+
+    /// Byte offset of the inode table
+    uint64_t tableOffset = 0;
+
+    /// Size of one inode record
+    int recordBytes = INode::BYTES;
+
+    /// Cached inodes by identifier
+    std::unordered_map<uint32_t, Entry> entries;
+
+    /// True if dirty inodes are only written through TakeDirty()
+    bool pinned = false;
+
+    /// Number of entries at which the next Shrink() takes place
+    std::size_t shrinkAt;
+
+    /// Guards all members above
+    mutable std::mutex mutex;
+
+    /**
+     * @brief Collect dirty records (the mutex must be held).
+     */
+    [[nodiscard]] std::vector<ImageWrite> CollectDirty();
+
+    /**
+     * @brief Write back and drop everything when over capacity
+     *        (the mutex must be held).
+     */
+    void Shrink();
+};
@@ -0,0 +1,178 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "../helpers/FileIOHandler.h"
+#include "../helpers/ImageWrite.h"
+
+/**
+ * @class Journal
+ * @brief Write-ahead log of metadata updates.
+ *
+ * All metadata writes collected since the last commit (inode records,
+ * bitmap ranges, directory and pointer blocks) are packed into a single
+ * transaction, written sequentially into the journal region and made
+ * durable before any of them is applied in place. A transaction whose
+ * checksum matches is complete, so after a crash it is simply applied
+ * again on mount; a torn one fails the checksum and is ignored, leaving
+ * the previous consistent state in place.
+ *
+ * On-disk layout of the journal region:
+ *
+ *   offset | item
+ *   =================
+ *        0 | magic
+ *        4 | state (1 = committed, 0 = applied)
+ *        8 | sequence number (u64)
+ *       16 | record count
+ *       20 | payload size in bytes
+ *       24 | checksum of the payload
+ *       28 | overflow extent count
+ *       32 | overflow extents: offset (u64), length (u32)
+ *        … | records: offset (u64), length (u32), bytes
+ *
+ * A transaction larger than the journal continues in overflow extents,
+ * byte ranges of space that is free both before and after it, so it
+ * stays atomic. The checksum covers the extent table and all records.
+ * Only when not enough such space is left is it committed as several
+ * transactions, each of them atomic on its own.
+ */
+class Journal {
+public:
+    /** Magic number of a journal header ("ZJNL"). */
+    static constexpr uint32_t MAGIC = 0x4C4E4A5A;
+
+    /** Size of the journal header in bytes. */
+    static constexpr std::size_t HEADER_SIZE = 32;
+
+    /** Size of a record header in bytes. */
+    static constexpr std::size_t RECORD_HEADER_SIZE = 12;
+
+    /** Size of an overflow extent entry in bytes. */
+    static constexpr std::size_t EXTENT_SIZE = 12;
+
+    /**
+     * @struct Extent
+     * @brief Byte range of the image holding part of a transaction.
+     */
+    struct Extent {
+        /// Byte offset on the image
+        uint64_t offset;
+
+        /// Length in bytes
+        uint32_t length;
+    };
+
+    /**
+     * @brief Provider of overflow space.
+     *
+     * Called with the number of bytes still missing; returns extents that
+     * are not touched by the transaction and hold no committed data, or
+     * none when no such space is left.
+     */
+    using SpillAllocator = std::function<std::vector<Extent>(uint64_t bytes)>;
+
+    /**
+     * @brief Construct a journal over an open image.
+     *
+     * The journal is disabled until it is configured.
+     *
+     * @param io I/O handler of the filesystem image.
+     */
+    explicit Journal(FileIOHandler& io);
+
+    /**
+     * @brief Set the location of the journal region.
+     *
+     * @param offset Byte offset of the journal region.
+     * @param size Size of the journal region in bytes (0 disables it).
+     */
+    void Configure(uint64_t offset, uint64_t size);
+
+    /**
+     * @brief Check whether a journal region is configured.
+     */
+    [[nodiscard]] bool Enabled() const;
+
+    /**
+     * @brief Durably log a batch of writes as one transaction and apply it in place.
+     *
+     * @param writes Writes of the batch, in any order.
+     * @param spill Provider of overflow space for a batch larger than the journal.
+     *
+     * @throws FileWriteException If the image cannot be written or synced.
+     */
+    void Commit(const std::vector<ImageWrite>& writes, const SpillAllocator& spill = nullptr);
+
+    /**
+     * @brief Apply a committed but not yet applied transaction.
+     *
+     * Called on mount before any metadata is read.
+     *
+     * @return True if a record was replayed.
+     */
+    bool Replay();
+
+    /**
+     * @brief Mark the journal empty (used when formatting).
+     */
+    void Reset();
+
+private:
+    /// I/O handler of the filesystem image
+    FileIOHandler& io;
+
+    /// Byte offset of the journal region
+    uint64_t offset = 0;
+
+    /// Size of the journal region in bytes
+    uint64_t size = 0;
+
+    /// Sequence number of the next transaction
+    uint64_t sequence = 1;
+
+    /**
+     * @brief Bytes of records that fit the journal region next to an extent table.
+     */
+    [[nodiscard]] uint64_t Room(std::size_t extents) const;
+
+    /**
+     * @brief Write, sync and apply one transaction.
+     *
+     * @param payload Serialized records.
+     * @param count Number of records in the payload.
+     * @param extents Overflow extents holding the records beyond the journal region.
+     */
+    void CommitTransaction(const std::vector<char>& payload, uint32_t count,
+                           const std::vector<Extent>& extents);
+
+    /**
+     * @brief Commit writes as several transactions that each fit the journal region.
+     */
+    void CommitInParts(const std::vector<ImageWrite>& writes);
+
+    /**
+     * @brief Apply the records of a payload in place.
+     */
+    void Apply(const char* payload, uint64_t payloadSize) const;
+
+    /**
+     * @brief Write the journal header.
+     */
+    void WriteHeader(uint32_t state, uint64_t sequence, uint32_t count,
+                     uint32_t payloadSize, uint32_t checksum, uint32_t extents = 0) const;
+
+    /**
+     * @brief Compute the FNV-1a checksum of a byte range.
+     *
+     * @param hash Checksum of the preceding bytes, to continue over several ranges.
+     */
+    [[nodiscard]] static uint32_t Checksum(const char* data, uint64_t size,
+                                           uint32_t hash = 2166136261u);
+};
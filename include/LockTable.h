@@ -0,0 +1,44 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+
+/**
+ * @class LockTable
+ * @brief Striped reader/writer locks keyed by inode identifier.
+ *
+ * Every inode maps to one of a fixed number of locks so that no lock
+ * has to be created or destroyed while inodes come and go. Two inodes
+ * may share a lock; callers never hold more than one at a time.
+ */
+class LockTable {
+public:
+    /** Default number of locks. */
+    static constexpr std::size_t DEFAULT_STRIPES = 64;
+
+    /**
+     * @brief Construct a lock table.
+     *
+     * @param stripes Number of locks (at least 1).
+     */
+    explicit LockTable(std::size_t stripes = DEFAULT_STRIPES);
+
+    /**
+     * @brief Get the lock guarding an inode.
+     *
+     * @param id Inode identifier.
+     */
+    [[nodiscard]] std::shared_mutex& For(uint32_t id) const;
+
+private:
+    /// Number of locks
+    std::size_t stripes;
+
+    /// The locks
+    std::unique_ptr<std::shared_mutex[]> locks;
+};
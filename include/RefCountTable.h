@@ -0,0 +1,127 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "../helpers/DirtyPages.h"
+
+/**
+ * @class RefCountTable
+ * @brief Per-block reference counts of shared data blocks.
+ *
+ * Block copies (CopyFile) share data blocks between inodes instead of
+ * duplicating them. The table stores, for every data block, the number
+ * of owners beyond the first one:
+ *  - 0 → the block belongs to a single inode (or is free)
+ *  - n → the block is shared by n + 1 inodes
+ *
+ * Every entry is a little-endian 16-bit counter. An empty table
+ * (images formatted before layout version 3) reports every block as
+ * exclusively owned.
+ */
+class RefCountTable {
+public:
+    /** Size of one serialized counter in bytes. */
+    static constexpr uint32_t ENTRY_BYTES = 2;
+
+    /** Largest number of extra owners a block can have. */
+    static constexpr uint32_t MAX_SHARES = UINT16_MAX;
+
+    /**
+     * @brief Construct a table with all counters cleared.
+     *
+     * @param blockCount Number of tracked blocks (0 for no table).
+     */
+    explicit RefCountTable(uint32_t blockCount);
+
+    /**
+     * @brief Check whether the image has a reference count table.
+     */
+    [[nodiscard]] bool Enabled() const;
+
+    /**
+     * @brief Get the number of extra owners of a block.
+     */
+    [[nodiscard]] uint32_t Get(uint32_t block) const;
+
+    /**
+     * @brief Add an owner to a block.
+     *
+     * @return False if the counter is saturated (nothing is changed).
+     */
+    bool Share(uint32_t block);
+
+    /**
+     * @brief Remove an extra owner from a block.
+     *
+     * @return False if the block has a single owner (nothing is changed);
+     *         the caller then frees it.
+     */
+    bool Release(uint32_t block);
+
+    /**
+     * @brief Overwrite the number of extra owners of a block.
+     *
+     * @param block Block identifier.
+     * @param count Extra owners (clamped to MAX_SHARES).
+     */
+    void Set(uint32_t block, uint32_t count);
+
+    /**
+     * @brief Number of blocks with more than one owner.
+     */
+    [[nodiscard]] uint32_t SharedCount() const;
+
+    // =====================================================
+    // Persistence
+    // =====================================================
+
+    /**
+     * @brief Serialized size of a table in bytes.
+     *
+     * @param blockCount Number of tracked blocks.
+     */
+    [[nodiscard]] static uint64_t ByteSize(uint32_t blockCount);
+
+    /**
+     * @brief Load a table from raw byte data.
+     *
+     * @param data Raw table bytes read from disk.
+     * @param blockCount Number of tracked blocks.
+     */
+    static RefCountTable LoadFromBytes(std::vector<char> data, uint32_t blockCount);
+
+    /**
+     * @brief Serialize the table to raw byte data.
+     */
+    [[nodiscard]] std::vector<char> SaveToBytes() const;
+
+    /**
+     * @brief Take the pages modified since the last call.
+     *
+     * @param offset Byte offset of the table on the image.
+     * @return One write per run of modified pages (empty if nothing changed).
+     */
+    [[nodiscard]] std::vector<ImageWrite> TakeDirty(uint64_t offset);
+
+private:
+    /// Number of tracked blocks
+    uint32_t size;
+
+    /// Serialized counters
+    std::vector<char> data;
+
+    /// Number of non-zero counters
+    uint32_t shared = 0;
+
+    /// Pages modified since the last TakeDirty()
+    DirtyPages dirty;
+
+    /**
+     * @brief Store a counter and mark its page modified.
+     */
+    void Put(uint32_t block, uint32_t value);
+};
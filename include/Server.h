@@ -0,0 +1,144 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "FilesystemInterface.h"
+
+/**
+ * @class Server
+ * @brief Daemon serving filesystem commands over a Unix socket.
+ *
+ * The server keeps one FilesystemInterface (and so one mounted image
+ * with all its caches) alive and executes the commands of any number of
+ * clients with it, so the startup and mount costs are paid only once.
+ *
+ * Protocol:
+ *  - a request is one command per line, exactly as typed into the shell
+ *  - every command gets one response, in the order of the requests
+ *  - a response is a header line `<length> <cwd>\n` followed by exactly
+ *    `<length>` bytes of the command result
+ *
+ * Clients may pipeline: all complete lines received so far are executed
+ * in one go and their responses are sent back together. Commands of one
+ * connection run in order; connections are served one batch at a time
+ * on a single thread, so Execute() is never called concurrently.
+ *
+ * Every connection has its own working directory, starting in the root.
+ * If another client removes it, the next command of the connection fails
+ * with an error and the connection continues in the root.
+ * The "exit" command is answered and then closes the connection; the
+ * server itself stops on SIGINT or SIGTERM and flushes the image like
+ * the shell does on exit.
+ */
+class Server {
+public:
+    /** Maximum number of result bytes waiting for a slow client before its commands are paused. */
+    static constexpr std::size_t MAX_PENDING_OUTPUT = 16 * 1024 * 1024;
+
+    /** Maximum length of a single request line. */
+    static constexpr std::size_t MAX_LINE = 1024 * 1024;
+
+    /**
+     * @brief Constructs the server and starts listening.
+     *
+     * A stale socket file left by a server that is no longer running
+     * is replaced.
+     *
+     * @param fs Filesystem interface executing the commands.
+     * @param socketPath Path of the Unix socket.
+     *
+     * @throws CouldNotOpenFileException If the socket cannot be created,
+     *         or another server already listens on it.
+     */
+    Server(FilesystemInterface& fs, std::string socketPath);
+
+    /**
+     * @brief Stops listening and removes the socket file.
+     */
+    ~Server();
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    /**
+     * @brief Serve clients until SIGINT or SIGTERM is received.
+     */
+    void Run();
+
+private:
+    /**
+     * @brief State of one client connection.
+     */
+    struct Connection {
+        /// Socket of the connection
+        int fd = -1;
+
+        /// Received bytes not yet forming a complete line
+        std::string input;
+
+        /// Encoded responses not yet sent
+        std::string output;
+
+        /// Bytes of output already sent
+        std::size_t sent = 0;
+
+        /// Working directory of the connection
+        std::string cwd = "/";
+
+        /// True once the client sent "exit" or closed its end
+        bool closing = false;
+    };
+
+    /// Filesystem command dispatcher
+    FilesystemInterface& fs;
+
+    /// Path of the Unix socket
+    std::string socketPath;
+
+    /// Listening socket
+    int listener = -1;
+
+    /// Open connections
+    std::vector<Connection> connections;
+
+    /**
+     * @brief Accept all pending connections.
+     */
+    void Accept();
+
+    /**
+     * @brief Read available bytes and execute every complete line.
+     *
+     * @return False if the connection is to be dropped.
+     */
+    bool Receive(Connection& connection);
+
+    /**
+     * @brief Execute complete lines of a connection while its output is below the limit.
+     */
+    void ExecutePending(Connection& connection);
+
+    /**
+     * @brief Send as much pending output as the socket accepts.
+     *
+     * @return False if the connection is to be dropped.
+     */
+    bool Send(Connection& connection);
+
+    /**
+     * @brief Execute one command in the working directory of a connection.
+     *
+     * @return Result of the command.
+     */
+    std::string Execute(Connection& connection, const std::string& line);
+
+    /**
+     * @brief Append one encoded response to the output of a connection.
+     */
+    static void Encode(Connection& connection, const std::string& result);
+};
@@ -3,8 +3,9 @@
 //
 
 #pragma once
+#include <array>
+#include <cstddef>
 #include <cstdint>
-#include <vector>
 
 /**
  * @brief Filesystem magic number.
@@ -24,6 +25,16 @@ constexpr uint32_t FILESYSTEM_MAGIC = 0xDEADBEEF;
  *  - filesystem geometry (block size, counts)
  *  - allocation state (free blocks / inodes)
  *  - on-disk layout (offsets of all major structures)
+ *  - the metadata journal (layout version 2 and later)
+ *  - the block reference count table (layout version 3 and later)
+ *  - the deduplication index (optional, layout version 4 and later)
+ *  - the file compression (optional, layout version 6 and later)
+ *
+ * Sizes and byte offsets are 64-bit. The first 56 bytes keep the layout
+ * of version 3 and hold their low 32 bits; from version 4 on the high
+ * halves, the mount state and the deduplication index offset follow in
+ * an extension, so older readers still find every field where they
+ * expect it.
  *
  * The superblock is required to correctly interpret all other data
  * stored in the filesystem image.
@@ -66,7 +77,7 @@ public:
     /**
      * @brief Total size of the filesystem image in bytes.
      */
-    uint32_t size;
+    uint64_t size;
 
     // ========================
     // Layout (byte offsets)
@@ -77,26 +88,26 @@ public:
      *
      * Each bit corresponds to one inode (free / used).
      */
-    uint32_t inodeBitmapOffset;
+    uint64_t inodeBitmapOffset;
 
     /**
      * @brief Byte offset of the data block bitmap.
      *
      * Each bit corresponds to one data block (free / used).
      */
-    uint32_t blockBitmapOffset;
+    uint64_t blockBitmapOffset;
 
     /**
      * @brief Byte offset of the inode table.
      *
      * The inode table stores serialized inode structures.
      */
-    uint32_t inodeTableOffset;
+    uint64_t inodeTableOffset;
 
     /**
      * @brief Byte offset of the first data block.
      */
-    uint32_t dataBlocksOffset;
+    uint64_t dataBlocksOffset;
 
     /**
      * @brief Inode ID of the root directory.
@@ -105,6 +116,87 @@ public:
      */
     uint32_t rootNodeId;
 
+    // ========================
+    // Journal (version 2+)
+    // ========================
+
+    /**
+     * @brief On-disk layout version.
+     *
+     * Version 1 images have a 40-byte superblock and no journal.
+     * Version 5 keeps the superblock of version 4 and widens the inode
+     * records for inline file data. Version 6 records the file
+     * compression and may store files compressed. Version 7 keeps the
+     * superblock of version 6 and records the number of entries of
+     * every directory in its inode.
+     */
+    uint32_t version;
+
+    /**
+     * @brief Byte offset of the metadata journal (0 if none).
+     */
+    uint64_t journalOffset;
+
+    /**
+     * @brief Size of the metadata journal in bytes (0 if none).
+     */
+    uint64_t journalSize;
+
+    // ========================
+    // Shared blocks (version 3+)
+    // ========================
+
+    /**
+     * @brief Byte offset of the block reference count table (0 if none).
+     */
+    uint64_t refcountOffset;
+
+    // ========================
+    // Mount state (version 4+)
+    // ========================
+
+    /**
+     * @brief Mount state (STATE_CLEAN, STATE_MOUNTED, or 0 if never recorded).
+     *
+     * Set to STATE_MOUNTED on mount and to STATE_CLEAN once everything is
+     * written back on unmount, so anything but STATE_CLEAN on mount means
+     * the image was not unmounted properly.
+     */
+    uint32_t state;
+
+    /** Mount state of an image that was unmounted properly. */
+    static constexpr uint32_t STATE_CLEAN = 1;
+
+    /** Mount state of an image in use (or left behind by a crash). */
+    static constexpr uint32_t STATE_MOUNTED = 2;
+
+    // ========================
+    // Deduplication (version 4+)
+    // ========================
+
+    /**
+     * @brief Byte offset of the deduplication index (0 if none).
+     *
+     * Only images formatted with deduplication have the index; it lies
+     * between the reference count table and the inode table.
+     */
+    uint64_t dedupOffset;
+
+    // ========================
+    // Compression (version 6+)
+    // ========================
+
+    /**
+     * @brief Codec new files are compressed with (COMPRESSION_NONE if none).
+     */
+    uint32_t compression;
+
+    /** Files are stored as written. */
+    static constexpr uint32_t COMPRESSION_NONE = 0;
+
+    /** Files are stored in LZ4-compressed chunks. */
+    static constexpr uint32_t COMPRESSION_LZ4 = 1;
+
     // ========================
     // Serialization
     // ========================
@@ -114,7 +206,32 @@ public:
      *
      * This value must remain constant to allow correct deserialization.
      */
-    static constexpr std::size_t BYTE_SIZE = 40;
+    static constexpr std::size_t BYTE_SIZE = 104;
+
+    /**
+     * @brief Serialized size of a version 1 superblock in bytes.
+     */
+    static constexpr std::size_t LEGACY_BYTE_SIZE = 40;
+
+    /**
+     * @brief Serialized size of a version 2 superblock in bytes.
+     */
+    static constexpr std::size_t JOURNAL_BYTE_SIZE = 52;
+
+    /**
+     * @brief Serialized size of a version 3 superblock in bytes.
+     */
+    static constexpr std::size_t SHARED_BYTE_SIZE = 56;
+
+    /**
+     * @brief Serialized size of a version 4 and 5 superblock in bytes.
+     */
+    static constexpr std::size_t WIDE_BYTE_SIZE = 100;
+
+    /**
+     * @brief Layout version written by Format().
+     */
+    static constexpr uint32_t CURRENT_VERSION = 7;
 
     /*
      * offset | item
@@ -129,8 +246,18 @@ public:
      *     28 | inode table offset
      *     32 | data blocks offset
      *     36 | root node id
+     *     40 | layout version (2+)
+     *     44 | journal offset (2+)
+     *     48 | journal size (2+)
+     *     52 | reference count table offset (3+)
+     *     56 | high 32 bits of the filesystem size and of the
+     *        | seven offsets and sizes above, in that order (4+)
+     *     88 | mount state (4+, zero on images written before it)
+     *     92 | deduplication index offset, 64-bit (4+, zero if none)
+     *    100 | file compression (6+, zero if none)
      * =================
-     * TOTAL = 40 bytes
+     * TOTAL = 104 bytes (40 for version 1, 52 for version 2, 56 for version 3,
+     *         100 for versions 4 and 5)
      */
 
     /**
@@ -143,6 +270,14 @@ public:
      */
     [[nodiscard]] std::array<char, BYTE_SIZE> toBytes() const;
 
+    /**
+     * @brief Number of serialized bytes that belong to this version.
+     *
+     * Only this prefix of toBytes() may be written back, since a version
+     * 1 image stores the inode bitmap right after byte 40.
+     */
+    [[nodiscard]] std::size_t ByteSize() const;
+
     /**
      * @brief Deserializes a superblock from raw bytes.
      *
@@ -153,4 +288,19 @@ public:
      * @return Reconstructed Superblock instance.
      */
     static Superblock fromBytes(std::array<char, BYTE_SIZE> data);
+
+    /**
+     * @brief Deserializes a superblock in place from raw memory.
+     *
+     * The journal fields are only read when the layout leaves room for
+     * them; otherwise the superblock is reported as version 1. The
+     * reference count table offset is only read from version 3 on, the
+     * high halves of sizes and offsets, the mount state and the
+     * deduplication index offset from version 4 on, the file compression
+     * from version 6 on.
+     *
+     * @param data Pointer to exactly BYTE_SIZE bytes of superblock data.
+     * @return Reconstructed Superblock instance.
+     */
+    static Superblock fromBytes(const char* data);
 };
\ No newline at end of file
@@ -0,0 +1,70 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @class ThreadPool
+ * @brief Fixed set of worker threads executing queued tasks.
+ *
+ * Tasks run in submission order as workers become free. Destroying the
+ * pool waits until every submitted task has finished.
+ */
+class ThreadPool {
+public:
+    /**
+     * @brief Start the worker threads.
+     *
+     * @param threads Number of workers (at least 1).
+     */
+    explicit ThreadPool(std::size_t threads = DefaultThreads());
+
+    /**
+     * @brief Finish all queued tasks and stop the workers.
+     */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Queue a task.
+     *
+     * @param task Task to run on a worker; must not throw.
+     */
+    void Submit(std::function<void()> task);
+
+    /**
+     * @brief Number of workers used by default (the number of cores, at most 8).
+     */
+    [[nodiscard]] static std::size_t DefaultThreads();
+
+private:
+    /// Worker threads
+    std::vector<std::thread> workers;
+
+    /// Tasks not yet started
+    std::deque<std::function<void()>> tasks;
+
+    /// Guards tasks and stopping
+    std::mutex mutex;
+
+    /// Signalled when a task is queued or the pool stops
+    std::condition_variable available;
+
+    /// True once the pool is being destroyed
+    bool stopping = false;
+
+    /**
+     * @brief Run tasks until the pool stops and the queue is empty.
+     */
+    void Work();
+};
@@ -4,23 +4,95 @@
 #include <cassert>
 #include <iostream>
 #include <filesystem>
+#include <unistd.h>
 
 #include "helpers/FileIOHandler.h"
 #include "helpers/FileIOExceptions.h"
 #include "helpers/IntParser.h"
+#include "helpers/SizeParser.h"
 #include "include/Bitmap.h"
+#include "include/Client.h"
 #include "include/Filesystem.h"
 #include "include/FilesystemInterface.h"
 #include "include/INode.h"
+#include "include/Server.h"
 #include "include/Shell.h"
 #include "include/Superblock.h"
 
 int main (int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <path_to_image>" << std::endl;
+    // Client of a running server: no image is mounted
+    if (argc == 3 && std::string(argv[1]) == "--connect") {
+        try {
+            Client client(argv[2]);
+            client.Run(std::cin, std::cout, ::isatty(STDIN_FILENO) != 0);
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    FilesystemOptions options;
+    std::string serveSocket;
+    bool validArgs = argc >= 2;
+
+    // Optional flags after the image path
+    for (int i = 2; i < argc; ++i) {
+        const std::string flag = argv[i];
+        if (flag == "--mmap") {
+            options.ioBackend = FileIOHandler::Backends::MMAP;
+        } else if (flag == "--secure-erase") {
+            options.secureErase = true;
+        } else if (flag == "--trim") {
+            options.trimFreedBlocks = true;
+        } else if (flag == "--async") {
+            options.asyncIO = true;
+
+            // Optional engine name
+            const std::string engine = i + 1 < argc ? argv[i + 1] : "";
+            if (engine == "uring" || engine == "threads") {
+                options.asyncEngine = engine == "uring"
+                    ? AsyncIO::Engines::IO_URING
+                    : AsyncIO::Engines::THREAD_POOL;
+                ++i;
+            }
+        } else if (flag == "--serve" && i + 1 < argc) {
+            serveSocket = argv[++i];
+        } else if (flag == "--read-ahead" && i + 1 < argc) {
+            uint64_t bytes = 0;
+            validArgs = validArgs && ParseSize(argv[++i], bytes);
+            options.readAheadBytes = static_cast<std::size_t>(bytes);
+        } else {
+            validArgs = false;
+        }
+    }
+
+    if (!validArgs) {
+        std::cerr << "Usage: " << argv[0]
+                  << " <path_to_image> [--mmap] [--secure-erase] [--trim] [--read-ahead <size>]"
+                  << " [--async [uring|threads]] [--serve <socket>]" << std::endl
+                  << "       " << argv[0] << " --connect <socket>" << std::endl;
         return 1;
     }
-    auto fs = FilesystemInterface(argv[1]);
+    auto fs = FilesystemInterface(argv[1], options);
+
+    // Daemon mode keeps the image mounted for clients of the socket
+    if (!serveSocket.empty()) {
+        const std::string mounted = fs.MountMessage();
+        if (!mounted.empty()) {
+            std::cerr << mounted << std::endl;
+        }
+
+        try {
+            Server server(fs, serveSocket);
+            server.Run();
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
     Shell sh(fs);
     sh.Run();
     return 0;
@@ -4,8 +4,47 @@
 
 #include "../include/Bitmap.h"
 
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
+namespace {
+
+/// Number of bits scanned at once
+constexpr uint32_t WORD_BITS = 64;
+
+/**
+ * @brief Count trailing zero bits of a non-zero word.
+ */
+uint32_t CountTrailingZeros(const uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<uint32_t>(__builtin_ctzll(word));
+#else
+    uint32_t count = 0;
+    while (((word >> count) & 0x1) == 0) {
+        ++count;
+    }
+    return count;
+#endif
+}
+
+/**
+ * @brief Count set bits of a word.
+ */
+uint32_t PopCount(const uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<uint32_t>(__builtin_popcountll(word));
+#else
+    uint32_t count = 0;
+    for (uint64_t w = word; w != 0; w &= w - 1) {
+        ++count;
+    }
+    return count;
+#endif
+}
+
+} // namespace
+
 // =====================================================
 // Constructor
 // =====================================================
@@ -15,7 +54,8 @@
  */
 Bitmap::Bitmap(const uint32_t bitCount)
     : size(bitCount),
-      data((bitCount + 7) / 8, 0) {
+      data((bitCount + 7) / 8, 0),
+      freeBits(bitCount) {
 }
 
 // =====================================================
@@ -37,15 +77,27 @@ bool Bitmap::Get(const uint32_t index) const {
  * @brief Set or clear a bit.
  */
 void Bitmap::Set(const uint32_t index, const bool value) {
+    if (this->Get(index) == value) {
+        return;
+    }
+
     const uint32_t byteIndex = index / 8;
     const uint32_t bitIndex  = index % 8;
 
+    this->dirty.Mark(byteIndex, 1);
+
     if (value) {
         // Mark resource as allocated
         this->data[byteIndex] |= (1 << bitIndex);
+        --this->freeBits;
     } else {
         // Mark resource as free
         this->data[byteIndex] &= ~(1 << bitIndex);
+        ++this->freeBits;
+
+        if (index < this->hint) {
+            this->hint = index;
+        }
     }
 }
 
@@ -55,29 +107,92 @@ void Bitmap::Set(const uint32_t index, const bool value) {
 
 /**
  * @brief Find the first free (unset) bit.
+ *
+ * Scans 64 bits at a time, starting at the word containing the hint.
  */
 std::optional<uint32_t> Bitmap::FindFirstFree() const {
-    for (uint32_t i = 0; i < this->size; ++i) {
-        if (!this->Get(i)) {
-            return i;
+    if (this->freeBits == 0) {
+        return std::nullopt;
+    }
+
+    const uint32_t words = (this->size + WORD_BITS - 1) / WORD_BITS;
+
+    for (uint32_t w = this->hint / WORD_BITS; w < words; ++w) {
+        const uint64_t freeMask = ~this->Word(w);
+        if (freeMask == 0) {
+            continue;
+        }
+
+        const uint32_t index = w * WORD_BITS + CountTrailingZeros(freeMask);
+        if (index >= this->size) {
+            break;
         }
+
+        // Everything below the first free bit is allocated
+        this->hint = index;
+        return index;
     }
+
     return std::nullopt;
 }
 
 /**
- * @brief Count the number of free bits.
+ * @brief Find the first run of consecutive free bits.
+ *
+ * Fully allocated and fully free words are skipped as a whole;
+ * only mixed words are inspected bit by bit.
  */
-uint32_t Bitmap::FreeCount() const {
-    uint32_t count = 0;
+std::optional<uint32_t> Bitmap::FindFreeRun(const uint32_t count) const {
+    if (count == 0 || count > this->freeBits) {
+        return std::nullopt;
+    }
+
+    const uint32_t words = (this->size + WORD_BITS - 1) / WORD_BITS;
+
+    uint32_t runStart = 0;
+    uint32_t runLength = 0;
 
-    for (uint32_t i = 0; i < this->size; ++i) {
-        if (!this->Get(i)) {
-            ++count;
+    for (uint32_t w = this->hint / WORD_BITS; w < words; ++w) {
+        const uint64_t word = this->Word(w);
+
+        if (word == UINT64_MAX) {
+            runLength = 0;
+            continue;
+        }
+
+        if (word == 0) {
+            if (runLength == 0) {
+                runStart = w * WORD_BITS;
+            }
+            runLength += WORD_BITS;
+        } else {
+            for (uint32_t bit = 0; bit < WORD_BITS && runLength < count; ++bit) {
+                if ((word >> bit) & 0x1) {
+                    runLength = 0;
+                    continue;
+                }
+
+                if (runLength == 0) {
+                    runStart = w * WORD_BITS + bit;
+                }
+                ++runLength;
+            }
+        }
+
+        if (runLength >= count) {
+            // Padding bits past the end read as allocated
+            return runStart;
         }
     }
 
-    return count;
+    return std::nullopt;
+}
+
+/**
+ * @brief Count the number of free bits.
+ */
+uint32_t Bitmap::FreeCount() const {
+    return this->freeBits;
 }
 
 // =====================================================
@@ -93,6 +208,17 @@ Bitmap Bitmap::LoadFromBytes(std::vector<char> data,
 
     // Replace internal storage with loaded data
     bitmap.data = std::move(data);
+    bitmap.data.resize((bitCount + 7) / 8, 0);
+
+    // Rebuild the free counter
+    const uint32_t words = (bitCount + WORD_BITS - 1) / WORD_BITS;
+    uint32_t used = 0;
+    for (uint32_t w = 0; w < words; ++w) {
+        used += PopCount(bitmap.Word(w));
+    }
+
+    // Padding bits past the end are counted as allocated
+    bitmap.freeBits = words * WORD_BITS - used;
     return bitmap;
 }
 
@@ -102,3 +228,41 @@ Bitmap Bitmap::LoadFromBytes(std::vector<char> data,
 std::vector<char> Bitmap::SaveToBytes() const {
     return this->data;
 }
+
+/**
+ * @brief Take the bytes modified since the last call.
+ */
+std::vector<ImageWrite> Bitmap::TakeDirty(const uint64_t offset) {
+    return this->dirty.Take(this->data, offset);
+}
+
+// =====================================================
+// Word access
+// =====================================================
+
+/**
+ * @brief Load 64 bits of the bitmap as a word.
+ */
+uint64_t Bitmap::Word(const uint32_t wordIndex) const {
+    const std::size_t offset = static_cast<std::size_t>(wordIndex) * (WORD_BITS / 8);
+    const std::size_t available = std::min<std::size_t>(this->data.size() - offset, WORD_BITS / 8);
+
+    // Bytes past the end of the bitmap read as allocated
+    uint8_t bytes[WORD_BITS / 8];
+    std::memset(bytes, 0xFF, sizeof(bytes));
+    std::memcpy(bytes, this->data.data() + offset, available);
+
+    uint64_t word = 0;
+    for (uint32_t i = 0; i < WORD_BITS / 8; ++i) {
+        word |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+    }
+
+    // Bits past the end of the bitmap read as allocated
+    const uint32_t firstBit = wordIndex * WORD_BITS;
+    if (firstBit + WORD_BITS > this->size) {
+        const uint32_t valid = this->size - firstBit;
+        word |= UINT64_MAX << valid;
+    }
+
+    return word;
+}
@@ -0,0 +1,449 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#include "../include/BlockCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "../helpers/FileIOExceptions.h"
+#include "../helpers/FilesystemExceptions.h"
+
+BlockCache::BlockCache(FileIOHandler& io, const std::size_t capacity)
+    : io(io),
+      capacity(std::max<std::size_t>(capacity, 1)) {
+}
+
+void BlockCache::Configure(const uint64_t dataOffset, const uint32_t blockSize) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->entries.clear();
+    this->lru.clear();
+    this->dataOffset = dataOffset;
+    this->blockSize = blockSize;
+}
+
+const char* BlockCache::ReadBlock(const uint32_t block) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    if (this->io.IsMapped() && this->entries.count(block) == 0) {
+        const char* mapped = this->io.Data(this->OffsetOf(block), this->blockSize);
+        if (!mapped) {
+            throw InvalidBlockSizeException(
+                "Could not read block " + std::to_string(block)
+            );
+        }
+        return mapped;
+    }
+
+    return this->Lookup(block, true).data.data();
+}
+
+void BlockCache::WriteBlock(const uint32_t block, std::vector<char> data) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    data.resize(this->blockSize, 0);
+
+    if (this->io.IsMapped() && !this->pinned) {
+        this->io.WriteBytes(this->OffsetOf(block), data);
+        return;
+    }
+
+    Entry& entry = this->Lookup(block, false);
+    entry.data = std::move(data);
+    this->MarkDirty(entry);
+}
+
+void BlockCache::WriteBytes(const uint32_t block,
+                            const uint32_t offset,
+                            const std::vector<char>& data) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    if (offset + data.size() > this->blockSize) {
+        throw InvalidBlockSizeException(
+            "Write exceeds block " + std::to_string(block)
+        );
+    }
+
+    if (this->io.IsMapped() && !this->pinned) {
+        this->io.WriteBytes(this->OffsetOf(block) + offset, data);
+        return;
+    }
+
+    Entry& entry = this->Lookup(block, true);
+    std::copy(data.begin(), data.end(), entry.data.begin() + offset);
+    this->MarkDirty(entry);
+}
+
+void BlockCache::WriteThrough(const uint32_t firstBlock,
+                              const char* data,
+                              const uint64_t size) {
+    const auto blocks = static_cast<uint32_t>((size + this->blockSize - 1) / this->blockSize);
+    this->SubmitThrough({BlockRun{firstBlock, blocks}}, data, size).get();
+}
+
+std::future<void> BlockCache::SubmitThrough(const std::vector<BlockRun>& runs,
+                                            const char* data,
+                                            const uint64_t size) {
+    std::vector<IORequest> writes;
+    writes.reserve(runs.size());
+
+    uint64_t done = 0;
+    for (const BlockRun& run : runs) {
+        if (done == size) {
+            break;
+        }
+
+        for (uint32_t i = 0; i < run.length; ++i) {
+            this->Discard(run.start + i);
+        }
+
+        const uint64_t chunk = std::min<uint64_t>(
+            static_cast<uint64_t>(run.length) * this->blockSize, size - done
+        );
+        writes.push_back(IORequest::Write(this->OffsetOf(run.start), data + done, chunk));
+        done += chunk;
+    }
+
+    // The blocks belong to the writer's inode; no cache lock is needed
+    return this->io.Submit(std::move(writes));
+}
+
+void BlockCache::ReadThrough(const uint32_t firstBlock,
+                             const uint32_t offset,
+                             char* out,
+                             const uint64_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    const auto blocks = static_cast<uint32_t>((offset + size + this->blockSize - 1) / this->blockSize);
+    this->ReadThrough({BlockRun{firstBlock, blocks}}, offset, out, size);
+}
+
+void BlockCache::ReadThrough(const std::vector<BlockRun>& runs,
+                             const uint32_t offset,
+                             char* out,
+                             const uint64_t size) {
+    std::vector<IORequest> reads;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        // Only the first run starts inside a block
+        uint64_t done = 0;
+        uint64_t inRun = offset;
+        for (const BlockRun& run : runs) {
+            if (done == size) {
+                break;
+            }
+
+            const uint64_t end = std::min<uint64_t>(
+                static_cast<uint64_t>(run.length) * this->blockSize, inRun + size - done
+            );
+            char* base = out + done - inRun;
+
+            // Part of the run that lies inside block i, relative to the run start
+            auto first = [&](const uint64_t i) { return std::max<uint64_t>(i * this->blockSize, inRun); };
+            auto last = [&](const uint64_t i) { return std::min<uint64_t>((i + 1) * this->blockSize, end); };
+
+            const auto blocks = static_cast<uint32_t>((end + this->blockSize - 1) / this->blockSize);
+
+            // Cached copies may be newer than the image
+            for (uint32_t i = 0; i < blocks; ++i) {
+                const auto it = this->entries.find(run.start + i);
+                if (it == this->entries.end()) {
+                    continue;
+                }
+
+                if (it->second.listed) {
+                    this->lru.splice(this->lru.begin(), this->lru, it->second.lru);
+                }
+                std::memcpy(base + first(i),
+                            it->second.data.data() + (first(i) - static_cast<uint64_t>(i) * this->blockSize),
+                            last(i) - first(i));
+            }
+
+            for (const BlockRun& stretch : this->Uncached(BlockRun{run.start, blocks})) {
+                const uint64_t from = first(stretch.start - run.start);
+                const uint64_t to = last(stretch.start - run.start + stretch.length - 1);
+                reads.push_back(IORequest::Read(this->OffsetOf(run.start) + from, base + from, to - from));
+            }
+
+            done += end - inRun;
+            inRun = 0;
+        }
+    }
+
+    // Read outside the lock; the blocks belong to the reader's inode
+    try {
+        this->io.Transfer(std::move(reads));
+    } catch (const FileReadException& e) {
+        throw InvalidBlockSizeException(std::string("Could not read blocks: ") + e.what());
+    }
+}
+
+void BlockCache::Prefetch(const BlockRun& run) {
+    this->Prefetch(std::vector<BlockRun>{run});
+}
+
+void BlockCache::Prefetch(const std::vector<BlockRun>& runs) {
+    if (this->io.IsMapped()) {
+        return;
+    }
+
+    std::vector<BlockRun> missing;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (const BlockRun& run : runs) {
+            for (const BlockRun& stretch : this->Uncached(run)) {
+                missing.push_back(stretch);
+            }
+        }
+    }
+
+    if (missing.empty()) {
+        return;
+    }
+
+    std::vector<std::vector<char>> buffers(missing.size());
+    std::vector<IORequest> reads;
+    reads.reserve(missing.size());
+    for (std::size_t i = 0; i < missing.size(); ++i) {
+        const uint64_t bytes = static_cast<uint64_t>(missing[i].length) * this->blockSize;
+        buffers[i].resize(bytes);
+        reads.push_back(IORequest::Read(this->OffsetOf(missing[i].start), buffers[i].data(), bytes));
+    }
+
+    try {
+        this->io.Transfer(std::move(reads));
+    } catch (const FileReadException& e) {
+        throw InvalidBlockSizeException(std::string("Could not read blocks: ") + e.what());
+    }
+
+    // Blocks loaded by another thread in the meantime are kept
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (std::size_t run = 0; run < missing.size(); ++run) {
+        for (uint32_t i = 0; i < missing[run].length; ++i) {
+            const uint32_t block = missing[run].start + i;
+            if (this->entries.count(block) != 0) {
+                continue;
+            }
+
+            const auto from = buffers[run].begin() + static_cast<std::ptrdiff_t>(i) * this->blockSize;
+            Entry entry;
+            entry.data.assign(from, from + this->blockSize);
+
+            this->lru.push_front(block);
+            entry.lru = this->lru.begin();
+            this->entries.emplace(block, std::move(entry));
+        }
+    }
+    this->Evict();
+}
+
+void BlockCache::Discard(const uint32_t block) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    const auto it = this->entries.find(block);
+    if (it == this->entries.end()) {
+        return;
+    }
+
+    if (it->second.listed) {
+        this->lru.erase(it->second.lru);
+    }
+    this->entries.erase(it);
+}
+
+void BlockCache::CopyBlock(const uint32_t block, char* out) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        const auto it = this->entries.find(block);
+        if (it != this->entries.end()) {
+            if (it->second.listed) {
+                this->lru.splice(this->lru.begin(), this->lru, it->second.lru);
+            }
+            std::memcpy(out, it->second.data.data(), this->blockSize);
+            return;
+        }
+
+        if (const char* mapped = this->io.Data(this->OffsetOf(block), this->blockSize)) {
+            std::memcpy(out, mapped, this->blockSize);
+            return;
+        }
+    }
+
+    // Read outside the lock so that misses of other threads proceed
+    std::vector<char> data = this->io.ReadBytes(this->OffsetOf(block), this->blockSize);
+    if (data.size() != this->blockSize) {
+        throw InvalidBlockSizeException(
+            "Could not read block " + std::to_string(block)
+        );
+    }
+    std::memcpy(out, data.data(), this->blockSize);
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->entries.count(block) == 0) {
+        Entry entry;
+        entry.data = std::move(data);
+
+        this->lru.push_front(block);
+        entry.lru = this->lru.begin();
+        this->entries.emplace(block, std::move(entry));
+        this->Evict();
+    }
+}
+
+void BlockCache::SetPinned(const bool pinned) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->pinned = pinned;
+
+    // Unpinned dirty blocks are evicted like any other
+    if (!pinned) {
+        for (auto& [block, entry] : this->entries) {
+            if (!entry.listed) {
+                this->lru.push_front(block);
+                entry.lru = this->lru.begin();
+                entry.listed = true;
+            }
+        }
+    }
+}
+
+std::vector<ImageWrite> BlockCache::TakeDirty() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->CollectDirty();
+}
+
+void BlockCache::Flush() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->io.WriteAll(this->CollectDirty());
+}
+
+void BlockCache::Clear() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->entries.clear();
+    this->lru.clear();
+}
+
+std::size_t BlockCache::Capacity() const {
+    return this->capacity;
+}
+
+std::vector<BlockRun> BlockCache::Uncached(const BlockRun& run) const {
+    std::vector<BlockRun> stretches;
+    for (uint32_t i = 0; i < run.length; ++i) {
+        const uint32_t block = run.start + i;
+        if (this->entries.count(block) != 0) {
+            continue;
+        }
+
+        if (!stretches.empty() &&
+            stretches.back().start + stretches.back().length == block) {
+            ++stretches.back().length;
+        } else {
+            stretches.push_back(BlockRun{block, 1});
+        }
+    }
+    return stretches;
+}
+
+std::vector<ImageWrite> BlockCache::CollectDirty() {
+    std::vector<uint32_t> dirty;
+    for (const auto& [block, entry] : this->entries) {
+        if (entry.dirty) {
+            dirty.push_back(block);
+        }
+    }
+
+    std::sort(dirty.begin(), dirty.end());
+
+    // Merge runs of adjacent blocks into a single write
+    std::vector<ImageWrite> writes;
+    size_t i = 0;
+    while (i < dirty.size()) {
+        size_t end = i + 1;
+        while (end < dirty.size() && dirty[end] == dirty[end - 1] + 1) {
+            ++end;
+        }
+
+        std::vector<char> run;
+        run.reserve((end - i) * this->blockSize);
+        for (size_t j = i; j < end; ++j) {
+            Entry& entry = this->entries.at(dirty[j]);
+            run.insert(run.end(), entry.data.begin(), entry.data.end());
+            entry.dirty = false;
+
+            // Clean blocks take part in eviction again
+            if (!entry.listed) {
+                this->lru.push_front(dirty[j]);
+                entry.lru = this->lru.begin();
+                entry.listed = true;
+            }
+        }
+
+        writes.push_back(ImageWrite{this->OffsetOf(dirty[i]), std::move(run)});
+        i = end;
+    }
+
+    this->Evict();
+    return writes;
+}
+
+BlockCache::Entry& BlockCache::Lookup(const uint32_t block, const bool fetch) {
+    const auto it = this->entries.find(block);
+    if (it != this->entries.end()) {
+        // Move to the front of the LRU list
+        if (it->second.listed) {
+            this->lru.splice(this->lru.begin(), this->lru, it->second.lru);
+        }
+        return it->second;
+    }
+
+    Entry entry;
+    if (fetch) {
+        entry.data = this->io.ReadBytes(this->OffsetOf(block), this->blockSize);
+        if (entry.data.size() != this->blockSize) {
+            throw InvalidBlockSizeException(
+                "Could not read block " + std::to_string(block)
+            );
+        }
+    } else {
+        entry.data.assign(this->blockSize, 0);
+    }
+
+    this->lru.push_front(block);
+    entry.lru = this->lru.begin();
+
+    Entry& inserted = this->entries.emplace(block, std::move(entry)).first->second;
+    this->Evict();
+    return inserted;
+}
+
+void BlockCache::MarkDirty(Entry& entry) {
+    entry.dirty = true;
+
+    if (this->pinned && entry.listed) {
+        this->lru.erase(entry.lru);
+        entry.listed = false;
+    }
+}
+
+void BlockCache::Evict() {
+    while (this->entries.size() > this->capacity && this->lru.size() > 1) {
+        const uint32_t victim = this->lru.back();
+        Entry& entry = this->entries.at(victim);
+
+        if (entry.dirty) {
+            this->io.WriteBytes(this->OffsetOf(victim), entry.data);
+        }
+
+        this->lru.pop_back();
+        this->entries.erase(victim);
+    }
+}
+
+uint64_t BlockCache::OffsetOf(const uint32_t block) const {
+    return this->dataOffset + static_cast<uint64_t>(block) * this->blockSize;
+}
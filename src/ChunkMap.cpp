@@ -0,0 +1,134 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#include "../include/ChunkMap.h"
+
+#include <algorithm>
+
+#include "../helpers/FileIOExceptions.h"
+#include "../helpers/IntParser.h"
+#include "../helpers/Lz4.h"
+
+ChunkMap::ChunkMap(const uint32_t blockSize)
+    : blockSize(blockSize),
+      first{0} {
+}
+
+uint64_t ChunkMap::ChunkBytes() const {
+    return static_cast<uint64_t>(CHUNK_BLOCKS) * this->blockSize;
+}
+
+uint32_t ChunkMap::ChunksFor(const uint64_t fileSize) const {
+    return static_cast<uint32_t>((fileSize + this->ChunkBytes() - 1) / this->ChunkBytes());
+}
+
+uint32_t ChunkMap::TableBlocks(const uint32_t chunks) const {
+    return (chunks + this->blockSize - 1) / this->blockSize;
+}
+
+uint32_t ChunkMap::Count() const {
+    return static_cast<uint32_t>(this->stored.size());
+}
+
+uint32_t ChunkMap::StoredBlocks(const uint32_t chunk) const {
+    return this->stored[chunk];
+}
+
+uint32_t ChunkMap::FirstBlock(const uint32_t chunk) const {
+    return this->first[chunk];
+}
+
+bool ChunkMap::Compressed(const uint64_t fileSize) const {
+    for (uint32_t chunk = 0; chunk < this->Count(); ++chunk) {
+        const uint64_t contents = std::min(this->ChunkBytes(), fileSize - chunk * this->ChunkBytes());
+        if (this->stored[chunk] < (contents + this->blockSize - 1) / this->blockSize) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ChunkMap::Push(const uint32_t storedBlocks) {
+    this->stored.push_back(static_cast<uint8_t>(storedBlocks));
+    this->first.push_back(this->first.back() + storedBlocks);
+}
+
+void ChunkMap::Append(const ChunkMap& other) {
+    for (const uint8_t blocks : other.stored) {
+        this->Push(blocks);
+    }
+}
+
+void ChunkMap::Truncate(const uint32_t chunks) {
+    if (chunks < this->Count()) {
+        this->stored.resize(chunks);
+        this->first.resize(chunks + 1);
+    }
+}
+
+std::vector<char> ChunkMap::Pack(const char* data, const std::size_t size) const {
+    const std::size_t contentBlocks = (size + this->blockSize - 1) / this->blockSize;
+
+    // Compressed only if the length and the data fit one block less
+    if (contentBlocks > 1) {
+        std::vector<char> compressed((contentBlocks - 1) * this->blockSize - HEADER_BYTES);
+        const std::size_t length = Lz4::Compress(data, size, compressed.data(), compressed.size());
+
+        if (length > 0) {
+            const std::size_t blocks = (HEADER_BYTES + length + this->blockSize - 1) / this->blockSize;
+            std::vector<char> out(blocks * this->blockSize, 0);
+            IntParser::WriteUInt32(out.data(), static_cast<uint32_t>(length));
+            std::copy_n(compressed.data(), length, out.data() + HEADER_BYTES);
+            return out;
+        }
+    }
+
+    std::vector<char> out(contentBlocks * this->blockSize, 0);
+    std::copy_n(data, size, out.data());
+    return out;
+}
+
+void ChunkMap::Unpack(const char* stored, const uint32_t storedBlocks,
+                      char* out, const std::size_t size) const {
+    const std::size_t contentBlocks = (size + this->blockSize - 1) / this->blockSize;
+
+    if (storedBlocks == contentBlocks) {
+        std::copy_n(stored, size, out);
+        return;
+    }
+
+    const uint32_t length = IntParser::ReadUInt32(stored);
+    if (length > static_cast<uint64_t>(storedBlocks) * this->blockSize - HEADER_BYTES) {
+        throw FileReadException("Damaged compressed chunk");
+    }
+    Lz4::Decompress(stored + HEADER_BYTES, length, out, size);
+}
+
+ChunkMap ChunkMap::LoadFromBytes(const std::vector<char>& data,
+                                 const uint64_t fileSize,
+                                 const uint32_t blockSize) {
+    ChunkMap map(blockSize);
+    const uint32_t chunks = map.ChunksFor(fileSize);
+
+    if (data.size() < chunks) {
+        throw FileReadException("Damaged chunk table");
+    }
+
+    for (uint32_t chunk = 0; chunk < chunks; ++chunk) {
+        const uint64_t contents = std::min(map.ChunkBytes(), fileSize - chunk * map.ChunkBytes());
+        const auto blocks = static_cast<uint8_t>(data[chunk]);
+
+        if (blocks == 0 || blocks > (contents + blockSize - 1) / blockSize) {
+            throw FileReadException("Damaged chunk table");
+        }
+        map.Push(blocks);
+    }
+    return map;
+}
+
+std::vector<char> ChunkMap::SaveToBytes() const {
+    std::vector<char> data(static_cast<std::size_t>(this->TableBlocks(this->Count())) * this->blockSize, 0);
+    std::copy(this->stored.begin(), this->stored.end(), data.begin());
+    return data;
+}
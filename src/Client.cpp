@@ -0,0 +1,169 @@
+//
+// Created by laadim on 14.10.26.
+//
+#include "../include/Client.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../helpers/FileIOExceptions.h"
+
+// =====================================================
+// Construction
+// =====================================================
+
+Client::Client(const std::string& socketPath) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path)) {
+        throw CouldNotOpenFileException("Invalid socket path: " + socketPath);
+    }
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    this->fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (this->fd < 0) {
+        throw CouldNotOpenFileException(std::string("Cannot create socket: ") + std::strerror(errno));
+    }
+    if (::connect(this->fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        const std::string reason = std::strerror(errno);
+        ::close(this->fd);
+        throw CouldNotOpenFileException("Cannot connect to " + socketPath + ": " + reason);
+    }
+}
+
+Client::~Client() {
+    ::close(this->fd);
+}
+
+// =====================================================
+// Main loop
+// =====================================================
+
+/**
+ * @brief Pipelines commands to the server.
+ *
+ * A batch ends after PIPELINE_DEPTH commands, at "exit" or at the end
+ * of input; its responses are printed before the next batch is read.
+ */
+void Client::Run(std::istream& in, std::ostream& out, bool interactive) {
+    const std::size_t depth = interactive ? 1 : PIPELINE_DEPTH;
+    std::string cwd = "/";
+    bool done = false;
+
+    while (!done) {
+        std::string batch;
+        std::size_t commands = 0;
+
+        while (commands < depth) {
+            if (interactive) {
+                out << cwd << " > " << std::flush;
+            }
+
+            std::string line;
+            if (!std::getline(in, line)) {
+                done = true;
+                break;
+            }
+
+            // Blank lines get no response
+            if (std::all_of(line.begin(), line.end(), ::isspace)) {
+                continue;
+            }
+
+            batch += line;
+            batch += '\n';
+            ++commands;
+
+            // The server closes the connection after "exit"
+            std::string cmd;
+            std::istringstream(line) >> cmd;
+            if (cmd == "exit") {
+                done = true;
+                break;
+            }
+        }
+
+        if (commands == 0) {
+            break;
+        }
+        this->SendAll(batch);
+
+        for (std::size_t i = 0; i < commands; ++i) {
+            const std::string result = this->ReadResponse(cwd);
+            if (result == "exit") {
+                return;
+            }
+            out << result << '\n';
+        }
+        out << std::flush;
+    }
+}
+
+// =====================================================
+// Socket I/O
+// =====================================================
+
+void Client::SendAll(const std::string& data) {
+    std::size_t sent = 0;
+    while (sent < data.size()) {
+        const ssize_t put = ::send(this->fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (put < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw FileWriteException(std::string("Cannot send commands: ") + std::strerror(errno));
+        }
+        sent += static_cast<std::size_t>(put);
+    }
+}
+
+std::string Client::ReadResponse(std::string& cwd) {
+    // Header: "<length> <cwd>\n"
+    std::size_t end;
+    while ((end = this->input.find('\n', this->consumed)) == std::string::npos) {
+        this->Fill(this->input.size() - this->consumed + 1);
+    }
+    const std::string header = this->input.substr(this->consumed, end - this->consumed);
+    this->consumed = end + 1;
+
+    const std::size_t space = header.find(' ');
+    std::size_t length = 0;
+    try {
+        length = std::stoull(header.substr(0, space));
+    } catch (const std::exception&) {
+        throw FileReadException("Malformed response: " + header);
+    }
+    cwd = space == std::string::npos ? "/" : header.substr(space + 1);
+
+    this->Fill(length);
+    std::string result = this->input.substr(this->consumed, length);
+    this->consumed += length;
+
+    // Drop consumed bytes once they dominate the buffer
+    if (this->consumed > this->input.size() / 2) {
+        this->input.erase(0, this->consumed);
+        this->consumed = 0;
+    }
+    return result;
+}
+
+void Client::Fill(const std::size_t count) {
+    char buffer[64 * 1024];
+
+    while (this->input.size() - this->consumed < count) {
+        const ssize_t got = ::recv(this->fd, buffer, sizeof(buffer), 0);
+        if (got > 0) {
+            this->input.append(buffer, static_cast<std::size_t>(got));
+            continue;
+        }
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        throw FileReadException("Server closed the connection");
+    }
+}
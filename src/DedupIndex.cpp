@@ -0,0 +1,170 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#include "../include/DedupIndex.h"
+
+#include "../helpers/IntParser.h"
+
+namespace {
+    constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+    constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+    constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+    constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+    constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+    constexpr uint64_t RotateLeft(const uint64_t value, const int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    constexpr uint64_t Round(const uint64_t lane, const uint64_t word) {
+        return RotateLeft(lane + word * PRIME2, 31) * PRIME1;
+    }
+
+    constexpr uint64_t Merge(const uint64_t hash, const uint64_t lane) {
+        return (hash ^ Round(0, lane)) * PRIME1 + PRIME4;
+    }
+}
+
+DedupIndex::DedupIndex(const uint32_t blockCount)
+    : size(blockCount),
+      data(ByteSize(blockCount), 0) {
+}
+
+bool DedupIndex::Enabled() const {
+    return this->size > 0;
+}
+
+/**
+ * @brief Hash in the style of xxHash64, over little-endian words.
+ *
+ * Four independent lanes keep the multiplier busy, so hashing a block
+ * costs far less than writing it. The hash is stored on disk and must
+ * not depend on the host byte order.
+ */
+uint64_t DedupIndex::Hash(const char* data, const std::size_t size) {
+    const char* position = data;
+    const char* const end = data + size;
+    uint64_t hash;
+
+    if (size >= 32) {
+        uint64_t lanes[4] = {PRIME1 + PRIME2, PRIME2, 0, 0 - PRIME1};
+
+        for (; end - position >= 32; position += 32) {
+            for (int i = 0; i < 4; ++i) {
+                lanes[i] = Round(lanes[i], IntParser::ReadUInt64(position + 8 * i));
+            }
+        }
+
+        hash = RotateLeft(lanes[0], 1) + RotateLeft(lanes[1], 7) +
+               RotateLeft(lanes[2], 12) + RotateLeft(lanes[3], 18);
+        for (const uint64_t lane : lanes) {
+            hash = Merge(hash, lane);
+        }
+    } else {
+        hash = PRIME5;
+    }
+
+    hash += size;
+
+    for (; end - position >= 8; position += 8) {
+        hash ^= Round(0, IntParser::ReadUInt64(position));
+        hash = RotateLeft(hash, 27) * PRIME1 + PRIME4;
+    }
+    for (; position < end; ++position) {
+        hash ^= static_cast<uint64_t>(static_cast<uint8_t>(*position)) * PRIME5;
+        hash = RotateLeft(hash, 11) * PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+
+    // NO_HASH marks unindexed blocks
+    return hash == NO_HASH ? 1 : hash;
+}
+
+std::optional<uint32_t> DedupIndex::Find(const uint64_t hash) const {
+    const auto it = this->blocks.find(hash);
+    if (it == this->blocks.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+uint64_t DedupIndex::Get(const uint32_t block) const {
+    if (block >= this->size) {
+        return NO_HASH;
+    }
+    return IntParser::ReadUInt64(this->data.data() + static_cast<std::size_t>(block) * ENTRY_BYTES);
+}
+
+void DedupIndex::Insert(const uint32_t block, const uint64_t hash) {
+    if (block >= this->size || hash == NO_HASH) {
+        return;
+    }
+
+    this->Forget(block);
+    this->Put(block, hash);
+    this->blocks[hash] = block;
+    ++this->indexed;
+}
+
+void DedupIndex::Forget(const uint32_t block) {
+    const uint64_t hash = this->Get(block);
+    if (hash == NO_HASH) {
+        return;
+    }
+
+    this->Put(block, NO_HASH);
+    --this->indexed;
+
+    // Another block may have replaced this one in the map
+    const auto it = this->blocks.find(hash);
+    if (it != this->blocks.end() && it->second == block) {
+        this->blocks.erase(it);
+    }
+}
+
+uint32_t DedupIndex::IndexedCount() const {
+    return this->indexed;
+}
+
+uint64_t DedupIndex::ByteSize(const uint32_t blockCount) {
+    return static_cast<uint64_t>(blockCount) * ENTRY_BYTES;
+}
+
+DedupIndex DedupIndex::LoadFromBytes(std::vector<char> data, const uint32_t blockCount) {
+    DedupIndex table(blockCount);
+
+    table.data = std::move(data);
+    table.data.resize(ByteSize(blockCount), 0);
+
+    // Rebuild the hash map
+    for (uint32_t block = 0; block < blockCount; ++block) {
+        const uint64_t hash = table.Get(block);
+        if (hash != NO_HASH) {
+            table.blocks[hash] = block;
+            ++table.indexed;
+        }
+    }
+    return table;
+}
+
+std::vector<char> DedupIndex::SaveToBytes() const {
+    return this->data;
+}
+
+std::vector<ImageWrite> DedupIndex::TakeDirty(const uint64_t offset) {
+    return this->dirty.Take(this->data, offset);
+}
+
+void DedupIndex::Put(const uint32_t block, const uint64_t hash) {
+    const uint64_t offset = static_cast<uint64_t>(block) * ENTRY_BYTES;
+
+    IntParser::WriteUInt64(this->data.data() + offset, hash);
+
+    this->dirty.Mark(offset, ENTRY_BYTES);
+}
@@ -0,0 +1,159 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#include "../include/DirectoryIndex.h"
+
+DirectoryIndex::DirectoryIndex(const std::size_t capacity)
+    : capacity(capacity) {
+}
+
+std::size_t DirectoryIndex::Capacity() const {
+    return this->capacity;
+}
+
+bool DirectoryIndex::Contains(const uint32_t dir) const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->directories.count(dir) != 0;
+}
+
+void DirectoryIndex::Build(const uint32_t dir,
+                           const std::vector<ChildNodeNameIdPair>& children) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->Forget(dir);
+
+    // Make room by dropping every other directory
+    if (this->entryCount + children.size() > this->capacity) {
+        this->directories.clear();
+        this->parents.clear();
+        this->entryCount = 0;
+    }
+
+    auto& names = this->directories[dir];
+    names.reserve(children.size());
+
+    for (const auto& child : children) {
+        if (names.emplace(child.name, child.id).second && !IsDotEntry(child.name)) {
+            this->parents[child.id] = ParentEntry{dir, child.name};
+        }
+    }
+
+    this->entryCount += names.size();
+}
+
+std::optional<uint32_t> DirectoryIndex::Find(const uint32_t dir,
+                                             const std::string& name) const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto it = this->directories.find(dir);
+    if (it == this->directories.end()) {
+        return std::nullopt;
+    }
+
+    const auto entry = it->second.find(name);
+    if (entry == it->second.end()) {
+        return std::nullopt;
+    }
+    return entry->second;
+}
+
+bool DirectoryIndex::TryFind(const uint32_t dir,
+                             const std::string& name,
+                             std::optional<uint32_t>& child) const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto it = this->directories.find(dir);
+    if (it == this->directories.end()) {
+        return false;
+    }
+
+    const auto entry = it->second.find(name);
+    child = entry == it->second.end()
+        ? std::nullopt
+        : std::optional<uint32_t>(entry->second);
+    return true;
+}
+
+std::optional<DirectoryIndex::ParentEntry>
+DirectoryIndex::FindParent(const uint32_t child) const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto it = this->parents.find(child);
+    if (it == this->parents.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+void DirectoryIndex::Insert(const uint32_t dir,
+                            const std::string& name,
+                            const uint32_t child) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto it = this->directories.find(dir);
+    if (it == this->directories.end()) {
+        return;
+    }
+
+    if (it->second.emplace(name, child).second) {
+        ++this->entryCount;
+
+        if (!IsDotEntry(name)) {
+            this->parents[child] = ParentEntry{dir, name};
+        }
+    }
+}
+
+void DirectoryIndex::Remove(const uint32_t dir, const std::string& name) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto it = this->directories.find(dir);
+    if (it == this->directories.end()) {
+        return;
+    }
+
+    const auto entry = it->second.find(name);
+    if (entry == it->second.end()) {
+        return;
+    }
+
+    this->ForgetParent(entry->second, dir, name);
+    it->second.erase(entry);
+    --this->entryCount;
+}
+
+void DirectoryIndex::Drop(const uint32_t dir) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->Forget(dir);
+}
+
+void DirectoryIndex::Clear() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->directories.clear();
+    this->parents.clear();
+    this->entryCount = 0;
+}
+
+void DirectoryIndex::Forget(const uint32_t dir) {
+    const auto it = this->directories.find(dir);
+    if (it == this->directories.end()) {
+        return;
+    }
+
+    for (const auto& [name, child] : it->second) {
+        this->ForgetParent(child, dir, name);
+    }
+
+    this->entryCount -= it->second.size();
+    this->directories.erase(it);
+}
+
+bool DirectoryIndex::IsDotEntry(const std::string& name) {
+    return name == "." || name == "..";
+}
+
+void DirectoryIndex::ForgetParent(const uint32_t child,
+                                  const uint32_t dir,
+                                  const std::string& name) {
+    const auto it = this->parents.find(child);
+    if (it != this->parents.end() &&
+        it->second.parent == dir &&
+        it->second.name == name) {
+        this->parents.erase(it);
+    }
+}
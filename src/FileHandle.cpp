@@ -0,0 +1,85 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#include "../include/FileHandle.h"
+
+#include "../include/Filesystem.h"
+
+FileHandle::FileHandle(Filesystem& filesystem, const uint32_t inodeId)
+    : filesystem(&filesystem),
+      inodeId(inodeId) {
+}
+
+FileHandle::ReadAhead::ReadAhead(const ReadAhead& other)
+    : next(other.next.load(std::memory_order_relaxed)),
+      end(other.end.load(std::memory_order_relaxed)) {
+}
+
+FileHandle::ReadAhead& FileHandle::ReadAhead::operator=(const ReadAhead& other) {
+    this->next.store(other.next.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    this->end.store(other.end.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    return *this;
+}
+
+uint64_t FileHandle::Size() const {
+    const auto guard = this->filesystem->ShareOperations();
+    const auto lock = this->filesystem->ShareINode(this->inodeId);
+    return this->filesystem->readINode(this->inodeId).getSize();
+}
+
+std::size_t FileHandle::Read(const uint64_t offset,
+                             char* buffer,
+                             const std::size_t size) const {
+    // A sequential reader loads the next window once it passes the last
+    // one; reads of a whole window or more are large enough on their own
+    const uint64_t window = this->filesystem->options.readAheadBytes;
+    const bool sequential = offset == this->readAhead.next.load(std::memory_order_relaxed);
+    const uint64_t ahead =
+        sequential && size < window &&
+        offset + size > this->readAhead.end.load(std::memory_order_relaxed)
+            ? window
+            : 0;
+
+    std::size_t read = 0;
+    {
+        const auto guard = this->filesystem->ShareOperations();
+        const auto lock = this->filesystem->ShareINode(this->inodeId);
+        const INode node = this->filesystem->readINode(this->inodeId);
+        read = this->filesystem->ReadAt(node, offset, buffer, size, ahead);
+    }
+
+    if (ahead > 0) {
+        this->readAhead.end.store(offset + size + ahead, std::memory_order_relaxed);
+    } else if (!sequential) {
+        this->readAhead.end.store(0, std::memory_order_relaxed);
+    }
+    this->readAhead.next.store(offset + read, std::memory_order_relaxed);
+    return read;
+}
+
+void FileHandle::Write(const uint64_t offset,
+                       const char* data,
+                       const std::size_t size) {
+    const auto guard = this->filesystem->ShareOperations();
+    this->filesystem->EnsureWritable();
+    const auto lock = this->filesystem->LockINode(this->inodeId);
+    INode node = this->filesystem->readINode(this->inodeId);
+    this->filesystem->WriteAt(node, offset, data, size);
+}
+
+void FileHandle::Append(const char* data, const std::size_t size) {
+    const auto guard = this->filesystem->ShareOperations();
+    this->filesystem->EnsureWritable();
+    const auto lock = this->filesystem->LockINode(this->inodeId);
+    INode node = this->filesystem->readINode(this->inodeId);
+    this->filesystem->WriteAt(node, node.getSize(), data, size);
+}
+
+void FileHandle::Truncate(const uint64_t size) {
+    const auto guard = this->filesystem->ShareOperations();
+    this->filesystem->EnsureWritable();
+    const auto lock = this->filesystem->LockINode(this->inodeId);
+    INode node = this->filesystem->readINode(this->inodeId);
+    this->filesystem->TruncateAt(node, size);
+}
@@ -5,25 +5,112 @@
 #include "../include/Filesystem.h"
 
 #include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <iterator>
 #include <sstream>
 
 #include "../helpers/FileIOExceptions.h"
 #include "../helpers/FilesystemExceptions.h"
 #include "../helpers/IntParser.h"
+#include "../helpers/Perf.h"
 #include "../helpers/StringHelpers.h"
+#include "../include/ThreadPool.h"
+
+namespace {
+
+/// Number of operation guards held by the calling thread
+thread_local uint32_t operationDepth = 0;
+
+/// Chunks of a compressed file packed or unpacked by the calling thread alone
+constexpr uint32_t PARALLEL_CHUNKS = 8;
+
+/**
+ * @brief Run a task for every chunk, spread over a thread pool for many chunks.
+ *
+ * @throws The first exception raised by a task.
+ */
+void ForEachChunk(const uint32_t count, const std::function<void(uint32_t)>& task) {
+    const std::size_t workers = ThreadPool::DefaultThreads();
+    if (count < PARALLEL_CHUNKS || workers == 1) {
+        for (uint32_t chunk = 0; chunk < count; ++chunk) {
+            task(chunk);
+        }
+        return;
+    }
+
+    std::atomic<uint32_t> next{0};
+    std::exception_ptr error;
+    std::mutex mutex;
+    {
+        // Destroyed first, so every worker is done before the results are used
+        ThreadPool pool;
+        for (std::size_t worker = 0; worker < workers; ++worker) {
+            pool.Submit([&] {
+                try {
+                    for (uint32_t chunk = next++; chunk < count; chunk = next++) {
+                        task(chunk);
+                    }
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                }
+            });
+        }
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+} // namespace
 
-Filesystem::Filesystem(const std::string& imagePath)
+Filesystem::Filesystem(const std::string& imagePath,
+                       const FilesystemOptions& options)
     : FileIO(std::make_unique<FileIOHandler>()),
+      options(options),
       INodeBitmap(0),
       BlockBitmap(0),
+      References(0),
+      Dedup(0),
       imagePath(imagePath) {
 
+    // The stream shares one file position between all threads and
+    // requests in flight
     this->FileIO->OpenFile(
         this->imagePath,
-        FileIOHandler::FileModes::READ_WRITE
+        FileIOHandler::FileModes::READ_WRITE,
+        (options.threadSafe || options.asyncIO) && options.ioBackend == FileIOHandler::Backends::STREAM
+            ? FileIOHandler::Backends::POSITIONAL
+            : options.ioBackend
+    );
+
+    if (options.asyncIO) {
+        this->FileIO->StartAsync(options.asyncEngine, options.asyncQueueDepth);
+    }
+
+    this->Cache = std::make_unique<BlockCache>(
+        *this->FileIO,
+        options.blockCacheCapacity
+    );
+
+    this->INodes = std::make_unique<INodeCache>(
+        *this->FileIO,
+        options.inodeCacheCapacity
     );
 
+    this->Index = std::make_unique<DirectoryIndex>(
+        options.directoryIndexCapacity
+    );
+
+    this->Log = std::make_unique<Journal>(*this->FileIO);
+
     // Attempt to read superblock
     auto sbData = this->FileIO->ReadBytes(
         0,
@@ -34,16 +121,33 @@ Filesystem::Filesystem(const std::string& imagePath)
         return;
     }
 
-    std::array<char, Superblock::BYTE_SIZE> sbBytes{};
-    std::copy(sbData.begin(), sbData.end(), sbBytes.begin());
-
-    this->superblock = Superblock::fromBytes(sbBytes);
+    this->superblock = Superblock::fromBytes(sbData.data());
 
     // Invalid magic → not formatted
     if (this->superblock.magic != FILESYSTEM_MAGIC) {
         return;
     }
 
+    this->Cache->Configure(
+        this->superblock.dataBlocksOffset,
+        this->superblock.blockSize
+    );
+
+    this->INodes->Configure(
+        this->superblock.inodeTableOffset,
+        this->INodeRecordBytes()
+    );
+
+    // Finish the last commit before any metadata is read
+    this->Log->Configure(
+        this->superblock.journalOffset,
+        this->superblock.journalSize
+    );
+    this->Log->Replay();
+
+    this->INodes->SetPinned(this->Log->Enabled());
+    this->Cache->SetPinned(this->Log->Enabled());
+
     // Load inode bitmap
     const uint32_t inodeBitmapBytes =
         (this->superblock.totalInodes + 7) / 8;
@@ -68,70 +172,167 @@ Filesystem::Filesystem(const std::string& imagePath)
         this->superblock.totalBlocks
     );
 
-    // Load root inode
-    this->currentNode =
-        this->readINode(this->superblock.rootNodeId);
+    // Load reference counts (layout version 3+)
+    if (this->superblock.refcountOffset != 0) {
+        this->References = RefCountTable::LoadFromBytes(
+            this->FileIO->ReadBytes(
+                this->superblock.refcountOffset,
+                RefCountTable::ByteSize(this->superblock.totalBlocks)
+            ),
+            this->superblock.totalBlocks
+        );
+    }
+
+    // Load the deduplication index; images written before the field
+    // existed may hold anything there, so it must sit where Format()
+    // puts it
+    const uint64_t dedupOffset = this->superblock.refcountOffset +
+                                 RefCountTable::ByteSize(this->superblock.totalBlocks);
+    if (this->superblock.dedupOffset != 0 &&
+        this->superblock.refcountOffset != 0 &&
+        this->superblock.dedupOffset == dedupOffset &&
+        this->superblock.inodeTableOffset == dedupOffset + DedupIndex::ByteSize(this->superblock.totalBlocks)) {
+        this->Dedup = DedupIndex::LoadFromBytes(
+            this->FileIO->ReadBytes(
+                this->superblock.dedupOffset,
+                DedupIndex::ByteSize(this->superblock.totalBlocks)
+            ),
+            this->superblock.totalBlocks
+        );
+    } else {
+        this->superblock.dedupOffset = 0;
+    }
+
+    // Start in the root directory
+    this->workingDirectory = WorkingDirectory{
+        this->superblock.rootNodeId,
+        std::vector<std::string>{}
+    };
 
     this->formated = true;
+
+    // From layout version 4 on the image records whether it was unmounted
+    // properly; otherwise the metadata on disk is not trusted
+    if (this->superblock.version >= 4) {
+        if (this->superblock.state != Superblock::STATE_CLEAN) {
+            bool unrepairable = false;
+            try {
+                const auto guard = this->LockOperations();
+                this->mountReport = this->CheckImage(true, unrepairable);
+            } catch (const std::exception& e) {
+                this->mountReport = e.what();
+                unrepairable = true;
+            }
+
+            // Nothing is written to a damaged image; it stays marked as
+            // not clean, so the next mount checks it again
+            if (unrepairable) {
+                this->readOnly = true;
+                return;
+            }
+        }
+        this->superblock.state = Superblock::STATE_MOUNTED;
+        this->WriteSuperblock();
+        this->FileIO->Flush();
+    }
 }
 
 Filesystem::~Filesystem() {
-    if (!this->formated) {
+    if (!this->formated || this->readOnly) {
         this->FileIO->CloseFile();
         return;
     }
 
-    // Persist superblock
-    auto sb = this->superblock.toBytes();
-    this->FileIO->WriteBytes(
-        0,
-        std::vector<char>(sb.begin(), sb.end())
-    );
+    // Write back cached inodes, blocks and bitmaps, even mid-batch
+    this->batchDepth = 0;
+    this->Sync();
 
-    // Persist bitmaps
-    this->FileIO->WriteBytes(
-        this->superblock.inodeBitmapOffset,
-        this->INodeBitmap.SaveToBytes()
-    );
+    // Everything is on stable storage before the image is marked clean
+    if (this->superblock.version >= 4) {
+        this->FileIO->FlushToDisk();
+        this->superblock.state = Superblock::STATE_CLEAN;
+    }
 
-    this->FileIO->WriteBytes(
-        this->superblock.blockBitmapOffset,
-        this->BlockBitmap.SaveToBytes()
-    );
+    // Persist superblock (a version 1 image has no room for the extension)
+    this->WriteSuperblock();
 
     this->FileIO->Flush();
     this->FileIO->CloseFile();
 }
 
 
-void Filesystem::Format(const uint32_t bytes) {
-    // Resize backing image
-    if (this->FileIO->Resize(bytes) != bytes) {
-        throw CouldNotResizeImageException(
-            "Could not resize image"
+void Filesystem::Format(const uint64_t bytes, const FormatOptions& options) {
+    const uint32_t blockSize = options.blockSize;
+    const uint32_t blocksPerInode = options.blocksPerInode;
+
+    if (blockSize < FormatOptions::MIN_BLOCK_SIZE ||
+        blockSize > FormatOptions::MAX_BLOCK_SIZE ||
+        (blockSize & (blockSize - 1)) != 0) {
+        throw InvalidBlockSizeException(
+            "Block size must be a power of two between 1KB and 64KB"
+        );
+    }
+
+    if (blocksPerInode == 0) {
+        throw InvalidFilesystemSizeException(
+            "Inode ratio must be at least 1"
         );
     }
 
-    constexpr uint32_t BLOCK_SIZE = 1024;
+    const auto guard = this->LockOperations();
+
+    // Every data block costs its own bytes, a bitmap bit, a reference
+    // counter, a hash with deduplication and its share of an inode
+    // record and an inode bitmap bit
+    const uint64_t hashBytes = options.dedup ? DedupIndex::ENTRY_BYTES : 0;
+
+    // Journal of about 1/64 of the image plus the whole bitmaps, reference
+    // counters and hashes, which a single transaction may all touch, in
+    // whole blocks
+    constexpr uint64_t MIN_JOURNAL_BLOCKS = 16;
+    constexpr uint64_t MAX_JOURNAL_BLOCKS = 8192;
+
+    const uint64_t imageBlocks = bytes / blockSize;
+    const uint64_t tableBytes =
+        (imageBlocks / blocksPerInode + 7) / 8 +
+        (imageBlocks + 7) / 8 +
+        imageBlocks * (RefCountTable::ENTRY_BYTES + hashBytes);
+    const uint64_t journalBlocks = std::min(
+        std::clamp(imageBlocks / 64, MIN_JOURNAL_BLOCKS, MAX_JOURNAL_BLOCKS) +
+            (tableBytes + blockSize - 1) / blockSize,
+        imageBlocks / 4
+    );
+    const uint64_t journalBytes = journalBlocks * blockSize;
+
+    auto metadataBytes = [&](const uint64_t blocks, const uint64_t inodes) {
+        return blockSize +
+               journalBytes +
+               (inodes + 7) / 8 +
+               (blocks + 7) / 8 +
+               RefCountTable::ByteSize(blocks) +
+               blocks * hashBytes +
+               inodes * INode::BYTES;
+    };
 
-    uint32_t blocks = bytes / BLOCK_SIZE;
-    uint32_t inodes = 0;
+    const uint64_t reserved = blockSize + journalBytes;
+    if (bytes <= reserved) {
+        throw InvalidFilesystemSizeException(
+            "Filesystem too small"
+        );
+    }
 
-    // Compute geometry that fits
-    while (blocks > 0) {
-        constexpr uint32_t BLOCKS_PER_INODE = 4;
-        inodes = blocks / BLOCKS_PER_INODE;
+    // Estimate in eighths of a byte per block, then settle the rounding
+    const uint64_t eighthsPerBlock =
+        8 * (blockSize + RefCountTable::ENTRY_BYTES + hashBytes) + 1 +
+        (8 * INode::BYTES + 1 + blocksPerInode - 1) / blocksPerInode;
 
-        uint32_t metadata =
-            Superblock::BYTE_SIZE +
-            ((inodes + 7) / 8) +
-            ((blocks + 7) / 8) +
-            inodes * INode::BYTES;
+    uint64_t blocks = (bytes - reserved) * 8 / eighthsPerBlock;
+    uint64_t inodes = blocks / blocksPerInode;
 
-        if (metadata + blocks * BLOCK_SIZE <= bytes) {
-            break;
-        }
+    while (blocks > 0 &&
+           metadataBytes(blocks, inodes) + blocks * blockSize > bytes) {
         --blocks;
+        inodes = blocks / blocksPerInode;
     }
 
     if (blocks == 0 || inodes == 0) {
@@ -140,32 +341,86 @@ void Filesystem::Format(const uint32_t bytes) {
         );
     }
 
+    if (blocks > UINT32_MAX) {
+        throw InvalidFilesystemSizeException(
+            "Filesystem has too many blocks, use a larger block size"
+        );
+    }
+
+    // Cached blocks and inodes belong to the old layout
+    this->Cache->Clear();
+    this->INodes->Clear();
+    this->Index->Clear();
+    this->releasedBlocks.clear();
+
+    // Resize backing image
+    if (this->FileIO->Resize(bytes, !options.fast) != bytes) {
+        throw CouldNotResizeImageException(
+            "Could not resize image"
+        );
+    }
+
     // Initialize superblock
     this->superblock = Superblock{};
     this->superblock.magic = FILESYSTEM_MAGIC;
-    this->superblock.blockSize = BLOCK_SIZE;
-    this->superblock.totalBlocks = blocks;
-    this->superblock.totalInodes = inodes;
+    this->superblock.blockSize = blockSize;
+    this->superblock.totalBlocks = static_cast<uint32_t>(blocks);
+    this->superblock.totalInodes = static_cast<uint32_t>(inodes);
     this->superblock.size = bytes;
+    this->superblock.version = Superblock::CURRENT_VERSION;
+    this->superblock.state = Superblock::STATE_MOUNTED;
+    this->superblock.compression = options.compress
+        ? Superblock::COMPRESSION_LZ4
+        : Superblock::COMPRESSION_NONE;
+
+    // The journal starts at the first block boundary
+    this->superblock.journalOffset = journalBytes > 0 ? blockSize : 0;
+    this->superblock.journalSize = journalBytes;
 
     this->superblock.inodeBitmapOffset =
-        Superblock::BYTE_SIZE;
+        blockSize + journalBytes;
 
     this->superblock.blockBitmapOffset =
         this->superblock.inodeBitmapOffset +
         (inodes + 7) / 8;
 
-    this->superblock.inodeTableOffset =
+    this->superblock.refcountOffset =
         this->superblock.blockBitmapOffset +
         (blocks + 7) / 8;
 
+    this->superblock.dedupOffset = options.dedup
+        ? this->superblock.refcountOffset + RefCountTable::ByteSize(this->superblock.totalBlocks)
+        : 0;
+
+    this->superblock.inodeTableOffset =
+        this->superblock.refcountOffset +
+        RefCountTable::ByteSize(this->superblock.totalBlocks) +
+        static_cast<uint64_t>(this->superblock.totalBlocks) * hashBytes;
+
     this->superblock.dataBlocksOffset =
         this->superblock.inodeTableOffset +
         inodes * INode::BYTES;
 
+    this->Cache->Configure(
+        this->superblock.dataBlocksOffset,
+        this->superblock.blockSize
+    );
+    this->INodes->Configure(this->superblock.inodeTableOffset, INode::BYTES);
+
+    this->Log->Configure(
+        this->superblock.journalOffset,
+        this->superblock.journalSize
+    );
+    this->Log->Reset();
+
+    this->INodes->SetPinned(this->Log->Enabled());
+    this->Cache->SetPinned(this->Log->Enabled());
+
     // Initialize bitmaps
-    this->INodeBitmap = Bitmap(inodes);
-    this->BlockBitmap = Bitmap(blocks);
+    this->INodeBitmap = Bitmap(this->superblock.totalInodes);
+    this->BlockBitmap = Bitmap(this->superblock.totalBlocks);
+    this->References = RefCountTable(this->superblock.totalBlocks);
+    this->Dedup = DedupIndex(options.dedup ? this->superblock.totalBlocks : 0);
 
     // Allocate root inode
     auto root = this->AllocateNode(true);
@@ -175,76 +430,323 @@ void Filesystem::Format(const uint32_t bytes) {
         );
     }
 
-    this->currentNode = *root;
     this->superblock.rootNodeId = root->getId();
 
+    // Every session starts over in the new root
+    this->workingDirectory = WorkingDirectory{
+        root->getId(),
+        std::vector<std::string>{}
+    };
+    {
+        std::lock_guard<std::mutex> lock(this->sessions->lock);
+        this->sessions->byThread.clear();
+    }
+
     // Add "." and ".."
     this->AddChild(*root, ".", root->getId());
     this->AddChild(*root, "..", root->getId());
 
-    // Persist initial metadata
+    // Persist initial metadata; the rest of the first block is cleared,
+    // so fields added to the superblock later read as zero
     auto sb = this->superblock.toBytes();
-    this->FileIO->WriteBytes(
-        0,
-        std::vector<char>(sb.begin(), sb.end())
-    );
-
-    this->FileIO->WriteBytes(
-        this->superblock.inodeBitmapOffset,
-        this->INodeBitmap.SaveToBytes()
-    );
+    std::vector<char> first(sb.begin(), sb.end());
+    first.resize(blockSize, 0);
+
+    std::vector<ImageWrite> metadata = {
+        ImageWrite{0, std::move(first)},
+        ImageWrite{this->superblock.inodeBitmapOffset, this->INodeBitmap.SaveToBytes()},
+        ImageWrite{this->superblock.blockBitmapOffset, this->BlockBitmap.SaveToBytes()},
+        ImageWrite{this->superblock.refcountOffset, this->References.SaveToBytes()}
+    };
+    if (this->Dedup.Enabled()) {
+        metadata.push_back(ImageWrite{this->superblock.dedupOffset, this->Dedup.SaveToBytes()});
+    }
+    this->FileIO->WriteAll(metadata);
 
-    this->FileIO->WriteBytes(
-        this->superblock.blockBitmapOffset,
-        this->BlockBitmap.SaveToBytes()
-    );
+    // Both bitmaps are fully on disk now
+    (void) this->INodeBitmap.TakeDirty(this->superblock.inodeBitmapOffset);
+    (void) this->BlockBitmap.TakeDirty(this->superblock.blockBitmapOffset);
 
-    this->writeINode(this->currentNode);
+    // A fresh layout replaces whatever the mount-time check found
     this->formated = true;
+    this->readOnly = false;
+    this->mountReport.clear();
+    this->WriteBack();
 }
 
 bool Filesystem::Formated() const {
     return this->formated;
 }
 
-INode Filesystem::readINode(const uint32_t id) const {
-    auto data = this->FileIO->ReadBytes(
-        this->superblock.inodeTableOffset +
-        id * INode::BYTES,
-        INode::BYTES
+bool Filesystem::ReadOnly() const {
+    return this->readOnly;
+}
+
+const std::string& Filesystem::MountReport() const {
+    return this->mountReport;
+}
+
+void Filesystem::EnsureWritable() const {
+    if (this->readOnly) {
+        throw ReadOnlyFilesystemException("Filesystem is mounted read-only");
+    }
+}
+
+void Filesystem::Sync() {
+    const auto guard = this->LockOperations();
+
+    if (!this->formated || this->batchDepth > 0 || this->readOnly) {
+        return;
+    }
+
+    this->WriteBack();
+}
+
+void Filesystem::WriteBack() {
+    // =========================
+    // Blocks freed since the last commit are free in this transaction
+    // =========================
+    std::sort(this->releasedBlocks.begin(), this->releasedBlocks.end());
+    for (const uint32_t block : this->releasedBlocks) {
+        this->BlockBitmap.Set(block, false);
+    }
+
+    std::vector<ImageWrite> writes = this->INodes->TakeDirty();
+
+    std::vector<ImageWrite> blocks = this->Cache->TakeDirty();
+    writes.insert(writes.end(),
+                  std::make_move_iterator(blocks.begin()),
+                  std::make_move_iterator(blocks.end()));
+
+    // Only the modified pages of the bitmaps and tables are written
+    auto append = [&writes](std::vector<ImageWrite> pages) {
+        writes.insert(writes.end(),
+                      std::make_move_iterator(pages.begin()),
+                      std::make_move_iterator(pages.end()));
+    };
+    append(this->INodeBitmap.TakeDirty(this->superblock.inodeBitmapOffset));
+    append(this->BlockBitmap.TakeDirty(this->superblock.blockBitmapOffset));
+    append(this->References.TakeDirty(this->superblock.refcountOffset));
+    append(this->Dedup.TakeDirty(this->superblock.dedupOffset));
+
+    // =========================
+    // Commit as one transaction, or in place on images without a journal
+    // =========================
+    std::vector<uint32_t> spilled;
+    if (this->Log->Enabled()) {
+        uint32_t next = 0;
+        this->Log->Commit(writes, [&](const uint64_t bytes) {
+            return this->SpillExtents(bytes, next, spilled);
+        });
+    } else {
+        this->FileIO->WriteAll(writes);
+    }
+
+    // Released blocks are scrubbed and reused only once the committed
+    // tree no longer references them
+    this->releasedBlocks.insert(this->releasedBlocks.end(), spilled.begin(), spilled.end());
+    if (!this->releasedBlocks.empty() && (this->options.secureErase || this->options.trimFreedBlocks)) {
+        this->ScrubReleasedBlocks();
+    }
+    this->releasedBlocks.clear();
+    this->FileIO->Flush();
+}
+
+void Filesystem::WriteSuperblock() const {
+    const auto sb = this->superblock.toBytes();
+    this->FileIO->WriteBytes(0, sb.data(), this->superblock.ByteSize());
+}
+
+int Filesystem::INodeRecordBytes() const {
+    // Inodes carry a 64-bit file size from layout version 4 on and
+    // inline data from version 5 on
+    return this->superblock.version >= 5 ? INode::BYTES
+        : this->superblock.version == 4 ? INode::WIDE_BYTES
+        : INode::LEGACY_BYTES;
+}
+
+void Filesystem::BeginBatch() {
+    const auto guard = this->LockOperations();
+    ++this->batchDepth;
+}
+
+void Filesystem::Commit() {
+    const auto guard = this->LockOperations();
+
+    if (this->batchDepth == 0) {
+        return;
+    }
+
+    if (--this->batchDepth == 0 && this->formated && !this->readOnly) {
+        this->WriteBack();
+    }
+}
+
+bool Filesystem::InBatch() const {
+    const auto guard = this->ShareOperations();
+    return this->batchDepth > 0;
+}
+
+Filesystem::OperationGuard::OperationGuard(std::shared_mutex* mutex, const bool exclusive)
+    : mutex(operationDepth == 0 ? mutex : nullptr),
+      exclusive(exclusive) {
+    ++operationDepth;
+
+    if (!this->mutex) {
+        return;
+    }
+
+    if (exclusive) {
+        this->mutex->lock();
+    } else {
+        this->mutex->lock_shared();
+    }
+}
+
+Filesystem::OperationGuard::~OperationGuard() {
+    --operationDepth;
+
+    if (!this->mutex) {
+        return;
+    }
+
+    if (this->exclusive) {
+        this->mutex->unlock();
+    } else {
+        this->mutex->unlock_shared();
+    }
+}
+
+Filesystem::OperationGuard Filesystem::ShareOperations() const {
+    return OperationGuard(this->options.threadSafe ? &this->operationLock : nullptr, false);
+}
+
+Filesystem::OperationGuard Filesystem::LockOperations() const {
+    return OperationGuard(this->options.threadSafe ? &this->operationLock : nullptr, true);
+}
+
+std::shared_lock<std::shared_mutex> Filesystem::ShareINode(const uint32_t id) const {
+    if (!this->options.threadSafe) {
+        return {};
+    }
+    return std::shared_lock<std::shared_mutex>(this->INodeLocks.For(id));
+}
+
+std::unique_lock<std::shared_mutex> Filesystem::LockINode(const uint32_t id) const {
+    if (!this->options.threadSafe) {
+        return {};
+    }
+    return std::unique_lock<std::shared_mutex>(this->INodeLocks.For(id));
+}
+
+std::unique_lock<std::mutex> Filesystem::LockAllocator() const {
+    if (!this->options.threadSafe) {
+        return {};
+    }
+    return std::unique_lock<std::mutex>(this->allocatorLock);
+}
+
+Filesystem::WorkingDirectory& Filesystem::Session() const {
+    if (!this->options.threadSafe) {
+        return this->workingDirectory;
+    }
+
+    std::lock_guard<std::mutex> lock(this->sessions->lock);
+
+    // New sessions start in the root directory
+    const auto [it, inserted] = this->sessions->byThread.try_emplace(
+        std::this_thread::get_id(),
+        WorkingDirectory{this->superblock.rootNodeId, std::vector<std::string>{}}
     );
+    if (inserted) {
+        DropSessionAtExit(this->sessions);
+    }
+    return it->second;
+}
 
-    if (data.size() != INode::BYTES) {
-        throw InvalidINodeSizeException(
-            "Invalid inode size"
-        );
+void Filesystem::DropSessionAtExit(const std::shared_ptr<SessionTable>& table) {
+    // Tables of the filesystems the thread has a session in, held weakly
+    // so a filesystem closed before the thread ends is skipped
+    struct ThreadSessions {
+        std::vector<std::weak_ptr<SessionTable>> tables;
+
+        ~ThreadSessions() {
+            for (const auto& weak : this->tables) {
+                if (const auto owner = weak.lock()) {
+                    std::lock_guard<std::mutex> lock(owner->lock);
+                    owner->byThread.erase(std::this_thread::get_id());
+                }
+            }
+        }
+    };
+
+    thread_local ThreadSessions owned;
+
+    auto& tables = owned.tables;
+    tables.erase(std::remove_if(tables.begin(), tables.end(),
+                                [](const auto& weak) { return weak.expired(); }),
+                 tables.end());
+    tables.push_back(table);
+}
+
+void Filesystem::ForgetWorkingPaths() const {
+    this->workingDirectory.path.reset();
+
+    std::lock_guard<std::mutex> lock(this->sessions->lock);
+    for (auto& [thread, session] : this->sessions->byThread) {
+        session.path.reset();
+    }
+}
+
+bool Filesystem::IsWorkingDirectory(const uint32_t id) const {
+    if (!this->options.threadSafe) {
+        return this->workingDirectory.node == id;
     }
 
-    return INode::FromBytes(data);
+    std::lock_guard<std::mutex> lock(this->sessions->lock);
+    return std::any_of(this->sessions->byThread.begin(), this->sessions->byThread.end(),
+                       [id](const auto& session) { return session.second.node == id; });
 }
 
-void Filesystem::writeINode(const INode& node) const {
-    const uint64_t offset =
-        this->superblock.inodeTableOffset +
-        node.getId() * INode::BYTES;
+const char* Filesystem::BlockData(const uint32_t block, std::vector<char>& scratch) const {
+    if (!this->options.threadSafe) {
+        return this->Cache->ReadBlock(block);
+    }
+
+    scratch.resize(this->superblock.blockSize);
+    this->Cache->CopyBlock(block, scratch.data());
+    return scratch.data();
+}
 
-    this->FileIO->WriteBytes(offset, node.ToBytes());
+INode Filesystem::readINode(const uint32_t id) const {
+    ZOS_PERF_SCOPE(Perf::Probe::READ_INODE);
+    return this->INodes->Read(id);
+}
+
+void Filesystem::writeINode(const INode& node) const {
+    ZOS_PERF_SCOPE(Perf::Probe::WRITE_INODE);
+    this->INodes->Write(node);
 }
 
 std::optional<INode> Filesystem::AllocateNode(const bool isDir) {
-    const auto id = INodeBitmap.FindFirstFree();
-    if (!id) return std::nullopt;
+    std::optional<uint32_t> id;
+    {
+        const auto lock = this->LockAllocator();
+        id = INodeBitmap.FindFirstFree();
+        if (!id) return std::nullopt;
 
-    INodeBitmap.Set(*id, true);
+        INodeBitmap.Set(*id, true);
+    }
     INode node(*id, isDir);
 
     if (isDir) {
         auto b = AllocateBlock();
         if (b == std::nullopt) {
+            const auto lock = this->LockAllocator();
             INodeBitmap.Set(*id, false);
             return std::nullopt;
         }
-        this->FileIO->WriteBytes(this->superblock.dataBlocksOffset + *b * this->superblock.blockSize, std::vector<char>(this->superblock.blockSize, 0xFF));
+        this->Cache->WriteBlock(*b, std::vector<char>(this->superblock.blockSize, 0xFF));
         AttachBlock(node, *b);
     }
     this->writeINode(node);
@@ -253,15 +755,23 @@ std::optional<INode> Filesystem::AllocateNode(const bool isDir) {
 }
 
 void Filesystem::FreeNode(const INode& node) {
-    this->INodeBitmap.Set(node.getId(), false);
+    if (node.isDir()) {
+        this->Index->Drop(node.getId());
+    }
+    {
+        const auto lock = this->LockAllocator();
+        this->INodeBitmap.Set(node.getId(), false);
+    }
     for (auto b : this->GetAllBlockIds(node)) {
         this->FreeBlock(b);
     }
-    const std::vector<char> toWrite(INode::BYTES, 0);
-    this->FileIO->WriteBytes(this->superblock.inodeTableOffset + INode::BYTES * node.getId(), toWrite);
+    this->INodes->Erase(node.getId());
 }
 
 std::optional<uint32_t> Filesystem::AllocateBlock() {
+    ZOS_PERF_SCOPE(Perf::Probe::ALLOCATE_BLOCK, this->superblock.blockSize);
+    const auto lock = this->LockAllocator();
+    this->ReclaimReleasedBlocks(1);
     const auto block = this->BlockBitmap.FindFirstFree();
     if (block != std::nullopt) {
         this->BlockBitmap.Set(*block, true);
@@ -269,246 +779,356 @@ std::optional<uint32_t> Filesystem::AllocateBlock() {
     return block;
 }
 
-void Filesystem::FreeBlock(const uint32_t block) {
-    this->BlockBitmap.Set(block, false);
-    this->FileIO->WriteBytes(this->superblock.dataBlocksOffset + block * this->superblock.blockSize, std::vector<char>(this->superblock.blockSize, 0));
-}
+std::vector<BlockRun> Filesystem::AllocateBlockRuns(const uint32_t count) {
+    ZOS_PERF_SCOPE(Perf::Probe::ALLOCATE_RUNS,
+                   static_cast<uint64_t>(count) * this->superblock.blockSize);
+    const auto lock = this->LockAllocator();
 
-void Filesystem::AddChild(INode &node, std::string name, uint32_t childNode) {
-    if (!node.isDir()) {
-        throw NotADirectoryException("Target node is not a directory");
-    }
-    // construct data for writing
-    std::vector<char> toWrite(name.begin(), name.end());
-    while (toWrite.size() < 12) {
-        toWrite.push_back('\0');
-    }
-    auto childBytes = IntParser::WriteUInt32(childNode);
-    for (auto b : childBytes) {
-        toWrite.push_back(b);
+    this->ReclaimReleasedBlocks(count);
+    if (this->BlockBitmap.FreeCount() < count) {
+        throw CouldNotAllocateBlockException("No free blocks for file data");
     }
-    constexpr uint32_t ENTRYSIZE = 12 + sizeof(uint32_t);
 
-    // attempt using direct blocks
-    for (auto block : node.getDirectLinks()) {
-        if (block == INode::UNUSED_LINK) {
-            auto tmp = this->AllocateBlock();
-            if (tmp == std::nullopt) {
-                throw CouldNotAllocateBlockException("Could not allocate block");
-            }
-
-            this->FileIO->WriteBytes(
-                    this->superblock.dataBlocksOffset +
-                    *tmp * this->superblock.blockSize,
-                    std::vector<char>(this->superblock.blockSize, 0xFF)
-                );
+    std::vector<BlockRun> runs;
+    uint32_t remaining = count;
+    uint32_t request = count;
 
-            node.addDirectLink(*tmp);
-            block = *tmp;
-            writeINode(node);
+    while (remaining > 0) {
+        request = std::min(request, remaining);
 
+        const auto start = this->BlockBitmap.FindFreeRun(request);
+        if (!start) {
+            // Settle for shorter runs; a single free block always exists
+            request = std::max<uint32_t>(request / 2, 1);
+            continue;
         }
 
-        auto children = this->ReadBlockAsSubdirectories(block);
+        for (uint32_t i = 0; i < request; ++i) {
+            this->BlockBitmap.Set(*start + i, true);
+        }
 
-        if (children.size() < this->superblock.blockSize / ENTRYSIZE) {
-            const uint32_t offset =
-                this->superblock.dataBlocksOffset +
-                block * this->superblock.blockSize +
-                children.size() * ENTRYSIZE;  // ✅ correct index domain
+        runs.push_back(BlockRun{*start, request});
+        remaining -= request;
+    }
 
-            this->FileIO->WriteBytes(offset, toWrite);
+    return runs;
+}
 
-            writeINode(node);
+void Filesystem::FreeBlock(const uint32_t block) {
+    const auto lock = this->LockAllocator();
 
-            return;
-        }
+    // The other owners keep a shared block
+    if (this->References.Release(block)) {
+        return;
     }
 
-    {
-        // allocate indirect block if necessary
-        if (node.getFirstLevelIndirectLink() == INode::UNUSED_LINK) {
-            const auto indirectBlock = this->AllocateBlock();
-            if (indirectBlock == std::nullopt) {
-                throw CouldNotAllocateBlockException("Could not allocate block");
-            }
+    // The block may be reused for anything, so no write may share it
+    this->Dedup.Forget(block);
 
-            this->FileIO->WriteBytes(
-                    this->superblock.dataBlocksOffset +
-                    *indirectBlock * this->superblock.blockSize,
-                    std::vector<char>(this->superblock.blockSize, 0xFF)
-                );
+    // Contents of a free block are never read; don't write them back
+    this->Cache->Discard(block);
 
-            node.addFirstLevelIndirectLink(*indirectBlock);
+    // The committed tree may still reference the block, so it stays
+    // allocated until the next write-back commits its release
+    this->releasedBlocks.push_back(block);
+}
 
-            writeINode(node);
-        }
+void Filesystem::ReclaimReleasedBlocks(const uint32_t count) {
+    const uint32_t free = this->BlockBitmap.FreeCount();
+    if (free >= count) {
+        return;
+    }
 
-        auto indirects = this->ReadBlockAsBlockIds(node.getFirstLevelIndirectLink());
+    // Only as many as the allocation lacks, so the rest stay intact
+    // (and scrubbed) until the commit
+    uint32_t missing = count - free;
+    while (missing > 0 && !this->releasedBlocks.empty()) {
+        this->BlockBitmap.Set(this->releasedBlocks.back(), false);
+        this->releasedBlocks.pop_back();
+        --missing;
+    }
+}
 
-        // attempt to use first level indirect block
-        for (auto block : indirects) {
-            auto children = this->ReadBlockAsSubdirectories(block);
-            if (children.size() < this->superblock.blockSize / ENTRYSIZE) {
-                const uint32_t offset =
-                    this->superblock.dataBlocksOffset +
-                    block * this->superblock.blockSize +
-                    children.size() * ENTRYSIZE;
+uint32_t Filesystem::AvailableBlocks() const {
+    const auto lock = this->LockAllocator();
+    return this->BlockBitmap.FreeCount() + static_cast<uint32_t>(this->releasedBlocks.size());
+}
 
-                this->FileIO->WriteBytes(offset, toWrite);
+uint32_t Filesystem::ReleasableBlocks(const std::string& path) const {
+    const INode parent = ResolveParent(path);
+    if (!parent.isDir()) {
+        return 0;
+    }
 
-                writeINode(node);
-                return;
-            }
-        }
+    const auto id = FindChildId(parent, SplitPath(path).back());
+    if (!id) {
+        return 0;
+    }
 
-        if (indirects.size() < this->superblock.blockSize / sizeof(uint32_t)) {
-            auto newBlock = this->AllocateBlock();
-            if (newBlock == std::nullopt) {
-                throw CouldNotAllocateBlockException("Could not allocate block");
-            }
+    const INode file = readINode(*id);
+    if (file.isDir()) {
+        return 0;
+    }
 
-            this->FileIO->WriteBytes(
-                    this->superblock.dataBlocksOffset +
-                    *newBlock * this->superblock.blockSize,
-                    std::vector<char>(this->superblock.blockSize, 0xFF)
-                );
+    // A block is released once this file held every of its owners
+    std::unordered_map<uint32_t, uint32_t> owners;
+    for (const uint32_t block : GetAllBlockIds(file)) {
+        ++owners[block];
+    }
 
-            this->FileIO->WriteBytes(
-                    this->superblock.dataBlocksOffset +
-                    node.getFirstLevelIndirectLink() * this->superblock.blockSize +
-                    indirects.size() * sizeof(uint32_t),
-                    IntParser::WriteUInt32(*newBlock)
-                );
-
-            const uint32_t offset =
-                this->superblock.dataBlocksOffset +
-                *newBlock * this->superblock.blockSize;
+    const auto lock = this->LockAllocator();
+    return static_cast<uint32_t>(std::count_if(owners.begin(), owners.end(), [this](const auto& entry) {
+        return this->References.Get(entry.first) < entry.second;
+    }));
+}
 
-            this->FileIO->WriteBytes(offset, toWrite);
+std::vector<Journal::Extent> Filesystem::SpillExtents(const uint64_t bytes,
+                                                      uint32_t& next,
+                                                      std::vector<uint32_t>& taken) const {
+    const uint32_t blockSize = this->superblock.blockSize;
+    const uint32_t maxRun = UINT32_MAX / blockSize;
+
+    std::vector<Journal::Extent> extents;
+    uint64_t found = 0;
+
+    // Blocks free before and after the transaction; released blocks
+    // still hold data of the committed tree
+    while (found < bytes && next < this->superblock.totalBlocks) {
+        const uint32_t block = next++;
+        if (this->BlockBitmap.Get(block) ||
+            std::binary_search(this->releasedBlocks.begin(), this->releasedBlocks.end(), block)) {
+            continue;
+        }
 
-            writeINode(node);
-            return;
+        const uint64_t offset = this->superblock.dataBlocksOffset + static_cast<uint64_t>(block) * blockSize;
+        if (!extents.empty() && !taken.empty() && taken.back() + 1 == block &&
+            extents.back().length / blockSize < maxRun) {
+            extents.back().length += blockSize;
+        } else {
+            extents.push_back(Journal::Extent{offset, blockSize});
         }
+
+        taken.push_back(block);
+        found += blockSize;
     }
 
-    {
-        // use second level indirect block
+    return extents;
+}
 
-        if (node.getSecondLevelIndirectLink() == INode::UNUSED_LINK) {
-            const auto indirectBlock = this->AllocateBlock();
-            if (indirectBlock == std::nullopt) {
-                throw CouldNotAllocateBlockException("Could not allocate block");
-            }
+void Filesystem::ScrubReleasedBlocks() {
+    std::sort(this->releasedBlocks.begin(), this->releasedBlocks.end());
 
-            this->FileIO->WriteBytes(
-                    this->superblock.dataBlocksOffset +
-                    *indirectBlock * this->superblock.blockSize,
-                    std::vector<char>(this->superblock.blockSize, 0xFF)
-                );
+    const std::vector<char> zeros(this->superblock.blockSize, 0);
+    std::vector<IORequest> erases;
 
-            node.addSecondLevelIndirectLink(*indirectBlock);
+    size_t i = 0;
+    while (i < this->releasedBlocks.size()) {
+        const uint32_t start = this->releasedBlocks[i];
+        size_t end = i + 1;
 
-            writeINode(node);
+        while (end < this->releasedBlocks.size() &&
+               this->releasedBlocks[end] == start + (end - i)) {
+            ++end;
         }
 
-        auto indirects = this->ReadBlockAsBlockIds(node.getSecondLevelIndirectLink());
-        for (auto block : indirects) {
-            auto indirects2 = this->ReadBlockAsBlockIds(block);
+        const uint64_t offset =
+            this->superblock.dataBlocksOffset + static_cast<uint64_t>(start) * this->superblock.blockSize;
 
-            for (auto block2 : indirects2) {
-                auto children = this->ReadBlockAsSubdirectories(block2);
-                if (children.size() < this->superblock.blockSize / ENTRYSIZE) {
-                    const uint32_t offset =
-                        this->superblock.dataBlocksOffset +
-                        block2 * this->superblock.blockSize +
-                        children.size() * ENTRYSIZE;
+        if (this->options.secureErase) {
+            for (size_t block = i; block < end; ++block) {
+                erases.push_back(IORequest::Write(
+                    offset + static_cast<uint64_t>(block - i) * this->superblock.blockSize,
+                    zeros.data(), zeros.size()));
+            }
+        } else if (this->options.trimFreedBlocks) {
+            this->FileIO->PunchHole(offset, static_cast<uint64_t>(end - i) * this->superblock.blockSize);
+        }
+        i = end;
+    }
 
-                    this->FileIO->WriteBytes(offset, toWrite);
+    if (!erases.empty()) {
+        this->FileIO->Transfer(std::move(erases));
+    }
+}
 
-                    writeINode(node);
-                    return;
-                }
-            }
+Filesystem::Placement Filesystem::PlaceBlocks(const char* data, const uint64_t size, const uint32_t count) {
+    const uint32_t blockSize = superblock.blockSize;
+    constexpr uint32_t NONE = UINT32_MAX;
 
-            if (indirects2.size() < this->superblock.blockSize / sizeof(uint32_t)) {
-                auto newBlock = this->AllocateBlock();
-                if (newBlock == std::nullopt) {
-                    throw CouldNotAllocateBlockException("Could not allocate block");
-                }
+    Placement placement;
+    placement.blocks.assign(count, INode::UNUSED_LINK);
+    placement.fresh.assign(count, true);
 
-                this->FileIO->WriteBytes(
-                        this->superblock.dataBlocksOffset +
-                        *newBlock * this->superblock.blockSize,
-                        std::vector<char>(this->superblock.blockSize, 0xFF)
-                    );
+    // Position whose new block a position shares (NONE for a fresh one
+    // or one sharing an indexed block)
+    std::vector<uint32_t> sameAs(count, NONE);
+    uint32_t freshCount = count;
 
-                this->FileIO->WriteBytes(
-                        this->superblock.dataBlocksOffset +
-                        block * this->superblock.blockSize +
-                        indirects2.size() * sizeof(uint32_t),
-                        IntParser::WriteUInt32(*newBlock)
-                    );
+    const auto whole = static_cast<uint32_t>(std::min<uint64_t>(count, size / blockSize));
 
-                const uint32_t offset =
-                    this->superblock.dataBlocksOffset +
-                    *newBlock * this->superblock.blockSize;
+    if (this->Dedup.Enabled() && whole > 0) {
+        placement.hashes.assign(count, DedupIndex::NO_HASH);
+        for (uint32_t i = 0; i < whole; ++i) {
+            placement.hashes[i] = DedupIndex::Hash(data + static_cast<uint64_t>(i) * blockSize, blockSize);
+        }
 
-                this->FileIO->WriteBytes(offset, toWrite);
+        // Fresh positions of this write by hash, with their number of sharers
+        std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> earlier;
+        std::vector<char> scratch;
+
+        // Matched and shared at once, so that the block cannot be freed
+        // or written in place in between
+        const auto lock = this->LockAllocator();
+        for (uint32_t i = 0; i < whole; ++i) {
+            const char* content = data + static_cast<uint64_t>(i) * blockSize;
+            const uint64_t hash = placement.hashes[i];
+
+            const std::optional<uint32_t> stored = this->Dedup.Find(hash);
+            if (stored && this->BlockBitmap.Get(*stored) &&
+                std::equal(content, content + blockSize, BlockData(*stored, scratch)) &&
+                this->References.Share(*stored)) {
+                placement.blocks[i] = *stored;
+                placement.fresh[i] = false;
+                placement.hashes[i] = DedupIndex::NO_HASH;
+                --freshCount;
+                continue;
+            }
 
-                writeINode(node);
-                return;
+            const auto match = earlier.find(hash);
+            if (match != earlier.end() &&
+                match->second.second < RefCountTable::MAX_SHARES &&
+                std::equal(content, content + blockSize,
+                           data + static_cast<uint64_t>(match->second.first) * blockSize)) {
+                sameAs[i] = match->second.first;
+                ++match->second.second;
+                placement.fresh[i] = false;
+                placement.hashes[i] = DedupIndex::NO_HASH;
+                --freshCount;
+                continue;
             }
+
+            // A saturated block is replaced by this one for later matches
+            earlier[hash] = {i, 0};
         }
+    }
 
-        if (indirects.size() < this->superblock.blockSize / sizeof(uint32_t)) {
-            auto newBlock = this->AllocateBlock();
-            if (newBlock == std::nullopt) {
-                throw CouldNotAllocateBlockException("Could not allocate block");
+    std::vector<BlockRun> runs;
+    try {
+        runs = AllocateBlockRuns(freshCount);
+    } catch (...) {
+        const auto lock = this->LockAllocator();
+        for (uint32_t i = 0; i < count; ++i) {
+            if (!placement.fresh[i] && sameAs[i] == NONE) {
+                this->References.Release(placement.blocks[i]);
             }
+        }
+        throw;
+    }
 
-            this->FileIO->WriteBytes(
-                    this->superblock.dataBlocksOffset +
-                    *newBlock * this->superblock.blockSize,
-                    std::vector<char>(this->superblock.blockSize, 0xFF)
-                );
-
-            this->FileIO->WriteBytes(
-                    this->superblock.dataBlocksOffset +
-                    node.getSecondLevelIndirectLink() * this->superblock.blockSize +
-                    indirects.size() * sizeof(uint32_t),
-                    IntParser::WriteUInt32(*newBlock)
-                );
+    // Fresh positions take the runs in order
+    uint32_t position = 0;
+    for (const BlockRun& run : runs) {
+        for (uint32_t i = 0; i < run.length; ++i) {
+            while (!placement.fresh[position]) {
+                ++position;
+            }
+            placement.blocks[position++] = run.start + i;
+        }
+    }
 
-            auto newBlock2 = this->AllocateBlock();
-            if (newBlock2 == std::nullopt) {
-                throw CouldNotAllocateBlockException("Could not allocate block");
+    if (freshCount < count) {
+        const auto lock = this->LockAllocator();
+        for (uint32_t i = 0; i < count; ++i) {
+            if (sameAs[i] != NONE) {
+                placement.blocks[i] = placement.blocks[sameAs[i]];
+                this->References.Share(placement.blocks[i]);
             }
+        }
+    }
 
-            this->FileIO->WriteBytes(
-                    this->superblock.dataBlocksOffset +
-                    *newBlock2 * this->superblock.blockSize,
-                    std::vector<char>(this->superblock.blockSize, 0xFF)
-                );
+    return placement;
+}
 
-            this->FileIO->WriteBytes(
-                    this->superblock.dataBlocksOffset +
-                    *newBlock * this->superblock.blockSize,
-                    IntParser::WriteUInt32(*newBlock2)
-                );
+std::vector<std::future<void>> Filesystem::SubmitPlaced(const Placement& placement,
+                                                        const char* data,
+                                                        const uint64_t size) {
+    const uint64_t blockSize = superblock.blockSize;
+    const auto count = static_cast<uint32_t>(placement.blocks.size());
+
+    std::vector<std::future<void>> written;
+    uint32_t first = 0;
+    while (first < count) {
+        if (!placement.fresh[first]) {
+            ++first;
+            continue;
+        }
 
-            const uint32_t offset =
-                this->superblock.dataBlocksOffset +
-                *newBlock2 * this->superblock.blockSize;
+        uint32_t last = first;
+        while (last < count && placement.fresh[last]) {
+            ++last;
+        }
 
-            this->FileIO->WriteBytes(offset, toWrite);
+        const uint64_t from = first * blockSize;
+        const uint64_t to = std::min<uint64_t>(size, last * blockSize);
+        const std::vector<uint32_t> stretch(placement.blocks.begin() + first,
+                                            placement.blocks.begin() + last);
+        written.push_back(Cache->SubmitThrough(CoalesceRuns(stretch), data + from, to - from));
+        first = last;
+    }
+    return written;
+}
 
-            writeINode(node);
-            return;
+void Filesystem::IndexBlocks(const Placement& placement) {
+    if (placement.hashes.empty()) {
+        return;
+    }
+
+    const auto lock = this->LockAllocator();
+    for (std::size_t i = 0; i < placement.hashes.size(); ++i) {
+        if (placement.hashes[i] != DedupIndex::NO_HASH) {
+            this->Dedup.Insert(placement.blocks[i], placement.hashes[i]);
         }
     }
+}
+
+void Filesystem::AddChild(INode &node, std::string name, uint32_t childNode) {
+    if (!node.isDir()) {
+        throw NotADirectoryException("Target node is not a directory");
+    }
+    if (name.size() > ChildNodeNameIdPair::NAME_LENGTH) {
+        throw InvalidFileNameException("Name too long: " + name);
+    }
+    constexpr uint32_t ENTRYSIZE = ChildNodeNameIdPair::ENTRY_BYTES;
+    const uint32_t ENTRIES_PER_BLOCK = this->superblock.blockSize / ENTRYSIZE;
+    const uint32_t IDS_PER_BLOCK = this->superblock.blockSize / sizeof(uint32_t);
+
+    // construct data for writing (NUL-padded name + inode id)
+    std::vector<char> toWrite(ENTRYSIZE, '\0');
+    std::copy(name.begin(), name.end(), toWrite.begin());
+    IntParser::WriteUInt32(toWrite.data() + ChildNodeNameIdPair::NAME_LENGTH, childNode);
+
+    // Entries are kept packed, so the new one takes the slot after the last
+    const uint32_t position = this->CountChildren(node);
+    const uint32_t index = position / ENTRIES_PER_BLOCK;
+
+    if (index >= INode::DIRECT_LINKS + IDS_PER_BLOCK + IDS_PER_BLOCK * IDS_PER_BLOCK) {
+        throw FileTooLargeException("Directory is full");
+    }
+
+    uint32_t block = this->BlockAt(node, index);
+    if (block == INode::UNUSED_LINK) {
+        this->EnsureTables(node, index);
+        block = this->AllocateTable();
+        this->MapBlock(node, index, block);
+    }
+
+    this->Cache->WriteBytes(block, position % ENTRIES_PER_BLOCK * ENTRYSIZE, toWrite);
 
-    throw FileTooLargeException("Directory is full");
+    if (this->CountsEntries()) {
+        node.setEntryCount(position + 1);
+    }
+    writeINode(node);
+    this->Index->Insert(node.getId(), name, childNode);
 }
 
 void Filesystem::AttachBlock(INode& node, const uint32_t block) {
@@ -537,10 +1157,7 @@ void Filesystem::AttachBlock(INode& node, const uint32_t block) {
         if (!ind) throw CouldNotAllocateBlockException("Could not allocate block");
 
         // init pointer table
-        FileIO->WriteBytes(
-            superblock.dataBlocksOffset + *ind * superblock.blockSize,
-            std::vector<char>(superblock.blockSize, 0xFF)
-        );
+        Cache->WriteBlock(*ind, std::vector<char>(superblock.blockSize, 0xFF));
 
         node.addFirstLevelIndirectLink(*ind);
         writeINode(node);
@@ -551,12 +1168,7 @@ void Filesystem::AttachBlock(INode& node, const uint32_t block) {
         auto ids = ReadBlockAsBlockIds(ind);
 
         if (ids.size() < IDS_PER_BLOCK) {
-            uint64_t offset =
-                superblock.dataBlocksOffset +
-                ind * superblock.blockSize +
-                ids.size() * ENTRYSIZE;
-
-            FileIO->WriteBytes(offset, entry);
+            Cache->WriteBytes(ind, ids.size() * ENTRYSIZE, entry);
             return;
         }
     }
@@ -568,10 +1180,7 @@ void Filesystem::AttachBlock(INode& node, const uint32_t block) {
         auto ind2 = AllocateBlock();
         if (!ind2) throw CouldNotAllocateBlockException("Could not allocate block");
 
-        FileIO->WriteBytes(
-            superblock.dataBlocksOffset + *ind2 * superblock.blockSize,
-            std::vector<char>(superblock.blockSize, 0xFF)
-        );
+        Cache->WriteBlock(*ind2, std::vector<char>(superblock.blockSize, 0xFF));
 
         node.addSecondLevelIndirectLink(*ind2);
         writeINode(node);
@@ -585,12 +1194,7 @@ void Filesystem::AttachBlock(INode& node, const uint32_t block) {
         auto ids = ReadBlockAsBlockIds(ptr);
 
         if (ids.size() < IDS_PER_BLOCK) {
-            uint64_t offset =
-                superblock.dataBlocksOffset +
-                ptr * superblock.blockSize +
-                ids.size() * ENTRYSIZE;
-
-            FileIO->WriteBytes(offset, entry);
+            Cache->WriteBytes(ptr, ids.size() * ENTRYSIZE, entry);
             return;
         }
     }
@@ -600,95 +1204,198 @@ void Filesystem::AttachBlock(INode& node, const uint32_t block) {
         auto newPtr = AllocateBlock();
         if (!newPtr) throw CouldNotAllocateBlockException("Could not allocate block");
 
-        FileIO->WriteBytes(
-            superblock.dataBlocksOffset + *newPtr * superblock.blockSize,
-            std::vector<char>(superblock.blockSize, 0xFF)
-        );
+        Cache->WriteBlock(*newPtr, std::vector<char>(superblock.blockSize, 0xFF));
 
         // link it into double-indirect table
-        uint64_t ptrOffset =
-            superblock.dataBlocksOffset +
-            ind2 * superblock.blockSize +
-            firstLevelPtrs.size() * ENTRYSIZE;
-
-        FileIO->WriteBytes(ptrOffset, IntParser::WriteUInt32(*newPtr));
+        Cache->WriteBytes(ind2, firstLevelPtrs.size() * ENTRYSIZE, IntParser::WriteUInt32(*newPtr));
 
         // write first data entry
-        uint64_t dataOffset =
-            superblock.dataBlocksOffset +
-            *newPtr * superblock.blockSize;
-
-        FileIO->WriteBytes(dataOffset, entry);
+        Cache->WriteBytes(*newPtr, 0, entry);
         return;
     }
 
     throw FileTooLargeException("No room for new blocks");
 }
 
-std::vector<ChildNodeNameIdPair> Filesystem::ReadBlockAsSubdirectories(const uint32_t block) const {
-    const auto data = FileIO->ReadBytes(
-        superblock.dataBlocksOffset +
-        superblock.blockSize * block,
-        superblock.blockSize
-    );
+uint32_t Filesystem::BlockMapOverhead(const uint32_t dataBlocks) const {
+    const uint32_t IDS_PER_BLOCK = superblock.blockSize / sizeof(uint32_t);
 
-    if (data.size() != superblock.blockSize) {
-        throw InvalidBlockSizeException("Could not read block " + std::to_string(block));
+    if (dataBlocks <= INode::DIRECT_LINKS) {
+        return 0;
     }
 
-    std::vector<ChildNodeNameIdPair> childNodes;
+    // Single indirect table
+    uint32_t remaining = dataBlocks - INode::DIRECT_LINKS;
+    if (remaining <= IDS_PER_BLOCK) {
+        return 1;
+    }
 
-    constexpr size_t ENTRY_SIZE = sizeof(uint32_t) + 12;
-    size_t offset = 0;
+    // Double indirect table and its second-level tables
+    remaining -= IDS_PER_BLOCK;
+    const uint32_t tables = (remaining + IDS_PER_BLOCK - 1) / IDS_PER_BLOCK;
+    if (tables > IDS_PER_BLOCK) {
+        throw FileTooLargeException("No room for new blocks");
+    }
 
-    while (offset + ENTRY_SIZE <= data.size()) {
-        // ---- read fixed-length name ----
-        std::string name(
-            data.begin() + offset,
-            data.begin() + offset + 12
-        );
-        offset += 12;
+    return 2 + tables;
+}
 
-        auto nul = name.find('\0');
-        if (nul != std::string::npos) {
-            name.resize(nul);
+void Filesystem::BuildBlockMap(INode& node, const std::vector<uint32_t>& blocks) {
+    const uint32_t IDS_PER_BLOCK = superblock.blockSize / sizeof(uint32_t);
+    const auto count = static_cast<uint32_t>(blocks.size());
+
+    // Reserve all tables at once
+    std::vector<uint32_t> tables;
+    for (const BlockRun& run : AllocateBlockRuns(BlockMapOverhead(count))) {
+        for (uint32_t i = 0; i < run.length; ++i) {
+            tables.push_back(run.start + i);
         }
+    }
 
-        // ---- read inode id ----
-        uint32_t inodeId = IntParser::ReadUInt32(
-            std::vector<char>(
-                data.begin() + offset,
-                data.begin() + offset + sizeof(uint32_t)
-            )
-        );
-        offset += sizeof(uint32_t);
+    // Serialize a slice of block ids as a 0xFF-padded pointer table
+    auto writeTable = [&](const uint32_t table, const uint32_t* ids, const uint32_t n) {
+        std::vector<char> data(superblock.blockSize, static_cast<char>(0xFF));
+        for (uint32_t i = 0; i < n; ++i) {
+            IntParser::WriteUInt32(data.data() + i * sizeof(uint32_t), ids[i]);
+        }
+        Cache->WriteBlock(table, std::move(data));
+    };
 
-        // Unused entry → end
-        if (inodeId == INode::UNUSED_LINK) {
-            break;
+    // =========================
+    // 1) DIRECT BLOCKS
+    // =========================
+    uint32_t next = 0;
+    while (next < count && next < INode::DIRECT_LINKS) {
+        node.addDirectLink(blocks[next++]);
+    }
+
+    // =========================
+    // 2) SINGLE INDIRECT
+    // =========================
+    std::size_t table = 0;
+    if (next < count) {
+        const uint32_t n = std::min(IDS_PER_BLOCK, count - next);
+        writeTable(tables[table], blocks.data() + next, n);
+        node.addFirstLevelIndirectLink(tables[table++]);
+        next += n;
+    }
+
+    // =========================
+    // 3) DOUBLE INDIRECT
+    // =========================
+    if (next < count) {
+        const uint32_t ind2 = tables[table++];
+        std::vector<uint32_t> secondLevel(tables.begin() + table, tables.end());
+
+        for (const uint32_t ptr : secondLevel) {
+            const uint32_t n = std::min(IDS_PER_BLOCK, count - next);
+            writeTable(ptr, blocks.data() + next, n);
+            next += n;
         }
 
-        childNodes.push_back({ name, inodeId });
+        writeTable(ind2, secondLevel.data(), static_cast<uint32_t>(secondLevel.size()));
+        node.addSecondLevelIndirectLink(ind2);
+    }
+}
+
+uint32_t Filesystem::AllocateTable() {
+    const auto table = AllocateBlock();
+    if (!table) {
+        throw CouldNotAllocateBlockException("Could not allocate block");
     }
 
-    return childNodes;
+    Cache->WriteBlock(*table, std::vector<char>(superblock.blockSize, static_cast<char>(0xFF)));
+    return *table;
 }
 
-std::vector<uint32_t> Filesystem::ReadBlockAsBlockIds(const uint32_t block) const {
-    const auto data = FileIO->ReadBytes(
-        superblock.dataBlocksOffset +
-        superblock.blockSize * block,
-        superblock.blockSize
-    );
+uint32_t Filesystem::ReadTableEntry(const uint32_t table, const uint32_t index) const {
+    std::vector<char> scratch;
+    return IntParser::ReadUInt32(BlockData(table, scratch) + index * sizeof(uint32_t));
+}
+
+uint32_t Filesystem::BlockAt(const INode& node, uint32_t index) const {
+    const uint32_t IDS_PER_BLOCK = superblock.blockSize / sizeof(uint32_t);
+
+    if (index < INode::DIRECT_LINKS) {
+        return node.getDirectLinks()[index];
+    }
+    index -= INode::DIRECT_LINKS;
+
+    if (index < IDS_PER_BLOCK) {
+        const uint32_t ind = node.getFirstLevelIndirectLink();
+        return ind == INode::UNUSED_LINK ? INode::UNUSED_LINK : ReadTableEntry(ind, index);
+    }
+    index -= IDS_PER_BLOCK;
+
+    const uint32_t ind2 = node.getSecondLevelIndirectLink();
+    if (ind2 == INode::UNUSED_LINK || index / IDS_PER_BLOCK >= IDS_PER_BLOCK) {
+        return INode::UNUSED_LINK;
+    }
+
+    const uint32_t ptr = ReadTableEntry(ind2, index / IDS_PER_BLOCK);
+    return ptr == INode::UNUSED_LINK ? INode::UNUSED_LINK : ReadTableEntry(ptr, index % IDS_PER_BLOCK);
+}
+
+void Filesystem::EnsureTables(INode& node, uint32_t index) {
+    const uint32_t IDS_PER_BLOCK = superblock.blockSize / sizeof(uint32_t);
+
+    if (index < INode::DIRECT_LINKS) {
+        return;
+    }
+    index -= INode::DIRECT_LINKS;
+
+    if (index < IDS_PER_BLOCK) {
+        if (node.getFirstLevelIndirectLink() == INode::UNUSED_LINK) {
+            node.addFirstLevelIndirectLink(AllocateTable());
+        }
+        return;
+    }
+    index -= IDS_PER_BLOCK;
+
+    if (index / IDS_PER_BLOCK >= IDS_PER_BLOCK) {
+        throw FileTooLargeException("No room for new blocks");
+    }
+
+    if (node.getSecondLevelIndirectLink() == INode::UNUSED_LINK) {
+        node.addSecondLevelIndirectLink(AllocateTable());
+    }
+
+    const uint32_t ind2 = node.getSecondLevelIndirectLink();
+    if (ReadTableEntry(ind2, index / IDS_PER_BLOCK) == INode::UNUSED_LINK) {
+        const uint32_t ptr = AllocateTable();
+        Cache->WriteBytes(ind2, index / IDS_PER_BLOCK * sizeof(uint32_t), IntParser::WriteUInt32(ptr));
+    }
+}
+
+void Filesystem::MapBlock(INode& node, uint32_t index, const uint32_t block) {
+    const uint32_t IDS_PER_BLOCK = superblock.blockSize / sizeof(uint32_t);
+    const std::vector<char> entry = IntParser::WriteUInt32(block);
+
+    if (index < INode::DIRECT_LINKS) {
+        // Blocks are mapped in order, so the first free link is this one
+        node.addDirectLink(block);
+        return;
+    }
+    index -= INode::DIRECT_LINKS;
 
-    if (data.size() != superblock.blockSize) {
-        throw InvalidBlockSizeException("Could not read block" + std::to_string(block));
+    if (index < IDS_PER_BLOCK) {
+        Cache->WriteBytes(node.getFirstLevelIndirectLink(), index * sizeof(uint32_t), entry);
+        return;
     }
+    index -= IDS_PER_BLOCK;
+
+    const uint32_t ptr = ReadTableEntry(node.getSecondLevelIndirectLink(), index / IDS_PER_BLOCK);
+    Cache->WriteBytes(ptr, index % IDS_PER_BLOCK * sizeof(uint32_t), entry);
+}
+
+std::vector<uint32_t> Filesystem::ReadBlockAsBlockIds(const uint32_t block) const {
+    std::vector<char> scratch;
+    const char* data = BlockData(block, scratch);
 
     std::vector<uint32_t> children;
     size_t offset = 0;
-    while (offset + sizeof(uint32_t) <= data.size()) {
-        auto number = IntParser::ReadUInt32(std::vector<char>(data.begin() + offset, data.begin() + offset + sizeof(uint32_t)));
+    while (offset + sizeof(uint32_t) <= superblock.blockSize) {
+        const uint32_t number = IntParser::ReadUInt32(data + offset);
         if (number == INode::UNUSED_LINK) {
             break;
         }
@@ -698,149 +1405,165 @@ std::vector<uint32_t> Filesystem::ReadBlockAsBlockIds(const uint32_t block) cons
     return children;
 }
 
-std::vector<ChildNodeNameIdPair> Filesystem::GetChildren(const INode &node) const {
-    if (!node.isDir()) {
+bool Filesystem::ForEachChild(const INode& dir,
+                              const std::function<bool(const ChildNodeNameIdView&)>& visit) const {
+    if (!dir.isDir()) {
         throw NotADirectoryException("Target not a directory");
     }
-    std::vector<ChildNodeNameIdPair> children;
+    constexpr uint32_t ENTRYSIZE = ChildNodeNameIdPair::ENTRY_BYTES;
 
-    for (auto block : node.getDirectLinks()) {
-        if (block == INode::UNUSED_LINK) {
-            return children;
+    // A recorded count ends the scan at the last entry; otherwise every
+    // block is read up to its first free slot
+    const uint32_t count = dir.getEntryCount();
+    uint32_t seen = 0;
+    bool stopped = false;
+    std::vector<char> scratch;
+
+    // True once the block list needs to be walked no further
+    auto visitBlock = [&](const uint32_t block) {
+        if (block == INode::UNUSED_LINK || (count != 0 && seen == count)) {
+            return true;
+        }
+
+        const char* data = BlockData(block, scratch);
+        for (uint32_t offset = 0; offset + ENTRYSIZE <= superblock.blockSize; offset += ENTRYSIZE) {
+            const uint32_t id = IntParser::ReadUInt32(data + offset + ChildNodeNameIdPair::NAME_LENGTH);
+            if (id == INode::UNUSED_LINK || (count != 0 && seen == count)) {
+                break;
+            }
+            ++seen;
+
+            // Fixed-length, NUL-padded name
+            const char* name = data + offset;
+            const char* nameEnd = std::find(name, name + ChildNodeNameIdPair::NAME_LENGTH, '\0');
+            if (!visit({std::string_view(name, static_cast<std::size_t>(nameEnd - name)), id})) {
+                stopped = true;
+                return true;
+            }
         }
-        for (auto child : this->ReadBlockAsSubdirectories(block)) {
-            children.push_back(child);
+        return false;
+    };
+
+    for (const uint32_t block : dir.getDirectLinks()) {
+        if (visitBlock(block)) {
+            return stopped;
         }
     }
 
-    const auto indirect = node.getFirstLevelIndirectLink();
+    const uint32_t indirect = dir.getFirstLevelIndirectLink();
     if (indirect == INode::UNUSED_LINK) {
-        return children;
+        return false;
     }
-    for (auto childBlock : this->ReadBlockAsBlockIds(indirect)) {
-        if (childBlock == INode::UNUSED_LINK) {
-            return children;
-        }
-        for (auto child : this->ReadBlockAsSubdirectories(childBlock)) {
-            children.push_back(child);
+    for (const uint32_t block : this->ReadBlockAsBlockIds(indirect)) {
+        if (visitBlock(block)) {
+            return stopped;
         }
     }
 
-    const auto indirect2 = node.getSecondLevelIndirectLink();
+    const uint32_t indirect2 = dir.getSecondLevelIndirectLink();
     if (indirect2 == INode::UNUSED_LINK) {
-        return children;
+        return false;
     }
-    for (auto childBlock : this->ReadBlockAsBlockIds(indirect2)) {
-        if (childBlock == INode::UNUSED_LINK) {
-            return children;
-        }
-        for (auto childChildBlock : this->ReadBlockAsBlockIds(childBlock)) {
-            if (childChildBlock == INode::UNUSED_LINK) {
-                return children;
-            }
-            for (auto child : this->ReadBlockAsSubdirectories(childChildBlock)) {
-                children.push_back(child);
+    for (const uint32_t table : this->ReadBlockAsBlockIds(indirect2)) {
+        for (const uint32_t block : this->ReadBlockAsBlockIds(table)) {
+            if (visitBlock(block)) {
+                return stopped;
             }
         }
     }
-    return children;
+    return false;
 }
 
-void Filesystem::RemoveChild(const INode& node, const uint32_t childNode, std::string filename = "") const {
-    if (!node.isDir()) {
-        throw NotADirectoryException("Target not a directory");
+uint32_t Filesystem::CountChildren(const INode& dir) const {
+    if (dir.getEntryCount() != 0) {
+        return dir.getEntryCount();
     }
 
-    constexpr uint32_t ENTRYSIZE = 12 + sizeof(uint32_t);
+    uint32_t count = 0;
+    (void) this->ForEachChild(dir, [&count](const ChildNodeNameIdView&) {
+        ++count;
+        return true;
+    });
+    return count;
+}
 
-    struct EntryLoc {
-        uint32_t block;
-        uint32_t index;
-    };
+bool Filesystem::CountsEntries() const {
+    return this->superblock.version >= 7;
+}
 
-    std::optional<EntryLoc> target;
-    std::optional<EntryLoc> last;
+std::vector<ChildNodeNameIdPair> Filesystem::GetChildren(const INode &node) const {
+    ZOS_PERF_SCOPE(Perf::Probe::GET_CHILDREN);
+    std::vector<ChildNodeNameIdPair> children;
+    children.reserve(node.getEntryCount());
 
-    auto scanBlock = [&](uint32_t blockId) {
-        auto entries = ReadBlockAsSubdirectories(blockId);
-        for (uint32_t i = 0; i < entries.size(); ++i) {
-            if (entries[i].id == childNode && (filename.empty() || filename == entries[i].name)) {
-                target = { blockId, i };
-            }
-            last = { blockId, i };
-        }
-    };
+    (void) this->ForEachChild(node, [&children](const ChildNodeNameIdView& child) {
+        children.push_back({std::string(child.name), child.id});
+        return true;
+    });
+    return children;
+}
 
-    // =========================
-    // Scan direct blocks
-    // =========================
-    for (auto block : node.getDirectLinks()) {
-        if (block == INode::UNUSED_LINK) break;
-        scanBlock(block);
-    }
+void Filesystem::RemoveChild(INode& node, const uint32_t childNode, std::string filename = "") const {
+    constexpr uint32_t ENTRYSIZE = ChildNodeNameIdPair::ENTRY_BYTES;
+    const uint32_t ENTRIES_PER_BLOCK = this->superblock.blockSize / ENTRYSIZE;
 
     // =========================
-    // Scan single indirect
+    // Find the entry
     // =========================
-    if (node.getFirstLevelIndirectLink() != INode::UNUSED_LINK) {
-        for (auto block : ReadBlockAsBlockIds(node.getFirstLevelIndirectLink())) {
-            scanBlock(block);
-        }
-    }
+    // With a recorded count the last entry is known, so the scan stops
+    // at the match
+    const bool counted = node.getEntryCount() != 0;
+    std::optional<uint32_t> target;
+    std::string targetName;
+    uint32_t count = 0;
 
-    // =========================
-    // Scan double indirect
-    // =========================
-    if (node.getSecondLevelIndirectLink() != INode::UNUSED_LINK) {
-        for (auto ptr : ReadBlockAsBlockIds(node.getSecondLevelIndirectLink())) {
-            for (auto block : ReadBlockAsBlockIds(ptr)) {
-                scanBlock(block);
-            }
+    (void) this->ForEachChild(node, [&](const ChildNodeNameIdView& entry) {
+        if (!target && entry.id == childNode && (filename.empty() || filename == entry.name)) {
+            target = count;
+            targetName = std::string(entry.name);
         }
-    }
+        ++count;
+        return !(target && counted);
+    });
 
     if (!target) {
         throw ChildNotFoundException("Child " + std::to_string(childNode) + "not found");
     }
 
-    // =========================
-    // If target == last → just clear
-    // =========================
-    if (target->block == last->block &&
-        target->index == last->index) {
-
-        uint64_t offset =
-            superblock.dataBlocksOffset +
-            last->block * superblock.blockSize +
-            last->index * ENTRYSIZE;
+    this->Index->Remove(node.getId(), targetName);
 
-        FileIO->WriteBytes(offset, std::vector<char>(ENTRYSIZE, 0xFF));
-        return;
+    // Removing a directory entry may rename working directories (an
+    // entry repaired by Check() may name a nonexistent inode)
+    if (childNode < this->superblock.totalInodes && this->readINode(childNode).isDir()) {
+        this->ForgetWorkingPaths();
     }
 
     // =========================
-    // Move last entry into target
+    // Move the last entry into the freed slot
     // =========================
-    uint64_t lastOffset =
-        superblock.dataBlocksOffset +
-        last->block * superblock.blockSize +
-        last->index * ENTRYSIZE;
-
-    auto lastData = FileIO->ReadBytes(lastOffset, ENTRYSIZE);
-    if (lastData.size() != ENTRYSIZE) {
-        throw std::runtime_error("Failed to read last entry");
+    const uint32_t last = (counted ? node.getEntryCount() : count) - 1;
+    const uint32_t lastBlock = this->BlockAt(node, last / ENTRIES_PER_BLOCK);
+    const uint32_t targetBlock = this->BlockAt(node, *target / ENTRIES_PER_BLOCK);
+    if (lastBlock == INode::UNUSED_LINK || targetBlock == INode::UNUSED_LINK) {
+        throw FileReadException("Entry count of directory " + std::to_string(node.getId()) + " is damaged");
     }
 
-    uint64_t targetOffset =
-        superblock.dataBlocksOffset +
-        target->block * superblock.blockSize +
-        target->index * ENTRYSIZE;
+    const uint32_t lastOffset = last % ENTRIES_PER_BLOCK * ENTRYSIZE;
+    if (*target != last) {
+        std::vector<char> scratch;
+        const char* lastData = BlockData(lastBlock, scratch);
+        const std::vector<char> entry(lastData + lastOffset, lastData + lastOffset + ENTRYSIZE);
 
-    // overwrite removed entry
-    FileIO->WriteBytes(targetOffset, lastData);
+        Cache->WriteBytes(targetBlock, *target % ENTRIES_PER_BLOCK * ENTRYSIZE, entry);
+    }
 
     // clear last slot
-    FileIO->WriteBytes(lastOffset, std::vector<char>(ENTRYSIZE, 0xFF));
+    Cache->WriteBytes(lastBlock, lastOffset, std::vector<char>(ENTRYSIZE, 0xFF));
+
+    if (this->CountsEntries()) {
+        node.setEntryCount(last);
+        writeINode(node);
+    }
 }
 
 bool Filesystem::RemoveFromBlockIdTable(const uint32_t tableBlock, const uint32_t value) {
@@ -849,8 +1572,9 @@ bool Filesystem::RemoveFromBlockIdTable(const uint32_t tableBlock, const uint32_
     auto ids = ReadBlockAsBlockIds(tableBlock);
     if (ids.empty()) return false;
 
+    // Files shrink from their end; look there first
     int target = -1;
-    for (int i = 0; i < static_cast<int>(ids.size()); ++i) {
+    for (int i = static_cast<int>(ids.size()) - 1; i >= 0; --i) {
         if (ids[i] == value) {
             target = i;
             break;
@@ -860,36 +1584,46 @@ bool Filesystem::RemoveFromBlockIdTable(const uint32_t tableBlock, const uint32_
 
     int last = static_cast<int>(ids.size()) - 1;
 
-    uint64_t targetOffset =
-        superblock.dataBlocksOffset +
-        tableBlock * superblock.blockSize +
-        target * ENTRYSIZE;
-
-    uint64_t lastOffset =
-        superblock.dataBlocksOffset +
-        tableBlock * superblock.blockSize +
-        last * ENTRYSIZE;
-
     if (target != last) {
-        auto lastBytes = FileIO->ReadBytes(lastOffset, ENTRYSIZE);
-        FileIO->WriteBytes(targetOffset, lastBytes);
+        Cache->WriteBytes(tableBlock, target * ENTRYSIZE, IntParser::WriteUInt32(ids[last]));
     }
 
     // clear last entry
-    FileIO->WriteBytes(lastOffset, std::vector<char>(ENTRYSIZE, 0xFF));
+    Cache->WriteBytes(tableBlock, last * ENTRYSIZE, std::vector<char>(ENTRYSIZE, 0xFF));
     return true;
 }
 
 void Filesystem::DeattachBlock(INode& node, const uint32_t block) {
+    // A block may be referenced more than once (deduplicated contents);
+    // the map is searched from its end, so the last reference is removed
+
     // =========================
-    // 1) Direct blocks
+    // 1) Double indirect
     // =========================
-    for (auto b : node.getDirectLinks()) {
-        if (b == block) {
-            node.removeDirectLink(block);
-            FreeBlock(block);
-            writeINode(node);
-            return;
+    if (node.getSecondLevelIndirectLink() != INode::UNUSED_LINK) {
+        uint32_t ind2 = node.getSecondLevelIndirectLink();
+
+        auto ptrs = ReadBlockAsBlockIds(ind2);
+        for (auto it = ptrs.rbegin(); it != ptrs.rend(); ++it) {
+            const uint32_t ptr = *it;
+            if (RemoveFromBlockIdTable(ptr, block)) {
+                FreeBlock(block);
+
+                // if second-level table empty, free it
+                if (ReadBlockAsBlockIds(ptr).empty()) {
+                    RemoveFromBlockIdTable(ind2, ptr);
+                    FreeBlock(ptr);
+                }
+
+                // if double-indirect table empty, free it
+                if (ReadBlockAsBlockIds(ind2).empty()) {
+                    FreeBlock(ind2);
+                    node.removeSecondLevelIndirectLink();
+                }
+
+                writeINode(node);
+                return;
+            }
         }
     }
 
@@ -914,31 +1648,14 @@ void Filesystem::DeattachBlock(INode& node, const uint32_t block) {
     }
 
     // =========================
-    // 3) Double indirect
+    // 3) Direct blocks
     // =========================
-    if (node.getSecondLevelIndirectLink() != INode::UNUSED_LINK) {
-        uint32_t ind2 = node.getSecondLevelIndirectLink();
-
-        auto ptrs = ReadBlockAsBlockIds(ind2);
-        for (uint32_t ptr : ptrs) {
-            if (RemoveFromBlockIdTable(ptr, block)) {
-                FreeBlock(block);
-
-                // if second-level table empty, free it
-                if (ReadBlockAsBlockIds(ptr).empty()) {
-                    RemoveFromBlockIdTable(ind2, ptr);
-                    FreeBlock(ptr);
-                }
-
-                // if double-indirect table empty, free it
-                if (ReadBlockAsBlockIds(ind2).empty()) {
-                    FreeBlock(ind2);
-                    node.removeSecondLevelIndirectLink();
-                }
-
-                writeINode(node);
-                return;
-            }
+    for (auto b : node.getDirectLinks()) {
+        if (b == block) {
+            node.removeDirectLink(block);
+            FreeBlock(block);
+            writeINode(node);
+            return;
         }
     }
 
@@ -946,10 +1663,32 @@ void Filesystem::DeattachBlock(INode& node, const uint32_t block) {
 }
 
 std::optional<uint32_t> Filesystem::FindChildId(const INode &dir, std::string name) const {
+    std::optional<uint32_t> child;
+    if (this->Index->TryFind(dir.getId(), name, child)) {
+        return child;
+    }
+
+    // "." and ".." are no reason to index a directory, nor is a name in
+    // one too large to index; those are scanned up to the match
+    if (name == "." || name == ".." || dir.getEntryCount() > this->Index->Capacity()) {
+        (void) this->ForEachChild(dir, [&](const ChildNodeNameIdView& entry) {
+            if (entry.name != name) {
+                return true;
+            }
+            child = entry.id;
+            return false;
+        });
+        return child;
+    }
+
+    // Index the directory on first lookup
     const auto children = this->GetChildren(dir);
-    for (auto child : children) {
-        if (child.name == name) {
-            return child.id;
+    this->Index->Build(dir.getId(), children);
+
+    // Answer from the entries read; another thread may drop the index again
+    for (const auto& entry : children) {
+        if (entry.name == name) {
+            return entry.id;
         }
     }
     return std::nullopt;
@@ -959,6 +1698,31 @@ bool Filesystem::ExistsChild(const INode &dir, const std::string& name) const {
     return this->FindChildId(dir, name) != std::nullopt;
 }
 
+std::vector<uint32_t> Filesystem::GetDataBlockIds(const INode &node) const {
+    std::vector<uint32_t> ids;
+
+    for (auto b : node.getDirectLinks()) {
+        if (b != INode::UNUSED_LINK) {
+            ids.push_back(b);
+        }
+    }
+
+    if (node.getFirstLevelIndirectLink() != INode::UNUSED_LINK) {
+        for (auto b : this->ReadBlockAsBlockIds(node.getFirstLevelIndirectLink())) {
+            ids.push_back(b);
+        }
+    }
+
+    if (node.getSecondLevelIndirectLink() != INode::UNUSED_LINK) {
+        for (auto ptr : this->ReadBlockAsBlockIds(node.getSecondLevelIndirectLink())) {
+            for (auto b : this->ReadBlockAsBlockIds(ptr)) {
+                ids.push_back(b);
+            }
+        }
+    }
+    return ids;
+}
+
 std::vector<uint32_t> Filesystem::GetAllBlockIds(const INode &node) const {
     std::vector<uint32_t> ids;
 
@@ -994,6 +1758,7 @@ std::vector<uint32_t> Filesystem::GetAllBlockIds(const INode &node) const {
 }
 
 INode Filesystem::ResolvePath(const std::string& path) const {
+    ZOS_PERF_SCOPE(Perf::Probe::RESOLVE_PATH);
     if (path.empty()) {
         throw EmptyPathException("Empty path");
     }
@@ -1001,7 +1766,7 @@ INode Filesystem::ResolvePath(const std::string& path) const {
     INode node =
         (path[0] == '/')
             ? this->readINode(this->superblock.rootNodeId)
-            : this->currentNode;
+            : this->readINode(this->Session().node);
 
     for (const auto& part : SplitPath(path)) {
         if (part == ".") {
@@ -1045,7 +1810,7 @@ INode Filesystem::ResolveParent(const std::string& path) const {
 
     INode node = (path[0] == '/')
         ? readINode(superblock.rootNodeId)
-        : currentNode;
+        : readINode(Session().node);
 
     auto parts = SplitPath(path);
     parts.pop_back();
@@ -1079,6 +1844,8 @@ INode Filesystem::ResolveParent(const std::string& path) const {
 }
 
 void Filesystem::CreateDirectory(const std::string& path) {
+    const auto guard = this->LockOperations();
+    this->EnsureWritable();
     if (path.empty()) {
         throw EmptyPathException("Empty path");
     }
@@ -1086,6 +1853,10 @@ void Filesystem::CreateDirectory(const std::string& path) {
     INode parent = this->ResolveParent(path);
     auto name = SplitPath(path).back();
 
+    if (this->ExistsChild(parent, name)) {
+        throw FileWriteException("Destination already exists");
+    }
+
     auto newNode = this->AllocateNode(true);
     if (!newNode) {
         throw CouldNotAllocateNodeException(
@@ -1105,6 +1876,8 @@ void Filesystem::CreateDirectory(const std::string& path) {
 }
 
 void Filesystem::RemoveDirectory(const std::string& path) {
+    const auto guard = this->LockOperations();
+    this->EnsureWritable();
     if (path.empty()) {
         throw EmptyPathException("Empty path");
     }
@@ -1122,7 +1895,7 @@ void Filesystem::RemoveDirectory(const std::string& path) {
         throw PathNotFoundException("Directory not found");
     }
 
-    if (*id == this->currentNode.getId()) {
+    if (this->IsWorkingDirectory(*id)) {
         throw PathNotFoundException("Cannot remove current directory");
     }
 
@@ -1131,7 +1904,7 @@ void Filesystem::RemoveDirectory(const std::string& path) {
         throw NotADirectoryException("Target is not a directory");
     }
 
-    if (this->GetChildren(dir).size() > 2) {
+    if (this->CountChildren(dir) > 2) {
         throw std::runtime_error("Directory not empty");
     }
 
@@ -1141,20 +1914,20 @@ void Filesystem::RemoveDirectory(const std::string& path) {
 }
 
 
-void Filesystem::WriteFile(const std::string& srcPath, std::vector<char> data) {
-    if (srcPath.empty()) {
+INode Filesystem::CreateOrTruncate(const std::string& path) {
+    if (path.empty()) {
         throw EmptyPathException("Empty path");
     }
 
     // =========================
     // Resolve parent directory
     // =========================
-    INode parent = ResolveParent(srcPath);
+    INode parent = ResolveParent(path);
     if (!parent.isDir()) {
         throw NotADirectoryException("Parent is not a directory");
     }
 
-    auto parts = SplitPath(srcPath);
+    auto parts = SplitPath(path);
     const std::string& filename = parts.back();
 
     if (filename.empty()) {
@@ -1191,130 +1964,870 @@ void Filesystem::WriteFile(const std::string& srcPath, std::vector<char> data) {
             file.removeFirstLevelIndirectLink();
         }
 
-        if (file.getSecondLevelIndirectLink() != INode::UNUSED_LINK) {
-            for (uint32_t ptr : ReadBlockAsBlockIds(file.getSecondLevelIndirectLink())) {
-                for (uint32_t block : ReadBlockAsBlockIds(ptr)) {
-                    FreeBlock(block);
-                }
-                FreeBlock(ptr);
-            }
-            FreeBlock(file.getSecondLevelIndirectLink());
-            file.removeSecondLevelIndirectLink();
-        }
+        if (file.getSecondLevelIndirectLink() != INode::UNUSED_LINK) {
+            for (uint32_t ptr : ReadBlockAsBlockIds(file.getSecondLevelIndirectLink())) {
+                for (uint32_t block : ReadBlockAsBlockIds(ptr)) {
+                    FreeBlock(block);
+                }
+                FreeBlock(ptr);
+            }
+            FreeBlock(file.getSecondLevelIndirectLink());
+            file.removeSecondLevelIndirectLink();
+        }
+
+        file.clearDirectLinks();
+        file.clearInline();
+        file.clearCompressed();
+        file.removeSize(file.getSize());
+    } else {
+        auto newNode = AllocateNode(false);
+        if (!newNode) {
+            throw CouldNotAllocateNodeException("Could not allocate file inode");
+        }
+
+        file = *newNode;
+        AddChild(parent, filename, file.getId());
+        writeINode(parent);
+    }
+
+    writeINode(file);
+    return file;
+}
+
+void Filesystem::WriteFile(const std::string& srcPath, std::vector<char> data) {
+    const auto guard = this->LockOperations();
+    this->EnsureWritable();
+    if (srcPath.empty()) {
+        throw EmptyPathException("Empty path");
+    }
+
+    const size_t total = data.size();
+
+    // Small files take no data block at all
+    if (total > 0 && total <= InlineCapacity()) {
+        INode file = CreateOrTruncate(srcPath);
+        file.writeInline(0, data.data(), total);
+        file.addSize(total);
+        writeINode(file);
+        return;
+    }
+
+    // =========================
+    // Pack file data
+    // =========================
+    // Stored compressed, with the chunk table behind the chunks, only
+    // if that takes fewer blocks
+    const size_t blockSize = superblock.blockSize;
+    std::vector<char> packed;
+
+    if (CompressesFiles()) {
+        ChunkMap map(blockSize);
+        packed = PackChunks(data.data(), total, map);
+
+        const std::vector<char> table = map.SaveToBytes();
+        packed.insert(packed.end(), table.begin(), table.end());
+
+        if (packed.size() >= (total + blockSize - 1) / blockSize * blockSize) {
+            packed = std::vector<char>();
+        }
+    }
+
+    const char* contents = packed.empty() ? data.data() : packed.data();
+    const uint64_t bytes = packed.empty() ? total : packed.size();
+
+    // =========================
+    // Write file data
+    // =========================
+    const auto blockCount = static_cast<uint32_t>((bytes + blockSize - 1) / blockSize);
+
+    // Fail before the old contents are released if data and tables do
+    // not fit in the free blocks and the blocks the old contents hold
+    if (AvailableBlocks() + ReleasableBlocks(srcPath) < blockCount + BlockMapOverhead(blockCount)) {
+        throw CouldNotAllocateBlockException("No free blocks for file data");
+    }
+
+    INode file = CreateOrTruncate(srcPath);
+
+    // Data blocks are reserved up front so the file is laid out in
+    // contiguous runs, each of which is written with a single request;
+    // all runs are submitted at once and the block map is built while
+    // they are in flight. Blocks that share stored ones are not written.
+    const Placement placement = PlaceBlocks(contents, bytes, blockCount);
+    std::vector<std::future<void>> written = SubmitPlaced(placement, contents, bytes);
+
+    try {
+        BuildBlockMap(file, placement.blocks);
+    } catch (...) {
+        // The requests still read from data
+        for (auto& request : written) {
+            request.wait();
+        }
+        throw;
+    }
+    for (auto& request : written) {
+        request.wait();
+    }
+    for (auto& request : written) {
+        request.get();
+    }
+    IndexBlocks(placement);
+
+    if (!packed.empty()) {
+        file.setCompressed(blockCount);
+    }
+    file.addSize(total);
+    writeINode(file);
+}
+
+std::vector<char> Filesystem::ReadFile(const std::string& srcPath) {
+    const auto guard = this->ShareOperations();
+
+    if (srcPath.empty()) {
+        throw EmptyPathException("Empty path");
+    }
+
+    const uint32_t id = ResolvePath(srcPath).getId();
+
+    // File handles may write the file in the meantime
+    const auto fileLock = this->ShareINode(id);
+    INode file = readINode(id);
+
+    if (file.isDir()) {
+        throw NotADirectoryException("Cannot read a directory");
+    }
+
+    if (file.isInline()) {
+        return std::vector<char>(file.getInlineData(), file.getInlineData() + file.getSize());
+    }
+
+    // All chunks are read as one batch and unpacked in parallel
+    if (file.isCompressed()) {
+        const ChunkMap map = ReadChunkMap(file);
+
+        std::vector<uint32_t> blocks = GetDataBlockIds(file);
+        if (blocks.size() != file.getStoredBlocks()) {
+            throw FileReadException("Block map of inode " + std::to_string(id) + " is damaged");
+        }
+        blocks.resize(map.FirstBlock(map.Count()));
+
+        return ReadChunks(map, 0, map.Count(), blocks, file.getSize());
+    }
+
+    // Gather the whole block list first, so that adjacent blocks are
+    // read with a single request straight into the result
+    const uint32_t blockSize = superblock.blockSize;
+    const uint64_t size = file.getSize();
+    const uint64_t used = (size + blockSize - 1) / blockSize;
+
+    std::vector<uint32_t> blocks = GetDataBlockIds(file);
+    if (blocks.size() > used) {
+        blocks.resize(used);
+    }
+
+    std::vector<char> result(size);
+    ReadBlocks(blocks, 0, result.data(), size);
+    return result;
+}
+
+void Filesystem::AppendFile(const std::string& path, const std::vector<char>& data) {
+    // May create the file
+    const auto guard = this->LockOperations();
+    this->EnsureWritable();
+    if (path.empty()) {
+        throw EmptyPathException("Empty path");
+    }
+
+    const INode parent = ResolveParent(path);
+    const auto parts = SplitPath(path);
+    const auto id = parts.empty() ? std::nullopt : FindChildId(parent, parts.back());
+
+    INode file = id ? readINode(*id) : CreateOrTruncate(path);
+    if (file.isDir()) {
+        throw NotADirectoryException("Cannot write to a directory");
+    }
+
+    WriteAt(file, file.getSize(), data.data(), data.size());
+}
+
+void Filesystem::WriteAt(const std::string& path, const uint64_t offset, const std::vector<char>& data) {
+    FileHandle file = Open(path);
+    file.Write(offset, data.data(), data.size());
+}
+
+void Filesystem::TruncateFile(const std::string& path, const uint64_t size) {
+    FileHandle file = Open(path);
+    file.Truncate(size);
+}
+
+FileHandle Filesystem::Open(const std::string& path) {
+    const auto guard = this->ShareOperations();
+    if (path.empty()) {
+        throw EmptyPathException("Empty path");
+    }
+
+    const INode file = ResolvePath(path);
+    if (file.isDir()) {
+        throw NotADirectoryException("Cannot open a directory");
+    }
+
+    return FileHandle(*this, file.getId());
+}
+
+FileHandle Filesystem::Create(const std::string& path) {
+    const auto guard = this->LockOperations();
+    this->EnsureWritable();
+    return FileHandle(*this, CreateOrTruncate(path).getId());
+}
+
+void Filesystem::EnsureRoom(const std::string& path, const uint64_t size) const {
+    const auto guard = this->ShareOperations();
+    if (size <= InlineCapacity() || CompressesFiles()) {
+        return;
+    }
+    if (size > MaxFileSize()) {
+        throw FileTooLargeException("No room for new blocks");
+    }
+
+    const uint32_t blockSize = superblock.blockSize;
+    const auto blocks = static_cast<uint32_t>((size + blockSize - 1) / blockSize);
+    if (static_cast<uint64_t>(AvailableBlocks()) + ReleasableBlocks(path) <
+        static_cast<uint64_t>(blocks) + BlockMapOverhead(blocks)) {
+        throw CouldNotAllocateBlockException("No free blocks for file data");
+    }
+}
+
+std::size_t Filesystem::ReadAt(const INode& node,
+                               const uint64_t offset,
+                               char* buffer,
+                               const std::size_t size,
+                               const uint64_t readAhead) const {
+    if (offset >= node.getSize()) {
+        return 0;
+    }
+
+    const uint32_t blockSize = superblock.blockSize;
+    const std::size_t total = std::min<uint64_t>(size, node.getSize() - offset);
+
+    if (node.isInline()) {
+        std::copy_n(node.getInlineData() + offset, total, buffer);
+        return total;
+    }
+
+    if (node.isCompressed()) {
+        return ReadCompressed(node, offset, buffer, total, readAhead);
+    }
+
+    const auto first = static_cast<uint32_t>(offset / blockSize);
+    const auto last = static_cast<uint32_t>((offset + total - 1) / blockSize);
+    const auto used = static_cast<uint32_t>((node.getSize() + blockSize - 1) / blockSize);
+
+    // =========================
+    // Read ahead
+    // =========================
+    const auto ahead = static_cast<uint32_t>(std::min<uint64_t>(
+        (readAhead + blockSize - 1) / blockSize, used - last - 1
+    ));
+
+    if (ahead > 0) {
+        std::vector<uint32_t> upcoming;
+        upcoming.reserve(ahead);
+        for (uint32_t index = last + 1; index <= last + ahead; ++index) {
+            upcoming.push_back(BlockAt(node, index));
+        }
+        Cache->Prefetch(CoalesceRuns(upcoming));
+    }
+
+    // =========================
+    // Requested range
+    // =========================
+    std::vector<uint32_t> blocks;
+    blocks.reserve(last - first + 1);
+    for (uint32_t index = first; index <= last; ++index) {
+        blocks.push_back(BlockAt(node, index));
+    }
+
+    ReadBlocks(blocks, static_cast<uint32_t>(offset % blockSize), buffer, total);
+    return total;
+}
+
+void Filesystem::ReadBlocks(const std::vector<uint32_t>& blocks,
+                            const uint32_t offset,
+                            char* buffer,
+                            const uint64_t size) const {
+    // The uncached parts of all runs are read as one batch
+    Cache->ReadThrough(CoalesceRuns(blocks), offset, buffer, size);
+}
+
+std::vector<BlockRun> Filesystem::CoalesceRuns(const std::vector<uint32_t>& blocks) {
+    std::vector<BlockRun> runs;
+    for (const uint32_t block : blocks) {
+        if (!runs.empty() && runs.back().start + runs.back().length == block) {
+            ++runs.back().length;
+        } else {
+            runs.push_back(BlockRun{block, 1});
+        }
+    }
+    return runs;
+}
+
+void Filesystem::WriteAt(INode& node,
+                         const uint64_t offset,
+                         const char* data,
+                         const std::size_t size) {
+    const uint64_t end = offset + size;
+
+    // =========================
+    // Compressed contents
+    // =========================
+    // Appending repacks the last chunk only; anything else overwrites
+    // contents in place, which needs them as written
+    if (node.isCompressed()) {
+        if (offset == node.getSize()) {
+            if (size > 0) {
+                RewriteCompressed(node, offset, data, size);
+            }
+            return;
+        }
+        Inflate(node);
+    }
+
+    // =========================
+    // Inline contents
+    // =========================
+    // An empty file owns no block, so it may start out inline as well
+    if (node.isInline() || node.getSize() == 0) {
+        if (end == 0) {
+            return;
+        }
+
+        if (end <= InlineCapacity()) {
+            node.writeInline(offset, data, size);
+            if (end > node.getSize()) {
+                node.addSize(end - node.getSize());
+            }
+            writeINode(node);
+            return;
+        }
+
+        // Outgrown by appending on an image that compresses files: packed
+        // from the first block on, unless the data does not compress
+        if (CompressesFiles() && offset == node.getSize()) {
+            std::vector<char> content(node.getInlineData(), node.getInlineData() + node.getSize());
+            content.insert(content.end(), data, data + size);
+            node.clearInline();
+            node.removeSize(node.getSize());
+
+            if (!RewriteCompressed(node, 0, content.data(), content.size())) {
+                WriteBlocks(node, 0, content.data(), content.size());
+            }
+            return;
+        }
+
+        // Outgrown: move the contents to a data block first
+        if (node.isInline()) {
+            const std::vector<char> content(node.getInlineData(),
+                                            node.getInlineData() + node.getSize());
+            node.clearInline();
+            node.removeSize(node.getSize());
+            WriteBlocks(node, 0, content.data(), content.size());
+        }
+    }
+
+    WriteBlocks(node, offset, data, size);
+}
+
+void Filesystem::WriteBlocks(INode& node,
+                             const uint64_t offset,
+                             const char* data,
+                             const std::size_t size) {
+    const uint32_t blockSize = superblock.blockSize;
+    const uint64_t end = offset + size;
+
+    // Fill a gap past the end of file with zeros first, in block-aligned
+    // pieces so that whole blocks bypass the cache
+    if (offset > node.getSize()) {
+        const std::vector<char> zeros(blockSize, 0);
+        while (node.getSize() < offset) {
+            const auto chunk = static_cast<std::size_t>(
+                std::min<uint64_t>(blockSize - node.getSize() % blockSize,
+                                   offset - node.getSize())
+            );
+            WriteBlocks(node, node.getSize(), zeros.data(), chunk);
+        }
+    }
+
+    if (size == 0) {
+        return;
+    }
+
+    const auto oldBlocks = static_cast<uint32_t>((node.getSize() + blockSize - 1) / blockSize);
+    const uint64_t needed = (end + blockSize - 1) / blockSize;
+
+    if (needed > UINT32_MAX || end > MaxFileSize()) {
+        throw FileTooLargeException("No room for new blocks");
+    }
+    const auto newBlocks = static_cast<uint32_t>(needed);
+
+    // =========================
+    // Grow the block map
+    // =========================
+    Placement placement;
+    if (newBlocks > oldBlocks) {
+        const uint32_t tables = BlockMapOverhead(newBlocks) - BlockMapOverhead(oldBlocks);
+        if (AvailableBlocks() < newBlocks - oldBlocks + tables) {
+            throw CouldNotAllocateBlockException("No free blocks for file data");
+        }
+
+        // Tables first, so the data of this write stays contiguous
+        for (uint32_t index = oldBlocks; index < newBlocks; ++index) {
+            EnsureTables(node, index);
+        }
+
+        // New blocks start at a block boundary past the old end of file
+        const uint64_t first = static_cast<uint64_t>(oldBlocks) * blockSize;
+        placement = PlaceBlocks(data + (first - offset), end - first, newBlocks - oldBlocks);
+
+        uint32_t index = oldBlocks;
+        for (const uint32_t block : placement.blocks) {
+            MapBlock(node, index++, block);
+        }
+    }
+
+    // =========================
+    // Copy shared blocks before writing them
+    // =========================
+    // Indexed blocks may gain owners at any time, so with an index every
+    // block is checked, and leaves the index, under the allocator lock
+    bool shared = false;
+    {
+        const auto lock = this->LockAllocator();
+        shared = this->References.SharedCount() > 0 || this->Dedup.Enabled();
+    }
+
+    if (shared) {
+        const auto last = std::min(oldBlocks, newBlocks);
+        for (auto index = static_cast<uint32_t>(offset / blockSize); index < last; ++index) {
+            const uint64_t start = static_cast<uint64_t>(index) * blockSize;
+            const bool whole = offset <= start && end >= start + blockSize;
+            UnshareBlock(node, index, !whole);
+        }
+    }
+
+    // =========================
+    // Write data
+    // =========================
+    // Only the first and the last block can be partial, so the whole
+    // blocks cover one stretch of the data, split only where new blocks
+    // share stored ones; runs of physically adjacent blocks go out in
+    // one write each, a stretch as one batch
+    std::size_t done = 0;
+    std::vector<BlockRun> whole;
+    std::size_t wholeFrom = 0;
+    std::vector<std::future<void>> written;
+
+    auto submitWhole = [&] {
+        if (whole.empty()) {
+            return;
+        }
+        uint64_t bytes = 0;
+        for (const BlockRun& run : whole) {
+            bytes += static_cast<uint64_t>(run.length) * blockSize;
+        }
+        written.push_back(Cache->SubmitThrough(whole, data + wholeFrom, bytes));
+        whole.clear();
+    };
+
+    while (done < size) {
+        const uint64_t position = offset + done;
+        const auto index = static_cast<uint32_t>(position / blockSize);
+        const uint32_t inBlock = position % blockSize;
+        const std::size_t chunk = std::min<std::size_t>(blockSize - inBlock, size - done);
+        const uint32_t block = BlockAt(node, index);
+
+        if (index >= oldBlocks && !placement.fresh[index - oldBlocks]) {
+            // Already holds these contents
+            submitWhole();
+        } else if (chunk == blockSize) {
+            if (whole.empty()) {
+                wholeFrom = done;
+            }
+            if (whole.empty() || whole.back().start + whole.back().length != block) {
+                whole.push_back(BlockRun{block, 0});
+            }
+            ++whole.back().length;
+        } else {
+            if (index >= oldBlocks) {
+                // New block: whatever is not written reads as zeros
+                std::vector<char> content(blockSize, 0);
+                std::copy_n(data + done, chunk, content.begin() + inBlock);
+                Cache->WriteBlock(block, std::move(content));
+            } else {
+                Cache->WriteBytes(block, inBlock, std::vector<char>(data + done, data + done + chunk));
+            }
+        }
+
+        done += chunk;
+    }
+
+    submitWhole();
+    for (auto& request : written) {
+        request.wait();
+    }
+    for (auto& request : written) {
+        request.get();
+    }
+    IndexBlocks(placement);
+
+    if (end > node.getSize()) {
+        node.addSize(end - node.getSize());
+    }
+    writeINode(node);
+}
+
+uint32_t Filesystem::UnshareBlock(INode& node, const uint32_t index, const bool preserve) {
+    const uint32_t block = BlockAt(node, index);
+    const uint32_t blockSize = superblock.blockSize;
+
+    uint32_t copy = 0;
+    std::vector<char> content;
+    {
+        // Checked, copied and released at once, so that two owners
+        // writing the block at the same time both see its old contents
+        const auto lock = this->LockAllocator();
+        if (this->References.Get(block) == 0) {
+            // Written in place, so its contents no longer match the index
+            this->Dedup.Forget(block);
+            return block;
+        }
+
+        const auto free = BlockBitmap.FindFirstFree();
+        if (!free) {
+            throw CouldNotAllocateBlockException("No free block for a private copy");
+        }
+        BlockBitmap.Set(*free, true);
+        copy = *free;
+
+        if (preserve) {
+            std::vector<char> scratch;
+            const char* data = BlockData(block, scratch);
+            content.assign(data, data + blockSize);
+        }
+
+        this->References.Release(block);
+    }
+
+    if (preserve) {
+        Cache->WriteBlock(copy, std::move(content));
+    }
+
+    if (index < INode::DIRECT_LINKS) {
+        node.replaceDirectLink(static_cast<int>(index), copy);
+    } else {
+        MapBlock(node, index, copy);
+    }
+    return copy;
+}
+
+uint64_t Filesystem::MaxFileSize() const {
+    return superblock.version >= 4 ? UINT64_MAX : UINT32_MAX;
+}
+
+uint32_t Filesystem::InlineCapacity() const {
+    return superblock.version >= 5 ? INode::INLINE_BYTES : 0;
+}
+
+bool Filesystem::CompressesFiles() const {
+    return superblock.compression == Superblock::COMPRESSION_LZ4;
+}
+
+std::vector<char> Filesystem::PackChunks(const char* data, const uint64_t size, ChunkMap& map) const {
+    const uint64_t chunkBytes = map.ChunkBytes();
+    const uint32_t count = map.ChunksFor(size);
+
+    std::vector<std::vector<char>> chunks(count);
+    ForEachChunk(count, [&](const uint32_t chunk) {
+        const uint64_t from = chunk * chunkBytes;
+        chunks[chunk] = map.Pack(data + from, std::min(chunkBytes, size - from));
+    });
+
+    std::vector<char> stored;
+    for (const std::vector<char>& chunk : chunks) {
+        map.Push(static_cast<uint32_t>(chunk.size() / superblock.blockSize));
+        stored.insert(stored.end(), chunk.begin(), chunk.end());
+    }
+    return stored;
+}
+
+ChunkMap Filesystem::ReadChunkMap(const INode& node) const {
+    const uint32_t blockSize = superblock.blockSize;
+    const ChunkMap empty(blockSize);
+
+    const uint32_t tables = empty.TableBlocks(empty.ChunksFor(node.getSize()));
+    const uint32_t stored = node.getStoredBlocks();
+    if (tables > stored) {
+        throw FileReadException("Chunk table of inode " + std::to_string(node.getId()) + " is damaged");
+    }
+
+    // The table blocks end the block map
+    std::vector<char> data(static_cast<std::size_t>(tables) * blockSize);
+    ReadBlocks(BlocksAt(node, stored - tables, stored), 0, data.data(), data.size());
+
+    ChunkMap map = ChunkMap::LoadFromBytes(data, node.getSize(), blockSize);
+    if (map.FirstBlock(map.Count()) + tables != stored) {
+        throw FileReadException("Chunk table of inode " + std::to_string(node.getId()) + " is damaged");
+    }
+    return map;
+}
+
+std::vector<uint32_t> Filesystem::BlocksAt(const INode& node, const uint32_t from, const uint32_t to) const {
+    std::vector<uint32_t> blocks;
+    blocks.reserve(to - from);
+
+    for (uint32_t index = from; index < to; ++index) {
+        const uint32_t block = BlockAt(node, index);
+        if (block == INode::UNUSED_LINK) {
+            throw FileReadException("Block map of inode " + std::to_string(node.getId()) + " is damaged");
+        }
+        blocks.push_back(block);
+    }
+    return blocks;
+}
+
+std::vector<char> Filesystem::ReadChunks(const ChunkMap& map,
+                                         const uint32_t first,
+                                         const uint32_t end,
+                                         const std::vector<uint32_t>& blocks,
+                                         const uint64_t fileSize) const {
+    const uint32_t blockSize = superblock.blockSize;
+    const uint64_t chunkBytes = map.ChunkBytes();
+
+    std::vector<char> stored(blocks.size() * blockSize);
+    ReadBlocks(blocks, 0, stored.data(), stored.size());
+
+    const uint64_t begin = first * chunkBytes;
+    std::vector<char> contents(std::min(fileSize, end * chunkBytes) - begin);
+
+    ForEachChunk(end - first, [&](const uint32_t i) {
+        const uint32_t chunk = first + i;
+        const uint64_t position = chunk * chunkBytes;
+
+        map.Unpack(stored.data() + static_cast<uint64_t>(map.FirstBlock(chunk) - map.FirstBlock(first)) * blockSize,
+                   map.StoredBlocks(chunk),
+                   contents.data() + (position - begin),
+                   std::min(chunkBytes, fileSize - position));
+    });
+    return contents;
+}
+
+std::size_t Filesystem::ReadCompressed(const INode& node,
+                                       const uint64_t offset,
+                                       char* buffer,
+                                       const std::size_t size,
+                                       const uint64_t readAhead) const {
+    const ChunkMap map = ReadChunkMap(node);
+    const uint64_t chunkBytes = map.ChunkBytes();
+
+    const auto first = static_cast<uint32_t>(offset / chunkBytes);
+    const auto end = static_cast<uint32_t>((offset + size - 1) / chunkBytes) + 1;
 
-        file.clearDirectLinks();
-        file.removeSize(file.getSize());
-    } else {
-        auto newNode = AllocateNode(false);
-        if (!newNode) {
-            throw CouldNotAllocateNodeException("Could not allocate file inode");
-        }
+    // =========================
+    // Read ahead
+    // =========================
+    const auto ahead = static_cast<uint32_t>(std::min<uint64_t>(
+        (readAhead + chunkBytes - 1) / chunkBytes, map.Count() - end
+    ));
 
-        file = *newNode;
-        AddChild(parent, filename, file.getId());
-        writeINode(parent);
+    if (ahead > 0) {
+        Cache->Prefetch(CoalesceRuns(BlocksAt(node, map.FirstBlock(end), map.FirstBlock(end + ahead))));
     }
 
     // =========================
-    // Write file data
+    // Requested range
     // =========================
-    size_t written = 0;
-    const size_t total = data.size();
-    const size_t blockSize = superblock.blockSize;
+    const std::vector<char> contents = ReadChunks(
+        map, first, end,
+        BlocksAt(node, map.FirstBlock(first), map.FirstBlock(end)),
+        node.getSize()
+    );
 
-    while (written < total) {
-        auto blockOpt = AllocateBlock();
-        if (!blockOpt) {
-            throw CouldNotAllocateBlockException("No free blocks for file data");
-        }
+    std::copy_n(contents.data() + (offset - first * chunkBytes), size, buffer);
+    return size;
+}
+
+bool Filesystem::RewriteCompressed(INode& node, const uint64_t keep, const char* data, const std::size_t size) {
+    const uint32_t blockSize = superblock.blockSize;
+    const bool compressed = node.isCompressed();
+    const uint64_t end = keep + size;
+
+    if (end > MaxFileSize()) {
+        throw FileTooLargeException("No room for new blocks");
+    }
 
-        uint32_t block = *blockOpt;
+    ChunkMap map = compressed ? ReadChunkMap(node) : ChunkMap(blockSize);
+    const uint64_t chunkBytes = map.ChunkBytes();
 
-        size_t chunk = std::min(blockSize, total - written);
+    // =========================
+    // Pack the new tail
+    // =========================
+    // The chunk the cut falls into is packed again with the new data
+    const auto kept = static_cast<uint32_t>(keep / chunkBytes);
+    std::vector<char> pending;
 
-        FileIO->WriteBytes(
-            superblock.dataBlocksOffset + block * blockSize,
-            std::vector<char>(data.begin() + written, data.begin() + written + chunk)
+    if (keep % chunkBytes != 0) {
+        const std::vector<char> partial = ReadChunks(
+            map, kept, kept + 1,
+            BlocksAt(node, map.FirstBlock(kept), map.FirstBlock(kept + 1)),
+            node.getSize()
         );
+        pending.assign(partial.begin(), partial.begin() + static_cast<std::ptrdiff_t>(keep % chunkBytes));
+    }
+    pending.insert(pending.end(), data, data + size);
 
-        AttachBlock(file, block);
-        written += chunk;
+    ChunkMap tail(blockSize);
+    std::vector<char> stored = PackChunks(pending.data(), pending.size(), tail);
+
+    // A new file whose first data does not compress is stored as written
+    if (!compressed && !tail.Compressed(pending.size())) {
+        return false;
     }
 
-    file.addSize(total);
-    writeINode(file);
-}
+    const uint32_t cut = map.FirstBlock(kept);
+    const uint32_t oldBlocks = node.getStoredBlocks();
 
-std::vector<char> Filesystem::ReadFile(const std::string& srcPath) {
-    if (srcPath.empty()) {
-        throw EmptyPathException("Empty path");
+    map.Truncate(kept);
+    map.Append(tail);
+
+    const std::vector<char> table = map.SaveToBytes();
+    stored.insert(stored.end(), table.begin(), table.end());
+    const auto count = static_cast<uint32_t>(stored.size() / blockSize);
+
+    // Fail before any change if the new tail does not fit
+    const uint32_t tables = BlockMapOverhead(cut + count) - BlockMapOverhead(cut);
+    if (AvailableBlocks() < count + tables) {
+        throw CouldNotAllocateBlockException("No free blocks for file data");
     }
 
-    INode file = ResolvePath(srcPath);
+    // =========================
+    // Replace the old tail and table
+    // =========================
+    // Last-first, so every pointer table shrinks from its end
+    for (uint32_t index = oldBlocks; index > cut; --index) {
+        DeattachBlock(node, BlockAt(node, index - 1));
+    }
 
-    if (file.isDir()) {
-        throw NotADirectoryException("Cannot read a directory");
+    if (map.Count() == 0) {
+        node.clearCompressed();
+    } else {
+        AppendBlocks(node, cut, stored.data(), count);
+        node.setCompressed(cut + count);
     }
 
-    std::vector<char> result;
-    result.reserve(file.getSize());
+    node.removeSize(node.getSize());
+    node.addSize(end);
+    writeINode(node);
+    return true;
+}
 
+void Filesystem::Inflate(INode& node) {
     const uint32_t blockSize = superblock.blockSize;
-    size_t remaining = file.getSize();
+    const uint64_t size = node.getSize();
+    const auto blocks = static_cast<uint32_t>((size + blockSize - 1) / blockSize);
 
-    auto readBlock = [&](uint32_t blockId) {
-        if (remaining == 0) return;
+    // The packed blocks are released once the contents are stored anew
+    if (AvailableBlocks() < blocks + BlockMapOverhead(blocks)) {
+        throw CouldNotAllocateBlockException("No free blocks to unpack the file");
+    }
 
-        size_t toRead = std::min(static_cast<size_t>(blockSize), remaining);
+    const INode packed = node;
+    const ChunkMap map = ReadChunkMap(packed);
 
-        auto data = FileIO->ReadBytes(
-            superblock.dataBlocksOffset + blockId * blockSize,
-            toRead
-        );
+    const std::vector<uint32_t> stored = GetDataBlockIds(packed);
+    if (stored.size() != packed.getStoredBlocks()) {
+        throw FileReadException("Block map of inode " + std::to_string(node.getId()) + " is damaged");
+    }
 
-        if (data.size() != toRead) {
-            throw FileReadException("Failed to read file block");
-        }
+    node.clearDirectLinks();
+    node.removeFirstLevelIndirectLink();
+    node.removeSecondLevelIndirectLink();
+    node.clearCompressed();
+    node.removeSize(size);
 
-        result.insert(result.end(), data.begin(), data.end());
-        remaining -= toRead;
-    };
+    // A batch of chunks at a time, to bound memory
+    for (uint32_t first = 0; first < map.Count(); first += PARALLEL_CHUNKS) {
+        const uint32_t end = std::min(first + PARALLEL_CHUNKS, map.Count());
+        const std::vector<uint32_t> range(stored.begin() + map.FirstBlock(first),
+                                          stored.begin() + map.FirstBlock(end));
 
-    // =========================
-    // Direct blocks
-    // =========================
-    for (uint32_t block : file.getDirectLinks()) {
-        if (block == INode::UNUSED_LINK || remaining == 0) break;
-        readBlock(block);
+        const std::vector<char> contents = ReadChunks(map, first, end, range, size);
+        WriteBlocks(node, first * map.ChunkBytes(), contents.data(), contents.size());
     }
 
-    // =========================
-    // Single indirect
-    // =========================
-    if (remaining > 0 && file.getFirstLevelIndirectLink() != INode::UNUSED_LINK) {
-        for (uint32_t block : ReadBlockAsBlockIds(file.getFirstLevelIndirectLink())) {
-            if (remaining == 0) break;
-            readBlock(block);
-        }
+    for (const uint32_t block : GetAllBlockIds(packed)) {
+        FreeBlock(block);
     }
+    writeINode(node);
+}
 
-    // =========================
-    // Double indirect
-    // =========================
-    if (remaining > 0 && file.getSecondLevelIndirectLink() != INode::UNUSED_LINK) {
-        for (uint32_t ptr : ReadBlockAsBlockIds(file.getSecondLevelIndirectLink())) {
-            for (uint32_t block : ReadBlockAsBlockIds(ptr)) {
-                if (remaining == 0) break;
-                readBlock(block);
-            }
-            if (remaining == 0) break;
-        }
+void Filesystem::AppendBlocks(INode& node, const uint32_t index, const char* data, const uint32_t count) {
+    const uint64_t bytes = static_cast<uint64_t>(count) * superblock.blockSize;
+
+    // Tables first, so the new blocks stay contiguous
+    for (uint32_t position = index; position < index + count; ++position) {
+        EnsureTables(node, position);
     }
 
-    return result;
+    const Placement placement = PlaceBlocks(data, bytes, count);
+    for (uint32_t i = 0; i < count; ++i) {
+        MapBlock(node, index + i, placement.blocks[i]);
+    }
+
+    std::vector<std::future<void>> written = SubmitPlaced(placement, data, bytes);
+    for (auto& request : written) {
+        request.wait();
+    }
+    for (auto& request : written) {
+        request.get();
+    }
+    IndexBlocks(placement);
+}
+
+void Filesystem::TruncateAt(INode& node, const uint64_t size) {
+    if (size >= node.getSize()) {
+        WriteAt(node, size, nullptr, 0);
+        return;
+    }
+
+    // The cut-off inline bytes must read as zeros when the file grows
+    if (node.isInline()) {
+        node.clearInline(size);
+        node.removeSize(node.getSize() - size);
+        writeINode(node);
+        return;
+    }
+
+    // The chunk holding the new end is packed again, those past it dropped
+    if (node.isCompressed()) {
+        RewriteCompressed(node, size, nullptr, 0);
+        return;
+    }
+
+    const uint32_t blockSize = superblock.blockSize;
+    const auto keep = static_cast<uint32_t>((size + blockSize - 1) / blockSize);
+    const auto used = static_cast<uint32_t>((node.getSize() + blockSize - 1) / blockSize);
+
+    // Last-first, so every pointer table shrinks from its end
+    for (uint32_t index = used; index > keep; --index) {
+        DeattachBlock(node, BlockAt(node, index - 1));
+    }
+
+    // Bytes past the end of the last block are zeroed when the file grows
+    node.removeSize(node.getSize() - size);
+    writeINode(node);
 }
 
 void Filesystem::CopyFile(const std::string& srcPath, const std::string& dstPath) {
+    const auto guard = this->LockOperations();
+    this->EnsureWritable();
     if (srcPath.empty() || dstPath.empty()) {
         throw EmptyPathException("Source or destination path is empty");
     }
@@ -1328,18 +2841,74 @@ void Filesystem::CopyFile(const std::string& srcPath, const std::string& dstPath
         throw NotADirectoryException("Source is a directory");
     }
 
-    // =========================
-    // Read source file
-    // =========================
-    std::vector<char> data = ReadFile(srcPath);
+    // Copying a file onto itself (or onto one of its links) changes nothing
+    const INode parent = ResolveParent(dstPath);
+    if (FindChildId(parent, SplitPath(dstPath).back()) == src.getId()) {
+        return;
+    }
+
+    // Inline contents are copied along with the inode
+    if (src.isInline()) {
+        INode file = CreateOrTruncate(dstPath);
+        file.writeInline(0, src.getInlineData(), src.getSize());
+        file.addSize(src.getSize());
+        writeINode(file);
+        return;
+    }
 
     // =========================
-    // Write destination file
+    // Share the source blocks
     // =========================
-    WriteFile(dstPath, std::move(data));
+    const std::vector<uint32_t> blocks = GetDataBlockIds(src);
+
+    // A deduplicated block may be referenced several times by the source
+    std::unordered_map<uint32_t, uint32_t> references;
+    for (const uint32_t block : blocks) {
+        ++references[block];
+    }
+
+    bool shareable = this->References.Enabled();
+    {
+        const auto lock = this->LockAllocator();
+        shareable = shareable && std::all_of(references.begin(), references.end(), [this](const auto& entry) {
+            return this->References.Get(entry.first) + entry.second <= RefCountTable::MAX_SHARES;
+        });
+    }
+
+    if (!shareable) {
+        // No reference counts on this image (or too many copies): copy the data
+        std::vector<char> data = ReadFile(srcPath);
+        WriteFile(dstPath, std::move(data));
+        return;
+    }
+
+    // Only the pointer tables are new; fail before the old contents of
+    // the destination are released if they do not fit.
+    // A compressed source shares its chunk table as well
+    const auto count = static_cast<uint32_t>(blocks.size());
+    if (AvailableBlocks() + ReleasableBlocks(dstPath) < BlockMapOverhead(count)) {
+        throw CouldNotAllocateBlockException("No free blocks for file data");
+    }
+
+    INode file = CreateOrTruncate(dstPath);
+    BuildBlockMap(file, blocks);
+    {
+        const auto lock = this->LockAllocator();
+        for (const uint32_t block : blocks) {
+            this->References.Share(block);
+        }
+    }
+
+    if (src.isCompressed()) {
+        file.setCompressed(src.getStoredBlocks());
+    }
+    file.addSize(src.getSize());
+    writeINode(file);
 }
 
 void Filesystem::MoveFile(const std::string& srcPath, const std::string& dstPath) {
+    const auto guard = this->LockOperations();
+    this->EnsureWritable();
     if (srcPath.empty() || dstPath.empty()) {
         throw EmptyPathException("Source or destination path is empty");
     }
@@ -1350,26 +2919,101 @@ void Filesystem::MoveFile(const std::string& srcPath, const std::string& dstPath
     }
 
     // =========================
-    // Validate source
+    // Resolve source entry
     // =========================
-    INode src = ResolvePath(srcPath);
+    const auto srcParts = SplitPath(srcPath);
+    if (srcParts.empty()) {
+        throw InvalidFileNameException("Cannot move root directory");
+    }
 
-    if (src.isDir()) {
-        throw NotADirectoryException("Source is a directory");
+    const std::string& name = srcParts.back();
+    if (name == "." || name == "..") {
+        throw InvalidFileNameException("Cannot move " + name);
+    }
+
+    INode srcParent = ResolveParent(srcPath);
+    const auto id = FindChildId(srcParent, name);
+    if (!id) {
+        throw PathNotFoundException("Path not found: " + name);
+    }
+
+    const INode node = readINode(*id);
+
+    // =========================
+    // Resolve destination entry
+    // =========================
+    const auto dstParts = SplitPath(dstPath);
+    INode dstParent = dstParts.empty() ? ResolvePath(dstPath) : ResolveParent(dstPath);
+    std::string dstName = dstParts.empty() ? name : dstParts.back();
+    auto existing = FindChildId(dstParent, dstName);
+
+    // Moving onto a directory moves into it
+    if (!dstParts.empty() && existing && *existing != *id && readINode(*existing).isDir()) {
+        dstParent = readINode(*existing);
+        dstName = name;
+        existing = FindChildId(dstParent, dstName);
+    }
+
+    // Same entry, or another link of the same file
+    if (existing == id) {
+        return;
+    }
+
+    // A directory must not end up inside its own subtree
+    if (node.isDir()) {
+        INode ancestor = dstParent;
+        while (true) {
+            if (ancestor.getId() == node.getId()) {
+                throw InvalidFileNameException("Cannot move a directory into itself");
+            }
+
+            const auto parent = FindChildId(ancestor, "..");
+            if (!parent || *parent == ancestor.getId()) {
+                break;
+            }
+            ancestor = readINode(*parent);
+        }
     }
 
     // =========================
-    // Copy first (safe)
+    // Replace an existing file
     // =========================
-    CopyFile(srcPath, dstPath);
+    if (existing) {
+        INode victim = readINode(*existing);
+        if (node.isDir() || victim.isDir()) {
+            throw FileWriteException("Destination already exists");
+        }
+
+        RemoveChild(dstParent, victim.getId(), dstName);
+        if (victim.getLinks() == 1) {
+            FreeNode(victim);
+        } else {
+            victim.removeLink();
+            writeINode(victim);
+        }
+    }
 
     // =========================
-    // Remove source
+    // Relink the entry
     // =========================
-    RemoveFile(srcPath);
+    // The new entry comes first, so a full destination changes nothing
+    AddChild(dstParent, dstName, node.getId());
+    writeINode(dstParent);
+
+    // Adding may have grown the directory if both parents are the same
+    srcParent = readINode(srcParent.getId());
+    RemoveChild(srcParent, node.getId(), name);
+
+    if (node.isDir() && srcParent.getId() != dstParent.getId()) {
+        INode dir = node;
+        RemoveChild(dir, srcParent.getId(), "..");
+        AddChild(dir, "..", dstParent.getId());
+    }
 }
 
 void Filesystem::RemoveFile(const std::string& path) {
+    const auto guard = this->LockOperations();
+    this->EnsureWritable();
     if (path.empty()) {
         throw EmptyPathException("Empty path");
     }
@@ -1419,6 +3063,7 @@ void Filesystem::RemoveFile(const std::string& path) {
 
 std::vector<std::pair<std::string, bool>>
 Filesystem::GetSubdirectories(const std::string& path) const {
+    const auto guard = this->ShareOperations();
     if (path.empty()) {
         throw EmptyPathException("Empty path");
     }
@@ -1445,6 +3090,7 @@ Filesystem::GetSubdirectories(const std::string& path) const {
 }
 
 void Filesystem::ChangeActiveDirectory(const std::string &path) {
+    const auto guard = this->ShareOperations();
     if (path.empty()) {
         throw EmptyPathException("Empty path");
     }
@@ -1454,13 +3100,55 @@ void Filesystem::ChangeActiveDirectory(const std::string &path) {
     if (!dir.isDir()) {
         throw NotADirectoryException("Path is not a directory");
     }
-    this->currentNode = dir;
+    WorkingDirectory& session = this->Session();
+    session.node = dir.getId();
+
+    if (!session.path) {
+        return;
+    }
+
+    // Apply the path to the cached one; directories have a single
+    // parent, so ".." always drops the last component
+    auto& cwd = *session.path;
+    if (path[0] == '/') {
+        cwd.clear();
+    }
+
+    for (const auto& part : SplitPath(path)) {
+        if (part == ".") {
+            continue;
+        }
+
+        if (part == "..") {
+            if (!cwd.empty()) {
+                cwd.pop_back();
+            }
+            continue;
+        }
+
+        cwd.push_back(part);
+    }
 }
 
 std::vector<std::string> Filesystem::GetCurrentPath() const {
+    const auto guard = this->ShareOperations();
+
+    // A failed format leaves nothing to resolve
+    if (!this->formated) {
+        return {};
+    }
+
+    WorkingDirectory& session = this->Session();
+    if (!session.path) {
+        session.path = this->PathOf(this->readINode(session.node));
+    }
+    return *session.path;
+}
+
+std::vector<std::string> Filesystem::PathOf(const INode& dir) const {
     std::vector<std::string> path;
 
-    INode node = currentNode;
+    INode node = dir;
 
     // Root → empty path
     if (node.getId() == superblock.rootNodeId) {
@@ -1482,19 +3170,24 @@ std::vector<std::string> Filesystem::GetCurrentPath() const {
         }
 
         // Find name of current node in parent
-        bool found = false;
-        for (const auto& child : GetChildren(parent)) {
-            if (child.id == node.getId() && child.name != "." && child.name != "..") {
-                path.push_back(child.name);
-                found = true;
-                break;
-            }
+        auto entry = Index->FindParent(node.getId());
+        if (!entry || entry->parent != parent.getId()) {
+            entry.reset();
+            (void) ForEachChild(parent, [&](const ChildNodeNameIdView& child) {
+                if (child.id != node.getId() || child.name == "." || child.name == "..") {
+                    return true;
+                }
+                entry = DirectoryIndex::ParentEntry{parent.getId(), std::string(child.name)};
+                return false;
+            });
         }
 
-        if (!found) {
+        if (!entry) {
             throw FileReadException("Failed to resolve current path");
         }
 
+        path.push_back(entry->name);
+
         node = parent;
     }
 
@@ -1503,6 +3196,7 @@ std::vector<std::string> Filesystem::GetCurrentPath() const {
 }
 
 std::string Filesystem::GetNodeInfo(const std::string& path) const {
+    const auto guard = this->ShareOperations();
     if (path.empty()) {
         throw EmptyPathException("Empty path");
     }
@@ -1531,6 +3225,16 @@ std::string Filesystem::GetNodeInfo(const std::string& path) const {
     // inode id
     out << " – i-uzel " << node.getId();
 
+    if (node.isCompressed()) {
+        out << " – komprimováno do " << node.getStoredBlocks() << " bloků";
+    }
+
+    if (node.isInline()) {
+        out << " – data uložena v i-uzlu";
+        out << " – hardlinky " << node.getLinks();
+        return out.str();
+    }
+
     // =========================
     // Direct blocks
     // =========================
@@ -1572,6 +3276,8 @@ std::string Filesystem::GetNodeInfo(const std::string& path) const {
 
 void Filesystem::LinkFile(const std::string& originalPath,
                           const std::string& linkPath) {
+    const auto guard = this->LockOperations();
+    this->EnsureWritable();
     if (originalPath.empty() || linkPath.empty()) {
         throw EmptyPathException("Source or link path is empty");
     }
@@ -1615,6 +3321,7 @@ void Filesystem::LinkFile(const std::string& originalPath,
 }
 
 std::string Filesystem::GetFilesystemStats() const {
+    const auto guard = this->ShareOperations();
     if (!formated) {
         throw FilesystemNotFormattedException("Filesystem is not formatted");
     }
@@ -1630,30 +3337,31 @@ std::string Filesystem::GetFilesystemStats() const {
     // =========================
     // Block stats
     // =========================
-    uint32_t usedBlocks = 0;
-    for (uint32_t i = 0; i < superblock.totalBlocks; ++i) {
-        if (BlockBitmap.Get(i)) {
-            ++usedBlocks;
-        }
-    }
-
-    uint32_t freeBlocks = superblock.totalBlocks - usedBlocks;
+    const auto allocator = this->LockAllocator();
+    uint32_t freeBlocks = BlockBitmap.FreeCount();
+    uint32_t usedBlocks = superblock.totalBlocks - freeBlocks;
 
     out << "Bloky: celkem " << superblock.totalBlocks
         << ", použito " << usedBlocks
         << ", volné " << freeBlocks << "\n";
 
+    if (References.Enabled()) {
+        out << "Sdílené bloky: " << References.SharedCount() << "\n";
+    }
+
+    if (Dedup.Enabled()) {
+        out << "Bloky v indexu deduplikace: " << Dedup.IndexedCount() << "\n";
+    }
+
+    if (CompressesFiles()) {
+        out << "Komprese souborů: LZ4\n";
+    }
+
     // =========================
     // Inode stats
     // =========================
-    uint32_t usedInodes = 0;
-    for (uint32_t i = 0; i < superblock.totalInodes; ++i) {
-        if (INodeBitmap.Get(i)) {
-            ++usedInodes;
-        }
-    }
-
-    uint32_t freeInodes = superblock.totalInodes - usedInodes;
+    uint32_t freeInodes = INodeBitmap.FreeCount();
+    uint32_t usedInodes = superblock.totalInodes - freeInodes;
 
     out << "I-uzly: celkem " << superblock.totalInodes
         << ", použito " << usedInodes
@@ -1686,3 +3394,194 @@ std::string Filesystem::GetFilesystemStats() const {
 
     return out.str();
 }
+
+std::string Filesystem::Check(const bool repair) {
+    const auto guard = this->LockOperations();
+    if (!formated) {
+        throw FilesystemNotFormattedException("Filesystem is not formatted");
+    }
+    if (repair) {
+        this->EnsureWritable();
+    }
+
+    bool unrepairable = false;
+    return this->CheckImage(repair, unrepairable);
+}
+
+std::string Filesystem::CheckImage(const bool repair, bool& unrepairable) {
+    // A plain check changes nothing, not even by writing back
+    const bool writeBack = repair && !this->readOnly;
+    FilesystemChecker::Report report = this->RunChecker(writeBack);
+    const std::size_t brokenEntries = report.entries.size();
+
+    // =========================
+    // Directory entry counts
+    // =========================
+    // Repaired first, since entries are removed and added by their count
+    uint32_t countDiffs = 0;
+    for (uint32_t id = 0; id < this->superblock.totalInodes; ++id) {
+        const uint32_t recorded = report.recordedEntryCounts[id];
+        if (recorded != 0 && recorded != report.entryCounts[id]) {
+            ++countDiffs;
+            if (repair) {
+                INode dir = this->readINode(id);
+                dir.setEntryCount(report.entryCounts[id]);
+                this->writeINode(dir);
+            }
+        }
+    }
+
+    // Entry repairs allocate and free blocks, so the tree is walked again
+    if (repair && brokenEntries > 0) {
+        this->RepairEntries(report.entries);
+        report = this->RunChecker(writeBack);
+    }
+
+    std::unique_lock<std::mutex> allocator = this->LockAllocator();
+
+    // =========================
+    // Inodes
+    // =========================
+    uint32_t inodeDiffs = 0;
+    uint32_t linkDiffs = 0;
+    for (uint32_t id = 0; id < this->superblock.totalInodes; ++id) {
+        const bool used = report.inodes[id];
+
+        if (this->INodeBitmap.Get(id) != used) {
+            ++inodeDiffs;
+            if (repair) {
+                this->INodeBitmap.Set(id, used);
+                if (!used) {
+                    this->INodes->Erase(id);
+                    this->Index->Drop(id);
+                }
+            }
+        }
+
+        if (used && report.recordedLinks[id] != report.links[id]) {
+            ++linkDiffs;
+            if (repair) {
+                INode node = this->readINode(id);
+                node.setLinks(report.links[id]);
+                this->writeINode(node);
+            }
+        }
+    }
+
+    // =========================
+    // Blocks and their owners
+    // =========================
+    uint32_t blockDiffs = 0;
+    uint32_t shareDiffs = 0;
+    uint32_t indexDiffs = 0;
+    uint32_t crossLinked = 0;
+    for (uint32_t block = 0; block < this->superblock.totalBlocks; ++block) {
+        const uint32_t owners = report.owners[block];
+
+        if (this->BlockBitmap.Get(block) != (owners > 0)) {
+            ++blockDiffs;
+            if (repair) {
+                this->BlockBitmap.Set(block, owners > 0);
+            }
+        }
+
+        // Without a reference count table a block has a single owner
+        const uint32_t extra = owners > 1 ? owners - 1 : 0;
+        if (!this->References.Enabled()) {
+            crossLinked += extra > 0 ? 1 : 0;
+        } else if (this->References.Get(block) != std::min(extra, RefCountTable::MAX_SHARES)) {
+            ++shareDiffs;
+            if (repair) {
+                this->References.Set(block, extra);
+            }
+        }
+
+        // A free block must not be shared by the next matching write
+        if (owners == 0 && this->Dedup.Get(block) != DedupIndex::NO_HASH) {
+            ++indexDiffs;
+            if (repair) {
+                this->Dedup.Forget(block);
+            }
+        }
+    }
+
+    const bool clean = brokenEntries + countDiffs + inodeDiffs + linkDiffs + blockDiffs + shareDiffs + indexDiffs == 0;
+    unrepairable = crossLinked + report.badBlockReferences > 0;
+
+    if (allocator.owns_lock()) {
+        allocator.unlock();
+    }
+    if (repair && !clean) {
+        this->ForgetWorkingPaths();
+        this->WriteBack();
+    }
+
+    std::ostringstream out;
+    out << "Adresáře: " << report.directories << ", soubory: " << report.files << "\n";
+    out << "Chybné položky adresářů: " << brokenEntries << "\n";
+    out << "Rozdíly v bitmapě i-uzlů: " << inodeDiffs << "\n";
+    out << "Rozdíly v bitmapě bloků: " << blockDiffs << "\n";
+    if (this->References.Enabled()) {
+        out << "Rozdíly v počtech sdílení: " << shareDiffs << "\n";
+    } else if (crossLinked > 0) {
+        out << "Bloky s více vlastníky (neopraveno): " << crossLinked << "\n";
+    }
+    out << "Rozdíly v počtech odkazů: " << linkDiffs << "\n";
+    if (this->CountsEntries()) {
+        out << "Rozdíly v počtech položek adresářů: " << countDiffs << "\n";
+    }
+    if (this->Dedup.Enabled()) {
+        out << "Volné bloky v indexu deduplikace: " << indexDiffs << "\n";
+    }
+    if (report.badBlockReferences > 0) {
+        out << "Neplatné odkazy na bloky (neopraveno): " << report.badBlockReferences << "\n";
+    }
+
+    out << "Stav: ";
+    if (clean && !unrepairable) {
+        out << "v pořádku";
+    } else if (repair && !clean) {
+        out << (unrepairable ? "opraveno, zůstaly neopravitelné chyby" : "opraveno");
+    } else if (!clean) {
+        out << "nalezeny chyby (opraví fsck --repair)";
+    } else {
+        out << "nalezeny neopravitelné chyby";
+    }
+    out << "\n";
+
+    return out.str();
+}
+
+FilesystemChecker::Report Filesystem::RunChecker(const bool writeBack) {
+    // The checker reads the image directly
+    if (writeBack) {
+        this->WriteBack();
+    }
+
+    FilesystemChecker checker(this->imagePath, this->superblock, this->INodeRecordBytes());
+    return checker.Run();
+}
+
+void Filesystem::RepairEntries(const std::vector<FilesystemChecker::EntryFix>& fixes) {
+    using Kinds = FilesystemChecker::EntryFix::Kinds;
+
+    for (const auto& fix : fixes) {
+        INode dir = this->readINode(fix.directory);
+
+        if (fix.kind != Kinds::MISSING) {
+            this->RemoveChild(dir, fix.target, fix.name);
+        }
+        if (fix.kind == Kinds::WRONG_TARGET || fix.kind == Kinds::MISSING) {
+            this->AddChild(dir, fix.name, fix.expected);
+        }
+        this->writeINode(dir);
+    }
+}
+
+FileIOHandler::Statistics Filesystem::GetIOStatistics() const {
+    return this->FileIO->GetStatistics();
+}
+
+void Filesystem::ResetIOStatistics() const {
+    this->FileIO->ResetStatistics();
+}
@@ -0,0 +1,337 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#include "../include/FilesystemChecker.h"
+
+#include <algorithm>
+#include <tuple>
+
+#include "../helpers/ChildNodeNameIdPair.h"
+#include "../helpers/FileIOExceptions.h"
+#include "../helpers/IntParser.h"
+
+FilesystemChecker::FilesystemChecker(const std::string& imagePath,
+                                     const Superblock& superblock,
+                                     const int inodeBytes,
+                                     const std::size_t threads)
+    : superblock(superblock),
+      inodeBytes(inodeBytes),
+      threads(threads),
+      reached(superblock.totalInodes),
+      named(superblock.totalInodes),
+      owners(superblock.totalBlocks),
+      recordedLinks(superblock.totalInodes, 0),
+      entryCounts(superblock.totalInodes, 0),
+      recordedEntryCounts(superblock.totalInodes, 0) {
+    // Positional reads need no shared file position, so every worker
+    // reads on its own
+    this->io.OpenFile(imagePath, FileIOHandler::FileModes::READ, FileIOHandler::Backends::POSITIONAL);
+}
+
+FilesystemChecker::Report FilesystemChecker::Run() {
+    const uint32_t root = this->superblock.rootNodeId;
+
+    {
+        // Destroyed before the results are collected
+        ThreadPool workers(this->threads);
+        this->pool = &workers;
+
+        this->reached[root] = 1;
+        this->Spawn([this, root] { this->VisitDirectory(root, root); });
+
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->idle.wait(lock, [this] { return this->pending == 0; });
+    }
+    this->pool = nullptr;
+
+    if (this->error) {
+        std::rethrow_exception(this->error);
+    }
+
+    Report report;
+    report.directories = this->directories;
+    report.files = this->files;
+    report.badBlockReferences = this->badBlockReferences;
+
+    report.inodes.resize(this->superblock.totalInodes);
+    report.links.resize(this->superblock.totalInodes);
+    for (uint32_t i = 0; i < this->superblock.totalInodes; ++i) {
+        report.inodes[i] = this->reached[i] != 0;
+        report.links[i] = this->named[i];
+    }
+
+    report.recordedLinks = std::move(this->recordedLinks);
+    report.entryCounts = std::move(this->entryCounts);
+    report.recordedEntryCounts = std::move(this->recordedEntryCounts);
+
+    report.owners.resize(this->superblock.totalBlocks);
+    for (uint32_t i = 0; i < this->superblock.totalBlocks; ++i) {
+        report.owners[i] = this->owners[i];
+    }
+
+    // Directories keep a single link: the entry they were reached through
+    for (const EntryFix& fix : this->entries) {
+        if (fix.kind == EntryFix::Kinds::EXTRA_LINK) {
+            --report.links[fix.target];
+        }
+    }
+    report.links[root] = 1;
+
+    // Tasks finish in any order; report the fixes in tree order
+    std::sort(this->entries.begin(), this->entries.end(), [](const EntryFix& a, const EntryFix& b) {
+        return std::tie(a.directory, a.name, a.target) < std::tie(b.directory, b.name, b.target);
+    });
+    report.entries = std::move(this->entries);
+
+    return report;
+}
+
+// =====================================================
+// Walk
+// =====================================================
+
+void FilesystemChecker::Spawn(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        ++this->pending;
+    }
+
+    this->pool->Submit([this, task = std::move(task)] {
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (!this->error) {
+                this->error = std::current_exception();
+            }
+        }
+
+        // Notified under the lock, so Run() cannot return in between
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (--this->pending == 0) {
+            this->idle.notify_all();
+        }
+    });
+}
+
+void FilesystemChecker::VisitDirectory(const uint32_t id, const uint32_t parent) {
+    ++this->directories;
+
+    const std::optional<INode> dir = this->ReadINode(id);
+    if (!dir || !dir->isDir()) {
+        throw FileReadException("Root inode " + std::to_string(id) + " is damaged");
+    }
+    this->recordedLinks[id] = dir->getLinks();
+    std::vector<Entry> all = this->ReadEntries(this->ClaimBlocks(*dir));
+    this->entryCounts[id] = static_cast<uint32_t>(all.size());
+    this->recordedEntryCounts[id] = dir->getEntryCount();
+
+    // "." and ".." are checked here, every other entry by VisitEntries()
+    bool haveDot = false;
+    bool haveDotDot = false;
+    std::vector<Entry> children;
+    children.reserve(all.size());
+
+    for (Entry& entry : all) {
+        if (entry.name == "." && !haveDot) {
+            haveDot = true;
+            if (entry.id != id) {
+                this->Record({EntryFix::Kinds::WRONG_TARGET, id, ".", entry.id, id});
+            }
+        } else if (entry.name == ".." && !haveDotDot) {
+            haveDotDot = true;
+            if (entry.id != parent) {
+                this->Record({EntryFix::Kinds::WRONG_TARGET, id, "..", entry.id, parent});
+            }
+        } else {
+            children.push_back(std::move(entry));
+        }
+    }
+
+    if (!haveDot) {
+        this->Record({EntryFix::Kinds::MISSING, id, ".", INode::UNUSED_LINK, id});
+    }
+    if (!haveDotDot) {
+        this->Record({EntryFix::Kinds::MISSING, id, "..", INode::UNUSED_LINK, parent});
+    }
+
+    // Large directories are split, so their files are checked in parallel
+    for (std::size_t first = ENTRIES_PER_TASK; first < children.size(); first += ENTRIES_PER_TASK) {
+        const auto begin = children.begin() + static_cast<std::ptrdiff_t>(first);
+        const auto end = children.begin() + static_cast<std::ptrdiff_t>(
+            std::min(first + ENTRIES_PER_TASK, children.size()));
+
+        std::vector<Entry> slice(std::make_move_iterator(begin), std::make_move_iterator(end));
+        this->Spawn([this, id, slice = std::move(slice)]() mutable {
+            this->VisitEntries(id, std::move(slice));
+        });
+    }
+
+    children.resize(std::min(children.size(), ENTRIES_PER_TASK));
+    this->VisitEntries(id, std::move(children));
+}
+
+void FilesystemChecker::VisitEntries(const uint32_t directory, std::vector<Entry> slice) {
+    for (Entry& entry : slice) {
+        if (entry.id >= this->superblock.totalInodes) {
+            this->Record({EntryFix::Kinds::DANGLING, directory, std::move(entry.name), entry.id, 0});
+            continue;
+        }
+
+        const std::optional<INode> child = this->ReadINode(entry.id);
+        if (!child) {
+            this->Record({EntryFix::Kinds::DANGLING, directory, std::move(entry.name), entry.id, 0});
+            continue;
+        }
+
+        ++this->named[entry.id];
+
+        // The first entry to reach an inode owns its subtree and blocks
+        if (this->reached[entry.id].exchange(1) != 0) {
+            if (child->isDir()) {
+                this->Record({EntryFix::Kinds::EXTRA_LINK, directory, std::move(entry.name), entry.id, 0});
+            }
+            continue;
+        }
+
+        if (child->isDir()) {
+            const uint32_t id = entry.id;
+            this->Spawn([this, id, directory] { this->VisitDirectory(id, directory); });
+        } else {
+            ++this->files;
+            this->recordedLinks[entry.id] = child->getLinks();
+            (void) this->ClaimBlocks(*child);
+        }
+    }
+}
+
+// =====================================================
+// Blocks
+// =====================================================
+
+std::vector<uint32_t> FilesystemChecker::ClaimBlocks(const INode& node) {
+    std::vector<uint32_t> data;
+
+    // Inline files own no block
+    if (node.isInline()) {
+        return data;
+    }
+
+    auto claim = [this](const uint32_t block) {
+        ++this->owners[block];
+    };
+
+    for (const uint32_t block : node.getDirectLinks()) {
+        if (block != INode::UNUSED_LINK && this->ValidBlock(block)) {
+            claim(block);
+            data.push_back(block);
+        }
+    }
+
+    const uint32_t first = node.getFirstLevelIndirectLink();
+    if (first != INode::UNUSED_LINK && this->ValidBlock(first)) {
+        claim(first);
+        for (const uint32_t block : this->ReadTable(first)) {
+            claim(block);
+            data.push_back(block);
+        }
+    }
+
+    const uint32_t second = node.getSecondLevelIndirectLink();
+    if (second != INode::UNUSED_LINK && this->ValidBlock(second)) {
+        claim(second);
+        for (const uint32_t table : this->ReadTable(second)) {
+            claim(table);
+            for (const uint32_t block : this->ReadTable(table)) {
+                claim(block);
+                data.push_back(block);
+            }
+        }
+    }
+
+    return data;
+}
+
+std::vector<FilesystemChecker::Entry> FilesystemChecker::ReadEntries(const std::vector<uint32_t>& blocks) {
+    constexpr std::size_t ENTRY_SIZE = ChildNodeNameIdPair::NAME_LENGTH + sizeof(uint32_t);
+
+    std::vector<Entry> entries;
+    std::vector<char> data;
+
+    for (const uint32_t block : blocks) {
+        this->ReadBlock(block, data);
+
+        for (std::size_t offset = 0; offset + ENTRY_SIZE <= data.size(); offset += ENTRY_SIZE) {
+            const uint32_t id = IntParser::ReadUInt32(data.data() + offset + ChildNodeNameIdPair::NAME_LENGTH);
+            if (id == INode::UNUSED_LINK) {
+                break;
+            }
+
+            const char* name = data.data() + offset;
+            const char* nameEnd = std::find(name, name + ChildNodeNameIdPair::NAME_LENGTH, '\0');
+            entries.push_back({std::string(name, nameEnd), id});
+        }
+    }
+    return entries;
+}
+
+std::vector<uint32_t> FilesystemChecker::ReadTable(const uint32_t table) {
+    std::vector<char> data;
+    this->ReadBlock(table, data);
+
+    std::vector<uint32_t> blocks;
+    for (std::size_t offset = 0; offset + sizeof(uint32_t) <= data.size(); offset += sizeof(uint32_t)) {
+        const uint32_t block = IntParser::ReadUInt32(data.data() + offset);
+        if (block == INode::UNUSED_LINK) {
+            break;
+        }
+        if (this->ValidBlock(block)) {
+            blocks.push_back(block);
+        }
+    }
+    return blocks;
+}
+
+void FilesystemChecker::ReadBlock(const uint32_t block, std::vector<char>& out) {
+    out.resize(this->superblock.blockSize);
+    const uint64_t offset = this->superblock.dataBlocksOffset +
+                            static_cast<uint64_t>(block) * this->superblock.blockSize;
+
+    if (this->io.ReadInto(offset, out.data(), out.size()) != out.size()) {
+        throw FileReadException("Cannot read block " + std::to_string(block));
+    }
+}
+
+std::optional<INode> FilesystemChecker::ReadINode(const uint32_t id) {
+    std::vector<char> record(static_cast<std::size_t>(this->inodeBytes));
+    const uint64_t offset = this->superblock.inodeTableOffset +
+                            static_cast<uint64_t>(id) * static_cast<uint64_t>(this->inodeBytes);
+
+    if (this->io.ReadInto(offset, record.data(), record.size()) != record.size()) {
+        throw FileReadException("Cannot read inode " + std::to_string(id));
+    }
+
+    // A record with another identifier or invalid flags never held this inode
+    try {
+        INode node = INode::FromBytes(record.data(), this->inodeBytes);
+        if (node.getId() == id) {
+            return node;
+        }
+    } catch (const std::runtime_error&) {
+    }
+    return std::nullopt;
+}
+
+bool FilesystemChecker::ValidBlock(const uint32_t block) {
+    if (block < this->superblock.totalBlocks) {
+        return true;
+    }
+    ++this->badBlockReferences;
+    return false;
+}
+
+void FilesystemChecker::Record(EntryFix fix) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->entries.push_back(std::move(fix));
+}
@@ -3,14 +3,23 @@
 //
 #include "../include/FilesystemInterface.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <mutex>
 #include <sstream>
 
+#include "../include/ThreadPool.h"
 #include "../helpers/FileIOExceptions.h"
 #include "../helpers/FilesystemExceptions.h"
 #include "../helpers/SizeParser.h"
 
-FilesystemInterface::FilesystemInterface(std::string path) {
-    this->filesystem = std::make_unique<Filesystem>(path);
+FilesystemInterface::FilesystemInterface(std::string path,
+                                         const FilesystemOptions& options) {
+    this->filesystem = std::make_unique<Filesystem>(path, options);
     this->imagePath = path;
     this->RegisterCommands();
 }
@@ -26,13 +35,26 @@ FilesystemInterface::Execute(const std::string &command) {
         return {"", "Filesystem not formated"};
     }
 
+    // Probes fired by a command (and its final sync) are attributed to it
+    const bool measured = Perf::ENABLED && cmd != "perf" && this->commandMap.count(cmd) != 0;
+    const Perf::Snapshot before = measured ? Perf::Capture() : Perf::Snapshot{};
+    const auto start = std::chrono::steady_clock::now();
+
     std::string msg;
     try {
         msg = commandMap[cmd](args);
+        this->filesystem->Sync();
+        if (measured) {
+            this->RecordCommand(cmd, before, start);
+        }
         auto cwd = this->cmd_pwd({});
         return {cwd, msg};
     }
     catch (std::exception& e) {
+        this->filesystem->Sync();
+        if (measured) {
+            this->RecordCommand(cmd, before, start);
+        }
         auto cwd = this->cmd_pwd({});
         msg = e.what();
         if (msg == "bad_function_call") {
@@ -42,6 +64,33 @@ FilesystemInterface::Execute(const std::string &command) {
     }
 }
 
+std::pair<std::string, std::string>
+FilesystemInterface::Execute(const std::string &command, const std::string &cwd) {
+    if (this->filesystem->Formated()) {
+        try {
+            this->filesystem->ChangeActiveDirectory(cwd);
+        } catch (std::exception&) {
+            // Removed meanwhile, e.g. by another client
+            this->filesystem->ChangeActiveDirectory("/");
+            return {"/", "Error: Working directory " + cwd + " no longer exists"};
+        }
+    }
+
+    return this->Execute(command);
+}
+
+std::string FilesystemInterface::MountMessage() const {
+    const std::string& report = this->filesystem->MountReport();
+    if (report.empty()) {
+        return "";
+    }
+
+    if (this->filesystem->ReadOnly()) {
+        return "Obraz nebyl řádně odpojen a kontrola ho neopravila, je připojen jen pro čtení:\n" + report;
+    }
+    return "Obraz nebyl řádně odpojen, kontrola při připojení:\n" + report;
+}
+
 std::string FilesystemInterface::ParseCommand(const std::string &command) {
     std::istringstream iss(command);
     std::string out;
@@ -64,8 +113,11 @@ std::vector<std::string> FilesystemInterface::ParseParams(const std::string &com
 }
 
 std::string FilesystemInterface::cmd_cp(const std::vector<std::string> &args) {
+    if (args.size() == 3 && args[0] == "-r") {
+        return this->CopyTree(args[1], args[2]);
+    }
     if (args.size() != 2) {
-        return "Usage: cp <src> <dst>";
+        return "Usage: cp [-r] <src> <dst>";
     }
     this->filesystem->CopyFile(args[0], args[1]);
 
@@ -126,8 +178,14 @@ std::string FilesystemInterface::cmd_cat(const std::vector<std::string> &args) {
         return "Usage: cat <file>";
     }
 
-    auto data = filesystem->ReadFile(args[0]);
-    return std::string(data.begin(), data.end());
+    const FileHandle file = filesystem->Open(args[0]);
+
+    std::string content(file.Size(), '\0');
+    for (uint64_t offset = 0; offset < content.size(); offset += TRANSFER_CHUNK) {
+        const std::size_t chunk = std::min<uint64_t>(TRANSFER_CHUNK, content.size() - offset);
+        file.Read(offset, content.data() + offset, chunk);
+    }
+    return content;
 }
 
 std::string FilesystemInterface::cmd_cd(const std::vector<std::string> &args) {
@@ -165,47 +223,331 @@ std::string FilesystemInterface::cmd_statfs(const std::vector<std::string> &) {
     return filesystem->GetFilesystemStats();
 }
 
+std::string FilesystemInterface::cmd_fsck(const std::vector<std::string> &args) {
+    if (args.size() > 1 || (args.size() == 1 && args[0] != "--repair")) {
+        return "Usage: fsck [--repair]";
+    }
+    return filesystem->Check(!args.empty());
+}
+
 std::string FilesystemInterface::cmd_incp(const std::vector<std::string> &args) {
+    if (args.size() == 3 && args[0] == "-r") {
+        return this->ImportTree(args[1], args[2]);
+    }
     if (args.size() != 2) {
-        return "Usage: incp <host_file> <fs_path>";
+        return "Usage: incp [-r] <host_file> <fs_path>";
     }
 
     std::ifstream in(args[0], std::ios::binary);
     if (!in) return "Could not open host file";
 
-    std::vector<char> data(
-        (std::istreambuf_iterator<char>(in)),
-        std::istreambuf_iterator<char>()
-    );
-
-    filesystem->WriteFile(args[1], data);
+    this->ImportStream(in, std::filesystem::file_size(args[0]), args[1]);
     return "Imported file";
 }
 
 std::string FilesystemInterface::cmd_outcp(const std::vector<std::string> &args) {
+    if (args.size() == 3 && args[0] == "-r") {
+        return this->ExportTree(args[1], args[2]);
+    }
     if (args.size() != 2) {
-        return "Usage: outcp <fs_file> <host_path>";
+        return "Usage: outcp [-r] <fs_file> <host_path>";
     }
 
-    auto data = filesystem->ReadFile(args[0]);
+    const FileHandle file = filesystem->Open(args[0]);
 
     std::ofstream out(args[1], std::ios::binary);
     if (!out) return "Could not create host file";
 
-    out.write(data.data(), data.size());
+    this->ExportHandle(file, out);
     return "Exported file";
 }
 
+void FilesystemInterface::ImportStream(std::istream& in, const uint64_t size, const std::string& target) {
+    // Nothing is created or truncated if the file cannot fit
+    filesystem->EnsureRoom(target, size);
+    FileHandle file = filesystem->Create(target);
+
+    try {
+        std::vector<char> buffer(TRANSFER_CHUNK);
+        while (in) {
+            in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            file.Append(buffer.data(), static_cast<std::size_t>(in.gcount()));
+        }
+    } catch (...) {
+        // A partial file is never committed
+        try {
+            filesystem->RemoveFile(target);
+        } catch (...) {
+            // The import error is reported instead
+        }
+        throw;
+    }
+}
+
+void FilesystemInterface::ExportHandle(const FileHandle& file, std::ostream& out) {
+    std::vector<char> buffer(TRANSFER_CHUNK);
+    uint64_t offset = 0;
+    while (const std::size_t read = file.Read(offset, buffer.data(), buffer.size())) {
+        out.write(buffer.data(), static_cast<std::streamsize>(read));
+        offset += read;
+    }
+
+    if (!out) {
+        throw FileWriteException("Could not write host file");
+    }
+}
+
+std::string FilesystemInterface::ImportTree(const std::string& hostDir, const std::string& fsDir) {
+    if (!std::filesystem::is_directory(hostDir)) {
+        return "Host path is not a directory";
+    }
+
+    struct Transfer {
+        std::filesystem::path host;
+        std::string target;
+    };
+
+    // =========================
+    // Create the directory tree, collect the files
+    // =========================
+    std::vector<Transfer> files;
+
+    std::function<void(const std::filesystem::path&, const std::string&)> walk =
+        [&](const std::filesystem::path& host, const std::string& target) {
+            filesystem->CreateDirectory(target);
+
+            for (const auto& entry : std::filesystem::directory_iterator(host)) {
+                const std::string child = JoinPath(target, entry.path().filename().string());
+
+                if (entry.is_directory()) {
+                    walk(entry.path(), child);
+                } else if (entry.is_regular_file()) {
+                    files.push_back(Transfer{entry.path(), child});
+                }
+            }
+        };
+    walk(hostDir, fsDir);
+
+    // =========================
+    // Workers read ahead, this thread writes in order
+    // =========================
+    struct Slot {
+        std::vector<char> data;
+        bool large = false;
+        bool failed = false;
+        bool ready = false;
+    };
+
+    std::vector<Slot> slots(files.size());
+    std::mutex mutex;
+    std::condition_variable loaded;
+
+    // Destroyed first, so running tasks never outlive the slots
+    ThreadPool pool;
+    const std::size_t window = 4 * ThreadPool::DefaultThreads();
+
+    auto load = [&](const std::size_t i) {
+        pool.Submit([&, i] {
+            Slot slot;
+
+            std::ifstream in(files[i].host, std::ios::binary | std::ios::ate);
+            if (!in) {
+                slot.failed = true;
+            } else if (static_cast<uint64_t>(in.tellg()) > TRANSFER_CHUNK) {
+                // Streamed by the writer in chunks to bound memory
+                slot.large = true;
+            } else {
+                slot.data.resize(static_cast<std::size_t>(in.tellg()));
+                in.seekg(0);
+                in.read(slot.data.data(), static_cast<std::streamsize>(slot.data.size()));
+                slot.failed = !in;
+            }
+            slot.ready = true;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                slots[i] = std::move(slot);
+            }
+            loaded.notify_all();
+        });
+    };
+
+    for (std::size_t i = 0; i < std::min(window, files.size()); ++i) {
+        load(i);
+    }
+
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        Slot slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            loaded.wait(lock, [&] { return slots[i].ready; });
+            slot = std::move(slots[i]);
+        }
+
+        if (i + window < files.size()) {
+            load(i + window);
+        }
+
+        if (slot.failed) {
+            throw FileReadException("Could not read host file: " + files[i].host.string());
+        }
+
+        if (slot.large) {
+            std::ifstream in(files[i].host, std::ios::binary);
+            this->ImportStream(in, std::filesystem::file_size(files[i].host), files[i].target);
+        } else {
+            filesystem->WriteFile(files[i].target, std::move(slot.data));
+        }
+    }
+
+    return "Imported " + std::to_string(files.size()) + " files";
+}
+
+std::string FilesystemInterface::ExportTree(const std::string& fsDir, const std::string& hostDir) {
+    std::error_code ec;
+    std::filesystem::create_directories(hostDir, ec);
+    if (ec) {
+        return "Could not create host directory";
+    }
+
+    // =========================
+    // This thread reads in order, workers write the host files
+    // =========================
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::size_t inFlight = 0;
+    std::string failure;
+    std::size_t count = 0;
+
+    // Destroyed first, so running tasks never outlive the state above
+    ThreadPool pool;
+    const std::size_t window = 4 * ThreadPool::DefaultThreads();
+
+    std::function<void(const std::string&, const std::filesystem::path&)> walk =
+        [&](const std::string& source, const std::filesystem::path& host) {
+            for (const auto& [name, isDir] : filesystem->GetSubdirectories(source)) {
+                const std::string child = JoinPath(source, name);
+                const std::filesystem::path target = host / name;
+
+                if (isDir) {
+                    std::filesystem::create_directory(target);
+                    walk(child, target);
+                    continue;
+                }
+
+                ++count;
+                const FileHandle file = filesystem->Open(child);
+
+                // Large files are streamed in chunks to bound memory
+                if (file.Size() > TRANSFER_CHUNK) {
+                    std::ofstream out(target, std::ios::binary);
+                    this->ExportHandle(file, out);
+                    continue;
+                }
+
+                std::vector<char> data(static_cast<std::size_t>(file.Size()));
+                file.Read(0, data.data(), data.size());
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    finished.wait(lock, [&] { return inFlight < window; });
+                    ++inFlight;
+                }
+
+                pool.Submit([&, target, data = std::move(data)] {
+                    std::ofstream out(target, std::ios::binary);
+                    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (!out && failure.empty()) {
+                            failure = "Could not write host file: " + target.string();
+                        }
+                        --inFlight;
+                    }
+                    finished.notify_all();
+                });
+            }
+        };
+    walk(fsDir, hostDir);
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return inFlight == 0; });
+    }
+
+    if (!failure.empty()) {
+        throw FileWriteException(failure);
+    }
+    return "Exported " + std::to_string(count) + " files";
+}
+
+std::string FilesystemInterface::CopyTree(const std::string& src, const std::string& dst) {
+    // Snapshot the source first, so a destination inside it is not copied into itself
+    std::vector<std::pair<std::string, bool>> entries;
+
+    std::function<void(const std::string&)> collect = [&](const std::string& relative) {
+        for (const auto& [name, isDir] : filesystem->GetSubdirectories(JoinPath(src, relative))) {
+            const std::string child = JoinPath(relative, name);
+            entries.emplace_back(child, isDir);
+
+            if (isDir) {
+                collect(child);
+            }
+        }
+    };
+
+    collect("");
+
+    filesystem->CreateDirectory(dst);
+
+    std::size_t count = 0;
+    for (const auto& [relative, isDir] : entries) {
+        if (isDir) {
+            filesystem->CreateDirectory(JoinPath(dst, relative));
+        } else {
+            filesystem->CopyFile(JoinPath(src, relative), JoinPath(dst, relative));
+            ++count;
+        }
+    }
+
+    return "Copied " + std::to_string(count) + " files";
+}
+
+std::string FilesystemInterface::JoinPath(const std::string& base, const std::string& name) {
+    if (base.empty()) {
+        return name;
+    }
+    if (name.empty()) {
+        return base;
+    }
+    return base.back() == '/' ? base + name : base + "/" + name;
+}
+
 std::string FilesystemInterface::cmd_load(const std::vector<std::string> &args) {
-    if (args.size() != 1) {
-        return "Usage: load <script_file>";
+    const bool batch = args.size() == 2 && args[0] == "--batch";
+    if (args.size() != 1 && !batch) {
+        return "Usage: load [--batch] <script_file>";
     }
 
-    std::ifstream in(args[0]);
+    std::ifstream in(args.back());
     if (!in.is_open()) {
         return "FILE NOT FOUND";
     }
 
+    // Everything executed so far is committed as one transaction, even on error
+    if (batch) {
+        filesystem->BeginBatch();
+    }
+    const std::string result = this->RunScript(in);
+    if (batch) {
+        filesystem->Commit();
+    }
+
+    return result;
+}
+
+std::string FilesystemInterface::RunScript(std::istream& in) {
     std::string line;
     while (std::getline(in, line)) {
         // ignore empty lines (optional)
@@ -229,13 +571,42 @@ std::string FilesystemInterface::cmd_load(const std::vector<std::string> &args)
 }
 
 std::string FilesystemInterface::cmd_format(const std::vector<std::string> &args) {
-    if (args.size() != 1) {
-        return "Usage: format <size_bytes>";
-    }
+    const std::string usage =
+        "Usage: format [--fast] [--dedup] [--compress] [--block-size <size>] [--inode-ratio <blocks>] <size_bytes>";
 
+    FormatOptions options;
     uint64_t size = 0;
-    ParseSize(args[0], size);
-    filesystem->Format(size);
+    bool haveSize = false;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        uint64_t value = 0;
+
+        if (args[i] == "--fast") {
+            options.fast = true;
+        } else if (args[i] == "--dedup") {
+            options.dedup = true;
+        } else if (args[i] == "--compress") {
+            options.compress = true;
+        } else if (args[i] == "--block-size" && i + 1 < args.size() &&
+                   ParseSize(args[i + 1], value) && value <= UINT32_MAX) {
+            options.blockSize = static_cast<uint32_t>(value);
+            ++i;
+        } else if (args[i] == "--inode-ratio" && i + 1 < args.size() &&
+                   ParseSize(args[i + 1], value) && value <= UINT32_MAX) {
+            options.blocksPerInode = static_cast<uint32_t>(value);
+            ++i;
+        } else if (!haveSize && ParseSize(args[i], size)) {
+            haveSize = true;
+        } else {
+            return usage;
+        }
+    }
+
+    if (!haveSize) {
+        return usage;
+    }
+
+    filesystem->Format(size, options);
 
     return "Filesystem formatted";
 }
@@ -252,3 +623,140 @@ std::string FilesystemInterface::cmd_ln(const std::vector<std::string> &args) {
     filesystem->LinkFile(args[0], args[1]);
     return "Link created";
 }
+
+std::string FilesystemInterface::cmd_append(const std::vector<std::string> &args) {
+    if (args.size() < 2) {
+        return "Usage: append <file> <text>";
+    }
+
+    std::string line = args[1];
+    for (size_t i = 2; i < args.size(); ++i) {
+        line += " " + args[i];
+    }
+    line += "\n";
+
+    filesystem->AppendFile(args[0], std::vector<char>(line.begin(), line.end()));
+    return "Appended";
+}
+
+std::string FilesystemInterface::cmd_truncate(const std::vector<std::string> &args) {
+    uint64_t size = 0;
+    if (args.size() != 2 || !ParseSize(args[1], size)) {
+        return "Usage: truncate <file> <size>";
+    }
+
+    filesystem->TruncateFile(args[0], size);
+    return "Truncated";
+}
+
+std::string FilesystemInterface::cmd_perf(const std::vector<std::string> &args) {
+    if (args.size() > 1 || (args.size() == 1 && args[0] != "commands" && args[0] != "reset")) {
+        return "Usage: perf [commands|reset]";
+    }
+
+    if (!Perf::ENABLED) {
+        return "Perf counters are not compiled in (build with ZOS_PERF)";
+    }
+
+    if (args.empty()) {
+        return FormatProbes(Perf::Capture());
+    }
+
+    if (args[0] == "commands") {
+        return this->FormatCommands();
+    }
+
+    this->ResetPerf();
+    return "Perf counters reset";
+}
+
+const std::map<std::string, Perf::CommandStats>& FilesystemInterface::GetCommandStats() const {
+    return this->commandStats;
+}
+
+void FilesystemInterface::ResetPerf() {
+    Perf::Reset();
+    this->commandStats.clear();
+    this->filesystem->ResetIOStatistics();
+}
+
+void FilesystemInterface::RecordCommand(const std::string &cmd,
+                                        const Perf::Snapshot &before,
+                                        const std::chrono::steady_clock::time_point start) {
+    Perf::Snapshot fired = Perf::Capture();
+    fired -= before;
+
+    Perf::CommandStats& stats = this->commandStats[cmd];
+    ++stats.runs;
+    stats.nanoseconds += static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start
+        ).count()
+    );
+    stats.probes += fired;
+}
+
+std::string FilesystemInterface::FormatProbes(const Perf::Snapshot &snapshot) {
+    std::ostringstream out;
+    out << std::left << std::setw(14) << "probe"
+        << std::right
+        << std::setw(10) << "calls"
+        << std::setw(14) << "bytes"
+        << std::setw(12) << "total ms"
+        << std::setw(10) << "avg us"
+        << std::setw(10) << "p50 us"
+        << std::setw(10) << "p99 us"
+        << "\n";
+
+    out << std::fixed;
+    for (std::size_t i = 0; i < Perf::PROBE_COUNT; ++i) {
+        const auto probe = static_cast<Perf::Probe>(i);
+        const Perf::ProbeStats& stats = snapshot[probe];
+        if (stats.calls == 0) {
+            continue;
+        }
+
+        out << std::left << std::setw(14) << Perf::ProbeName(probe)
+            << std::right
+            << std::setw(10) << stats.calls
+            << std::setw(14) << stats.bytes
+            << std::setw(12) << std::setprecision(3) << stats.TotalNanoseconds() / 1e6;
+
+        // Untimed probes (seeks) have no latency
+        if (stats.timed == 0) {
+            out << std::setw(10) << "-" << std::setw(10) << "-" << std::setw(10) << "-";
+        } else {
+            out << std::setprecision(2)
+                << std::setw(10) << stats.AverageNanoseconds() / 1e3
+                << std::setw(10) << static_cast<double>(stats.Percentile(0.5)) / 1e3
+                << std::setw(10) << static_cast<double>(stats.Percentile(0.99)) / 1e3;
+        }
+        out << "\n";
+    }
+
+    return out.str();
+}
+
+std::string FilesystemInterface::FormatCommands() const {
+    if (this->commandStats.empty()) {
+        return "No commands recorded";
+    }
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+
+    for (const auto& [cmd, stats] : this->commandStats) {
+        out << cmd << " – " << stats.runs << "x – "
+            << static_cast<double>(stats.nanoseconds) / 1e6 << " ms";
+
+        for (std::size_t i = 0; i < Perf::PROBE_COUNT; ++i) {
+            const auto probe = static_cast<Perf::Probe>(i);
+            if (const uint64_t calls = stats.probes[probe].calls) {
+                out << " – " << Perf::ProbeName(probe) << " " << calls;
+            }
+        }
+        out << "\n";
+    }
+
+    return out.str();
+}
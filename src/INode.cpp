@@ -4,22 +4,34 @@
 
 #include "../include/INode.h"
 
+#include <algorithm>
 #include <stdexcept>
 
 #include "../helpers/IntParser.h"
 
+namespace {
+    /// Flag bits of the byte following the block references
+    constexpr unsigned char DIRECTORY_FLAG = 1;
+    constexpr unsigned char INLINE_FLAG = 2;
+    constexpr unsigned char COMPRESSED_FLAG = 4;
+
+    /// Byte offset of the block references in the record
+    constexpr int LINKS_OFFSET = 12;
+}
+
 INode INode::FromBytes(std::vector<char> bytes) {
     if (bytes.size() != INode::BYTES) {
         throw std::runtime_error("INode::FromBytes size mismatch");
     }
 
+    return FromBytes(bytes.data());
+}
+
+INode INode::FromBytes(const char* bytes, const int recordBytes) {
     uint32_t offset = 0;
 
     auto readU32 = [&](uint32_t& out) {
-        out = IntParser::ReadUInt32(
-            std::vector<char>(bytes.begin() + offset,
-                              bytes.begin() + offset + sizeof(uint32_t))
-        );
+        out = IntParser::ReadUInt32(bytes + offset);
         offset += sizeof(uint32_t);
     };
 
@@ -27,68 +39,142 @@ INode INode::FromBytes(std::vector<char> bytes) {
 
     readU32(inode._id);
     readU32(inode._links);
-    readU32(inode._size);
 
-    for (int i = 0; i < DIRECT_LINKS; ++i) {
-        readU32(inode._direct[i]);
+    uint32_t sizeLow = 0;
+    readU32(sizeLow);
+
+    // Flags: byte following the block references
+    const auto flags = static_cast<unsigned char>(bytes[INode::LEGACY_BYTES - 1]);
+    const unsigned char known = recordBytes == INode::BYTES
+        ? DIRECTORY_FLAG | INLINE_FLAG | COMPRESSED_FLAG
+        : DIRECTORY_FLAG;
+    // Only a file is stored inline or compressed, never both
+    const int kinds = ((flags & DIRECTORY_FLAG) != 0) + ((flags & INLINE_FLAG) != 0) +
+                      ((flags & COMPRESSED_FLAG) != 0);
+    if ((flags & ~known) != 0 || kinds > 1) {
+        throw std::runtime_error("INode::FromBytes invalid flags value");
     }
+    inode._isDir = (flags & DIRECTORY_FLAG) != 0;
+    inode._isInline = (flags & INLINE_FLAG) != 0;
+    inode._isCompressed = (flags & COMPRESSED_FLAG) != 0;
+
+    if (inode._isInline) {
+        // The block references hold the first inline bytes
+        std::copy_n(bytes + offset, INode::LINK_BYTES, inode._inline.begin());
+        offset += INode::LINK_BYTES;
+    } else {
+        for (int i = 0; i < DIRECT_LINKS; ++i) {
+            readU32(inode._direct[i]);
+        }
 
-    readU32(inode._indirect1);
-    readU32(inode._indirect2);
-
+        readU32(inode._indirect1);
+        readU32(inode._indirect2);
+    }
 
-    // isDir: last byte (offset should now be 80)
-    if (offset != INode::BYTES - 1) {
+    if (offset != INode::LEGACY_BYTES - 1) {
         throw std::runtime_error("INode::FromBytes offset mismatch");
     }
+    ++offset;
 
-    const auto dirByte = static_cast<unsigned char>(bytes[offset]);
-    if (dirByte != 0 && dirByte != 1) {
-        throw std::runtime_error("INode::FromBytes invalid isDir value");
+    // High half of the size follows in wide records
+    uint32_t sizeHigh = 0;
+    if (recordBytes != INode::LEGACY_BYTES) {
+        readU32(sizeHigh);
+    }
+    inode._size = static_cast<uint64_t>(sizeHigh) << 32 | sizeLow;
+
+    if (inode._isInline) {
+        std::copy_n(bytes + offset,
+                    INode::BYTES - INode::WIDE_BYTES,
+                    inode._inline.begin() + INode::LINK_BYTES);
+
+        if (inode._size > INode::INLINE_BYTES) {
+            throw std::runtime_error("INode::FromBytes inline size mismatch");
+        }
+    } else if (inode._isCompressed) {
+        readU32(inode._storedBlocks);
+    } else if (inode._isDir && recordBytes == INode::BYTES) {
+        readU32(inode._entries);
     }
-    inode._isDir = (dirByte == 1);
 
     return inode;
 }
 
 std::vector<char> INode::ToBytes() const {
-    std::vector<char> bytes;
-    bytes.reserve(INode::BYTES);
+    std::vector<char> bytes(INode::BYTES);
+    ToBytes(bytes.data());
+    return bytes;
+}
+
+void INode::ToBytes(char* out, const int recordBytes) const {
+    uint32_t offset = 0;
 
     auto writeU32 = [&](uint32_t value) {
-        auto data = IntParser::WriteUInt32(value);
-        bytes.insert(bytes.end(), data.begin(), data.end());
+        IntParser::WriteUInt32(out + offset, value);
+        offset += sizeof(uint32_t);
     };
 
     writeU32(_id);
     writeU32(_links);
-    writeU32(_size);
+    writeU32(static_cast<uint32_t>(_size));
 
-    for (int i = 0; i < DIRECT_LINKS; ++i) {
-        writeU32(_direct[i]);
+    if ((_isInline || _isCompressed || _entries != 0) && recordBytes != INode::BYTES) {
+        throw std::runtime_error("INode::ToBytes no room for the record tail");
+    }
+
+    if (_isInline) {
+        std::copy_n(_inline.begin(), INode::LINK_BYTES, out + offset);
+        offset += INode::LINK_BYTES;
+    } else {
+        for (int i = 0; i < DIRECT_LINKS; ++i) {
+            writeU32(_direct[i]);
+        }
+
+        writeU32(_indirect1);
+        writeU32(_indirect2);
+    }
+
+    // Flags: exactly 1 byte
+    out[offset++] = static_cast<char>((_isDir ? DIRECTORY_FLAG : 0) |
+                                      (_isInline ? INLINE_FLAG : 0) |
+                                      (_isCompressed ? COMPRESSED_FLAG : 0));
+
+    if (recordBytes != INode::LEGACY_BYTES) {
+        writeU32(static_cast<uint32_t>(_size >> 32));
     }
 
-    writeU32(_indirect1);
-    writeU32(_indirect2);
+    if (recordBytes == INode::BYTES) {
+        const int tail = INode::BYTES - INode::WIDE_BYTES;
+        std::copy_n(_inline.begin() + INode::LINK_BYTES, tail, out + offset);
 
-    // isDir: exactly 1 byte
-    bytes.push_back(_isDir ? 1 : 0);
+        // The tail of a compressed file holds the size of its block map,
+        // the tail of a directory its number of entries
+        if (_isCompressed) {
+            IntParser::WriteUInt32(out + offset, _storedBlocks);
+        } else if (_isDir) {
+            IntParser::WriteUInt32(out + offset, _entries);
+        }
+        offset += tail;
+    }
 
     // Final safety check
-    if (bytes.size() != INode::BYTES) {
+    if (offset != static_cast<uint32_t>(recordBytes)) {
         throw std::runtime_error("INode::ToBytes size mismatch");
     }
-
-    return bytes;
 }
 
 INode::INode(const uint32_t id, const bool isDir)
     : _id(id),
       _links(1),
       _isDir(isDir),
+      _isInline(false),
+      _isCompressed(false),
+      _storedBlocks(0),
+      _entries(0),
       _size(0),
       _indirect1(UNUSED_LINK),
-      _indirect2(UNUSED_LINK) {
+      _indirect2(UNUSED_LINK),
+      _inline() {
 
     _direct = std::array<uint32_t, INode::DIRECT_LINKS>();
     for (auto& link : _direct) {
@@ -100,9 +186,14 @@ INode::INode()
     : _id(0),
       _links(0),
       _isDir(false),
+      _isInline(false),
+      _isCompressed(false),
+      _storedBlocks(0),
+      _entries(0),
       _size(0),
       _indirect1(UNUSED_LINK),
-      _indirect2(UNUSED_LINK) {
+      _indirect2(UNUSED_LINK),
+      _inline() {
 
     _direct = std::array<uint32_t, INode::DIRECT_LINKS>();
     for (auto& link : _direct) {
@@ -137,15 +228,19 @@ bool INode::removeLink() {
 
 }
 
-uint32_t INode::getSize() const {
+void INode::setLinks(const uint32_t links) {
+    _links = links;
+}
+
+uint64_t INode::getSize() const {
     return _size;
 }
 
-void INode::addSize(uint32_t bytes) {
+void INode::addSize(const uint64_t bytes) {
     _size += bytes;
 }
 
-void INode::removeSize(uint32_t bytes) {
+void INode::removeSize(const uint64_t bytes) {
     if (bytes > _size) {
         throw std::runtime_error("INode::removeSize mismatch");
     }
@@ -167,7 +262,7 @@ void INode::addDirectLink(const uint32_t link) {
 }
 
 void INode::removeDirectLink(const uint32_t link) {
-    for (int i = 0; i < DIRECT_LINKS; ++i) {
+    for (int i = DIRECT_LINKS - 1; i >= 0; --i) {
         if (_direct[i] == link) {
             _direct[i] = INode::UNUSED_LINK;
             return;
@@ -176,6 +271,13 @@ void INode::removeDirectLink(const uint32_t link) {
     throw std::runtime_error("INode::removeDirectLink mismatch");
 }
 
+void INode::replaceDirectLink(const int index, const uint32_t replacement) {
+    if (index < 0 || index >= DIRECT_LINKS || _direct[index] == INode::UNUSED_LINK) {
+        throw std::runtime_error("INode::replaceDirectLink mismatch");
+    }
+    _direct[index] = replacement;
+}
+
 uint32_t INode::getFirstLevelIndirectLink() const {
     return _indirect1;
 }
@@ -211,3 +313,71 @@ void INode::clearDirectLinks() {
         link = UNUSED_LINK;
     }
 }
+
+bool INode::isInline() const {
+    return _isInline;
+}
+
+const char* INode::getInlineData() const {
+    return _inline.data();
+}
+
+void INode::writeInline(const uint64_t offset, const char* data, const std::size_t size) {
+    if (offset + size > static_cast<uint64_t>(INLINE_BYTES)) {
+        throw std::runtime_error("INode::writeInline size mismatch");
+    }
+
+    if (!_isInline) {
+        const bool linked = _indirect1 != UNUSED_LINK || _indirect2 != UNUSED_LINK ||
+            std::any_of(_direct.begin(), _direct.end(), [](const uint32_t link) {
+                return link != UNUSED_LINK;
+            });
+        if (linked || _isDir || _isCompressed) {
+            throw std::runtime_error("INode::writeInline node has blocks");
+        }
+        _isInline = true;
+    }
+
+    std::copy_n(data, size, _inline.begin() + static_cast<std::ptrdiff_t>(offset));
+}
+
+void INode::clearInline(const uint64_t offset) {
+    if (offset < static_cast<uint64_t>(INLINE_BYTES)) {
+        std::fill(_inline.begin() + static_cast<std::ptrdiff_t>(offset), _inline.end(), 0);
+    }
+    if (offset == 0) {
+        _isInline = false;
+    }
+}
+
+bool INode::isCompressed() const {
+    return _isCompressed;
+}
+
+uint32_t INode::getStoredBlocks() const {
+    return _isCompressed ? _storedBlocks : 0;
+}
+
+void INode::setCompressed(const uint32_t storedBlocks) {
+    if (_isDir || _isInline) {
+        throw std::runtime_error("INode::setCompressed not a block file");
+    }
+    _isCompressed = true;
+    _storedBlocks = storedBlocks;
+}
+
+void INode::clearCompressed() {
+    _isCompressed = false;
+    _storedBlocks = 0;
+}
+
+uint32_t INode::getEntryCount() const {
+    return _isDir ? _entries : 0;
+}
+
+void INode::setEntryCount(const uint32_t entries) {
+    if (!_isDir) {
+        throw std::runtime_error("INode::setEntryCount not a directory");
+    }
+    _entries = entries;
+}
@@ -0,0 +1,150 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#include "../include/INodeCache.h"
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+#include "../helpers/FilesystemExceptions.h"
+
+INodeCache::INodeCache(FileIOHandler& io, const std::size_t capacity)
+    : io(io),
+      capacity(std::max<std::size_t>(capacity, 1)),
+      shrinkAt(this->capacity) {
+}
+
+void INodeCache::Configure(const uint64_t tableOffset, const int recordBytes) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->entries.clear();
+    this->tableOffset = tableOffset;
+    this->recordBytes = recordBytes;
+}
+
+INode INodeCache::Read(const uint32_t id) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    const auto it = this->entries.find(id);
+    if (it != this->entries.end()) {
+        if (it->second.erased) {
+            return INode::FromBytes(std::vector<char>(INode::BYTES, 0));
+        }
+        return it->second.node;
+    }
+
+    const uint64_t offset = this->tableOffset + static_cast<uint64_t>(id) * this->recordBytes;
+
+    // Decode straight from the mapping when the image is memory-mapped
+    INode node;
+    if (const char* mapped = this->io.Data(offset, this->recordBytes)) {
+        node = INode::FromBytes(mapped, this->recordBytes);
+    } else {
+        const auto data = this->io.ReadBytes(offset, this->recordBytes);
+
+        if (data.size() != static_cast<std::size_t>(this->recordBytes)) {
+            throw InvalidINodeSizeException(
+                "Invalid inode size"
+            );
+        }
+        node = INode::FromBytes(data.data(), this->recordBytes);
+    }
+    this->entries[id] = Entry{node, false, false};
+    this->Shrink();
+
+    return node;
+}
+
+void INodeCache::Write(const INode& node) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->entries[node.getId()] = Entry{node, true, false};
+    this->Shrink();
+}
+
+void INodeCache::Erase(const uint32_t id) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->entries[id] = Entry{INode(), true, true};
+    this->Shrink();
+}
+
+void INodeCache::SetPinned(const bool pinned) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->pinned = pinned;
+}
+
+std::vector<ImageWrite> INodeCache::TakeDirty() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->CollectDirty();
+}
+
+void INodeCache::Flush() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->io.WriteAll(this->CollectDirty());
+}
+
+void INodeCache::Clear() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->entries.clear();
+}
+
+std::vector<ImageWrite> INodeCache::CollectDirty() {
+    std::vector<uint32_t> dirty;
+    for (const auto& [id, entry] : this->entries) {
+        if (entry.dirty) {
+            dirty.push_back(id);
+        }
+    }
+
+    std::sort(dirty.begin(), dirty.end());
+
+    // Merge records with adjacent identifiers into a single write
+    std::vector<ImageWrite> writes;
+    size_t i = 0;
+    while (i < dirty.size()) {
+        size_t end = i + 1;
+        while (end < dirty.size() && dirty[end] == dirty[end - 1] + 1) {
+            ++end;
+        }
+
+        // Erased records stay zero
+        std::vector<char> run((end - i) * this->recordBytes, 0);
+        for (size_t j = i; j < end; ++j) {
+            Entry& entry = this->entries.at(dirty[j]);
+
+            if (!entry.erased) {
+                entry.node.ToBytes(run.data() + (j - i) * this->recordBytes, this->recordBytes);
+            }
+            entry.dirty = false;
+        }
+
+        writes.push_back(ImageWrite{
+            this->tableOffset + static_cast<uint64_t>(dirty[i]) * this->recordBytes,
+            std::move(run)
+        });
+        i = end;
+    }
+
+    this->shrinkAt = this->capacity;
+    return writes;
+}
+
+void INodeCache::Shrink() {
+    if (this->entries.size() <= this->shrinkAt) {
+        return;
+    }
+
+    if (!this->pinned) {
+        this->io.WriteAll(this->CollectDirty());
+        this->entries.clear();
+        return;
+    }
+
+    // Dirty inodes must stay until they are collected
+    for (auto it = this->entries.begin(); it != this->entries.end();) {
+        it = it->second.dirty ? std::next(it) : this->entries.erase(it);
+    }
+
+    // Don't rescan on every insertion while mostly dirty
+    this->shrinkAt = std::max(this->capacity, this->entries.size() * 2);
+}
@@ -0,0 +1,300 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#include "../include/Journal.h"
+
+#include <algorithm>
+
+#include "../helpers/IntParser.h"
+
+namespace {
+
+/// Header state of a record that still has to be applied
+constexpr uint32_t STATE_COMMITTED = 1;
+
+/// Header state of a record that is fully in place
+constexpr uint32_t STATE_APPLIED = 0;
+
+} // namespace
+
+Journal::Journal(FileIOHandler& io)
+    : io(io) {
+}
+
+void Journal::Configure(const uint64_t offset, const uint64_t size) {
+    this->offset = offset;
+    this->size = size;
+    this->sequence = 1;
+}
+
+bool Journal::Enabled() const {
+    return this->size > HEADER_SIZE + RECORD_HEADER_SIZE;
+}
+
+void Journal::Commit(const std::vector<ImageWrite>& writes, const SpillAllocator& spill) {
+    if (writes.empty()) {
+        return;
+    }
+
+    std::vector<char> payload;
+    uint32_t count = 0;
+
+    for (const ImageWrite& write : writes) {
+        char header[RECORD_HEADER_SIZE];
+        IntParser::WriteUInt64(header, write.offset);
+        IntParser::WriteUInt32(header + sizeof(uint64_t), static_cast<uint32_t>(write.data.size()));
+
+        payload.insert(payload.end(), header, header + RECORD_HEADER_SIZE);
+        payload.insert(payload.end(), write.data.begin(), write.data.end());
+        ++count;
+    }
+
+    // =========================
+    // Find room for the records beyond the journal region
+    // =========================
+    std::vector<Extent> extents;
+    uint64_t spilled = 0;
+
+    while (payload.size() > this->Room(extents.size()) + spilled && spill) {
+        // Every extent also takes a table entry in the journal region
+        const uint64_t missing = payload.size() - this->Room(extents.size()) - spilled + EXTENT_SIZE;
+        const std::vector<Extent> more = spill(missing);
+        if (more.empty() || this->Room(extents.size() + more.size()) == 0) {
+            break;
+        }
+
+        for (const Extent& extent : more) {
+            spilled += extent.length;
+        }
+        extents.insert(extents.end(), more.begin(), more.end());
+    }
+
+    if (payload.size() > this->Room(extents.size()) + spilled || payload.size() > UINT32_MAX) {
+        this->CommitInParts(writes);
+        return;
+    }
+
+    this->CommitTransaction(payload, count, extents);
+}
+
+uint64_t Journal::Room(const std::size_t extents) const {
+    const uint64_t table = static_cast<uint64_t>(extents) * EXTENT_SIZE;
+    const uint64_t capacity = this->size - HEADER_SIZE;
+    return table < capacity ? capacity - table : 0;
+}
+
+void Journal::CommitInParts(const std::vector<ImageWrite>& writes) {
+    const uint64_t capacity = this->size - HEADER_SIZE;
+
+    std::vector<char> payload;
+    payload.reserve(static_cast<std::size_t>(capacity));
+    uint32_t count = 0;
+
+    for (const ImageWrite& write : writes) {
+        uint64_t done = 0;
+
+        // Writes larger than the journal are split over several transactions
+        while (done < write.data.size()) {
+            if (payload.size() + RECORD_HEADER_SIZE >= capacity) {
+                this->CommitTransaction(payload, count, {});
+                payload.clear();
+                count = 0;
+            }
+
+            const uint64_t room = capacity - payload.size() - RECORD_HEADER_SIZE;
+            const uint64_t length = std::min<uint64_t>(room, write.data.size() - done);
+
+            char header[RECORD_HEADER_SIZE];
+            IntParser::WriteUInt64(header, write.offset + done);
+            IntParser::WriteUInt32(header + sizeof(uint64_t), static_cast<uint32_t>(length));
+
+            payload.insert(payload.end(), header, header + RECORD_HEADER_SIZE);
+            payload.insert(payload.end(),
+                           write.data.begin() + static_cast<std::ptrdiff_t>(done),
+                           write.data.begin() + static_cast<std::ptrdiff_t>(done + length));
+
+            ++count;
+            done += length;
+        }
+    }
+
+    if (count > 0) {
+        this->CommitTransaction(payload, count, {});
+    }
+}
+
+bool Journal::Replay() {
+    if (!this->Enabled()) {
+        return false;
+    }
+
+    const std::vector<char> header = this->io.ReadBytes(this->offset, HEADER_SIZE);
+    if (header.size() != HEADER_SIZE ||
+        IntParser::ReadUInt32(header.data()) != MAGIC) {
+        return false;
+    }
+
+    const uint32_t state = IntParser::ReadUInt32(header.data() + 4);
+    const uint64_t lastSequence = IntParser::ReadUInt64(header.data() + 8);
+    const uint32_t count = IntParser::ReadUInt32(header.data() + 16);
+    const uint32_t payloadSize = IntParser::ReadUInt32(header.data() + 20);
+    const uint32_t checksum = IntParser::ReadUInt32(header.data() + 24);
+    const uint32_t extentCount = IntParser::ReadUInt32(header.data() + 28);
+
+    this->sequence = lastSequence + 1;
+
+    if (state != STATE_COMMITTED || this->Room(extentCount) == 0) {
+        return false;
+    }
+
+    const uint64_t tableSize = static_cast<uint64_t>(extentCount) * EXTENT_SIZE;
+    const std::vector<char> table = this->io.ReadBytes(this->offset + HEADER_SIZE, tableSize);
+    if (table.size() != tableSize) {
+        return false;
+    }
+
+    std::vector<Extent> extents;
+    uint64_t spilled = 0;
+    for (uint32_t i = 0; i < extentCount; ++i) {
+        const char* entry = table.data() + static_cast<std::size_t>(i) * EXTENT_SIZE;
+        extents.push_back(Extent{IntParser::ReadUInt64(entry),
+                                 IntParser::ReadUInt32(entry + sizeof(uint64_t))});
+        spilled += extents.back().length;
+    }
+
+    if (payloadSize > this->Room(extentCount) + spilled) {
+        return false;
+    }
+
+    // =========================
+    // Gather the records from the journal region and the overflow
+    // =========================
+    const uint64_t inJournal = std::min<uint64_t>(payloadSize, this->Room(extentCount));
+    std::vector<char> payload = this->io.ReadBytes(this->offset + HEADER_SIZE + tableSize, inJournal);
+
+    for (const Extent& extent : extents) {
+        if (payload.size() >= payloadSize) {
+            break;
+        }
+        const uint64_t length = std::min<uint64_t>(extent.length, payloadSize - payload.size());
+        const std::vector<char> part = this->io.ReadBytes(extent.offset, length);
+        payload.insert(payload.end(), part.begin(), part.end());
+    }
+
+    // A torn transaction does not match its checksum and is dropped
+    if (payload.size() != payloadSize ||
+        Checksum(payload.data(), payload.size(), Checksum(table.data(), table.size())) != checksum) {
+        return false;
+    }
+
+    this->Apply(payload.data(), payload.size());
+    this->io.FlushToDisk();
+    this->WriteHeader(STATE_APPLIED, lastSequence, count, payloadSize, checksum, extentCount);
+    return true;
+}
+
+void Journal::Reset() {
+    if (!this->Enabled()) {
+        return;
+    }
+
+    this->sequence = 1;
+    this->WriteHeader(STATE_APPLIED, 0, 0, 0, Checksum(nullptr, 0));
+}
+
+void Journal::CommitTransaction(const std::vector<char>& payload,
+                                const uint32_t count,
+                                const std::vector<Extent>& extents) {
+    const auto payloadSize = static_cast<uint32_t>(payload.size());
+    const uint64_t transactionSequence = this->sequence++;
+
+    std::vector<char> region(extents.size() * EXTENT_SIZE);
+    for (std::size_t i = 0; i < extents.size(); ++i) {
+        IntParser::WriteUInt64(region.data() + i * EXTENT_SIZE, extents[i].offset);
+        IntParser::WriteUInt32(region.data() + i * EXTENT_SIZE + sizeof(uint64_t), extents[i].length);
+    }
+    const uint32_t checksum = Checksum(payload.data(), payload.size(),
+                                       Checksum(region.data(), region.size()));
+
+    // =========================
+    // Records fill the journal region first, then the overflow extents
+    // =========================
+    const uint64_t inJournal = std::min<uint64_t>(payload.size(), this->Room(extents.size()));
+    region.insert(region.end(), payload.begin(), payload.begin() + static_cast<std::ptrdiff_t>(inJournal));
+
+    std::vector<IORequest> writes;
+    writes.push_back(IORequest::Write(this->offset + HEADER_SIZE, region.data(), region.size()));
+
+    uint64_t position = inJournal;
+    for (const Extent& extent : extents) {
+        if (position >= payload.size()) {
+            break;
+        }
+        const uint64_t length = std::min<uint64_t>(extent.length, payload.size() - position);
+        writes.push_back(IORequest::Write(extent.offset, payload.data() + position, length));
+        position += length;
+    }
+
+    // The transaction must be durable before anything is changed in place
+    this->io.Transfer(std::move(writes));
+    const auto extentCount = static_cast<uint32_t>(extents.size());
+    this->WriteHeader(STATE_COMMITTED, transactionSequence, count, payloadSize, checksum, extentCount);
+    this->io.FlushToDisk();
+
+    this->Apply(payload.data(), payload.size());
+    this->io.FlushToDisk();
+
+    // Persisted by the barrier of the next commit; replaying an applied
+    // transaction again after a crash is harmless
+    this->WriteHeader(STATE_APPLIED, transactionSequence, count, payloadSize, checksum, extentCount);
+}
+
+void Journal::Apply(const char* payload, const uint64_t payloadSize) const {
+    uint64_t position = 0;
+
+    // Targets of one transaction never overlap, so they are written as one batch
+    std::vector<IORequest> writes;
+
+    while (position + RECORD_HEADER_SIZE <= payloadSize) {
+        const uint64_t target = IntParser::ReadUInt64(payload + position);
+        const uint32_t length = IntParser::ReadUInt32(payload + position + sizeof(uint64_t));
+        position += RECORD_HEADER_SIZE;
+
+        if (length > payloadSize - position) {
+            break;
+        }
+
+        writes.push_back(IORequest::Write(target, payload + position, length));
+        position += length;
+    }
+
+    this->io.Transfer(std::move(writes));
+}
+
+void Journal::WriteHeader(const uint32_t state,
+                          const uint64_t sequence,
+                          const uint32_t count,
+                          const uint32_t payloadSize,
+                          const uint32_t checksum,
+                          const uint32_t extents) const {
+    char header[HEADER_SIZE] = {};
+
+    IntParser::WriteUInt32(header, MAGIC);
+    IntParser::WriteUInt32(header + 4, state);
+    IntParser::WriteUInt64(header + 8, sequence);
+    IntParser::WriteUInt32(header + 16, count);
+    IntParser::WriteUInt32(header + 20, payloadSize);
+    IntParser::WriteUInt32(header + 24, checksum);
+    IntParser::WriteUInt32(header + 28, extents);
+
+    this->io.WriteBytes(this->offset, header, HEADER_SIZE);
+}
+
+uint32_t Journal::Checksum(const char* data, const uint64_t size, uint32_t hash) {
+    for (uint64_t i = 0; i < size; ++i) {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
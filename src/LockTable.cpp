@@ -0,0 +1,16 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#include "../include/LockTable.h"
+
+#include <algorithm>
+
+LockTable::LockTable(const std::size_t stripes)
+    : stripes(std::max<std::size_t>(stripes, 1)),
+      locks(std::make_unique<std::shared_mutex[]>(this->stripes)) {
+}
+
+std::shared_mutex& LockTable::For(const uint32_t id) const {
+    return this->locks[id % this->stripes];
+}
@@ -0,0 +1,111 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#include "../include/RefCountTable.h"
+
+#include <algorithm>
+
+RefCountTable::RefCountTable(const uint32_t blockCount)
+    : size(blockCount),
+      data(ByteSize(blockCount), 0) {
+}
+
+bool RefCountTable::Enabled() const {
+    return this->size > 0;
+}
+
+uint32_t RefCountTable::Get(const uint32_t block) const {
+    if (block >= this->size) {
+        return 0;
+    }
+
+    const std::size_t offset = static_cast<std::size_t>(block) * ENTRY_BYTES;
+    return static_cast<uint32_t>(static_cast<uint8_t>(this->data[offset])) |
+           static_cast<uint32_t>(static_cast<uint8_t>(this->data[offset + 1])) << 8;
+}
+
+bool RefCountTable::Share(const uint32_t block) {
+    const uint32_t count = this->Get(block);
+    if (block >= this->size || count >= MAX_SHARES) {
+        return false;
+    }
+
+    if (count == 0) {
+        ++this->shared;
+    }
+    this->Put(block, count + 1);
+    return true;
+}
+
+bool RefCountTable::Release(const uint32_t block) {
+    const uint32_t count = this->Get(block);
+    if (count == 0) {
+        return false;
+    }
+
+    if (count == 1) {
+        --this->shared;
+    }
+    this->Put(block, count - 1);
+    return true;
+}
+
+void RefCountTable::Set(const uint32_t block, const uint32_t count) {
+    if (block >= this->size) {
+        return;
+    }
+
+    const uint32_t previous = this->Get(block);
+    const uint32_t value = std::min(count, MAX_SHARES);
+    if (value == previous) {
+        return;
+    }
+
+    if (previous == 0) {
+        ++this->shared;
+    } else if (value == 0) {
+        --this->shared;
+    }
+    this->Put(block, value);
+}
+
+uint32_t RefCountTable::SharedCount() const {
+    return this->shared;
+}
+
+uint64_t RefCountTable::ByteSize(const uint32_t blockCount) {
+    return static_cast<uint64_t>(blockCount) * ENTRY_BYTES;
+}
+
+RefCountTable RefCountTable::LoadFromBytes(std::vector<char> data, const uint32_t blockCount) {
+    RefCountTable table(blockCount);
+
+    table.data = std::move(data);
+    table.data.resize(ByteSize(blockCount), 0);
+
+    // Rebuild the shared block counter
+    for (uint32_t block = 0; block < blockCount; ++block) {
+        if (table.Get(block) != 0) {
+            ++table.shared;
+        }
+    }
+    return table;
+}
+
+std::vector<char> RefCountTable::SaveToBytes() const {
+    return this->data;
+}
+
+std::vector<ImageWrite> RefCountTable::TakeDirty(const uint64_t offset) {
+    return this->dirty.Take(this->data, offset);
+}
+
+void RefCountTable::Put(const uint32_t block, const uint32_t value) {
+    const uint64_t offset = static_cast<uint64_t>(block) * ENTRY_BYTES;
+
+    this->data[offset] = static_cast<char>(value & 0xFF);
+    this->data[offset + 1] = static_cast<char>((value >> 8) & 0xFF);
+
+    this->dirty.Mark(offset, ENTRY_BYTES);
+}
@@ -0,0 +1,324 @@
+//
+// Created by laadim on 14.10.26.
+//
+#include "../include/Server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../helpers/FileIOExceptions.h"
+
+namespace {
+    /// Set by the handler of SIGINT and SIGTERM
+    volatile std::sig_atomic_t stopRequested = 0;
+
+    void RequestStop(int) {
+        stopRequested = 1;
+    }
+
+    /**
+     * @brief Fill a Unix socket address.
+     *
+     * @throws CouldNotOpenFileException If the path does not fit into the address.
+     */
+    sockaddr_un SocketAddress(const std::string& path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+            throw CouldNotOpenFileException("Invalid socket path: " + path);
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return address;
+    }
+
+    /**
+     * @brief Check whether a server accepts connections on a socket path.
+     */
+    bool Listening(const sockaddr_un& address) {
+        const int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe < 0) {
+            return false;
+        }
+        const bool connected = ::connect(probe, reinterpret_cast<const sockaddr*>(&address),
+                                         sizeof(address)) == 0;
+        ::close(probe);
+        return connected;
+    }
+}
+
+// =====================================================
+// Construction
+// =====================================================
+
+Server::Server(FilesystemInterface& fs, std::string socketPath)
+    : fs(fs), socketPath(std::move(socketPath)) {
+    const sockaddr_un address = SocketAddress(this->socketPath);
+
+    // Replace a socket file left behind by a server that crashed
+    struct stat status{};
+    if (::lstat(this->socketPath.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+        if (Listening(address)) {
+            throw CouldNotOpenFileException("Socket already in use: " + this->socketPath);
+        }
+        ::unlink(this->socketPath.c_str());
+    }
+
+    this->listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (this->listener < 0) {
+        throw CouldNotOpenFileException(std::string("Cannot create socket: ") + std::strerror(errno));
+    }
+    if (::bind(this->listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+        ::listen(this->listener, SOMAXCONN) != 0) {
+        const std::string reason = std::strerror(errno);
+        ::close(this->listener);
+        throw CouldNotOpenFileException("Cannot listen on " + this->socketPath + ": " + reason);
+    }
+}
+
+Server::~Server() {
+    for (const Connection& connection : this->connections) {
+        ::close(connection.fd);
+    }
+    ::close(this->listener);
+    ::unlink(this->socketPath.c_str());
+}
+
+// =====================================================
+// Main loop
+// =====================================================
+
+/**
+ * @brief Serves clients until SIGINT or SIGTERM.
+ *
+ * The stop signals are blocked except while waiting in ppoll(), so a
+ * signal arriving between two waits is not lost.
+ */
+void Server::Run() {
+    struct sigaction action{};
+    action.sa_handler = RequestStop;
+    sigemptyset(&action.sa_mask);
+    struct sigaction oldInt{}, oldTerm{}, oldPipe{};
+    ::sigaction(SIGINT, &action, &oldInt);
+    ::sigaction(SIGTERM, &action, &oldTerm);
+
+    // A client closing early must not kill the server
+    struct sigaction ignore{};
+    ignore.sa_handler = SIG_IGN;
+    sigemptyset(&ignore.sa_mask);
+    ::sigaction(SIGPIPE, &ignore, &oldPipe);
+
+    sigset_t blocked, waitMask;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    ::sigprocmask(SIG_BLOCK, &blocked, &waitMask);
+    sigdelset(&waitMask, SIGINT);
+    sigdelset(&waitMask, SIGTERM);
+
+    stopRequested = 0;
+    std::vector<pollfd> polled;
+
+    while (!stopRequested) {
+        polled.clear();
+        polled.push_back({this->listener, POLLIN, 0});
+        for (const Connection& connection : this->connections) {
+            short events = connection.closing ? 0 : POLLIN;
+            if (connection.sent < connection.output.size()) {
+                events |= POLLOUT;
+            }
+            polled.push_back({connection.fd, events, 0});
+        }
+
+        if (::ppoll(polled.data(), polled.size(), nullptr, &waitMask) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        // Connections accepted now are polled from the next round on
+        const std::size_t polledConnections = polled.size() - 1;
+        if (polled[0].revents & POLLIN) {
+            this->Accept();
+        }
+
+        std::vector<bool> keep(this->connections.size(), true);
+        for (std::size_t i = 0; i < polledConnections; ++i) {
+            Connection& connection = this->connections[i];
+            const short revents = polled[i + 1].revents;
+
+            if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                keep[i] = this->Receive(connection);
+            }
+            // Commands paused while the output was above the limit resume
+            // once enough of it is sent
+            while (keep[i]) {
+                this->ExecutePending(connection);
+                keep[i] = this->Send(connection);
+                if (!connection.output.empty() || connection.input.find('\n') == std::string::npos) {
+                    break;
+                }
+            }
+            if (connection.closing && connection.output.empty() && connection.input.empty()) {
+                keep[i] = false;
+            }
+        }
+
+        // Drop finished connections
+        std::size_t next = 0;
+        for (std::size_t i = 0; i < this->connections.size(); ++i) {
+            if (keep[i]) {
+                if (next != i) {
+                    this->connections[next] = std::move(this->connections[i]);
+                }
+                ++next;
+            } else {
+                ::close(this->connections[i].fd);
+            }
+        }
+        this->connections.resize(next);
+    }
+
+    ::sigprocmask(SIG_UNBLOCK, &blocked, nullptr);
+    ::sigaction(SIGINT, &oldInt, nullptr);
+    ::sigaction(SIGTERM, &oldTerm, nullptr);
+    ::sigaction(SIGPIPE, &oldPipe, nullptr);
+}
+
+// =====================================================
+// Connections
+// =====================================================
+
+void Server::Accept() {
+    while (true) {
+        const int fd = ::accept4(this->listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        Connection connection;
+        connection.fd = fd;
+        this->connections.push_back(std::move(connection));
+    }
+}
+
+bool Server::Receive(Connection& connection) {
+    char buffer[64 * 1024];
+
+    while (!connection.closing) {
+        const ssize_t got = ::recv(connection.fd, buffer, sizeof(buffer), 0);
+        if (got > 0) {
+            connection.input.append(buffer, static_cast<std::size_t>(got));
+            continue;
+        }
+        if (got == 0) {
+            // The client finished sending; an unterminated last line still counts
+            connection.closing = true;
+            if (!connection.input.empty() && connection.input.back() != '\n') {
+                connection.input.push_back('\n');
+            }
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        }
+        return false;
+    }
+
+    // A line that never ends is not a command
+    const std::size_t lineEnd = connection.input.rfind('\n');
+    const std::size_t partial = lineEnd == std::string::npos
+        ? connection.input.size()
+        : connection.input.size() - lineEnd - 1;
+    return partial <= MAX_LINE;
+}
+
+void Server::ExecutePending(Connection& connection) {
+    std::size_t start = 0;
+
+    while (connection.output.size() - connection.sent < MAX_PENDING_OUTPUT) {
+        const std::size_t end = connection.input.find('\n', start);
+        if (end == std::string::npos) {
+            break;
+        }
+        std::string line = connection.input.substr(start, end - start);
+        start = end + 1;
+
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+
+        // Blank lines are skipped like in the shell, without a response
+        if (std::all_of(line.begin(), line.end(), ::isspace)) {
+            continue;
+        }
+
+        const std::string result = this->Execute(connection, line);
+        Encode(connection, result);
+
+        // Nothing after "exit" is executed
+        if (result == "exit") {
+            connection.closing = true;
+            start = connection.input.size();
+            break;
+        }
+    }
+
+    connection.input.erase(0, start);
+}
+
+bool Server::Send(Connection& connection) {
+    while (connection.sent < connection.output.size()) {
+        const ssize_t put = ::send(connection.fd,
+                                   connection.output.data() + connection.sent,
+                                   connection.output.size() - connection.sent,
+                                   MSG_NOSIGNAL);
+        if (put > 0) {
+            connection.sent += static_cast<std::size_t>(put);
+            continue;
+        }
+        if (put < 0 && errno == EINTR) {
+            continue;
+        }
+        if (put < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        return false;
+    }
+
+    // Keep the buffer from growing with everything ever sent
+    if (connection.sent == connection.output.size()) {
+        connection.output.clear();
+        connection.sent = 0;
+    }
+    return true;
+}
+
+// =====================================================
+// Commands
+// =====================================================
+
+std::string Server::Execute(Connection& connection, const std::string& line) {
+    auto [cwd, result] = this->fs.Execute(line, connection.cwd);
+    if (!cwd.empty()) {
+        connection.cwd = cwd;
+    }
+    return result;
+}
+
+void Server::Encode(Connection& connection, const std::string& result) {
+    connection.output += std::to_string(result.size());
+    connection.output += ' ';
+    connection.output += connection.cwd;
+    connection.output += '\n';
+    connection.output += result;
+}
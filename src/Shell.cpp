@@ -39,6 +39,13 @@ Shell::Shell(FilesystemInterface& fs)
 void Shell::Run() {
     std::pair<std::string, std::string> result;
     result.first = "/";
+
+    // Result of the check of an image that was not unmounted properly
+    const std::string mounted = fs.MountMessage();
+    if (!mounted.empty()) {
+        std::cout << mounted << std::endl;
+    }
+
     while (true) {
         // Display prompt
         std::cout << result.first << " > ";
@@ -22,8 +22,18 @@
  *     28 | inode table offset
  *     32 | data blocks offset
  *     36 | root node id
+ *     40 | layout version (2+)
+ *     44 | journal offset (2+)
+ *     48 | journal size (2+)
+ *     52 | reference count table offset (3+)
+ *     56 | high 32 bits of the filesystem size and of the
+ *        | seven offsets and sizes above, in that order (4+)
+ *     88 | mount state (4+, zero on images written before it)
+ *     92 | deduplication index offset, 64-bit (4+, zero if none)
+ *    100 | file compression (6+, zero if none)
  * =================
- * TOTAL = 40 bytes
+ * TOTAL = 104 bytes (40 for version 1, 52 for version 2, 56 for version 3,
+ *         100 for versions 4 and 5)
  */
 
 std::array<char, Superblock::BYTE_SIZE> Superblock::toBytes() const {
@@ -31,21 +41,49 @@ std::array<char, Superblock::BYTE_SIZE> Superblock::toBytes() const {
     size_t offset = 0;
 
     auto writeU32 = [&](uint32_t value) {
-        auto data = IntParser::WriteUInt32(value);
-        std::copy(data.begin(), data.end(), bytes.begin() + offset);
+        IntParser::WriteUInt32(bytes.data() + offset, value);
         offset += sizeof(uint32_t);
     };
 
+    auto writeLow = [&](uint64_t value) {
+        writeU32(static_cast<uint32_t>(value));
+    };
+
+    auto writeHigh = [&](uint64_t value) {
+        writeU32(static_cast<uint32_t>(value >> 32));
+    };
+
+    auto writeU64 = [&](uint64_t value) {
+        IntParser::WriteUInt64(bytes.data() + offset, value);
+        offset += sizeof(uint64_t);
+    };
+
     writeU32(magic);
     writeU32(blockSize);
     writeU32(totalBlocks);
     writeU32(totalInodes);
-    writeU32(size);
-    writeU32(inodeBitmapOffset);
-    writeU32(blockBitmapOffset);
-    writeU32(inodeTableOffset);
-    writeU32(dataBlocksOffset);
+    writeLow(size);
+    writeLow(inodeBitmapOffset);
+    writeLow(blockBitmapOffset);
+    writeLow(inodeTableOffset);
+    writeLow(dataBlocksOffset);
     writeU32(rootNodeId);
+    writeU32(version);
+    writeLow(journalOffset);
+    writeLow(journalSize);
+    writeLow(refcountOffset);
+
+    writeHigh(size);
+    writeHigh(inodeBitmapOffset);
+    writeHigh(blockBitmapOffset);
+    writeHigh(inodeTableOffset);
+    writeHigh(dataBlocksOffset);
+    writeHigh(journalOffset);
+    writeHigh(journalSize);
+    writeHigh(refcountOffset);
+    writeU32(state);
+    writeU64(dedupOffset);
+    writeU32(compression);
 
     if (offset != BYTE_SIZE) {
         throw std::runtime_error("Superblock::toBytes size mismatch");
@@ -54,30 +92,114 @@ std::array<char, Superblock::BYTE_SIZE> Superblock::toBytes() const {
     return bytes;
 }
 
+std::size_t Superblock::ByteSize() const {
+    if (version >= 6) {
+        return BYTE_SIZE;
+    }
+    if (version >= 4) {
+        return WIDE_BYTE_SIZE;
+    }
+    if (version == 3) {
+        return SHARED_BYTE_SIZE;
+    }
+    return version == 2 ? JOURNAL_BYTE_SIZE : LEGACY_BYTE_SIZE;
+}
+
 Superblock Superblock::fromBytes(std::array<char, BYTE_SIZE> data) {
+    return fromBytes(data.data());
+}
+
+Superblock Superblock::fromBytes(const char* data) {
     size_t offset = 0;
 
     auto readU32 = [&](uint32_t& out) {
-        out = IntParser::ReadUInt32(
-            std::vector<char>(data.begin() + offset,
-                              data.begin() + offset + sizeof(uint32_t))
-        );
+        out = IntParser::ReadUInt32(data + offset);
+        offset += sizeof(uint32_t);
+    };
+
+    auto readLow = [&](uint64_t& out) {
+        out = IntParser::ReadUInt32(data + offset);
         offset += sizeof(uint32_t);
     };
 
+    auto readHigh = [&](uint64_t& out) {
+        out |= static_cast<uint64_t>(IntParser::ReadUInt32(data + offset)) << 32;
+        offset += sizeof(uint32_t);
+    };
+
+    auto readU64 = [&](uint64_t& out) {
+        out = IntParser::ReadUInt64(data + offset);
+        offset += sizeof(uint64_t);
+    };
+
     Superblock sb{};
 
     readU32(sb.magic);
     readU32(sb.blockSize);
     readU32(sb.totalBlocks);
     readU32(sb.totalInodes);
-    readU32(sb.size);
-    readU32(sb.inodeBitmapOffset);
-    readU32(sb.blockBitmapOffset);
-    readU32(sb.inodeTableOffset);
-    readU32(sb.dataBlocksOffset);
+    readLow(sb.size);
+    readLow(sb.inodeBitmapOffset);
+    readLow(sb.blockBitmapOffset);
+    readLow(sb.inodeTableOffset);
+    readLow(sb.dataBlocksOffset);
     readU32(sb.rootNodeId);
 
+    // Version 1 images keep the inode bitmap where the extension would be
+    // (the journal always ends below 4 GiB, so the low half suffices)
+    if (sb.inodeBitmapOffset < BYTE_SIZE) {
+        sb.version = 1;
+        sb.journalOffset = 0;
+        sb.journalSize = 0;
+        sb.refcountOffset = 0;
+        sb.state = 0;
+        sb.dedupOffset = 0;
+        sb.compression = Superblock::COMPRESSION_NONE;
+        return sb;
+    }
+
+    readU32(sb.version);
+    readLow(sb.journalOffset);
+    readLow(sb.journalSize);
+
+    // Version 2 images have no reference count table
+    if (sb.version < 3) {
+        sb.refcountOffset = 0;
+        sb.state = 0;
+        sb.dedupOffset = 0;
+        sb.compression = Superblock::COMPRESSION_NONE;
+        return sb;
+    }
+
+    readLow(sb.refcountOffset);
+
+    // Version 3 images fit in 32 bits
+    if (sb.version < 4) {
+        sb.state = 0;
+        sb.dedupOffset = 0;
+        sb.compression = Superblock::COMPRESSION_NONE;
+        return sb;
+    }
+
+    readHigh(sb.size);
+    readHigh(sb.inodeBitmapOffset);
+    readHigh(sb.blockBitmapOffset);
+    readHigh(sb.inodeTableOffset);
+    readHigh(sb.dataBlocksOffset);
+    readHigh(sb.journalOffset);
+    readHigh(sb.journalSize);
+    readHigh(sb.refcountOffset);
+    readU32(sb.state);
+    readU64(sb.dedupOffset);
+
+    // Versions 4 and 5 compress nothing
+    if (sb.version < 6) {
+        sb.compression = Superblock::COMPRESSION_NONE;
+        return sb;
+    }
+
+    readU32(sb.compression);
+
     if (offset != BYTE_SIZE) {
         throw std::runtime_error("Superblock::fromBytes size mismatch");
     }
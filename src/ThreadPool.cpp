@@ -0,0 +1,64 @@
+//
+// Created by laadim on 14.10.26.
+//
+
+#include "../include/ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(const std::size_t threads) {
+    const std::size_t count = std::max<std::size_t>(threads, 1);
+
+    this->workers.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        this->workers.emplace_back([this] { this->Work(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->available.notify_all();
+
+    for (std::thread& worker : this->workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->tasks.push_back(std::move(task));
+    }
+    this->available.notify_one();
+}
+
+std::size_t ThreadPool::DefaultThreads() {
+    constexpr std::size_t MAX_DEFAULT_THREADS = 8;
+
+    // hardware_concurrency() may report 0 when unknown
+    return std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, MAX_DEFAULT_THREADS);
+}
+
+void ThreadPool::Work() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->available.wait(lock, [this] {
+                return this->stopping || !this->tasks.empty();
+            });
+
+            if (this->tasks.empty()) {
+                return;
+            }
+
+            task = std::move(this->tasks.front());
+            this->tasks.pop_front();
+        }
+
+        task();
+    }
+}